@@ -1,64 +1,670 @@
 #include <jni.h>
-#include <android/log.h>
+#include <android/bitmap.h>
+#include <android/native_window_jni.h>
 #include <stdio.h>
+#include <time.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
 #include "bitmap/BitmapOperation.h"
+#include "bitmap/BitmapStore.h"
+#include "bitmap/Compositor.h"
+#include "bitmap/HealingBrush.h"
 #include "beautify/MagicBeautify.h"
+#include "dump/FrameDump.h"
+#include "preview/FocusAssist.h"
+#include "preview/FrameRing.h"
+#include "preview/PreviewRenderer.h"
+#include "preview/ScopeEngine.h"
+#include "utils/MemoryGovernor.h"
+#include "utils/MagicLog.h"
 
 #define  LOG_TAG    "MagicJni"
-#define  LOGD(...)  __android_log_print(ANDROID_LOG_DEBUG,LOG_TAG,__VA_ARGS__)
-#define  LOGE(...)  __android_log_print(ANDROID_LOG_ERROR,LOG_TAG,__VA_ARGS__)
 
-#ifdef __cplusplus
-extern "C" {
-#endif
+#define  MAGIC_JNI_CLASS "com/seu/magicfilter/beautify/MagicJni"
 
-JNIEXPORT void JNICALL
-Java_com_seu_magicfilter_beautify_MagicJni_jniInitMagicBeautify(JNIEnv *env, jobject instance,
-                                                                jobject handler) {
+// CLOCK_MONOTONIC time of the first native call that produced a result,
+// the same clock as System.nanoTime(), for cold-start measurement.
+static std::atomic<int64_t> sFirstResultNanos(0);
+
+static void markResult() {
+    if (sFirstResultNanos.load(std::memory_order_relaxed) != 0)
+        return;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    int64_t expected = 0;
+    sFirstResultNanos.compare_exchange_strong(expected, ts.tv_sec * 1000000000LL + ts.tv_nsec);
+}
+
+static void jniInitMagicBeautify(JNIEnv *env, jclass clazz, jobject handler) {
     JniBitmap *jniBitmap = (JniBitmap *) env->GetDirectBufferAddress(handler);
     if (jniBitmap->_storedBitmapPixels == NULL) {
         LOGE("no bitmap data was stored. returning null...");
         return;
     }
-    MagicBeautify::getInstance()->initMagicBeautify(jniBitmap);
+    // the results land in the stored pixels, which other handles may share
+    uint64_t hash = jniBitmap->_contentHash;
+    if (!BitmapStore::getInstance()->detach(jniBitmap)
+            || !MagicBeautify::getInstance()->initMagicBeautify(jniBitmap->getView(), hash)) {
+        env->ThrowNew(env->FindClass("java/lang/OutOfMemoryError"),
+                "native memory budget exceeded while initialising beautify");
+        return;
+    }
+    markResult();
 }
 
-JNIEXPORT void JNICALL
-Java_com_seu_magicfilter_beautify_MagicJni_jniStartWhiteSkin(JNIEnv *env, jobject instance,
-                                                             jfloat whiteLevel) {
+static void jniStartWhiteSkin(JNIEnv *env, jclass clazz, jfloat whiteLevel) {
     MagicBeautify::getInstance()->startWhiteSkin(whiteLevel);
+    markResult();
 }
 
-JNIEXPORT void JNICALL
-Java_com_seu_magicfilter_beautify_MagicJni_jniStartSkinSmooth(JNIEnv *env, jobject instance,
-                                                              jobject obj, jfloat DenoiseLevel) {
+static void jniStartSkinSmooth(JNIEnv *env, jclass clazz, jfloat DenoiseLevel) {
     float sigema = 10 + DenoiseLevel * DenoiseLevel * 5;
     MagicBeautify::getInstance()->startSkinSmooth(sigema);
+    markResult();
+}
+
+static void jniSetLinearLight(JNIEnv *env, jclass clazz, jboolean linear) {
+    MagicBeautify::getInstance()->setLinearLight(linear == JNI_TRUE);
 }
 
-JNIEXPORT void JNICALL
-Java_com_seu_magicfilter_beautify_MagicJni_jniUnInitMagicBeautify(JNIEnv *env, jobject instance) {
+static void jniSetWhitenMask(JNIEnv *env, jclass clazz, jint mask) {
+    MagicBeautify::getInstance()->setWhitenMask(mask);
+}
+
+static void jniSetSkinTone(JNIEnv *env, jclass clazz, jfloat strength, jint target) {
+    MagicBeautify::getInstance()->setSkinTone(strength, target);
+}
+
+static void jniSetResultCacheLimit(JNIEnv *env, jclass clazz, jlong bytes) {
+    MagicBeautify::getInstance()->setResultCacheLimit(bytes);
+}
+
+// a direct buffer holding at least a packed map, or NULL
+static uint8_t *gainMapBuffer(JNIEnv *env, jobject buffer, int width, int height, jint scale, jboolean wide) {
+    if (buffer == NULL || scale < 1 || width == 0)
+        return NULL;
+    int64_t bytes = (int64_t) GainMap::mapSize(width, scale) * GainMap::mapSize(height, scale)
+            * GainMap::cellBytes(wide == JNI_TRUE ? GainMap::DEPTH_16 : GainMap::DEPTH_8);
+    if (env->GetDirectBufferCapacity(buffer) < bytes) {
+        LOGE("gain map buffer too small, %lld bytes needed", (long long) bytes);
+        return NULL;
+    }
+    return (uint8_t *) env->GetDirectBufferAddress(buffer);
+}
+
+static jboolean jniExportGainMap(JNIEnv *env, jclass clazz, jint scale, jboolean wide, jobject buffer) {
+    MagicBeautify *beautify = MagicBeautify::getInstance();
+    int width = beautify->getImageWidth();
+    uint8_t *out = gainMapBuffer(env, buffer, width, beautify->getImageHeight(), scale, wide);
+    if (out == NULL)
+        return JNI_FALSE;
+    int depth = wide == JNI_TRUE ? GainMap::DEPTH_16 : GainMap::DEPTH_8;
+    return beautify->exportGainMap(scale, depth, out, GainMap::mapSize(width, scale) * GainMap::cellBytes(depth))
+           ? JNI_TRUE : JNI_FALSE;
+}
+
+static void jniUnInitMagicBeautify(JNIEnv *env, jclass clazz) {
     MagicBeautify::getInstance()->unInitMagicBeautify();
 }
 
-JNIEXPORT jobject JNICALL
-Java_com_seu_magicfilter_beautify_MagicJni_jniStoreBitmapData(JNIEnv *env, jobject instance,
-                                                              jobject bitmap) {
-    return BitmapOperation::jniStoreBitmapData(env, instance, bitmap);
+static jobject jniStoreBitmapData(JNIEnv *env, jclass clazz, jobject bitmap) {
+    return BitmapOperation::jniStoreBitmapData(env, clazz, bitmap);
+}
+
+static void jniFreeBitmapData(JNIEnv *env, jclass clazz, jobject handle) {
+    BitmapOperation::jniFreeBitmapData(env, clazz, handle);
+}
+
+static jobject jniGetBitmapFromStoredBitmapData(JNIEnv *env, jclass clazz, jobject handle) {
+    jobject bitmap = BitmapOperation::jniGetBitmapFromStoredBitmapData(env, clazz, handle);
+    markResult();
+    return bitmap;
+}
+
+static jboolean jniCopyBufferToBitmap(JNIEnv *env, jclass clazz, jobject buffer, jobject bitmap) {
+    return BitmapOperation::jniCopyBufferToBitmap(env, clazz, buffer, bitmap);
+}
+
+static jboolean jniDrawSprites(JNIEnv *env, jclass clazz, jobject handle, jobjectArray bitmaps,
+                               jfloatArray matrices, jfloatArray opacities) {
+    JniBitmap *jniBitmap = (JniBitmap *) env->GetDirectBufferAddress(handle);
+    if (jniBitmap == NULL || jniBitmap->_storedBitmapPixels == NULL || bitmaps == NULL)
+        return JNI_FALSE;
+    int count = env->GetArrayLength(bitmaps);
+    if (matrices == NULL || opacities == NULL || env->GetArrayLength(matrices) < count * 6
+            || env->GetArrayLength(opacities) < count) {
+        LOGE("drawSprites needs 6 matrix values and an opacity per sprite");
+        return JNI_FALSE;
+    }
+    std::vector<Sprite> sprites(count);
+    // read in place and released before any other JNI call, as critical access requires
+    jfloat *matrix = (jfloat *) env->GetPrimitiveArrayCritical(matrices, NULL);
+    jfloat *opacity = (jfloat *) env->GetPrimitiveArrayCritical(opacities, NULL);
+    if (matrix != NULL && opacity != NULL) {
+        for (int i = 0; i < count; i++) {
+            for (int k = 0; k < 6; k++)
+                sprites[i].matrix[k] = matrix[i * 6 + k];
+            sprites[i].opacity = opacity[i];
+        }
+    }
+    if (opacity != NULL)
+        env->ReleasePrimitiveArrayCritical(opacities, opacity, JNI_ABORT);
+    if (matrix != NULL)
+        env->ReleasePrimitiveArrayCritical(matrices, matrix, JNI_ABORT);
+    if (matrix == NULL || opacity == NULL)
+        return JNI_FALSE;
+    // other handles on the same pixels must not see the stickers
+    if (!BitmapStore::getInstance()->detach(jniBitmap)) {
+        env->ThrowNew(env->FindClass("java/lang/OutOfMemoryError"),
+                "native memory budget exceeded while copying a shared bitmap");
+        return JNI_FALSE;
+    }
+    std::vector<jobject> locked;
+    bool ok = true;
+    for (int i = 0; i < count && ok; i++) {
+        jobject bitmap = env->GetObjectArrayElement(bitmaps, i);
+        AndroidBitmapInfo info;
+        void *pixels;
+        if (bitmap == NULL || AndroidBitmap_getInfo(env, bitmap, &info) < 0
+                || info.format != ANDROID_BITMAP_FORMAT_RGBA_8888
+                || AndroidBitmap_lockPixels(env, bitmap, &pixels) < 0) {
+            LOGE("sprite %d must be an ARGB_8888 bitmap", i);
+            if (bitmap != NULL)
+                env->DeleteLocalRef(bitmap);
+            ok = false;
+            break;
+        }
+        locked.push_back(bitmap);
+        sprites[i].image = ImageView(pixels, info.width, info.height, info.stride, ImageView::FORMAT_RGBA_8888);
+    }
+    if (ok)
+        Compositor::draw(jniBitmap->getView(), sprites.data(), count);
+    for (size_t i = 0; i < locked.size(); i++) {
+        AndroidBitmap_unlockPixels(env, locked[i]);
+        env->DeleteLocalRef(locked[i]);
+    }
+    if (ok)
+        markResult();
+    return ok ? JNI_TRUE : JNI_FALSE;
+}
+
+static jboolean jniHeal(JNIEnv *env, jclass clazz, jobject handle, jint x, jint y, jint sourceX, jint sourceY,
+                        jint radius) {
+    JniBitmap *jniBitmap = (JniBitmap *) env->GetDirectBufferAddress(handle);
+    if (jniBitmap == NULL || jniBitmap->_storedBitmapPixels == NULL)
+        return JNI_FALSE;
+    // other handles on the same pixels must not see the healing
+    if (!BitmapStore::getInstance()->detach(jniBitmap)) {
+        env->ThrowNew(env->FindClass("java/lang/OutOfMemoryError"),
+                "native memory budget exceeded while copying a shared bitmap");
+        return JNI_FALSE;
+    }
+    if (!HealingBrush::heal(jniBitmap->getView(), x, y, sourceX, sourceY, radius))
+        return JNI_FALSE;
+    markResult();
+    return JNI_TRUE;
+}
+
+static jlong jniSaveFrame(JNIEnv *env, jclass clazz, jobject pixels, jint width, jint height,
+                          jboolean flip, jint fd) {
+    uint8_t *rgba = (uint8_t *) env->GetDirectBufferAddress(pixels);
+    if (rgba == NULL || env->GetDirectBufferCapacity(pixels) < (jlong) width * height * 4) {
+        LOGE("saveFrame needs a direct buffer of width * height * 4 bytes");
+        return -1;
+    }
+    jlong written = FrameDump::save(rgba, width, height, width * 4,
+                                    flip ? FrameDump::FLAG_FLIP_VERTICAL : 0, fd);
+    markResult();
+    return written;
+}
+
+static jlong jniGetFirstResultNanos(JNIEnv *env, jclass clazz) {
+    return sFirstResultNanos.load();
+}
+
+static void jniSetMemoryBudget(JNIEnv *env, jclass clazz, jlong bytes) {
+    MemoryGovernor::getInstance()->setBudget(bytes);
+}
+
+static jlong jniGetMemoryUsage(JNIEnv *env, jclass clazz, jint owner) {
+    if (owner < 0)
+        return MemoryGovernor::getInstance()->getTotalUsage();
+    return MemoryGovernor::getInstance()->getUsage(owner);
+}
+
+// a 512x512 lookup image in the MagicLookupFilter layout, locked; unlock with AndroidBitmap_unlockPixels
+static const uint8_t *lockLookup(JNIEnv *env, jobject bitmap, int *stride) {
+    AndroidBitmapInfo info;
+    void *pixels;
+    if (AndroidBitmap_getInfo(env, bitmap, &info) < 0 || info.format != ANDROID_BITMAP_FORMAT_RGBA_8888
+            || info.width != 512 || info.height != 512) {
+        LOGE("lookup must be a 512x512 ARGB_8888 bitmap");
+        return NULL;
+    }
+    if (AndroidBitmap_lockPixels(env, bitmap, &pixels) < 0)
+        return NULL;
+    *stride = info.stride;
+    return (const uint8_t *) pixels;
+}
+
+// look for the still image, kept across beautify sessions
+static LookTable *sLook = NULL;
+static bool sProtectSkin = false;
+
+// false with an OutOfMemoryError pending
+static bool ensureLook(JNIEnv *env) {
+    if (sLook != NULL)
+        return true;
+    if (!MemoryGovernor::getInstance()->reserve(MEMORY_OWNER_BEAUTIFY, LookTable::tableBytes())) {
+        env->ThrowNew(env->FindClass("java/lang/OutOfMemoryError"),
+                "native memory budget exceeded while loading a look");
+        return false;
+    }
+    sLook = new LookTable();
+    return true;
+}
+
+static void jniSetLook(JNIEnv *env, jclass clazz, jobject bitmap, jboolean protectSkin) {
+    if (bitmap == NULL) {
+        // a mixer stays in the table without the lookup
+        if (sLook != NULL)
+            sLook->setLookup(NULL, 0);
+        sProtectSkin = false;
+        MagicBeautify::getInstance()->setLook(sLook != NULL && !sLook->isEmpty() ? sLook : NULL, false);
+        return;
+    }
+    if (!ensureLook(env))
+        return;
+    int stride;
+    const uint8_t *pixels = lockLookup(env, bitmap, &stride);
+    if (pixels == NULL)
+        return;
+    sLook->setLookup(pixels, stride);
+    AndroidBitmap_unlockPixels(env, bitmap);
+    sProtectSkin = protectSkin == JNI_TRUE;
+    MagicBeautify::getInstance()->setLook(sLook, sProtectSkin);
+    markResult();
+}
+
+// hue, saturation and luminance for each HslMixer band in turn, or NULL for none
+static bool readMixer(JNIEnv *env, jfloatArray values, HslMixer *mixer) {
+    mixer->reset();
+    if (values == NULL)
+        return true;
+    if (env->GetArrayLength(values) < HslMixer::BANDS * 3) {
+        LOGE("the HSL mixer takes hue, saturation and luminance for %d bands", HslMixer::BANDS);
+        return false;
+    }
+    jfloat band[HslMixer::BANDS * 3];
+    env->GetFloatArrayRegion(values, 0, HslMixer::BANDS * 3, band);
+    for (int i = 0; i < HslMixer::BANDS; i++)
+        mixer->setBand(i, band[i * 3], band[i * 3 + 1], band[i * 3 + 2]);
+    return true;
+}
+
+static void jniSetHslMixer(JNIEnv *env, jclass clazz, jfloatArray values) {
+    HslMixer mixer;
+    if (!readMixer(env, values, &mixer))
+        return;
+    if (sLook == NULL && mixer.isIdentity())
+        return;
+    if (!ensureLook(env))
+        return;
+    sLook->setMixer(&mixer);
+    MagicBeautify::getInstance()->setLook(sLook->isEmpty() ? NULL : sLook, sProtectSkin);
+    markResult();
+}
+
+// CPU preview; the surface and camera callbacks arrive on different threads
+static std::mutex sPreviewLock;
+static PreviewRenderer *sPreview = NULL;
+static PreviewSurface *sPreviewSurface = NULL;
+
+static void releasePreviewSurface() {
+    if (sPreview != NULL)
+        sPreview->setSurface(NULL);
+    delete sPreviewSurface;
+    sPreviewSurface = NULL;
+}
+
+static jboolean jniPreviewStart(JNIEnv *env, jclass clazz, jint width, jint height) {
+    std::lock_guard<std::mutex> lock(sPreviewLock);
+    if (sPreview == NULL) {
+        sPreview = new PreviewRenderer();
+        sPreview->setSmoothPrecision(MagicBeautify::getInstance()->getSmoothPrecision());
+    }
+    if (sPreview->getWidth() != width || sPreview->getHeight() != height) {
+        sPreview->stop();
+        releasePreviewSurface();
+        if (!sPreview->init(width, height))
+            return JNI_FALSE;
+    }
+    sPreview->start();
+    return JNI_TRUE;
+}
+
+static void jniPreviewStop(JNIEnv *env, jclass clazz) {
+    std::lock_guard<std::mutex> lock(sPreviewLock);
+    if (sPreview == NULL)
+        return;
+    sPreview->stop();
+    releasePreviewSurface();
+    delete sPreview;
+    sPreview = NULL;
+}
+
+static void jniPreviewSetSurface(JNIEnv *env, jclass clazz, jobject surface) {
+    std::lock_guard<std::mutex> lock(sPreviewLock);
+    if (sPreview == NULL)
+        return;
+    releasePreviewSurface();
+    if (surface == NULL)
+        return;
+    ANativeWindow *window = ANativeWindow_fromSurface(env, surface);
+    if (window == NULL) {
+        LOGE("no native window for the preview surface");
+        return;
+    }
+    sPreviewSurface = new NativeWindowSurface(window, sPreview->getWidth(), sPreview->getHeight());
+    ANativeWindow_release(window);
+    sPreview->setSurface(sPreviewSurface);
+}
+
+static void jniPreviewSetBeautyLevel(JNIEnv *env, jclass clazz, jfloat smoothLevel, jfloat whitenLevel) {
+    std::lock_guard<std::mutex> lock(sPreviewLock);
+    if (sPreview != NULL)
+        sPreview->setBeautyLevel(smoothLevel, whitenLevel);
+}
+
+// the stills and the CPU preview smooth at the same precision
+static jboolean jniSetSmoothPrecision(JNIEnv *env, jclass clazz, jint precision) {
+    if (!MagicBeautify::getInstance()->setSmoothPrecision(precision))
+        return JNI_FALSE;
+    std::lock_guard<std::mutex> lock(sPreviewLock);
+    if (sPreview != NULL)
+        sPreview->setSmoothPrecision(precision);
+    return JNI_TRUE;
+}
+
+static void jniPreviewSetLookup(JNIEnv *env, jclass clazz, jobject bitmap) {
+    std::lock_guard<std::mutex> lock(sPreviewLock);
+    if (sPreview == NULL)
+        return;
+    if (bitmap == NULL) {
+        sPreview->setLookup(NULL, 0);
+        return;
+    }
+    int stride;
+    const uint8_t *pixels = lockLookup(env, bitmap, &stride);
+    if (pixels == NULL)
+        return;
+    sPreview->setLookup(pixels, stride);
+    AndroidBitmap_unlockPixels(env, bitmap);
+}
+
+static void jniPreviewSetHslMixer(JNIEnv *env, jclass clazz, jfloatArray values) {
+    HslMixer mixer;
+    if (!readMixer(env, values, &mixer))
+        return;
+    std::lock_guard<std::mutex> lock(sPreviewLock);
+    if (sPreview != NULL)
+        sPreview->setMixer(mixer);
+}
+
+static void jniPreviewSetSkinProtection(JNIEnv *env, jclass clazz, jboolean protect) {
+    std::lock_guard<std::mutex> lock(sPreviewLock);
+    if (sPreview != NULL)
+        sPreview->setSkinProtection(protect == JNI_TRUE);
+}
+
+static jboolean jniPreviewSubmit(JNIEnv *env, jclass clazz, jbyteArray nv21) {
+    std::lock_guard<std::mutex> lock(sPreviewLock);
+    if (sPreview == NULL || nv21 == NULL
+            || env->GetArrayLength(nv21) < sPreview->getWidth() * sPreview->getHeight() * 3 / 2)
+        return JNI_FALSE;
+    void *data = env->GetPrimitiveArrayCritical(nv21, NULL);
+    if (data == NULL)
+        return JNI_FALSE;
+    jboolean submitted = sPreview->submit((const uint8_t *) data) ? JNI_TRUE : JNI_FALSE;
+    env->ReleasePrimitiveArrayCritical(nv21, data, JNI_ABORT);
+    markResult();
+    return submitted;
+}
+
+static jboolean jniPreviewExportGainMap(JNIEnv *env, jclass clazz, jbyteArray nv21, jint scale, jboolean wide,
+                                        jobject buffer) {
+    std::lock_guard<std::mutex> lock(sPreviewLock);
+    if (sPreview == NULL || nv21 == NULL
+            || env->GetArrayLength(nv21) < sPreview->getWidth() * sPreview->getHeight() * 3 / 2)
+        return JNI_FALSE;
+    int width = sPreview->getWidth();
+    uint8_t *out = gainMapBuffer(env, buffer, width, sPreview->getHeight(), scale, wide);
+    if (out == NULL)
+        return JNI_FALSE;
+    int depth = wide == JNI_TRUE ? GainMap::DEPTH_16 : GainMap::DEPTH_8;
+    void *data = env->GetPrimitiveArrayCritical(nv21, NULL);
+    if (data == NULL)
+        return JNI_FALSE;
+    bool exported = sPreview->exportGainMap((const uint8_t *) data, scale, depth, out,
+                                            GainMap::mapSize(width, scale) * GainMap::cellBytes(depth));
+    env->ReleasePrimitiveArrayCritical(nv21, data, JNI_ABORT);
+    return exported ? JNI_TRUE : JNI_FALSE;
+}
+
+// the scope never takes the preview lock: it is fed and read from
+// different threads and publishes without locking
+static ScopeEngine sScope;
+static std::mutex sScopeReadLock;
+static ScopeData *sScopeData = NULL;
+
+static void jniScopeSetSampleStep(JNIEnv *env, jclass clazz, jint step) {
+    sScope.setSampleStep(step);
+}
+
+static jboolean jniScopeSubmit(JNIEnv *env, jclass clazz, jbyteArray nv21, jint width, jint height) {
+    if (nv21 == NULL || width <= 0 || height <= 0
+            || env->GetArrayLength(nv21) < (int64_t) width * height * 3 / 2)
+        return JNI_FALSE;
+    void *data = env->GetPrimitiveArrayCritical(nv21, NULL);
+    if (data == NULL)
+        return JNI_FALSE;
+    bool submitted = sScope.submit((const uint8_t *) data, width, height);
+    env->ReleasePrimitiveArrayCritical(nv21, data, JNI_ABORT);
+    return submitted ? JNI_TRUE : JNI_FALSE;
 }
 
-JNIEXPORT void JNICALL
-Java_com_seu_magicfilter_beautify_MagicJni_jniFreeBitmapData(JNIEnv *env, jobject instance,
-                                                             jobject handle) {
-    BitmapOperation::jniFreeBitmapData(env, instance, handle);
+static jlong jniScopeRead(JNIEnv *env, jclass clazz, jintArray histograms, jshortArray waveform) {
+    if (histograms == NULL || env->GetArrayLength(histograms) < 4 * 256
+            || (waveform != NULL && env->GetArrayLength(waveform) < SCOPE_COLUMNS * 256))
+        return 0;
+    std::lock_guard<std::mutex> lock(sScopeReadLock);
+    if (sScopeData == NULL) {
+        sScopeData = new (std::nothrow) ScopeData;
+        if (sScopeData == NULL)
+            return 0;
+    }
+    if (!sScope.read(sScopeData))
+        return 0;
+    env->SetIntArrayRegion(histograms, 0, 256, (const jint *) sScopeData->luma);
+    env->SetIntArrayRegion(histograms, 256, 256, (const jint *) sScopeData->red);
+    env->SetIntArrayRegion(histograms, 512, 256, (const jint *) sScopeData->green);
+    env->SetIntArrayRegion(histograms, 768, 256, (const jint *) sScopeData->blue);
+    if (waveform != NULL)
+        env->SetShortArrayRegion(waveform, 0, SCOPE_COLUMNS * 256, (const jshort *) sScopeData->waveform);
+    return sScopeData->frame;
+}
+
+// synchronised internally, so a push never waits for a shutter copy
+static FrameRing sRing;
+
+static jboolean jniRingStart(JNIEnv *env, jclass clazz, jint width, jint height, jint capacity) {
+    return sRing.init(width, height, capacity) ? JNI_TRUE : JNI_FALSE;
 }
 
-JNIEXPORT jobject JNICALL
-Java_com_seu_magicfilter_beautify_MagicJni_jniGetBitmapFromStoredBitmapData(JNIEnv *env,
-                                                                            jobject instance,
-                                                                            jobject handle) {
-    return BitmapOperation::jniGetBitmapFromStoredBitmapData(env, instance, handle);
+static void jniRingStop(JNIEnv *env, jclass clazz) {
+    sRing.release();
 }
-#ifdef __cplusplus
+
+static jfloat jniRingPush(JNIEnv *env, jclass clazz, jbyteArray nv21, jlong timestampNanos) {
+    if (nv21 == NULL)
+        return -1;
+    jsize length = env->GetArrayLength(nv21);
+    void *data = env->GetPrimitiveArrayCritical(nv21, NULL);
+    if (data == NULL)
+        return -1;
+    float score = sRing.push((const uint8_t *) data, length, timestampNanos);
+    env->ReleasePrimitiveArrayCritical(nv21, data, JNI_ABORT);
+    return score;
+}
+
+static jlong jniRingTakeSharpest(JNIEnv *env, jclass clazz, jlong maxAgeNanos, jbyteArray out) {
+    if (out == NULL)
+        return -1;
+    jsize length = env->GetArrayLength(out);
+    void *data = env->GetPrimitiveArrayCritical(out, NULL);
+    if (data == NULL)
+        return -1;
+    int64_t timestamp = sRing.takeSharpest(maxAgeNanos, (uint8_t *) data, length, NULL);
+    env->ReleasePrimitiveArrayCritical(out, data, timestamp >= 0 ? 0 : JNI_ABORT);
+    return timestamp;
+}
+
+static std::mutex sAssistLock;
+static FocusAssist sAssist;
+
+static void jniAssistSetPeaking(JNIEnv *env, jclass clazz, jint threshold) {
+    std::lock_guard<std::mutex> lock(sAssistLock);
+    sAssist.setPeaking(threshold);
+}
+
+static void jniAssistSetZebra(JNIEnv *env, jclass clazz, jint level) {
+    std::lock_guard<std::mutex> lock(sAssistLock);
+    sAssist.setZebra(level);
+}
+
+static jboolean jniAssistCompute(JNIEnv *env, jclass clazz, jbyteArray nv21, jint width, jint height,
+                                 jobject mask) {
+    if (nv21 == NULL || mask == NULL || width <= 0 || height <= 0
+            || env->GetArrayLength(nv21) < (int64_t) width * height * 3 / 2)
+        return JNI_FALSE;
+    int maskWidth = FocusAssist::maskSize(width);
+    uint8_t *out = (uint8_t *) env->GetDirectBufferAddress(mask);
+    if (out == NULL || env->GetDirectBufferCapacity(mask) < (int64_t) maskWidth * FocusAssist::maskSize(height))
+        return JNI_FALSE;
+    std::lock_guard<std::mutex> lock(sAssistLock);
+    void *data = env->GetPrimitiveArrayCritical(nv21, NULL);
+    if (data == NULL)
+        return JNI_FALSE;
+    bool computed = sAssist.compute(ImageView(data, width, height, width, ImageView::FORMAT_GRAY_8), out, maskWidth);
+    env->ReleasePrimitiveArrayCritical(nv21, data, JNI_ABORT);
+    return computed ? JNI_TRUE : JNI_FALSE;
+}
+
+static const JNINativeMethod gMethods[] = {
+        {"jniInitMagicBeautify",             "(Ljava/nio/ByteBuffer;)V",
+                (void *) jniInitMagicBeautify},
+        {"jniUnInitMagicBeautify",           "()V",
+                (void *) jniUnInitMagicBeautify},
+        {"jniStartSkinSmooth",               "(F)V",
+                (void *) jniStartSkinSmooth},
+        {"jniStartWhiteSkin",                "(F)V",
+                (void *) jniStartWhiteSkin},
+        {"jniSetLinearLight",                "(Z)V",
+                (void *) jniSetLinearLight},
+        {"jniSetSmoothPrecision",            "(I)Z",
+                (void *) jniSetSmoothPrecision},
+        {"jniSetWhitenMask",                 "(I)V",
+                (void *) jniSetWhitenMask},
+        {"jniSetSkinTone",                   "(FI)V",
+                (void *) jniSetSkinTone},
+        {"jniSetResultCacheLimit",           "(J)V",
+                (void *) jniSetResultCacheLimit},
+        {"jniExportGainMap",                 "(IZLjava/nio/ByteBuffer;)Z",
+                (void *) jniExportGainMap},
+        {"jniStoreBitmapData",               "(Landroid/graphics/Bitmap;)Ljava/nio/ByteBuffer;",
+                (void *) jniStoreBitmapData},
+        {"jniFreeBitmapData",                "(Ljava/nio/ByteBuffer;)V",
+                (void *) jniFreeBitmapData},
+        {"jniGetBitmapFromStoredBitmapData", "(Ljava/nio/ByteBuffer;)Landroid/graphics/Bitmap;",
+                (void *) jniGetBitmapFromStoredBitmapData},
+        {"jniCopyBufferToBitmap",            "(Ljava/nio/ByteBuffer;Landroid/graphics/Bitmap;)Z",
+                (void *) jniCopyBufferToBitmap},
+        {"jniDrawSprites",                   "(Ljava/nio/ByteBuffer;[Landroid/graphics/Bitmap;[F[F)Z",
+                (void *) jniDrawSprites},
+        {"jniHeal",                          "(Ljava/nio/ByteBuffer;IIIII)Z",
+                (void *) jniHeal},
+        {"jniSaveFrame",                     "(Ljava/nio/ByteBuffer;IIZI)J",
+                (void *) jniSaveFrame},
+        {"jniGetFirstResultNanos",           "()J",
+                (void *) jniGetFirstResultNanos},
+        {"jniSetMemoryBudget",               "(J)V",
+                (void *) jniSetMemoryBudget},
+        {"jniGetMemoryUsage",                "(I)J",
+                (void *) jniGetMemoryUsage},
+        {"jniSetLook",                       "(Landroid/graphics/Bitmap;Z)V",
+                (void *) jniSetLook},
+        {"jniSetHslMixer",                   "([F)V",
+                (void *) jniSetHslMixer},
+        {"jniPreviewStart",                  "(II)Z",
+                (void *) jniPreviewStart},
+        {"jniPreviewStop",                   "()V",
+                (void *) jniPreviewStop},
+        {"jniPreviewSetSurface",             "(Landroid/view/Surface;)V",
+                (void *) jniPreviewSetSurface},
+        {"jniPreviewSetBeautyLevel",         "(FF)V",
+                (void *) jniPreviewSetBeautyLevel},
+        {"jniPreviewSetLookup",              "(Landroid/graphics/Bitmap;)V",
+                (void *) jniPreviewSetLookup},
+        {"jniPreviewSetHslMixer",            "([F)V",
+                (void *) jniPreviewSetHslMixer},
+        {"jniPreviewSetSkinProtection",      "(Z)V",
+                (void *) jniPreviewSetSkinProtection},
+        {"jniPreviewExportGainMap",          "([BIZLjava/nio/ByteBuffer;)Z",
+                (void *) jniPreviewExportGainMap},
+        {"jniPreviewSubmit",                 "([B)Z",
+                (void *) jniPreviewSubmit},
+        {"jniAssistSetPeaking",              "(I)V",
+                (void *) jniAssistSetPeaking},
+        {"jniAssistSetZebra",                "(I)V",
+                (void *) jniAssistSetZebra},
+        {"jniAssistCompute",                 "([BIILjava/nio/ByteBuffer;)Z",
+                (void *) jniAssistCompute},
+        {"jniRingStart",                     "(III)Z",
+                (void *) jniRingStart},
+        {"jniRingStop",                      "()V",
+                (void *) jniRingStop},
+        {"jniRingPush",                      "([BJ)F",
+                (void *) jniRingPush},
+        {"jniRingTakeSharpest",              "(J[B)J",
+                (void *) jniRingTakeSharpest},
+        {"jniScopeSetSampleStep",            "(I)V",
+                (void *) jniScopeSetSampleStep},
+        {"jniScopeSubmit",                   "([BII)Z",
+                (void *) jniScopeSubmit},
+        {"jniScopeRead",                     "([I[S)J",
+                (void *) jniScopeRead},
+};
+
+/**
+ * Natives are bound once here instead of by symbol lookup on every first
+ * call. Nothing else is initialised: tables are compile-time constants
+ * and the worker pool starts on the first parallel job.
+ */
+extern "C" JNIEXPORT jint JNICALL
+JNI_OnLoad(JavaVM *vm, void *reserved) {
+    JNIEnv *env = NULL;
+    if (vm->GetEnv((void **) &env, JNI_VERSION_1_6) != JNI_OK)
+        return JNI_ERR;
+    jclass clazz = env->FindClass(MAGIC_JNI_CLASS);
+    if (clazz == NULL) {
+        LOGE("cannot find %s", MAGIC_JNI_CLASS);
+        return JNI_ERR;
+    }
+    if (env->RegisterNatives(clazz, gMethods, sizeof(gMethods) / sizeof(gMethods[0])) < 0) {
+        LOGE("RegisterNatives failed for %s", MAGIC_JNI_CLASS);
+        return JNI_ERR;
+    }
+    env->DeleteLocalRef(clazz);
+    return JNI_VERSION_1_6;
 }
-#endif
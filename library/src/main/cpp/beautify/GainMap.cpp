@@ -0,0 +1,171 @@
+#include "GainMap.h"
+#include <stdio.h>
+#include <string.h>
+#include <new>
+#include "../utils/MemoryGovernor.h"
+#include "../utils/ThreadPool.h"
+#include "../utils/MagicLog.h"
+
+#define  LOG_TAG    "GainMap"
+
+GainMap::GainMap(int owner)
+{
+	mOwner = owner;
+	mMapWidth = 0;
+	mMapHeight = 0;
+	mReservedBytes = 0;
+	mSum = NULL;
+	mSumSqr = NULL;
+	mSkin = NULL;
+}
+
+GainMap::~GainMap()
+{
+	release();
+}
+
+void GainMap::release()
+{
+	delete[] mSum;
+	delete[] mSumSqr;
+	delete[] mSkin;
+	mSum = NULL;
+	mSumSqr = NULL;
+	mSkin = NULL;
+	mMapWidth = 0;
+	mMapHeight = 0;
+	MemoryGovernor::getInstance()->release(mOwner, mReservedBytes);
+	mReservedBytes = 0;
+}
+
+bool GainMap::reserve(int mapWidth, int mapHeight)
+{
+	if (mapWidth == mMapWidth && mapHeight == mMapHeight)
+		return true;
+	release();
+	int64_t tables = (int64_t) (mapWidth + 1) * (mapHeight + 1);
+	int64_t bytes = tables * 2 * sizeof(uint64_t) + (int64_t) mapWidth * mapHeight * sizeof(uint32_t);
+	if (!MemoryGovernor::getInstance()->reserve(mOwner, bytes))
+		return false;
+	mReservedBytes = bytes;
+	mSum = new (std::nothrow) uint64_t[tables];
+	mSumSqr = new (std::nothrow) uint64_t[tables];
+	mSkin = new (std::nothrow) uint32_t[(int64_t) mapWidth * mapHeight];
+	if (mSum == NULL || mSumSqr == NULL || mSkin == NULL) {
+		LOGE("allocation failed for a %dx%d gain map", mapWidth, mapHeight);
+		release();
+		return false;
+	}
+	mMapWidth = mapWidth;
+	mMapHeight = mapHeight;
+	return true;
+}
+
+bool GainMap::compute(const ImageView& luma, const ImageView& skin, int scale, int radius, float level,
+		int depth, uint8_t* out, int stride)
+{
+	if (luma.isEmpty() || scale < 1 || out == NULL)
+		return false;
+	const int width = luma.width;
+	const int height = luma.height;
+	const int mapWidth = mapSize(width, scale);
+	const int mapHeight = mapSize(height, scale);
+	if (!reserve(mapWidth, mapHeight))
+		return false;
+	const int tableWidth = mapWidth + 1;
+	const int step = ImageView::bytesPerPixel(luma.format);
+	const bool hasSkin = !skin.isEmpty();
+	const int skinShift = hasSkin && skin.width < width ? 1 : 0;
+
+	// the one pass over the pixels: sums per cell, each row of cells a job,
+	// written to row cy + 1 of the tables before they are integrated.
+	// MagicBeautify neither smooths nor samples pixel row 0 or column 0, so
+	// they are left out of the sums and of the skin weight.
+	memset(mSum, 0, sizeof(uint64_t) * tableWidth);
+	memset(mSumSqr, 0, sizeof(uint64_t) * tableWidth);
+	ThreadPool::getInstance()->parallelFor(mapHeight, [&](int cy) {
+		uint64_t* sum = mSum + (size_t) (cy + 1) * tableWidth;
+		uint64_t* sumSqr = mSumSqr + (size_t) (cy + 1) * tableWidth;
+		uint32_t* skinSum = mSkin + (size_t) cy * mapWidth;
+		memset(sum, 0, sizeof(uint64_t) * tableWidth);
+		memset(sumSqr, 0, sizeof(uint64_t) * tableWidth);
+		memset(skinSum, 0, sizeof(uint32_t) * mapWidth);
+		int yEnd = (cy + 1) * scale < height ? (cy + 1) * scale : height;
+		for (int y = cy > 0 ? cy * scale : 1; y < yEnd; y++) {
+			const uint8_t* line = luma.row(y);
+			const uint8_t* skinLine = hasSkin ? skin.row(y >> skinShift) : NULL;
+			for (int cx = 0; cx < mapWidth; cx++) {
+				int xBegin = cx > 0 ? cx * scale : 1;
+				int xEnd = (cx + 1) * scale < width ? (cx + 1) * scale : width;
+				uint32_t s = 0, q = 0, k = 0;
+				for (int x = xBegin; x < xEnd; x++) {
+					uint32_t v = line[x * step];
+					s += v;
+					q += v * v;
+				}
+				if (hasSkin) {
+					for (int x = xBegin; x < xEnd; x++)
+						k += skinLine[x >> skinShift];
+				}
+				sum[cx + 1] += s;
+				sumSqr[cx + 1] += q;
+				skinSum[cx] += k;
+			}
+		}
+	});
+	for (int cy = 1; cy <= mapHeight; cy++) {
+		uint64_t* sum = mSum + (size_t) cy * tableWidth;
+		uint64_t* sumSqr = mSumSqr + (size_t) cy * tableWidth;
+		uint64_t rowSum = 0, rowSumSqr = 0;
+		for (int cx = 1; cx <= mapWidth; cx++) {
+			rowSum += sum[cx];
+			rowSumSqr += sumSqr[cx];
+			sum[cx] = rowSum + sum[cx - tableWidth];
+			sumSqr[cx] = rowSumSqr + sumSqr[cx - tableWidth];
+		}
+	}
+
+	// the smoothing window rounded to whole cells
+	const int r = (radius + scale / 2) / scale;
+	ThreadPool::getInstance()->parallelFor(mapHeight, [&](int cy) {
+		int top = cy - r > 0 ? cy - r : 0;
+		int bottom = cy + r < mapHeight - 1 ? cy + r : mapHeight - 1;
+		int rows = ((bottom + 1) * scale < height ? (bottom + 1) * scale : height) - (top > 0 ? top * scale : 1);
+		int cellRows = ((cy + 1) * scale < height ? (cy + 1) * scale : height) - cy * scale;
+		const uint64_t* sumTop = mSum + (size_t) top * tableWidth;
+		const uint64_t* sumBottom = mSum + (size_t) (bottom + 1) * tableWidth;
+		const uint64_t* sqrTop = mSumSqr + (size_t) top * tableWidth;
+		const uint64_t* sqrBottom = mSumSqr + (size_t) (bottom + 1) * tableWidth;
+		uint8_t* line = out + (size_t) cy * stride;
+		for (int cx = 0; cx < mapWidth; cx++) {
+			int left = cx - r > 0 ? cx - r : 0;
+			int right = cx + r < mapWidth - 1 ? cx + r : mapWidth - 1;
+			int columns = ((right + 1) * scale < width ? (right + 1) * scale : width) - (left > 0 ? left * scale : 1);
+			// integer averages, as MagicBeautify takes them; a one pixel
+			// wide or high image has nothing left to average
+			uint64_t count = (uint64_t) rows * columns;
+			uint64_t m = 0;
+			float v = 0;
+			if (count > 0) {
+				m = (sumBottom[right + 1] - sumBottom[left] - sumTop[right + 1] + sumTop[left]) / count;
+				v = (sqrBottom[right + 1] - sqrBottom[left] - sqrTop[right + 1] + sqrTop[left]) / count - m * m;
+			}
+			float g = 1;
+			if (level > 0 && count > 0) {
+				float cellPixels = (float) cellRows * (((cx + 1) * scale < width ? (cx + 1) * scale : width) - cx * scale);
+				float s = hasSkin ? mSkin[(size_t) cy * mapWidth + cx] / (255 * cellPixels) : 1;
+				float k = v > 0 ? v / (v + level) : 0;
+				g = 1 - s * (1 - k);
+			}
+			if (depth == DEPTH_16) {
+				uint16_t* cell = (uint16_t*) line + cx * 2;
+				cell[0] = (uint16_t) (m * 257);
+				cell[1] = (uint16_t) (g * 65535 + 0.5f);
+			} else {
+				line[cx * 2] = (uint8_t) m;
+				line[cx * 2 + 1] = (uint8_t) (g * 255 + 0.5f);
+			}
+		}
+	});
+	return true;
+}
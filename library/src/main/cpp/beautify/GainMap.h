@@ -0,0 +1,63 @@
+#ifndef _GAIN_MAP_H_
+#define _GAIN_MAP_H_
+
+#include <stdint.h>
+#include "../bitmap/ImageView.h"
+
+/**
+ * Low resolution export of the skin smoothing statistics, for renderers
+ * that apply the blend themselves. Each cell covers scale x scale pixels
+ * and holds the local mean m of luma over the smoothing window and the
+ * gain
+ *
+ *   g = 1 - s * (1 - v / (v + level))
+ *
+ * where v is the local variance and s the fraction of the cell that is
+ * skin, so g is 1 wherever nothing is smoothed. A consumer samples the map
+ * bilinearly and blends y' = mix(m, y, g): one texture fetch per pixel.
+ *
+ * Cells are (mean, gain) pairs: two bytes at DEPTH_8, two native-endian
+ * 16-bit values at DEPTH_16, both full range. The window statistics are
+ * built from per-cell sums, so everything after one pass over the luma is
+ * proportional to the map size. They are the integer window averages of
+ * the gamma mode of MagicBeautify, clamped to the same window and leaving
+ * pixel row and column 0 alone as it does: at scale 1 the blend
+ * reproduces its result up to the rounding of the gain, coarser maps
+ * approximate it.
+ */
+class GainMap
+{
+public:
+	static const int DEPTH_8 = 8;
+	static const int DEPTH_16 = 16;
+
+	// scratch is charged to this MemoryGovernor owner
+	GainMap(int owner);
+	~GainMap();
+
+	static int mapSize(int size, int scale) { return (size + scale - 1) / scale; }
+	static int cellBytes(int depth) { return depth == DEPTH_16 ? 4 : 2; }
+
+	// luma: a GRAY_8 plane, or the Y of YCBCR_888 pixels. skin: GRAY_8
+	// weights at the luma size or subsampled 2:1 both ways like 4:2:0
+	// chroma, empty when all of the image is skin. level <= 0 turns the
+	// smoothing off. out holds mapSize(width) x mapSize(height) cells,
+	// stride bytes apart. False when the scratch does not fit the budget.
+	bool compute(const ImageView& luma, const ImageView& skin, int scale, int radius, float level,
+			int depth, uint8_t* out, int stride);
+	void release();
+
+private:
+	bool reserve(int mapWidth, int mapHeight);
+
+	int mOwner;
+	int mMapWidth;
+	int mMapHeight;
+	int64_t mReservedBytes;
+	// summed area tables over the cells, (mapWidth + 1) x (mapHeight + 1)
+	uint64_t* mSum;
+	uint64_t* mSumSqr;
+	// skin weight summed per cell
+	uint32_t* mSkin;
+};
+#endif
@@ -1,15 +1,32 @@
 #include "MagicBeautify.h"
-#include "Math.h"
-#include "../bitmap/BitmapOperation.h"
+#include "math.h"
+#include <string.h>
+#include "../bitmap/ContentHash.h"
 #include "../bitmap/Conversion.h"
+#include "../bitmap/PixelCopy.h"
+#include "SmoothGain.h"
+#include "../utils/MagicTables.h"
+#include "../utils/MemoryGovernor.h"
+#include "../utils/ThreadPool.h"
+#include <new>
+#include "../utils/MagicLog.h"
 
 #define  LOG_TAG    "MagicBeautify"
-#define  LOGD(...)  __android_log_print(ANDROID_LOG_DEBUG,LOG_TAG,__VA_ARGS__)
-#define  LOGE(...)  __android_log_print(ANDROID_LOG_ERROR,LOG_TAG,__VA_ARGS__)
 
-#define div255(x) (x * 0.003921F)
 #define abs(x) (x>=0 ? x:(-x))
 
+// 12-bit linear variances against the 8-bit smoothing levels callers pass
+static const float kLinearLevelScale = (4095.0f / 255) * (4095.0f / 255);
+
+// a typical skin chroma in true JFIF terms, for images the skin mask finds nothing in
+static const int kDefaultSkinChroma = 110 << 8 | 150;
+
+// luma as the statistics see it: as stored, or decoded to 12-bit linear
+static void initLumaDecode(bool linear, uint16_t* decode){
+	for(int i = 0; i < 256; i++)
+		decode[i] = linear ? kSrgbToLinear12[i] : i;
+}
+
 MagicBeautify* MagicBeautify::instance;
 
 MagicBeautify* MagicBeautify::getInstance()
@@ -19,7 +36,7 @@ MagicBeautify* MagicBeautify::getInstance()
 	return instance;
 }
 
-MagicBeautify::MagicBeautify()
+MagicBeautify::MagicBeautify() : mGainMap(MEMORY_OWNER_BEAUTIFY), mSkinTone(MEMORY_OWNER_BEAUTIFY)
 {
 	LOGE("MagicBeautify");
 	mIntegralMatrix = NULL;
@@ -29,11 +46,35 @@ MagicBeautify::MagicBeautify()
 	mImageData_rgb = NULL;
 	mSmoothLevel = 0.0;
 	mWhitenLevel = 0.0;
+	mImageWidth = 0;
+	mImageHeight = 0;
+	mEngine = ENGINE_INTEGRAL;
+	mReservedBytes = 0;
+	mPlaneLayout = PlaneLayout::LAYOUT_LINEAR;
+	mPrecision = SmoothGain::PRECISION_FP32;
+	mLinearLight = false;
+	mLinearActive = false;
+	mLook = NULL;
+	mProtectSkin = false;
+	mWhitenMask = WHITEN_FULL;
+	mSoftSkin = NULL;
+	mSoftSkinValid = false;
+	mToneScratch = NULL;
+	mRowScratch = NULL;
+	mSpanMask = -1;
+	mOutputClean = -1;
+	mSkinChroma = Conversion::planeChroma(kDefaultSkinChroma);
+	mToneTable = NULL;
+	mSourceHash = ContentHash::NONE;
 }
 
 MagicBeautify::~MagicBeautify()
 {
 	LOGE("~MagicBeautify");
+	releaseBuffers();
+}
+
+void MagicBeautify::releaseBuffers(){
 	if(mIntegralMatrix != NULL)
 		delete[] mIntegralMatrix;
 	if(mIntegralMatrixSqr != NULL)
@@ -44,22 +85,183 @@ MagicBeautify::~MagicBeautify()
 		delete[] mSkinMatrix;
 	if(mImageData_rgb != NULL)
 		delete[] mImageData_rgb;
+	if(mSoftSkin != NULL)
+		delete[] mSoftSkin;
+	if(mToneScratch != NULL)
+		delete[] mToneScratch;
+	if(mRowScratch != NULL)
+		delete[] mRowScratch;
+	mIntegralMatrix = NULL;
+	mIntegralMatrixSqr = NULL;
+	mImageData_yuv = NULL;
+	mSkinMatrix = NULL;
+	mImageData_rgb = NULL;
+	mSoftSkin = NULL;
+	mSoftSkinValid = false;
+	mToneScratch = NULL;
+	mRowScratch = NULL;
+	mSpans.clear();
+	mSpanRows.clear();
+	mSpanMask = -1;
+	mSourceHash = ContentHash::NONE;
+	mGainMap.release();
+	mSkinTone.release();
+	MemoryGovernor::getInstance()->release(MEMORY_OWNER_BEAUTIFY, mReservedBytes);
+	mReservedBytes = 0;
+}
+
+int MagicBeautify::getSmoothRadius(){
+	return mImageWidth > mImageHeight ? mImageWidth * 0.02 : mImageHeight * 0.02;
 }
 
-void MagicBeautify::initMagicBeautify(JniBitmap* jniBitmap){
+/**
+ * Admission control: charge the whole session to the governor up front and
+ * fall back to the streaming engine, which keeps no integral images, when
+ * the budget cannot hold them.
+ */
+bool MagicBeautify::reserveBuffers(){
+	int64_t pixels = (int64_t)mImageWidth * mImageHeight;
+	int64_t tone = (int64_t)ThreadPool::getInstance()->getThreadCount() * mImageWidth * 3;
+	int64_t base = pixels * (sizeof(uint32_t) + 3 + 1) + tone;
+	// the integral build's column sums, which the smoothing and feathering rows fit in
+	int64_t rows = (int64_t)mImageWidth * 2 * sizeof(uint64_t);
+	int64_t integral = (int64_t)mLayout.size() * 2 * sizeof(uint64_t) + rows;
+	int64_t streaming = (int64_t)(2 * getSmoothRadius() + 2) * mImageWidth
+			+ mImageWidth * (sizeof(uint32_t) + 3 * sizeof(uint64_t) + 2 * sizeof(float));
+	MemoryGovernor* governor = MemoryGovernor::getInstance();
+	if(governor->reserve(MEMORY_OWNER_BEAUTIFY, base + integral)){
+		mEngine = ENGINE_INTEGRAL;
+		mReservedBytes = base + integral;
+	}else if(governor->reserve(MEMORY_OWNER_BEAUTIFY, base + streaming)){
+		LOGE("memory budget too small for integral images, using the streaming engine");
+		mEngine = ENGINE_STREAMING;
+		mReservedBytes = base + streaming;
+	}else{
+		LOGE("memory budget too small for a %dx%d beautify session", mImageWidth, mImageHeight);
+		return false;
+	}
+	mImageData_rgb = new (std::nothrow) uint32_t[pixels];
+	mImageData_yuv = new (std::nothrow) uint8_t[pixels * 3];
+	mSkinMatrix = new (std::nothrow) uint8_t[pixels];
+	mToneScratch = new (std::nothrow) uint8_t[tone];
+	mRowScratch = new (std::nothrow) uint8_t[mEngine == ENGINE_INTEGRAL ? rows : streaming];
+	if(mEngine == ENGINE_INTEGRAL){
+		mIntegralMatrix = new (std::nothrow) uint64_t[mLayout.size()];
+		mIntegralMatrixSqr = new (std::nothrow) uint64_t[mLayout.size()];
+	}
+	if(mImageData_rgb == NULL || mImageData_yuv == NULL || mSkinMatrix == NULL || mToneScratch == NULL || mRowScratch == NULL
+			|| (mEngine == ENGINE_INTEGRAL && (mIntegralMatrix == NULL || mIntegralMatrixSqr == NULL))){
+		LOGE("allocation failed for a %dx%d beautify session", mImageWidth, mImageHeight);
+		releaseBuffers();
+		return false;
+	}
+	return true;
+}
+
+bool MagicBeautify::initMagicBeautify(const ImageView& image, uint64_t contentHash){
 	LOGE("initMagicBeautify");
-	storedBitmapPixels = jniBitmap->_storedBitmapPixels;
-	mImageWidth = jniBitmap->_bitmapInfo.width;
-	mImageHeight = jniBitmap->_bitmapInfo.height;
+	if(mImageWidth != image.width || mImageHeight != image.height || mLayout.mode != mPlaneLayout)
+		releaseBuffers();
+	mOutput = image;
+	// everything derived from the source is still valid for the same pixels
+	if(contentHash != ContentHash::NONE && contentHash == mSourceHash && mImageData_rgb != NULL
+			&& mLinearActive == mLinearLight && ContentHash::equal(image, rgbView())){
+		mOutputClean = WHITEN_FULL;
+		return true;
+	}
+	mImageWidth = image.width;
+	mImageHeight = image.height;
+	mLayout = PlaneLayout(mPlaneLayout, mImageWidth, mImageHeight);
+	mLinearActive = mLinearLight;
+	if(mImageData_rgb == NULL && !reserveBuffers())
+		return false;
+
+	mSourceHash = ContentHash::copy(mOutput, rgbView());
+	mOutputClean = WHITEN_FULL;
+	Conversion::RGBToYCbCr(rgbView(), yuvView());
+	initSkinMatrix();
+	// the feathered mask and the spans describe the previous image
+	mSoftSkinValid = false;
+	mSpanMask = -1;
+	if(mEngine == ENGINE_INTEGRAL)
+		initIntegral();
+	return true;
+}
+
+int MagicBeautify::getEngine(){
+	return mEngine;
+}
+
+int MagicBeautify::getImageWidth(){
+	return mImageWidth;
+}
+
+int MagicBeautify::getImageHeight(){
+	return mImageHeight;
+}
+
+void MagicBeautify::setPlaneLayout(int layout){
+	mPlaneLayout = layout;
+}
+
+int MagicBeautify::getPlaneLayout(){
+	return mPlaneLayout;
+}
 
+bool MagicBeautify::setSmoothPrecision(int precision){
+	if(!SmoothGain::isSupported(precision)){
+		LOGE("smoothing precision %d is not supported on this CPU, keeping %d", precision, mPrecision);
+		return false;
+	}
+	mPrecision = precision;
+	return true;
+}
+
+int MagicBeautify::getSmoothPrecision(){
+	return mPrecision;
+}
+
+void MagicBeautify::setLinearLight(bool linear){
+	mLinearLight = linear;
+}
+
+bool MagicBeautify::getLinearLight(){
+	return mLinearLight;
+}
+
+void MagicBeautify::setLook(const LookTable* look, bool protectSkin){
+	mLook = look;
+	mProtectSkin = protectSkin;
+	if(mImageData_rgb != NULL)
+		_startBeauty(mSmoothLevel, mWhitenLevel);
+}
+
+void MagicBeautify::setResultCacheLimit(int64_t bytes){
+	mResults.setLimit(bytes);
+}
+
+void MagicBeautify::setSkinTone(float strength, int target){
+	// the tone table is indexed by the planes' chroma
+	mSkinTone.set(strength, target >= 0 && target <= 0xffff ? Conversion::planeChroma(target) : target);
+}
+
+void MagicBeautify::setWhitenMask(int mask){
+	mWhitenMask = mask;
+}
+
+int MagicBeautify::getWhitenMask(){
+	return mWhitenMask;
+}
+
+bool MagicBeautify::exportGainMap(int scale, int depth, uint8_t* out, int stride){
 	if(mImageData_rgb == NULL)
-		mImageData_rgb = new uint32_t[mImageWidth*mImageHeight];
-	memcpy(mImageData_rgb, jniBitmap->_storedBitmapPixels, sizeof(uint32_t) * mImageWidth * mImageHeight);
-	if(mImageData_yuv == NULL)
-		mImageData_yuv = new uint8_t[mImageWidth * mImageHeight * 3];
-	Conversion::RGBToYCbCr((uint8_t*)mImageData_rgb, mImageData_yuv, mImageWidth * mImageHeight);
-	initSkinMatrix();
-	initIntegral();
+		return false;
+	// the smoothing leaves its result in the luma plane
+	Conversion::RGBToYCbCr(rgbView(), yuvView());
+	float level = mSmoothLevel >= 10.0 && mSmoothLevel <= 510.0 ? mSmoothLevel : 0;
+	return mGainMap.compute(yuvView(),
+			ImageView::packed(mSkinMatrix, mImageWidth, mImageHeight, ImageView::FORMAT_GRAY_8),
+			scale, getSmoothRadius(), level, depth, out, stride);
 }
 
 void MagicBeautify::unInitMagicBeautify(){
@@ -76,32 +278,358 @@ void MagicBeautify::startWhiteSkin(float whitenlevel){
 	_startBeauty(mSmoothLevel,whitenlevel);
 }
 
+ResultKey MagicBeautify::resultKey(bool smoothed, bool whitened, bool looked, bool toned){
+	ResultKey key;
+	memset(&key, 0, sizeof(key));
+	key.source = mSourceHash;
+	key.look = looked ? mLook->getHash() : 0;
+	key.width = mImageWidth;
+	key.height = mImageHeight;
+	key.smoothLevel = smoothed ? mSmoothLevel : 0;
+	key.whitenLevel = whitened ? mWhitenLevel : 0;
+	key.whitenMask = whitened ? mWhitenMask : 0;
+	key.engine = mEngine;
+	key.precision = smoothed ? mPrecision : 0;
+	key.toneStrength = toned ? mSkinTone.getStrength() : 0;
+	key.toneTarget = toned ? mSkinTone.getTarget() : 0;
+	key.linearLight = mLinearActive;
+	key.protectSkin = looked && mProtectSkin;
+	return key;
+}
+
+/**
+ * Renders from the source into mOutput. Whatever was asked for lands in
+ * the result cache, and a request seen before for the same pixels is
+ * copied back from it; with no step valid there is nothing to key, since
+ * mOutput then keeps the previous render.
+ */
 void MagicBeautify::_startBeauty(float smoothlevel, float whitenlevel){
 	LOGE("smoothlevel=%f---whitenlevel=%f",smoothlevel,whitenlevel);
-	if(smoothlevel >= 10.0 && smoothlevel <= 510.0){
+	bool smoothed = smoothlevel >= 10.0 && smoothlevel <= 510.0;
+	bool whitened = whitenlevel >= 1.0 && whitenlevel <= 5.0;
+	bool looked = mLook != NULL && !mLook->isEmpty();
+	mToneTable = mSkinTone.isActive() && mImageData_yuv != NULL ? mSkinTone.prepare(mSkinChroma) : NULL;
+	bool toned = mToneTable != NULL;
+	if(smoothed)
 		mSmoothLevel = smoothlevel;
-		_startSkinSmooth(mSmoothLevel);
-	}
-	if(whitenlevel >= 1.0 && whitenlevel <= 5.0){
+	if(whitened)
 		mWhitenLevel = whitenlevel;
-		_startWhiteSkin(mWhitenLevel);
+	bool cached = (smoothed || whitened || looked || toned) && mSourceHash != ContentHash::NONE;
+	ResultKey key = resultKey(smoothed, whitened, looked, toned);
+	if(cached && mResults.find(key, mOutput)){
+		mOutputClean = -1;
+		return;
 	}
+	bool rendered = false;
+	if(smoothed){
+		rendered = true;
+		// the tone rides along in the conversion back to RGB
+		if(mEngine == ENGINE_STREAMING)
+			_startSkinSmoothStreaming(mSmoothLevel);
+		else
+			_startSkinSmooth(mSmoothLevel);
+		mOutputClean = -1;
+	}else if(toned){
+		rendered = true;
+		_applySkinTone();
+		mOutputClean = -1;
+	}
+	if(whitened){
+		rendered = true;
+		if(mWhitenMask == WHITEN_SKIN || mWhitenMask == WHITEN_SKIN_SOFT){
+			_startWhiteSkinMasked(mWhitenLevel, smoothed || toned);
+			// a feathered mask that did not fit fell back to the binary one
+			cached = cached && mSpanMask == mWhitenMask;
+		}else{
+			// from the source, replacing any smoothing or tone as it always has
+			_startWhiteSkin(mWhitenLevel);
+			mOutputClean = -1;
+		}
+	}
+	if(looked){
+		// the look must not land on its own output
+		if(!rendered)
+			PixelCopy::copy(rgbView(), mOutput, 0);
+		_applyLook();
+		mOutputClean = -1;
+	}
+	if(cached)
+		mResults.store(key, mOutput);
 }
 
-void MagicBeautify::_startWhiteSkin(float whitenlevel){
+/**
+ * The look runs last, in place on the stored pixels, in the same lookup
+ * as the skin blend: mSkinMatrix rows are the per-pixel weights.
+ */
+void MagicBeautify::_applyLook(){
+	int bands = ThreadPool::getInstance()->getThreadCount();
+	int rowsPerBand = (mImageHeight + bands - 1) / bands;
+	ThreadPool::getInstance()->parallelFor(bands, [this, rowsPerBand](int band){
+		ImageView rows = mOutput.crop(0, band * rowsPerBand, mImageWidth, rowsPerBand);
+		mLook->applyImage(rows, rows, mProtectSkin
+				? ImageView::packed(mSkinMatrix, mImageWidth, mImageHeight, ImageView::FORMAT_GRAY_8)
+						.crop(0, band * rowsPerBand, mImageWidth, rowsPerBand)
+				: ImageView());
+	});
+}
+
+/**
+ * The tone without the smoothing pass to ride along in: only runs of the
+ * skin mask go through YCbCr and back, everything else is the source.
+ */
+void MagicBeautify::_applySkinTone(){
+	if(mOutputClean != WHITEN_FULL && mOutputClean != WHITEN_SKIN)
+		PixelCopy::copy(rgbView(), mOutput, 0);
+	ImageView skin = ImageView::packed(mSkinMatrix, mImageWidth, mImageHeight, ImageView::FORMAT_GRAY_8);
+	int bands = ThreadPool::getInstance()->getThreadCount();
+	int rowsPerBand = (mImageHeight + bands - 1) / bands;
+	ThreadPool::getInstance()->parallelFor(bands, [&](int band){
+		uint8_t *yuv = mToneScratch + (size_t)band * mImageWidth * 3;
+		int end = (band + 1) * rowsPerBand < mImageHeight ? (band + 1) * rowsPerBand : mImageHeight;
+		for(int i = band * rowsPerBand; i < end; i++){
+			const uint8_t *mask = mSkinMatrix + (size_t)i * mImageWidth;
+			for(int j = 0; j < mImageWidth; ){
+				if(mask[j] == 0){
+					j++;
+					continue;
+				}
+				int start = j;
+				while(j < mImageWidth && mask[j] != 0)
+					j++;
+				ImageView run = ImageView::packed(yuv, j - start, 1, ImageView::FORMAT_YCBCR_888);
+				Conversion::RGBToYCbCr(rgbView().crop(start, i, j - start, 1), run);
+				Conversion::YCbCrToRGB(run, mOutput.crop(start, i, j - start, 1),
+						skin.crop(start, i, j - start, 1), mToneTable);
+			}
+		}
+	});
+}
+
+// the smoothed YCbCr planes into mOutput, through the tone table if any
+void MagicBeautify::_writeOutput(){
+	if(mToneTable != NULL)
+		Conversion::YCbCrToRGB(yuvView(), mOutput,
+				ImageView::packed(mSkinMatrix, mImageWidth, mImageHeight, ImageView::FORMAT_GRAY_8), mToneTable);
+	else
+		Conversion::YCbCrToRGB(yuvView(), mOutput);
+}
+
+static void initWhitenCurve(float whitenlevel, bool linear, uint8_t* whiten){
 	float a = log(whitenlevel);
+	for(int i = 0; i < 256; i++){
+		if(a == 0)
+			whiten[i] = i;
+		else if(linear)
+			// decode, curve and encode fused into one table
+			whiten[i] = kLinear12ToSrgb[(int)(4095 * (log(kSrgbToLinear12[i] / 4095.0f * (whitenlevel - 1) + 1) / a) + 0.5f)];
+		else
+			whiten[i] = 255 * (log(kDiv255[i] * (whitenlevel - 1) + 1) / a);
+	}
+}
+
+void MagicBeautify::_startWhiteSkin(float whitenlevel){
+	uint8_t whiten[256];
+	initWhitenCurve(whitenlevel, mLinearActive, whiten);
 	for(int i = 0; i < mImageHeight; i++){
+		uint32_t *out = mOutput.row32(i);
 		for(int j = 0; j < mImageWidth; j++){
 			int offset = i*mImageWidth+j;
 			ARGB RGB;
-			BitmapOperation::convertIntToArgb(mImageData_rgb[offset],&RGB);
-			if(a != 0){
-				RGB.red = 255 * (log(div255(RGB.red) * (whitenlevel - 1) + 1) / a);
-				RGB.green = 255 * (log(div255(RGB.green) * (whitenlevel - 1) + 1) / a);
-				RGB.blue = 255 * (log(div255(RGB.blue) * (whitenlevel - 1) + 1) / a);
+			Conversion::convertIntToArgb(mImageData_rgb[offset],&RGB);
+			RGB.red = whiten[RGB.red];
+			RGB.green = whiten[RGB.green];
+			RGB.blue = whiten[RGB.blue];
+			out[j] = Conversion::convertArgbToInt(RGB);
+		}
+	}
+}
+
+/**
+ * Box mean of the binary skin mask over a (2 * radius + 1)² window, with
+ * the sliding column sums of the streaming engine. Rounded up, so every
+ * pixel of the binary mask keeps a non-zero weight and skin interiors
+ * stay at 255; edges ramp over the window width instead of stepping.
+ */
+static void featherMask(const uint8_t* mask, uint8_t* soft, int width, int height, int radius,
+		uint32_t* columnSum){
+	memset(columnSum, 0, sizeof(uint32_t) * width);
+	int top = 0, bottom = -1;
+	for(int i = 0; i < height; i++){
+		int iMax = i + radius >= height-1 ? height-1 : i + radius;
+		int iMin = i - radius <= 0 ? 0 : i - radius;
+		while(bottom < iMax){
+			const uint8_t *line = mask + (size_t)++bottom * width;
+			for(int j = 0; j < width; j++)
+				columnSum[j] += line[j];
+		}
+		for(; top < iMin; top++){
+			const uint8_t *line = mask + (size_t)top * width;
+			for(int j = 0; j < width; j++)
+				columnSum[j] -= line[j];
+		}
+		int rows = iMax - iMin + 1;
+		uint32_t sum = 0;
+		for(int j = 0; j < radius && j < width; j++)
+			sum += columnSum[j];
+		uint8_t *out = soft + (size_t)i * width;
+		for(int j = 0; j < width; j++){
+			if(j + radius < width)
+				sum += columnSum[j + radius];
+			if(j - radius > 0)
+				sum -= columnSum[j - radius - 1];
+			int jMax = j + radius >= width-1 ? width-1 : j + radius;
+			int jMin = j - radius <= 0 ? 0 : j - radius;
+			uint32_t area = rows * (jMax - jMin + 1);
+			out[j] = (sum + area - 1) / area;
+		}
+	}
+}
+
+/**
+ * Weights and per-row runs of non-zero weight for a whitening mask.
+ * Returns the mask actually prepared: WHITEN_SKIN when the feathered
+ * mask does not fit the memory budget.
+ */
+int MagicBeautify::buildSkinSpans(int mask){
+	if(mask == WHITEN_SKIN_SOFT && mSoftSkin == NULL){
+		int64_t bytes = (int64_t)mImageWidth * mImageHeight;
+		MemoryGovernor* governor = MemoryGovernor::getInstance();
+		if(governor->reserve(MEMORY_OWNER_BEAUTIFY, bytes)){
+			mSoftSkin = new (std::nothrow) uint8_t[bytes];
+			if(mSoftSkin != NULL)
+				mReservedBytes += bytes;
+			else
+				governor->release(MEMORY_OWNER_BEAUTIFY, bytes);
+		}
+		if(mSoftSkin == NULL){
+			LOGE("memory budget too small for a feathered skin mask, whitening by the binary one");
+			mask = WHITEN_SKIN;
+		}
+	}
+	const uint8_t *weights = mSkinMatrix;
+	if(mask == WHITEN_SKIN_SOFT){
+		if(!mSoftSkinValid){
+			int radius = getSmoothRadius() / 2;
+			featherMask(mSkinMatrix, mSoftSkin, mImageWidth, mImageHeight, radius > 1 ? radius : 1,
+					(uint32_t*)mRowScratch);
+			mSoftSkinValid = true;
+		}
+		weights = mSoftSkin;
+	}
+	if(mSpanMask != mask){
+		mSpans.clear();
+		mSpanRows.resize(mImageHeight + 1);
+		for(int i = 0; i < mImageHeight; i++){
+			const uint8_t *line = weights + (size_t)i * mImageWidth;
+			mSpanRows[i] = mSpans.size();
+			for(int j = 0; j < mImageWidth; ){
+				if(line[j] == 0){
+					j++;
+					continue;
+				}
+				mSpans.push_back(j);
+				while(j < mImageWidth && line[j] != 0)
+					j++;
+				mSpans.push_back(j);
+			}
+		}
+		mSpanRows[mImageHeight] = mSpans.size();
+		mSpanMask = mask;
+	}
+	return mask;
+}
+
+/**
+ * Whitening gated by the skin mask: only the runs of skin are visited and
+ * each pixel moves toward its whitened value by the mask weight, so the
+ * cost follows the skin area and the background keeps its exposure.
+ * With onOutput the smoothing result already in mOutput is whitened in
+ * place. Otherwise the source is, and mOutput outside the mask must
+ * still hold the source: that costs one full copy after any pass which
+ * wrote elsewhere, none while the slider moves.
+ */
+void MagicBeautify::_startWhiteSkinMasked(float whitenlevel, bool onOutput){
+	int mask = buildSkinSpans(mWhitenMask);
+	if(!onOutput){
+		// the feathered mask covers the binary one
+		bool clean = mOutputClean == WHITEN_FULL || mOutputClean == mask
+				|| (mOutputClean == WHITEN_SKIN && mask == WHITEN_SKIN_SOFT);
+		if(!clean)
+			PixelCopy::copy(rgbView(), mOutput, 0);
+		mOutputClean = mask;
+	}
+	uint8_t whiten[256];
+	initWhitenCurve(whitenlevel, mLinearActive, whiten);
+	const uint8_t *weights = mask == WHITEN_SKIN_SOFT ? mSoftSkin : mSkinMatrix;
+
+	int bands = ThreadPool::getInstance()->getThreadCount();
+	int rowsPerBand = (mImageHeight + bands - 1) / bands;
+	ThreadPool::getInstance()->parallelFor(bands, [&](int band){
+		int end = (band + 1) * rowsPerBand < mImageHeight ? (band + 1) * rowsPerBand : mImageHeight;
+		for(int i = band * rowsPerBand; i < end; i++){
+			uint32_t *out = mOutput.row32(i);
+			const uint32_t *in = onOutput ? out : mImageData_rgb + (size_t)i * mImageWidth;
+			const uint8_t *weight = weights + (size_t)i * mImageWidth;
+			for(int s = mSpanRows[i]; s < mSpanRows[i+1]; s += 2){
+				for(int j = mSpans[s]; j < mSpans[s+1]; j++){
+					int w = weight[j];
+					ARGB RGB;
+					Conversion::convertIntToArgb(in[j],&RGB);
+					RGB.red += ((whiten[RGB.red] - RGB.red) * w + 127) / 255;
+					RGB.green += ((whiten[RGB.green] - RGB.green) * w + 127) / 255;
+					RGB.blue += ((whiten[RGB.blue] - RGB.blue) * w + 127) / 255;
+					out[j] = Conversion::convertArgbToInt(RGB);
+				}
 			}
-			storedBitmapPixels[offset] = BitmapOperation::convertArgbToInt(RGB);
 		}
+	});
+}
+
+/**
+ * The four corner lookups of each window sit 2 * radius rows apart; the
+ * index functor decides where those rows live (see PlaneLayout). Local
+ * mean and variance are gathered a row at a time and handed to SmoothGain.
+ */
+template <typename Index>
+static void smoothIntegral(const Index& index, const uint64_t* integral, const uint64_t* integralSqr,
+		const uint8_t* skin, uint8_t* yuv, int width, int height, int radius, float smoothlevel,
+		int precision, bool linear, float* mean, float* var){
+	for(int i = 1; i < height; i++){
+		int iMax = i + radius >= height-1 ? height-1 : i + radius;
+		int iMin = i - radius <= 1 ? 1 : i - radius;
+		for(int j = 1; j < width; j++){
+			int offset = i * width + j;
+			if(skin[offset] == 255){
+				int jMax = j + radius >= width-1 ? width-1 :j + radius;
+				int jMin = j - radius <= 1 ? 1 : j - radius;
+
+				int squar = (iMax - iMin + 1)*(jMax - jMin + 1);
+				size_t i4 = index(jMax, iMax);
+				size_t i3 = index(jMin-1, iMin-1);
+				size_t i2 = index(jMin-1, iMax);
+				size_t i1 = index(jMax, iMin-1);
+
+				float m = (integral[i4]
+						+ integral[i3]
+						- integral[i2]
+						- integral[i1]) / squar;
+
+				mean[j] = m;
+				var[j] = (integralSqr[i4]
+						+ integralSqr[i3]
+						- integralSqr[i2]
+						- integralSqr[i1]) / squar - m*m;
+			}else{
+				mean[j] = 0;
+				var[j] = 0;
+			}
+		}
+		if(linear)
+			SmoothGain::applyLinear(mean + 1, var + 1, skin + i * width + 1,
+					yuv + (i * width + 1) * 3, 3, width - 1, smoothlevel);
+		else
+			SmoothGain::apply(precision, mean + 1, var + 1, skin + i * width + 1,
+					yuv + (i * width + 1) * 3, 3, width - 1, smoothlevel);
 	}
 }
 
@@ -110,109 +638,181 @@ void MagicBeautify::_startSkinSmooth(float smoothlevel){
 		LOGE("not init correctly");
 		return;
 	}
-	Conversion::RGBToYCbCr((uint8_t*)mImageData_rgb, mImageData_yuv, mImageWidth * mImageHeight);
-
-	int radius = mImageWidth > mImageHeight ? mImageWidth * 0.02 : mImageHeight * 0.02;
+	Conversion::RGBToYCbCr(rgbView(), yuvView());
+
+	int radius = getSmoothRadius();
+	float level = mLinearActive ? smoothlevel * kLinearLevelScale : smoothlevel;
+	float *mean = (float*)mRowScratch;
+	float *var = mean + mImageWidth;
+	switch(mLayout.mode){
+	case PlaneLayout::LAYOUT_TILED:
+		smoothIntegral(mLayout.tiled(), mIntegralMatrix, mIntegralMatrixSqr, mSkinMatrix, mImageData_yuv,
+				mImageWidth, mImageHeight, radius, level, mPrecision, mLinearActive, mean, var);
+		break;
+	case PlaneLayout::LAYOUT_MORTON:
+		smoothIntegral(mLayout.morton(), mIntegralMatrix, mIntegralMatrixSqr, mSkinMatrix, mImageData_yuv,
+				mImageWidth, mImageHeight, radius, level, mPrecision, mLinearActive, mean, var);
+		break;
+	default:
+		smoothIntegral(mLayout.linear(), mIntegralMatrix, mIntegralMatrixSqr, mSkinMatrix, mImageData_yuv,
+				mImageWidth, mImageHeight, radius, level, mPrecision, mLinearActive, mean, var);
+		break;
+	}
+	_writeOutput();
+}
 
+/**
+ * Same statistics as _startSkinSmooth without the integral images: the
+ * window sums are kept as per-column sums over the rows [iMin, iMax] and
+ * slid down one row at a time. Luma is smoothed in place, so the rows that
+ * leave the window are subtracted from a ring of their original values.
+ */
+void MagicBeautify::_startSkinSmoothStreaming(float smoothlevel){
+	if(mSkinMatrix == NULL){
+		LOGE("not init correctly");
+		return;
+	}
+	Conversion::RGBToYCbCr(rgbView(), yuvView());
+
+	int radius = getSmoothRadius();
+	float level = mLinearActive ? smoothlevel * kLinearLevelScale : smoothlevel;
+	uint16_t decode[256];
+	initLumaDecode(mLinearActive, decode);
+	int ringRows = 2 * radius + 2;
+	// the 8 byte rows first, so every row of the scratch stays aligned
+	uint64_t *columnSumSqr = (uint64_t*)mRowScratch;
+	uint64_t *rowSum = columnSumSqr + mImageWidth;
+	uint64_t *rowSumSqr = rowSum + mImageWidth;
+	uint32_t *columnSum = (uint32_t*)(rowSumSqr + mImageWidth);
+	float *mean = (float*)(columnSum + mImageWidth);
+	float *var = mean + mImageWidth;
+	uint8_t *ring = (uint8_t*)(var + mImageWidth);
+	memset(columnSum, 0, sizeof(uint32_t) * mImageWidth);
+	memset(columnSumSqr, 0, sizeof(uint64_t) * mImageWidth);
+	rowSum[0] = 0;
+	rowSumSqr[0] = 0;
+
+	int top = 1, bottom = 0;
 	for(int i = 1; i < mImageHeight; i++){
+		int iMax = i + radius >= mImageHeight-1 ? mImageHeight-1 : i + radius;
+		int iMin = i - radius <= 1 ? 1 : i - radius;
+		while(bottom < iMax){
+			bottom++;
+			uint8_t *line = ring + (bottom % ringRows) * mImageWidth;
+			for(int j = 0; j < mImageWidth; j++){
+				uint8_t stored = mImageData_yuv[(bottom * mImageWidth + j) * 3];
+				uint32_t y = decode[stored];
+				line[j] = stored;
+				columnSum[j] += y;
+				columnSumSqr[j] += y * y;
+			}
+		}
+		while(top < iMin){
+			uint8_t *line = ring + (top % ringRows) * mImageWidth;
+			for(int j = 0; j < mImageWidth; j++){
+				uint32_t y = decode[line[j]];
+				columnSum[j] -= y;
+				columnSumSqr[j] -= y * y;
+			}
+			top++;
+		}
+		for(int j = 1; j < mImageWidth; j++){
+			rowSum[j] = rowSum[j-1] + columnSum[j];
+			rowSumSqr[j] = rowSumSqr[j-1] + columnSumSqr[j];
+		}
 		for(int j = 1; j < mImageWidth; j++){
 			int offset = i * mImageWidth + j;
 			if(mSkinMatrix[offset] == 255){
-				int iMax = i + radius >= mImageHeight-1 ? mImageHeight-1 : i + radius;
 				int jMax = j + radius >= mImageWidth-1 ? mImageWidth-1 :j + radius;
-				int iMin = i - radius <= 1 ? 1 : i - radius;
 				int jMin = j - radius <= 1 ? 1 : j - radius;
 
 				int squar = (iMax - iMin + 1)*(jMax - jMin + 1);
-				int i4 = iMax*mImageWidth+jMax;
-				int i3 = (iMin-1)*mImageWidth+(jMin-1);
-				int i2 = iMax*mImageWidth+(jMin-1);
-				int i1 = (iMin-1)*mImageWidth+jMax;
-
-				float m = (mIntegralMatrix[i4]
-						+ mIntegralMatrix[i3]
-						- mIntegralMatrix[i2]
-						- mIntegralMatrix[i1]) / squar;
-
-				float v = (mIntegralMatrixSqr[i4]
-						+ mIntegralMatrixSqr[i3]
-						- mIntegralMatrixSqr[i2]
-						- mIntegralMatrixSqr[i1]) / squar - m*m;
-				float k = v / (v + smoothlevel);
-
-				mImageData_yuv[offset * 3] = ceil(m - k * m + k * mImageData_yuv[offset * 3]);
+				float m = (rowSum[jMax] - rowSum[jMin-1]) / squar;
+				mean[j] = m;
+				var[j] = (rowSumSqr[jMax] - rowSumSqr[jMin-1]) / squar - m*m;
+			}else{
+				mean[j] = 0;
+				var[j] = 0;
 			}
 		}
+		if(mLinearActive)
+			SmoothGain::applyLinear(mean + 1, var + 1, mSkinMatrix + i * mImageWidth + 1,
+					mImageData_yuv + (i * mImageWidth + 1) * 3, 3, mImageWidth - 1, level);
+		else
+			SmoothGain::apply(mPrecision, mean + 1, var + 1, mSkinMatrix + i * mImageWidth + 1,
+					mImageData_yuv + (i * mImageWidth + 1) * 3, 3, mImageWidth - 1, level);
 	}
-	Conversion::YCbCrToRGB(mImageData_yuv, (uint8_t*)storedBitmapPixels,
-		mImageWidth * mImageHeight);
+	_writeOutput();
 }
 
 void MagicBeautify::initSkinMatrix(){
 	LOGE("initSkinMatrix");
-	if(mSkinMatrix == NULL)
-		mSkinMatrix = new uint8_t[mImageWidth * mImageHeight];
+	// the skin's mean chroma, read from the YCbCr planes built just before
+	uint64_t skinPixels = 0, sumCb = 0, sumCr = 0;
 	for(int i = 0; i < mImageHeight; i++){
 		for(int j = 0; j < mImageWidth; j++){
 			int offset = i*mImageWidth+j;
 			ARGB RGB;
-			BitmapOperation::convertIntToArgb(mImageData_rgb[offset],&RGB);
+			Conversion::convertIntToArgb(mImageData_rgb[offset],&RGB);
 			if ((RGB.blue>95 && RGB.green>40 && RGB.red>20 &&
 					RGB.blue-RGB.red>15 && RGB.blue-RGB.green>15)||
 					(RGB.blue>200 && RGB.green>210 && RGB.red>170 &&
-					abs(RGB.blue-RGB.red)<=15 && RGB.blue>RGB.red&& RGB.green>RGB.red))
+					abs(RGB.blue-RGB.red)<=15 && RGB.blue>RGB.red&& RGB.green>RGB.red)){
 				mSkinMatrix[offset] = 255;
-			else
+				skinPixels++;
+				sumCb += mImageData_yuv[offset * 3 + 1];
+				sumCr += mImageData_yuv[offset * 3 + 2];
+			}else{
 				mSkinMatrix[offset] = 0;
+			}
+		}
+	}
+	mSkinChroma = skinPixels == 0 ? Conversion::planeChroma(kDefaultSkinChroma)
+			: (int)((sumCb + skinPixels / 2) / skinPixels) << 8 | (int)((sumCr + skinPixels / 2) / skinPixels);
+}
+
+template <typename Index>
+static void buildIntegral(const Index& index, const uint8_t* yuv, const uint16_t* decode, int width, int height,
+		uint64_t* integral, uint64_t* integralSqr, uint64_t* columnSum, uint64_t* columnSumSqr){
+	memset(columnSum, 0, sizeof(uint64_t) * width);
+	memset(columnSumSqr, 0, sizeof(uint64_t) * width);
+
+	for(int i = 0; i < height; i++){
+		uint64_t rowSum = 0, rowSumSqr = 0;
+		const uint8_t *line = yuv + (size_t)i * width * 3;
+		for(int j = 0; j < width; j++){
+			uint32_t y = decode[line[3*j]];
+			columnSum[j] += y;
+			columnSumSqr[j] += y * y;
+			rowSum += columnSum[j];
+			rowSumSqr += columnSumSqr[j];
+
+			size_t k = index(j, i);
+			integral[k] = rowSum;
+			integralSqr[k] = rowSumSqr;
 		}
 	}
 }
 
 void MagicBeautify::initIntegral(){
 	LOGE("initIntegral");
-	if(mIntegralMatrix == NULL)
-		mIntegralMatrix = new uint64_t[mImageWidth * mImageHeight];
-	if(mIntegralMatrixSqr == NULL)
-		mIntegralMatrixSqr = new uint64_t[mImageWidth * mImageHeight];
-
-	uint64_t *columnSum = new uint64_t[mImageWidth];
-	uint64_t *columnSumSqr = new uint64_t[mImageWidth];
-
-	columnSum[0] = mImageData_yuv[0];
-	columnSumSqr[0] = mImageData_yuv[0] * mImageData_yuv[0];
-
-	mIntegralMatrix[0] = columnSum[0];
-	mIntegralMatrixSqr[0] = columnSumSqr[0];
-
-    for(int i = 1;i < mImageWidth;i++){
-
-    	columnSum[i] = mImageData_yuv[3*i];
-    	columnSumSqr[i] = mImageData_yuv[3*i] * mImageData_yuv[3*i];
-
-    	mIntegralMatrix[i] = columnSum[i];
-    	mIntegralMatrix[i] += mIntegralMatrix[i-1];
-    	mIntegralMatrixSqr[i] = columnSumSqr[i];
-    	mIntegralMatrixSqr[i] += mIntegralMatrixSqr[i-1];
-    }
-    for (int i = 1;i < mImageHeight; i++){
-        int offset = i * mImageWidth;
-
-        columnSum[0] += mImageData_yuv[3*offset];
-        columnSumSqr[0] += mImageData_yuv[3*offset] * mImageData_yuv[3*offset];
-
-        mIntegralMatrix[offset] = columnSum[0];
-        mIntegralMatrixSqr[offset] = columnSumSqr[0];
-
-        for(int j = 1; j < mImageWidth; j++){
-        	columnSum[j] += mImageData_yuv[3*(offset+j)];
-        	columnSumSqr[j] += mImageData_yuv[3*(offset+j)] * mImageData_yuv[3*(offset+j)];
-
-        	mIntegralMatrix[offset+j] = mIntegralMatrix[offset+j-1] + columnSum[j];
-        	mIntegralMatrixSqr[offset+j] = mIntegralMatrixSqr[offset+j-1] + columnSumSqr[j];
-        }
-    }
-    delete[] columnSum;
-    delete[] columnSumSqr;
-    LOGE("initIntegral~end");
+	uint16_t decode[256];
+	initLumaDecode(mLinearActive, decode);
+	uint64_t *columnSum = (uint64_t*)mRowScratch;
+	switch(mLayout.mode){
+	case PlaneLayout::LAYOUT_TILED:
+		buildIntegral(mLayout.tiled(), mImageData_yuv, decode, mImageWidth, mImageHeight,
+				mIntegralMatrix, mIntegralMatrixSqr, columnSum, columnSum + mImageWidth);
+		break;
+	case PlaneLayout::LAYOUT_MORTON:
+		buildIntegral(mLayout.morton(), mImageData_yuv, decode, mImageWidth, mImageHeight,
+				mIntegralMatrix, mIntegralMatrixSqr, columnSum, columnSum + mImageWidth);
+		break;
+	default:
+		buildIntegral(mLayout.linear(), mImageData_yuv, decode, mImageWidth, mImageHeight,
+				mIntegralMatrix, mIntegralMatrixSqr, columnSum, columnSum + mImageWidth);
+		break;
+	}
+	LOGE("initIntegral~end");
 }
 
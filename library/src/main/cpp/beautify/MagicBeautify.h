@@ -1,13 +1,65 @@
 #ifndef _MAGIC_BEAUTIFY_H_
 #define _MAGIC_BEAUTIFY_H_
 
-#include "../bitmap/JniBitmap.h"
+#include <vector>
+#include "../bitmap/ImageView.h"
+#include "../utils/PlaneLayout.h"
+#include "../bitmap/LookTable.h"
+#include "GainMap.h"
+#include "ResultCache.h"
+#include "SkinTone.h"
 
 class MagicBeautify
 {
 public:
-	void initMagicBeautify(JniBitmap* jniBitmap);
+	// full integral images for the local statistics, 24 bytes per pixel
+	static const int ENGINE_INTEGRAL = 0;
+	// sliding column sums over a ring of luma rows, 8 bytes per pixel
+	static const int ENGINE_STREAMING = 1;
+
+	// whitening over the whole frame, backgrounds included
+	static const int WHITEN_FULL = 0;
+	// only where the skin mask is set, other pixels keep their exposure
+	static const int WHITEN_SKIN = 1;
+	// blended by a feathered skin mask, so skin edges fade out
+	static const int WHITEN_SKIN_SOFT = 2;
+
+	// false when the memory budget cannot hold even the streaming engine;
+	// results are written back into the image, which may be a crop.
+	// contentHash is the image's ContentHash when the caller knows it: the
+	// same pixels as the last image keep its skin mask and integral images.
+	bool initMagicBeautify(const ImageView& image, uint64_t contentHash = 0);
 	void unInitMagicBeautify();
+	int getEngine();
+	int getImageWidth();
+	int getImageHeight();
+	// PlaneLayout::LAYOUT_* for the integral images, applied by the next init
+	void setPlaneLayout(int layout);
+	int getPlaneLayout();
+	// SmoothGain::PRECISION_*, FP32 by default; false and unchanged when the CPU lacks it
+	bool setSmoothPrecision(int precision);
+	int getSmoothPrecision();
+	// smoothing blend and whitening in linear light rather than on sRGB
+	// values, through 12-bit LUTs; applied by the next init
+	void setLinearLight(bool linear);
+	bool getLinearLight();
+	// not owned, NULL drops the look; with protectSkin the skin mask blends
+	// toward the look's skin-safe variant. Re-renders the stored bitmap.
+	void setLook(const LookTable* look, bool protectSkin);
+	// bytes of finished renders kept by source content and settings, 0 turns
+	// the result cache off
+	void setResultCacheLimit(int64_t bytes);
+	// skin tone unification inside the skin mask, strength 0..1 toward a
+	// true JFIF Cb << 8 | Cr target or SkinTone::AUTO_TARGET; applied by the next
+	// render, in the smoothing's YCbCr pass when smoothing is on
+	void setSkinTone(float strength, int target);
+	// WHITEN_*, applied by the next startWhiteSkin
+	void setWhitenMask(int mask);
+	int getWhitenMask();
+
+	// the smoothing statistics of the stored image at the last smoothing
+	// level as a GainMap, 1/scale of the image size
+	bool exportGainMap(int scale, int depth, uint8_t* out, int stride);
 
     void startSkinSmooth(float smoothlevel);
     void startWhiteSkin(float whitenlevel);
@@ -22,7 +74,7 @@ private:
     uint64_t *mIntegralMatrix;
 	uint64_t *mIntegralMatrixSqr;
 
-	uint32_t *storedBitmapPixels;
+	ImageView mOutput;
 	uint32_t *mImageData_rgb;
 
 	uint8_t *mImageData_yuv;
@@ -32,13 +84,64 @@ private:
 	int mImageHeight;
 	float mSmoothLevel;
 	float mWhitenLevel;
-	
+
+	int mEngine;
+	int64_t mReservedBytes;
+	int mPlaneLayout;
+	PlaneLayout mLayout;
+	int mPrecision;
+	bool mLinearLight;
+	// mLinearLight as of the last init, which the integral images were built with
+	bool mLinearActive;
+	const LookTable* mLook;
+	bool mProtectSkin;
+	int mWhitenMask;
+	// feathered mSkinMatrix for WHITEN_SKIN_SOFT, built on first use
+	uint8_t *mSoftSkin;
+	bool mSoftSkinValid;
+	// a row of YCbCr per pool thread for _applySkinTone
+	uint8_t *mToneScratch;
+	// the row sums and statistics of the integral build, the smoothing
+	// and the feathering, sized for mEngine by reserveBuffers
+	uint8_t *mRowScratch;
+	// runs of non-zero weight per row as [start, end) pairs, rows i in
+	// [mSpanRows[i], mSpanRows[i+1]); built for the mask in mSpanMask
+	std::vector<int> mSpans;
+	std::vector<int> mSpanRows;
+	int mSpanMask;
+	// WHITEN_FULL while mOutput holds the source everywhere, a skin mask
+	// while it does outside that mask, -1 once other pixels were written
+	int mOutputClean;
+	GainMap mGainMap;
+	SkinTone mSkinTone;
+	// mean plane Cb << 8 | Cr under mSkinMatrix, the AUTO_TARGET of the tone
+	int mSkinChroma;
+	// the tone table for the render in progress, NULL without one
+	const uint16_t* mToneTable;
+	// ContentHash of mImageData_rgb, 0 before the first init
+	uint64_t mSourceHash;
+	ResultCache mResults;
+
+	ImageView rgbView() { return ImageView::packed(mImageData_rgb, mImageWidth, mImageHeight, ImageView::FORMAT_RGBA_8888); }
+	ImageView yuvView() { return ImageView::packed(mImageData_yuv, mImageWidth, mImageHeight, ImageView::FORMAT_YCBCR_888); }
+
+	bool reserveBuffers();
+	void releaseBuffers();
+	int getSmoothRadius();
+
 	void initIntegral();
 	
 	void initSkinMatrix();
+	int buildSkinSpans(int mask);
 
+	ResultKey resultKey(bool smoothed, bool whitened, bool looked, bool toned);
 	void _startBeauty(float smoothlevel, float whitenlevel);
 	void _startSkinSmooth(float smoothlevel);
+	void _startSkinSmoothStreaming(float smoothlevel);
 	void _startWhiteSkin(float whitenlevel);
+	void _startWhiteSkinMasked(float whitenlevel, bool onOutput);
+	void _applyLook();
+	void _applySkinTone();
+	void _writeOutput();
 };
 #endif
@@ -0,0 +1,117 @@
+#include "ResultCache.h"
+#include <new>
+#include "../bitmap/PixelCopy.h"
+#include "../utils/MemoryGovernor.h"
+
+ResultCache::ResultCache()
+{
+	mBytes = 0;
+	mLimit = DEFAULT_LIMIT;
+	mEvictor = MemoryGovernor::getInstance()->registerEvictor([this](int64_t bytesNeeded) {
+		std::lock_guard<std::mutex> lock(mLock);
+		return trim(mBytes > bytesNeeded ? mBytes - bytesNeeded : 0);
+	});
+}
+
+ResultCache::~ResultCache()
+{
+	MemoryGovernor::getInstance()->unregisterEvictor(mEvictor);
+	clear();
+}
+
+void ResultCache::setLimit(int64_t bytes)
+{
+	std::lock_guard<std::mutex> lock(mLock);
+	mLimit = bytes > 0 ? bytes : 0;
+	trim(mLimit);
+}
+
+int64_t ResultCache::getLimit()
+{
+	std::lock_guard<std::mutex> lock(mLock);
+	return mLimit;
+}
+
+void ResultCache::clear()
+{
+	std::lock_guard<std::mutex> lock(mLock);
+	trim(0);
+}
+
+bool ResultCache::sameKey(const ResultKey& a, const ResultKey& b)
+{
+	return a.source == b.source && a.look == b.look && a.width == b.width && a.height == b.height
+			&& a.smoothLevel == b.smoothLevel && a.whitenLevel == b.whitenLevel && a.whitenMask == b.whitenMask
+			&& a.engine == b.engine && a.precision == b.precision && a.toneStrength == b.toneStrength
+			&& a.toneTarget == b.toneTarget && a.linearLight == b.linearLight && a.protectSkin == b.protectSkin;
+}
+
+int64_t ResultCache::entryBytes(const Entry& entry)
+{
+	return (int64_t) entry.key.width * entry.key.height * 4;
+}
+
+int64_t ResultCache::trim(int64_t bytes)
+{
+	int64_t freed = 0;
+	while (mBytes > bytes && !mEntries.empty()) {
+		int64_t size = entryBytes(mEntries.back());
+		mEntries.pop_back();
+		mBytes -= size;
+		freed += size;
+	}
+	return freed;
+}
+
+bool ResultCache::find(const ResultKey& key, const ImageView& out)
+{
+	std::shared_ptr<uint32_t> pixels;
+	{
+		std::lock_guard<std::mutex> lock(mLock);
+		for (std::list<Entry>::iterator it = mEntries.begin(); it != mEntries.end(); ++it) {
+			if (sameKey(it->key, key)) {
+				mEntries.splice(mEntries.begin(), mEntries, it);
+				pixels = it->pixels;
+				break;
+			}
+		}
+	}
+	if (!pixels)
+		return false;
+	PixelCopy::copy(ImageView::packed(pixels.get(), key.width, key.height, ImageView::FORMAT_RGBA_8888), out, 0);
+	return true;
+}
+
+void ResultCache::store(const ResultKey& key, const ImageView& image)
+{
+	int64_t bytes = (int64_t) key.width * key.height * 4;
+	if (bytes <= 0 || bytes > getLimit() || image.width != key.width || image.height != key.height)
+		return;
+	// reserved without the lock held: the governor may call back into trim()
+	if (!MemoryGovernor::getInstance()->reserve(MEMORY_OWNER_CACHE, bytes))
+		return;
+	uint32_t* copy = new (std::nothrow) uint32_t[(size_t) key.width * key.height];
+	if (copy == NULL) {
+		MemoryGovernor::getInstance()->release(MEMORY_OWNER_CACHE, bytes);
+		return;
+	}
+	PixelCopy::copy(image, ImageView::packed(copy, key.width, key.height, ImageView::FORMAT_RGBA_8888), 0);
+	Entry entry;
+	entry.key = key;
+	entry.pixels = std::shared_ptr<uint32_t>(copy, [bytes](uint32_t* pixels) {
+		delete[] pixels;
+		MemoryGovernor::getInstance()->release(MEMORY_OWNER_CACHE, bytes);
+	});
+
+	std::lock_guard<std::mutex> lock(mLock);
+	for (std::list<Entry>::iterator it = mEntries.begin(); it != mEntries.end(); ++it) {
+		if (sameKey(it->key, key)) {
+			mBytes -= entryBytes(*it);
+			mEntries.erase(it);
+			break;
+		}
+	}
+	mEntries.push_front(entry);
+	mBytes += bytes;
+	trim(mLimit);
+}
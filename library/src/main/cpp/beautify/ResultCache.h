@@ -0,0 +1,73 @@
+#ifndef _RESULT_CACHE_H_
+#define _RESULT_CACHE_H_
+
+#include <stdint.h>
+#include <list>
+#include <memory>
+#include <mutex>
+#include "../bitmap/ImageView.h"
+
+// everything a beautify render depends on; unused settings are 0
+typedef struct
+{
+	// ContentHash of the source image and of the look table
+	uint64_t source;
+	uint64_t look;
+	int32_t width;
+	int32_t height;
+	float smoothLevel;
+	float whitenLevel;
+	int32_t whitenMask;
+	int32_t engine;
+	int32_t precision;
+	float toneStrength;
+	int32_t toneTarget;
+	bool linearLight;
+	bool protectSkin;
+} ResultKey;
+
+/**
+ * Finished RGBA renders by source content and settings, least recently
+ * used first out, so exporting the same photo again, or going back to a
+ * look already tried, is one copy instead of a render. Entries are
+ * charged to MEMORY_OWNER_CACHE and given back to the MemoryGovernor
+ * whenever another owner needs the room.
+ */
+class ResultCache
+{
+public:
+	static const int64_t DEFAULT_LIMIT = (int64_t) 64 << 20;
+
+	ResultCache();
+	~ResultCache();
+
+	// bytes of renders kept, 0 turns the cache off
+	void setLimit(int64_t bytes);
+	int64_t getLimit();
+
+	// copies the render into out, which has the key's size
+	bool find(const ResultKey& key, const ImageView& out);
+	void store(const ResultKey& key, const ImageView& image);
+	void clear();
+
+private:
+	typedef struct
+	{
+		ResultKey key;
+		// shared with find() copies in flight, which run without the lock
+		std::shared_ptr<uint32_t> pixels;
+	} Entry;
+
+	static bool sameKey(const ResultKey& a, const ResultKey& b);
+	static int64_t entryBytes(const Entry& entry);
+	// drops the oldest entries until at most bytes are held; the bytes freed
+	int64_t trim(int64_t bytes);
+
+	std::mutex mLock;
+	// most recently used first
+	std::list<Entry> mEntries;
+	int64_t mBytes;
+	int64_t mLimit;
+	int mEvictor;
+};
+#endif
@@ -0,0 +1,79 @@
+#include "SkinTone.h"
+#include <math.h>
+#include <stdio.h>
+#include <new>
+#include "../utils/MemoryGovernor.h"
+#include "../utils/MagicLog.h"
+
+#define  LOG_TAG    "SkinTone"
+
+static const int kEntries = 256 * 256;
+
+SkinTone::SkinTone(int owner)
+{
+	mOwner = owner;
+	mStrength = 0;
+	mTarget = AUTO_TARGET;
+	mTable = NULL;
+	mBuiltStrength = 0;
+	mBuiltTarget = AUTO_TARGET;
+}
+
+SkinTone::~SkinTone()
+{
+	release();
+}
+
+void SkinTone::set(float strength, int target)
+{
+	mStrength = strength < 0 ? 0 : strength > 1 ? 1 : strength;
+	mTarget = target >= 0 && target < kEntries ? target : AUTO_TARGET;
+}
+
+void SkinTone::release()
+{
+	if (mTable == NULL)
+		return;
+	delete[] mTable;
+	mTable = NULL;
+	MemoryGovernor::getInstance()->release(mOwner, sizeof(uint16_t) * kEntries);
+}
+
+static inline int clampByte(int v)
+{
+	return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+const uint16_t* SkinTone::prepare(int autoTarget)
+{
+	int target = mTarget == AUTO_TARGET ? autoTarget : mTarget;
+	if (mTable != NULL && mBuiltStrength == mStrength && mBuiltTarget == target)
+		return mTable;
+	if (mTable == NULL) {
+		if (!MemoryGovernor::getInstance()->reserve(mOwner, sizeof(uint16_t) * kEntries)) {
+			LOGE("memory budget too small for the skin tone table");
+			return NULL;
+		}
+		mTable = new (std::nothrow) uint16_t[kEntries];
+		if (mTable == NULL) {
+			MemoryGovernor::getInstance()->release(mOwner, sizeof(uint16_t) * kEntries);
+			return NULL;
+		}
+	}
+	int targetCb = target >> 8, targetCr = target & 0xff;
+	float falloff = -1.0f / (2 * SPREAD * SPREAD);
+	for (int cb = 0; cb < 256; cb++) {
+		uint16_t* row = mTable + (cb << 8);
+		float dcb = (float) (targetCb - cb);
+		for (int cr = 0; cr < 256; cr++) {
+			float dcr = (float) (targetCr - cr);
+			float pull = mStrength * expf((dcb * dcb + dcr * dcr) * falloff);
+			int outCb = clampByte(cb + (int) lrintf(dcb * pull));
+			int outCr = clampByte(cr + (int) lrintf(dcr * pull));
+			row[cr] = (uint16_t) (outCr << 8 | outCb);
+		}
+	}
+	mBuiltStrength = mStrength;
+	mBuiltTarget = target;
+	return mTable;
+}
@@ -0,0 +1,56 @@
+#ifndef _SKIN_TONE_H_
+#define _SKIN_TONE_H_
+
+#include <stdint.h>
+
+/**
+ * Skin tone unification: a 256x256 table from a pixel's Cb/Cr to the
+ * chroma it takes, so blotchy redness and sallow patches converge on one
+ * tone while luma, and with it the texture, is left alone. A chroma at
+ * distance d from the target moves toward it by
+ *
+ *   strength * exp(-d² / (2 * SPREAD²))
+ *
+ * of the way: the tones around the target are pulled in, while colours
+ * far from it, such as lips, eyes and whatever the skin mask mistakes for
+ * skin, barely move. For strength <= 1 the mapping stays monotonic along
+ * every ray from the target, so neighbouring tones never swap order.
+ *
+ * Entries are Cb in the low byte and Cr in the high one, indexed by
+ * Cb << 8 | Cr; Conversion::YCbCrToRGB applies them inside a mask. All
+ * chroma here is as the planes hold it: see Conversion::planeChroma.
+ */
+class SkinTone
+{
+public:
+	// the mean chroma of the image's skin mask
+	static const int AUTO_TARGET = -1;
+	// chroma distance, in 8-bit steps, at which the pull falls to 61%
+	static const int SPREAD = 20;
+
+	// scratch is charged to this MemoryGovernor owner
+	SkinTone(int owner);
+	~SkinTone();
+
+	// strength 0..1, 0 turns it off; target is Cb << 8 | Cr or AUTO_TARGET
+	void set(float strength, int target);
+	float getStrength() const { return mStrength; }
+	int getTarget() const { return mTarget; }
+	bool isActive() const { return mStrength > 0; }
+
+	// the table for the current settings, pulling toward autoTarget when
+	// the target is AUTO_TARGET; rebuilt only when that changed. NULL when
+	// the memory budget cannot hold it.
+	const uint16_t* prepare(int autoTarget);
+	void release();
+
+private:
+	int mOwner;
+	float mStrength;
+	int mTarget;
+	uint16_t* mTable;
+	// what mTable was built for
+	float mBuiltStrength;
+	int mBuiltTarget;
+};
+#endif
@@ -0,0 +1,45 @@
+#include "SmoothGain.h"
+#include "math.h"
+#include "../utils/CpuFeatures.h"
+#include "../utils/MagicTables.h"
+
+bool SmoothGain::isSupported(int precision)
+{
+	if (precision == PRECISION_FP16)
+		return fp16Compiled() && CpuFeatures::hasFp16Arithmetic();
+	return precision == PRECISION_FP32;
+}
+
+void SmoothGain::apply(int precision, const float* mean, const float* var, const uint8_t* skin,
+		uint8_t* luma, int step, int count, float level)
+{
+	if (precision == PRECISION_FP16)
+		applyFp16(mean, var, skin, luma, step, count, level);
+	else
+		applyFp32(mean, var, skin, luma, step, count, level);
+}
+
+void SmoothGain::applyFp32(const float* mean, const float* var, const uint8_t* skin,
+		uint8_t* luma, int step, int count, float level)
+{
+	for (int j = 0; j < count; j++) {
+		if (skin[j] == 255) {
+			float m = mean[j];
+			float k = var[j] / (var[j] + level);
+			luma[j * step] = ceil(m - k * m + k * luma[j * step]);
+		}
+	}
+}
+
+void SmoothGain::applyLinear(const float* mean, const float* var, const uint8_t* skin,
+		uint8_t* luma, int step, int count, float level)
+{
+	for (int j = 0; j < count; j++) {
+		if (skin[j] == 255) {
+			float m = mean[j];
+			float k = var[j] / (var[j] + level);
+			int y = ceil(m - k * m + k * kSrgbToLinear12[luma[j * step]]);
+			luma[j * step] = kLinear12ToSrgb[y < 0 ? 0 : y > 4095 ? 4095 : y];
+		}
+	}
+}
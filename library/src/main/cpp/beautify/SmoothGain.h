@@ -0,0 +1,48 @@
+#ifndef _SMOOTH_GAIN_H_
+#define _SMOOTH_GAIN_H_
+
+#include <stdint.h>
+
+/**
+ * Gain and blend step of the skin smoothing filter, one row at a time:
+ *
+ *   k = v / (v + level),  y' = ceil(m - k * m + k * y)
+ *
+ * for every pixel whose skin mask is 255, where m and v are the local mean
+ * and variance of luma. Luma samples are step bytes apart: 3 for the
+ * interleaved YCbCr planes of MagicBeautify, 1 for planar preview frames.
+ *
+ * FP16 runs the divide and blend on 8 half precision lanes per instruction
+ * on CPUs with asimdhp; it is built into its own translation unit for
+ * ARMv8.2 and only called after a runtime check. Results may differ from
+ * FP32 by one luma level, so it is opt-in and every caller starts on FP32.
+ * mean and var are one row of fp32 scratch either way and are narrowed in
+ * registers: the gain is in lanes per instruction, not in memory.
+ *
+ * applyLinear() is the linear light variant: luma is decoded to 12-bit
+ * linear through a table for the blend and encoded back the same way, and
+ * mean, var and level are in 12-bit linear units. It is FP32 only, as
+ * 12-bit variances are beyond half precision range.
+ */
+class SmoothGain
+{
+public:
+	static const int PRECISION_FP32 = 0;
+	static const int PRECISION_FP16 = 1;
+
+	static bool isSupported(int precision);
+
+	static void apply(int precision, const float* mean, const float* var, const uint8_t* skin,
+			uint8_t* luma, int step, int count, float level);
+
+	static void applyFp32(const float* mean, const float* var, const uint8_t* skin,
+			uint8_t* luma, int step, int count, float level);
+	// falls back to FP32 when the library was built without ARMv8.2 FP16 support
+	static void applyFp16(const float* mean, const float* var, const uint8_t* skin,
+			uint8_t* luma, int step, int count, float level);
+	static bool fp16Compiled();
+
+	static void applyLinear(const float* mean, const float* var, const uint8_t* skin,
+			uint8_t* luma, int step, int count, float level);
+};
+#endif
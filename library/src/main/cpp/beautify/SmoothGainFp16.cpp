@@ -0,0 +1,69 @@
+#include "SmoothGain.h"
+
+/*
+ * Built with -march=armv8.2-a+fp16 on arm64 (see CMakeLists.txt); nothing
+ * in here may run before SmoothGain::isSupported() has checked the CPU.
+ */
+#if defined(__aarch64__) && defined(__ARM_FEATURE_FP16_VECTOR_ARITHMETIC)
+#include <arm_neon.h>
+
+// variance reaches 255 * 255 / 4 and v + level would overflow half range,
+// so both are scaled down; k is a ratio and does not change
+static const float kVarScale = 1.0f / 256;
+
+bool SmoothGain::fp16Compiled()
+{
+	return true;
+}
+
+// m + k * (y - m) on 8 lanes, rounded up like ceil()
+static inline uint8x8_t blend8(const float* mean, const float* var, uint8x8_t luma, float16x8_t scaledLevel)
+{
+	float16x8_t m = vcombine_f16(vcvt_f16_f32(vld1q_f32(mean)), vcvt_f16_f32(vld1q_f32(mean + 4)));
+	float16x8_t v = vcombine_f16(vcvt_f16_f32(vmulq_n_f32(vld1q_f32(var), kVarScale)),
+			vcvt_f16_f32(vmulq_n_f32(vld1q_f32(var + 4), kVarScale)));
+	float16x8_t y = vcvtq_f16_u16(vmovl_u8(luma));
+	float16x8_t k = vdivq_f16(v, vaddq_f16(v, scaledLevel));
+	return vqmovn_u16(vcvtpq_u16_f16(vfmaq_f16(m, k, vsubq_f16(y, m))));
+}
+
+void SmoothGain::applyFp16(const float* mean, const float* var, const uint8_t* skin,
+		uint8_t* luma, int step, int count, float level)
+{
+	if (step != 1 && step != 3) {
+		applyFp32(mean, var, skin, luma, step, count, level);
+		return;
+	}
+	const float16x8_t scaledLevel = vdupq_n_f16((float16_t) (level * kVarScale));
+	const uint8x8_t skinValue = vdup_n_u8(255);
+	int j = 0;
+	for (; j + 8 <= count; j += 8) {
+		uint8x8_t mask = vceq_u8(vld1_u8(skin + j), skinValue);
+		if (vget_lane_u64(vreinterpret_u64_u8(mask), 0) == 0)
+			continue;
+		if (step == 3) {
+			uint8x8x3_t pixels = vld3_u8(luma + j * 3);
+			pixels.val[0] = vbsl_u8(mask, blend8(mean + j, var + j, pixels.val[0], scaledLevel), pixels.val[0]);
+			vst3_u8(luma + j * 3, pixels);
+		} else {
+			uint8x8_t pixels = vld1_u8(luma + j);
+			vst1_u8(luma + j, vbsl_u8(mask, blend8(mean + j, var + j, pixels, scaledLevel), pixels));
+		}
+	}
+	applyFp32(mean + j, var + j, skin + j, luma + j * step, step, count - j, level);
+}
+
+#else
+
+bool SmoothGain::fp16Compiled()
+{
+	return false;
+}
+
+void SmoothGain::applyFp16(const float* mean, const float* var, const uint8_t* skin,
+		uint8_t* luma, int step, int count, float level)
+{
+	applyFp32(mean, var, skin, luma, step, count, level);
+}
+
+#endif
@@ -0,0 +1,815 @@
+/**
+ * Native kernel benchmark.
+ *
+ * usage: MagicBench [width] [height] [iterations] [frame.mfd]
+ *
+ * Runs every registered kernel/variant on a synthetic image, or on a frame
+ * dumped by EglSurfaceBase.saveFrame when a .mfd file is given, and reports
+ * wall time together with hardware counters (when perf_event_open is
+ * permitted): IPC, L1D/LLC misses per pixel, branch misses, DRAM bytes
+ * per pixel and bandwidth, and a roofline position against the peak
+ * bandwidth and instruction rate measured on this machine.
+ *
+ * Run on a device with: adb shell /data/local/tmp/MagicBench 4000 3000 5
+ * Counters need perf_event_paranoid <= 2 (setprop security.perf_harden 0).
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include "PerfCounters.h"
+#include "../bitmap/Compositor.h"
+#include "../bitmap/ContentHash.h"
+#include "../bitmap/Conversion.h"
+#include "../bitmap/HealingBrush.h"
+#include "../bitmap/HslMixer.h"
+#include "../bitmap/LookTable.h"
+#include "../bitmap/PixelCopy.h"
+#include "../beautify/MagicBeautify.h"
+#include "../beautify/SmoothGain.h"
+#include "../utils/MemoryGovernor.h"
+#include "../dump/FrameDump.h"
+#include "../video/Stabilizer.h"
+#include "../video/TemporalDenoiser.h"
+
+#define CACHE_LINE_BYTES 64
+
+typedef struct
+{
+	int width;
+	int height;
+	uint32_t* rgba;
+	uint8_t* yuv;
+	// the beautify target, rewritten from rgba by the setups
+	uint32_t* bitmap;
+	// integral-sized planes for the layout conversions
+	uint64_t* plane;
+	uint64_t* tiledPlane;
+} BenchContext;
+
+typedef struct
+{
+	const char* name;
+	const char* variant;
+	// bytes a perfectly streaming implementation moves per pixel
+	int nominalBytesPerPixel;
+	void (*setup)(BenchContext* ctx);
+	void (*run)(BenchContext* ctx);
+} BenchKernel;
+
+typedef struct
+{
+	double bandwidth;	// bytes per second
+	double instructionRate;	// instructions per second, 0 when unknown
+} MachinePeaks;
+
+static void fillSynthetic(uint32_t* pixels, int width, int height)
+{
+	uint32_t seed = 0x12345678;
+	for (int i = 0; i < height; i++) {
+		for (int j = 0; j < width; j++) {
+			seed = seed * 1664525 + 1013904223;
+			int noise = (seed >> 24) & 0x0f;
+			// left half skin-like tones so the skin mask is populated, right half background
+			uint8_t r, g, b;
+			if (j < width / 2) {
+				r = 120 + noise; g = 150 + noise; b = 210 + noise;
+			} else {
+				r = (uint8_t) (i * 255 / height); g = (uint8_t) (j * 255 / width); b = 60 + noise;
+			}
+			pixels[i * width + j] = 0xff000000u | (r << 16) | (g << 8) | b;
+		}
+	}
+}
+
+static ImageView bitmapView(BenchContext* ctx)
+{
+	return ImageView::packed(ctx->bitmap, ctx->width, ctx->height, ImageView::FORMAT_RGBA_8888);
+}
+
+static void setupNone(BenchContext*)
+{
+}
+
+// every iteration renders; the cached variants turn the result cache back on
+static void setupBeautify(BenchContext* ctx)
+{
+	memcpy(ctx->bitmap, ctx->rgba, sizeof(uint32_t) * ctx->width * ctx->height);
+	MagicBeautify::getInstance()->setResultCacheLimit(0);
+	MagicBeautify::getInstance()->initMagicBeautify(bitmapView(ctx));
+}
+
+// a budget too small for the integral images forces the streaming engine
+static void setupBeautifyStreaming(BenchContext* ctx)
+{
+	MemoryGovernor* governor = MemoryGovernor::getInstance();
+	int64_t budget = governor->getBudget();
+	if (MagicBeautify::getInstance()->getEngine() != MagicBeautify::ENGINE_STREAMING) {
+		MagicBeautify::getInstance()->unInitMagicBeautify();
+		governor->setBudget(governor->getTotalUsage() + (int64_t) ctx->width * ctx->height * 12);
+	}
+	setupBeautify(ctx);
+	governor->setBudget(budget);
+}
+
+static void useLayout(int layout)
+{
+	if (MagicBeautify::getInstance()->getEngine() != MagicBeautify::ENGINE_INTEGRAL)
+		MagicBeautify::getInstance()->unInitMagicBeautify();
+	MagicBeautify::getInstance()->setPlaneLayout(layout);
+	MagicBeautify::getInstance()->setSmoothPrecision(SmoothGain::PRECISION_FP32);
+	MagicBeautify::getInstance()->setLinearLight(false);
+	MagicBeautify::getInstance()->setWhitenMask(MagicBeautify::WHITEN_FULL);
+	MagicBeautify::getInstance()->setSkinTone(0, SkinTone::AUTO_TARGET);
+}
+
+static void setupLinear(BenchContext*)
+{
+	useLayout(PlaneLayout::LAYOUT_LINEAR);
+}
+
+static void setupTiled(BenchContext*)
+{
+	useLayout(PlaneLayout::LAYOUT_TILED);
+}
+
+static void setupMorton(BenchContext*)
+{
+	useLayout(PlaneLayout::LAYOUT_MORTON);
+}
+
+// linear plane layout, linear light processing
+static void setupLinearLight(BenchContext*)
+{
+	useLayout(PlaneLayout::LAYOUT_LINEAR);
+	MagicBeautify::getInstance()->setLinearLight(true);
+}
+
+static void setupBeautifyLinear(BenchContext* ctx)
+{
+	setupLinear(ctx);
+	setupBeautify(ctx);
+}
+
+static void setupBeautifyFp16(BenchContext* ctx)
+{
+	setupLinear(ctx);
+	MagicBeautify::getInstance()->setSmoothPrecision(SmoothGain::PRECISION_FP16);
+	setupBeautify(ctx);
+}
+
+static void setupBeautifyLinearLight(BenchContext* ctx)
+{
+	setupLinearLight(ctx);
+	setupBeautify(ctx);
+}
+
+// startWhiteSkin also renders the smoothing level an earlier row left
+// behind; a fresh instance times the whitening alone
+static void setupBeautifyWhiten(BenchContext* ctx)
+{
+	MagicBeautify::getInstance()->unInitMagicBeautify();
+	setupBeautifyLinear(ctx);
+}
+
+static void setupBeautifyWhitenLinearLight(BenchContext* ctx)
+{
+	MagicBeautify::getInstance()->unInitMagicBeautify();
+	setupBeautifyLinearLight(ctx);
+}
+
+static void setupBeautifySkinWhiten(BenchContext* ctx)
+{
+	setupBeautifyWhiten(ctx);
+	MagicBeautify::getInstance()->setWhitenMask(MagicBeautify::WHITEN_SKIN);
+}
+
+static void setupBeautifySoftSkinWhiten(BenchContext* ctx)
+{
+	setupBeautifyWhiten(ctx);
+	MagicBeautify::getInstance()->setWhitenMask(MagicBeautify::WHITEN_SKIN_SOFT);
+}
+
+static void setupBeautifySkinTone(BenchContext* ctx)
+{
+	setupBeautifyLinear(ctx);
+	MagicBeautify::getInstance()->setSkinTone(0.6f, SkinTone::AUTO_TARGET);
+}
+
+// the first run renders into the cache, the timed ones copy out of it
+static void setupBeautifyCached(BenchContext* ctx)
+{
+	setupBeautifyLinear(ctx);
+	MagicBeautify::getInstance()->setResultCacheLimit(ResultCache::DEFAULT_LIMIT);
+	MagicBeautify::getInstance()->startSkinSmooth(10 + 5 * 5 * 5);
+}
+
+static void setupBeautifyTiled(BenchContext* ctx)
+{
+	setupTiled(ctx);
+	setupBeautify(ctx);
+}
+
+static void setupBeautifyMorton(BenchContext* ctx)
+{
+	setupMorton(ctx);
+	setupBeautify(ctx);
+}
+
+static void runRGBToYCbCr(BenchContext* ctx)
+{
+	Conversion::RGBToYCbCr(ImageView::packed(ctx->rgba, ctx->width, ctx->height, ImageView::FORMAT_RGBA_8888),
+			ImageView::packed(ctx->yuv, ctx->width, ctx->height, ImageView::FORMAT_YCBCR_888));
+}
+
+static void runYCbCrToRGB(BenchContext* ctx)
+{
+	Conversion::YCbCrToRGB(ImageView::packed(ctx->yuv, ctx->width, ctx->height, ImageView::FORMAT_YCBCR_888),
+			bitmapView(ctx));
+}
+
+static void runCopy(BenchContext* ctx)
+{
+	PixelCopy::copy(ctx->rgba, ctx->width * 4, ctx->bitmap, ctx->width * 4,
+			ctx->width, ctx->height, 0);
+}
+
+static void runCopyStream(BenchContext* ctx)
+{
+	PixelCopy::copy(ctx->rgba, ctx->width * 4, ctx->bitmap, ctx->width * 4,
+			ctx->width, ctx->height, PixelCopy::STREAM);
+}
+
+static void runHashCopy(BenchContext* ctx)
+{
+	ContentHash::copy(ImageView::packed(ctx->rgba, ctx->width, ctx->height, ImageView::FORMAT_RGBA_8888),
+			bitmapView(ctx));
+}
+
+static void runHashCopyStream(BenchContext* ctx)
+{
+	ContentHash::copy(ImageView::packed(ctx->rgba, ctx->width, ctx->height, ImageView::FORMAT_RGBA_8888),
+			bitmapView(ctx), PixelCopy::STREAM);
+}
+
+static void runCopySwizzle(BenchContext* ctx)
+{
+	PixelCopy::copy(ctx->rgba, ctx->width * 4, ctx->bitmap, ctx->width * 4,
+			ctx->width, ctx->height, PixelCopy::SWAP_RB | PixelCopy::FILL_ALPHA | PixelCopy::STREAM);
+}
+
+static void runToTiled(BenchContext* ctx)
+{
+	PlaneLayout(PlaneLayout::LAYOUT_TILED, ctx->width, ctx->height).fromLinear(ctx->plane, ctx->width, ctx->tiledPlane);
+}
+
+static void runToMorton(BenchContext* ctx)
+{
+	PlaneLayout(PlaneLayout::LAYOUT_MORTON, ctx->width, ctx->height).fromLinear(ctx->plane, ctx->width, ctx->tiledPlane);
+}
+
+static void runFromMorton(BenchContext* ctx)
+{
+	PlaneLayout(PlaneLayout::LAYOUT_MORTON, ctx->width, ctx->height).toLinear(ctx->tiledPlane, ctx->plane, ctx->width);
+}
+
+static void runInitBeautify(BenchContext* ctx)
+{
+	MagicBeautify::getInstance()->initMagicBeautify(bitmapView(ctx));
+}
+
+static void runSkinSmooth(BenchContext*)
+{
+	MagicBeautify::getInstance()->startSkinSmooth(10 + 5 * 5 * 5);
+}
+
+static void runWhiteSkin(BenchContext*)
+{
+	MagicBeautify::getInstance()->startWhiteSkin(3.0f);
+}
+
+// map into the layout scratch, which is far larger than any map
+static void runGainMap(BenchContext* ctx, int scale)
+{
+	MagicBeautify::getInstance()->exportGainMap(scale, GainMap::DEPTH_8, (uint8_t*) ctx->tiledPlane,
+			GainMap::mapSize(ctx->width, scale) * GainMap::cellBytes(GainMap::DEPTH_8));
+}
+
+static void runGainMap4(BenchContext* ctx)
+{
+	runGainMap(ctx, 4);
+}
+
+static void runGainMap8(BenchContext* ctx)
+{
+	runGainMap(ctx, 8);
+}
+
+// a grid of rotated, half transparent 256x256 stickers over the whole frame
+static void runCompositor(BenchContext* ctx)
+{
+	static const int kSide = 256;
+	static uint32_t* sticker = NULL;
+	if (sticker == NULL) {
+		sticker = new uint32_t[kSide * kSide];
+		for (int i = 0; i < kSide * kSide; i++) {
+			uint32_t a = (i * 7) & 0xff;
+			sticker[i] = (a << 24) | ((a * (i & 0xff) / 255) << 8) | (a / 2);
+		}
+	}
+	const int columns = ctx->width / kSide + 1, rows = ctx->height / kSide + 1;
+	Sprite* sprites = new Sprite[columns * rows];
+	for (int i = 0; i < columns * rows; i++) {
+		float angle = 0.3f * i, c = cosf(angle), s = sinf(angle);
+		Sprite& sprite = sprites[i];
+		sprite.image = ImageView::packed(sticker, kSide, kSide, ImageView::FORMAT_RGBA_8888);
+		sprite.matrix[0] = c;
+		sprite.matrix[1] = -s;
+		sprite.matrix[2] = (i % columns) * kSide;
+		sprite.matrix[3] = s;
+		sprite.matrix[4] = c;
+		sprite.matrix[5] = (i / columns) * kSide;
+		sprite.opacity = 0.8f;
+	}
+	Compositor::draw(bitmapView(ctx), sprites, columns * rows);
+	delete[] sprites;
+}
+
+static const BenchKernel kernels[] = {
+	{ "RGBToYCbCr", "scalar", 7, setupNone, runRGBToYCbCr },
+	{ "YCbCrToRGB", "scalar", 7, setupNone, runYCbCrToRGB },
+	{ "PixelCopy", "copy", 8, setupNone, runCopy },
+	{ "PixelCopy", "stream", 8, setupNone, runCopyStream },
+	{ "PixelCopy", "swizzle", 8, setupNone, runCopySwizzle },
+	{ "ContentHash", "copy", 8, setupNone, runHashCopy },
+	{ "ContentHash", "stream", 8, setupNone, runHashCopyStream },
+	{ "Compositor", "stickers", 8, setupNone, runCompositor },
+	{ "PlaneLayout", "tiled", 16, setupNone, runToTiled },
+	{ "PlaneLayout", "morton", 16, setupNone, runToMorton },
+	{ "PlaneLayout", "linear", 16, setupNone, runFromMorton },
+	{ "initMagicBeautify", "linear", 39, setupLinear, runInitBeautify },
+	{ "initMagicBeautify", "linlight", 39, setupLinearLight, runInitBeautify },
+	{ "initMagicBeautify", "tiled", 39, setupTiled, runInitBeautify },
+	{ "initMagicBeautify", "morton", 39, setupMorton, runInitBeautify },
+	{ "_startSkinSmooth", "linear", 34, setupBeautifyLinear, runSkinSmooth },
+	{ "_startSkinSmooth", "linlight", 34, setupBeautifyLinearLight, runSkinSmooth },
+	{ "_startSkinSmooth", "fp16", 34, setupBeautifyFp16, runSkinSmooth },
+	{ "_startSkinSmooth", "tiled", 34, setupBeautifyTiled, runSkinSmooth },
+	{ "_startSkinSmooth", "morton", 34, setupBeautifyMorton, runSkinSmooth },
+	{ "_startSkinSmooth", "stream", 18, setupBeautifyStreaming, runSkinSmooth },
+	{ "_startSkinSmooth", "cached", 8, setupBeautifyCached, runSkinSmooth },
+	{ "_startSkinSmooth", "tone", 35, setupBeautifySkinTone, runSkinSmooth },
+	{ "_startWhiteSkin", "scalar", 8, setupBeautifyWhiten, runWhiteSkin },
+	{ "_startWhiteSkin", "linlight", 8, setupBeautifyWhitenLinearLight, runWhiteSkin },
+	{ "_startWhiteSkin", "skin", 8, setupBeautifySkinWhiten, runWhiteSkin },
+	{ "_startWhiteSkin", "softskin", 8, setupBeautifySoftSkinWhiten, runWhiteSkin },
+	{ "exportGainMap", "1/4", 11, setupBeautifyLinear, runGainMap4 },
+	{ "exportGainMap", "1/8", 11, setupBeautifyLinear, runGainMap8 },
+};
+
+/**
+ * Runs the smoothing once per precision on the same input and reports how
+ * far the FP16 luma lands from FP32.
+ */
+static void validateFp16(BenchContext* ctx)
+{
+	if (!SmoothGain::isSupported(SmoothGain::PRECISION_FP16)) {
+		printf("fp16 smoothing: not supported on this CPU, FP32 only\n");
+		return;
+	}
+	int pixels = ctx->width * ctx->height;
+	uint32_t* reference = new uint32_t[pixels];
+	setupBeautifyLinear(ctx);
+	runSkinSmooth(ctx);
+	memcpy(reference, ctx->bitmap, sizeof(uint32_t) * pixels);
+	setupBeautifyFp16(ctx);
+	runSkinSmooth(ctx);
+	// compare luma, the only channel the gain step writes
+	uint8_t* a = new uint8_t[pixels * 3];
+	uint8_t* b = new uint8_t[pixels * 3];
+	Conversion::RGBToYCbCr(ImageView::packed(reference, ctx->width, ctx->height, ImageView::FORMAT_RGBA_8888),
+			ImageView::packed(a, ctx->width, ctx->height, ImageView::FORMAT_YCBCR_888));
+	Conversion::RGBToYCbCr(bitmapView(ctx), ImageView::packed(b, ctx->width, ctx->height, ImageView::FORMAT_YCBCR_888));
+	int maxError = 0;
+	int64_t differing = 0;
+	for (int i = 0; i < pixels; i++) {
+		int error = abs((int) a[i * 3] - (int) b[i * 3]);
+		maxError = std::max(maxError, error);
+		differing += error != 0;
+	}
+	printf("fp16 smoothing: max luma error %d, %.3f%% of pixels differ from fp32\n",
+			maxError, 100.0 * differing / pixels);
+	delete[] a;
+	delete[] b;
+	delete[] reference;
+}
+
+/**
+ * Exports a scale 1 map for the same smoothing the still path renders,
+ * blends it into the source luma as a renderer would and reports how far
+ * the result lands from MagicBeautify's own.
+ */
+static void validateGainMap(BenchContext* ctx)
+{
+	int pixels = ctx->width * ctx->height;
+	MagicBeautify::getInstance()->unInitMagicBeautify();
+	setupBeautifyLinear(ctx);
+	runSkinSmooth(ctx);
+	int stride = ctx->width * GainMap::cellBytes(GainMap::DEPTH_16);
+	uint16_t* map = new uint16_t[pixels * 2];
+	if (!MagicBeautify::getInstance()->exportGainMap(1, GainMap::DEPTH_16, (uint8_t*) map, stride)) {
+		printf("gain map: export failed\n");
+		delete[] map;
+		return;
+	}
+	uint8_t* yuv = new uint8_t[pixels * 3];
+	memcpy(yuv, ctx->yuv, pixels * 3);
+	for (int i = 0; i < pixels; i++) {
+		float m = map[i * 2] / 257.0f;
+		float g = map[i * 2 + 1] / 65535.0f;
+		yuv[i * 3] = ceil(m + g * (yuv[i * 3] - m));
+	}
+	uint32_t* blended = new uint32_t[pixels];
+	Conversion::YCbCrToRGB(ImageView::packed(yuv, ctx->width, ctx->height, ImageView::FORMAT_YCBCR_888),
+			ImageView::packed(blended, ctx->width, ctx->height, ImageView::FORMAT_RGBA_8888));
+	int maxError = 0;
+	int64_t differing = 0;
+	for (int i = 0; i < pixels; i++) {
+		int error = 0;
+		for (int c = 0; c < 24; c += 8)
+			error = std::max(error, abs((int) ((blended[i] >> c) & 0xff) - (int) ((ctx->bitmap[i] >> c) & 0xff)));
+		maxError = std::max(maxError, error);
+		differing += error != 0;
+	}
+	printf("gain map: scale 1 blend max error %d, %.3f%% of pixels differ from MagicBeautify\n",
+			maxError, 100.0 * differing / pixels);
+	delete[] blended;
+	delete[] yuv;
+	delete[] map;
+}
+
+/**
+ * Compiles a strong HSL mixer into a look table and reports the compile
+ * time and how far the table lands from the exact per-pixel mixer.
+ */
+static void validateHslMixer(BenchContext* ctx)
+{
+	HslMixer mixer;
+	for (int band = 0; band < HslMixer::BANDS; band++)
+		mixer.setBand(band, band & 1 ? 0.8f : -0.6f, band & 2 ? -0.7f : 0.9f, band & 4 ? 0.5f : -0.5f);
+	LookTable* table = new LookTable();
+	double t0 = PerfCounters::nowSeconds();
+	table->setMixer(&mixer);
+	double compile = PerfCounters::nowSeconds() - t0;
+	int pixels = ctx->width * ctx->height;
+	int maxError = 0;
+	double sum = 0;
+	for (int i = 0; i < pixels; i++) {
+		uint32_t exact = mixer.apply(ctx->rgba[i]);
+		uint32_t looked = table->apply(ctx->rgba[i], 0);
+		for (int c = 0; c < 24; c += 8) {
+			int error = abs((int) ((exact >> c) & 0xff) - (int) ((looked >> c) & 0xff));
+			maxError = std::max(maxError, error);
+			sum += error;
+		}
+	}
+	printf("hsl mixer: compiled in %.2f ms, max error %d, mean %.3f against the exact mixer\n",
+			compile * 1e3, maxError, sum / (pixels * 3.0));
+	delete table;
+}
+
+/**
+ * A shaky pan cut out of the image's luma at known offsets: reports how
+ * far the measured motion lands from the true one, the frame-to-frame
+ * jitter (mean absolute second difference of the position) before and
+ * after stabilization, and the time to track and warp a frame.
+ */
+static void validateStabilizer(BenchContext* ctx)
+{
+	const int pad = 64, frames = 60;
+	int width = (ctx->width - 2 * pad) & ~1, height = (ctx->height - 2 * pad) & ~1;
+	if (width < 64 || height < 64) {
+		printf("stabilizer: image too small for the synthetic sequence\n");
+		return;
+	}
+	uint8_t* luma = new uint8_t[ctx->width * ctx->height];
+	for (int i = 0; i < ctx->width * ctx->height; i++)
+		luma[i] = ctx->yuv[i * 3];
+	uint8_t* out = new uint8_t[ctx->width * height];
+	uint8_t* scratch = new uint8_t[Stabilizer::scratchBytes(width)];
+	Stabilizer stabilizer;
+	stabilizer.reset(width, height);
+	srand(7);
+	double motionError = 0, jitterIn = 0, jitterOut = 0, trackTime = 0, warpTime = 0;
+	// crop origin, and where the output looks from after the correction
+	float shaky[frames][2], steady[frames][2];
+	for (int t = 0; t < frames; t++) {
+		// a slow pan with up to 8 pixels of shake either way
+		int x = pad / 2 + t / 2 + rand() % 17 - 8, y = pad + rand() % 17 - 8;
+		const uint8_t* frame = luma + (size_t) y * ctx->width + x;
+		float offsetX, offsetY;
+		double t0 = PerfCounters::nowSeconds();
+		stabilizer.track(frame, ctx->width, &offsetX, &offsetY);
+		double t1 = PerfCounters::nowSeconds();
+		stabilizer.warpRows(frame, out, width, height, ctx->width, 1, offsetX, offsetY, 0, height, scratch);
+		warpTime += PerfCounters::nowSeconds() - t1;
+		trackTime += t1 - t0;
+		shaky[t][0] = x;
+		shaky[t][1] = y;
+		steady[t][0] = x + offsetX;
+		steady[t][1] = y + offsetY;
+		// the content moves against the crop origin
+		if (t > 0)
+			motionError += fabs(stabilizer.getMotionX() + shaky[t][0] - shaky[t - 1][0])
+					+ fabs(stabilizer.getMotionY() + shaky[t][1] - shaky[t - 1][1]);
+		for (int k = 0; t >= 2 && k < 2; k++) {
+			jitterIn += fabs(shaky[t][k] - 2 * shaky[t - 1][k] + shaky[t - 2][k]);
+			jitterOut += fabs(steady[t][k] - 2 * steady[t - 1][k] + steady[t - 2][k]);
+		}
+	}
+	printf("stabilizer %dx%d: motion error %.2f px, jitter %.2f -> %.2f px, track %.2f ms, warp %.2f ms per frame\n",
+			width, height, motionError / (2 * (frames - 1)), jitterIn / (2 * (frames - 2)),
+			jitterOut / (2 * (frames - 2)), trackTime * 1e3 / frames, warpTime * 1e3 / frames);
+	delete[] luma;
+	delete[] out;
+	delete[] scratch;
+}
+
+/**
+ * Healing dabs of growing radius on a copy of the image: time per dab and
+ * per healed pixel, which stays flat when the solver's cost follows the
+ * dab's area.
+ */
+static void validateHealingBrush(BenchContext* ctx)
+{
+	int pixels = ctx->width * ctx->height;
+	uint32_t* copy = new uint32_t[pixels];
+	memcpy(copy, ctx->rgba, sizeof(uint32_t) * pixels);
+	ImageView view = ImageView::packed(copy, ctx->width, ctx->height, ImageView::FORMAT_RGBA_8888);
+	const int radii[] = { 16, 64, 256 };
+	printf("healing brush:");
+	for (int k = 0; k < 3; k++) {
+		int r = radii[k];
+		if (4 * r + 8 > ctx->width || 2 * r + 4 > ctx->height)
+			break;
+		int x = ctx->width / 2 + r, y = ctx->height / 2;
+		double t0 = PerfCounters::nowSeconds();
+		HealingBrush::heal(view, x, y, x - 2 * r - 2, y, r);
+		double t = PerfCounters::nowSeconds() - t0;
+		printf(" r=%d %.2f ms (%.0f ns/px)", r, t * 1e3, t * 1e9 / (M_PI * r * r));
+	}
+	printf("\n");
+	delete[] copy;
+}
+
+static double lumaPsnr(const uint8_t* a, const uint8_t* b, int width, int height, int stride)
+{
+	double sum = 0;
+	for (int i = 0; i < height; i++) {
+		for (int j = 0; j < width; j++) {
+			int d = a[(size_t) i * stride + j] - b[(size_t) i * stride + j];
+			sum += d * d;
+		}
+	}
+	return sum > 0 ? 10 * log10(255.0 * 255.0 * width * height / sum) : 99;
+}
+
+/**
+ * A pan cut out of the image's luma, one pixel a frame, with noise of
+ * sigma 8 added to every I420 frame: reports the luma PSNR against the
+ * clean frames before and after the denoise, once the recursion has
+ * settled, and the time to denoise a frame.
+ */
+static void validateDenoiser(BenchContext* ctx)
+{
+	const int pad = 64, frames = 30, settle = 5;
+	int width = (ctx->width - pad) & ~1, height = ctx->height & ~1;
+	if (width < 64 || height < 64) {
+		printf("denoiser: image too small for the synthetic sequence\n");
+		return;
+	}
+	size_t lumaBytes = (size_t) width * height, frameBytes = lumaBytes + lumaBytes / 2;
+	uint8_t* clean = new uint8_t[frameBytes];
+	uint8_t* noisy = new uint8_t[frameBytes];
+	TemporalDenoiser denoiser;
+	denoiser.setStrength(0.7f);
+	if (!denoiser.reset(width, height, lumaBytes, lumaBytes + lumaBytes / 4, 1, width / 2)) {
+		printf("denoiser: memory budget too small\n");
+		delete[] clean;
+		delete[] noisy;
+		return;
+	}
+	srand(11);
+	double before = 0, after = 0, time = 0;
+	for (int t = 0; t < frames; t++) {
+		for (int i = 0; i < height; i++) {
+			for (int j = 0; j < width; j++)
+				clean[(size_t) i * width + j] = ctx->yuv[((size_t) i * ctx->width + j + t) * 3];
+		}
+		memset(clean + lumaBytes, 128, lumaBytes / 2);
+		for (size_t k = 0; k < frameBytes; k++) {
+			// sum of four uniforms, near enough to a gaussian of sigma 8
+			int noise = (rand() % 15 + rand() % 15 + rand() % 15 + rand() % 15 - 28) * 8 / 9;
+			int v = clean[k] + noise;
+			noisy[k] = v < 0 ? 0 : v > 255 ? 255 : v;
+		}
+		double t0 = PerfCounters::nowSeconds();
+		denoiser.denoiseRows(noisy, t, 0, height);
+		time += PerfCounters::nowSeconds() - t0;
+		if (t >= settle) {
+			before += lumaPsnr(noisy, clean, width, height, width);
+			after += lumaPsnr(denoiser.getOutput(t), clean, width, height, width);
+		}
+	}
+	printf("denoiser %dx%d: luma PSNR %.2f -> %.2f dB, %.2f ms per frame\n", width, height,
+			before / (frames - settle), after / (frames - settle), time * 1e3 / frames);
+	denoiser.release();
+	delete[] clean;
+	delete[] noisy;
+}
+
+static MachinePeaks measurePeaks(PerfCounters* counters)
+{
+	MachinePeaks peaks;
+	const size_t size = 64 << 20;
+	uint8_t* a = new uint8_t[size];
+	uint8_t* b = new uint8_t[size];
+	memset(a, 1, size);
+	memset(b, 2, size);
+	double best = 1e9;
+	for (int pass = 0; pass < 5; pass++) {
+		double t0 = PerfCounters::nowSeconds();
+		memcpy(pass & 1 ? a : b, pass & 1 ? b : a, size);
+		double t = PerfCounters::nowSeconds() - t0;
+		best = std::min(best, t);
+	}
+	peaks.bandwidth = 2.0 * size / best;
+	delete[] a;
+	delete[] b;
+
+	// independent integer chains keep every ALU port busy
+	peaks.instructionRate = 0;
+	if (counters->isAvailable(PERF_EVENT_INSTRUCTIONS)) {
+		PerfSample sample;
+		volatile uint64_t sink;
+		uint64_t x0 = 1, x1 = 2, x2 = 3, x3 = 4;
+		counters->start();
+		for (int i = 0; i < 100000000; i++) {
+			x0 += i; x1 ^= i; x2 += x1; x3 ^= x0;
+			__asm__ volatile("" : "+r"(x0), "+r"(x1), "+r"(x2), "+r"(x3));
+		}
+		counters->stop(&sample);
+		sink = x0 + x1 + x2 + x3;
+		(void) sink;
+		if (sample.valid[PERF_EVENT_INSTRUCTIONS] && sample.seconds > 0)
+			peaks.instructionRate = sample.value[PERF_EVENT_INSTRUCTIONS] / sample.seconds;
+	}
+	return peaks;
+}
+
+static void printCounter(const PerfSample& s, int event, double divisor)
+{
+	if (s.valid[event])
+		printf(" %10.3f", s.value[event] / divisor);
+	else
+		printf(" %10s", "n/a");
+}
+
+static void report(const BenchKernel& k, const PerfSample& s, double coldMs, double minMs,
+		int iterations, int pixels, const MachinePeaks& peaks)
+{
+	double perIter = (double) iterations;
+	double px = (double) pixels * iterations;
+	printf("%-20s %-8s %9.3f %9.3f %9.3f", k.name, k.variant, coldMs, s.seconds * 1000 / perIter, minMs);
+	if (s.valid[PERF_EVENT_CYCLES] && s.valid[PERF_EVENT_INSTRUCTIONS] && s.value[PERF_EVENT_CYCLES] > 0)
+		printf(" %6.2f", (double) s.value[PERF_EVENT_INSTRUCTIONS] / s.value[PERF_EVENT_CYCLES]);
+	else
+		printf(" %6s", "n/a");
+	printCounter(s, PERF_EVENT_L1D_MISSES, px);
+	printCounter(s, PERF_EVENT_LLC_MISSES, px);
+	printCounter(s, PERF_EVENT_BRANCH_MISSES, px);
+
+	// LLC misses only see demand fills that reached DRAM, so hardware
+	// prefetched lines are missed; fall back to the nominal traffic
+	// when the counter is absent or clearly under-reports.
+	double bytesPerPixel = k.nominalBytesPerPixel;
+	const char* source = "nom";
+	if (s.valid[PERF_EVENT_LLC_MISSES]) {
+		double measured = (double) s.value[PERF_EVENT_LLC_MISSES] * CACHE_LINE_BYTES / px;
+		if (measured >= bytesPerPixel * 0.25) {
+			bytesPerPixel = measured;
+			source = "llc";
+		}
+	}
+	double bandwidth = bytesPerPixel * px / s.seconds;
+	printf(" %7.2f(%s) %8.2f", bytesPerPixel, source, bandwidth / 1e9);
+
+	if (peaks.instructionRate > 0 && s.valid[PERF_EVENT_INSTRUCTIONS]) {
+		double intensity = s.value[PERF_EVENT_INSTRUCTIONS] / (bytesPerPixel * px);
+		double ridge = peaks.instructionRate / peaks.bandwidth;
+		double attainable = std::min(peaks.instructionRate, intensity * peaks.bandwidth);
+		double achieved = s.value[PERF_EVENT_INSTRUCTIONS] / s.seconds;
+		printf(" %8.2f %-7s %5.0f%%", intensity, intensity < ridge ? "memory" : "compute",
+				100.0 * achieved / attainable);
+	} else {
+		printf(" %8s %-7s %6s", "n/a", bandwidth > 0.6 * peaks.bandwidth ? "memory" : "?", "n/a");
+	}
+	printf("\n");
+}
+
+int main(int argc, char** argv)
+{
+	int width = argc > 1 ? atoi(argv[1]) : 1920;
+	int height = argc > 2 ? atoi(argv[2]) : 1080;
+	int iterations = argc > 3 ? atoi(argv[3]) : 10;
+	uint8_t* dumped = NULL;
+	if (argc > 4 && (dumped = FrameDump::load(argv[4], &width, &height)) == NULL)
+		return 1;
+	if (width <= 0 || height <= 0 || iterations <= 0) {
+		fprintf(stderr, "usage: %s [width] [height] [iterations] [frame.mfd]\n", argv[0]);
+		return 1;
+	}
+	int pixels = width * height;
+
+	PerfCounters counters;
+	if (!counters.open())
+		fprintf(stderr, "perf: no hardware counters, reporting wall time only\n");
+	MachinePeaks peaks = measurePeaks(&counters);
+
+	BenchContext ctx;
+	ctx.width = width;
+	ctx.height = height;
+	ctx.rgba = new uint32_t[pixels];
+	ctx.yuv = new uint8_t[pixels * 3];
+	if (dumped != NULL) {
+		memcpy(ctx.rgba, dumped, sizeof(uint32_t) * pixels);
+		delete[] dumped;
+	} else {
+		fillSynthetic(ctx.rgba, width, height);
+	}
+	Conversion::RGBToYCbCr(ImageView::packed(ctx.rgba, width, height, ImageView::FORMAT_RGBA_8888),
+			ImageView::packed(ctx.yuv, width, height, ImageView::FORMAT_YCBCR_888));
+	ctx.bitmap = new uint32_t[pixels];
+	memcpy(ctx.bitmap, ctx.rgba, sizeof(uint32_t) * pixels);
+	ctx.plane = new uint64_t[pixels];
+	ctx.tiledPlane = new uint64_t[PlaneLayout(PlaneLayout::LAYOUT_MORTON, width, height).size()];
+	for (int i = 0; i < pixels; i++)
+		ctx.plane[i] = ctx.yuv[i * 3];
+
+	printf("image %dx%d, %d iterations, peak bandwidth %.2f GB/s", width, height, iterations, peaks.bandwidth / 1e9);
+	if (peaks.instructionRate > 0)
+		printf(", peak %.2f Ginstr/s, ridge %.2f instr/byte\n",
+				peaks.instructionRate / 1e9, peaks.instructionRate / peaks.bandwidth);
+	else
+		printf(", instruction rate unknown\n");
+	validateFp16(&ctx);
+	validateGainMap(&ctx);
+	validateHslMixer(&ctx);
+	validateStabilizer(&ctx);
+	validateDenoiser(&ctx);
+	validateHealingBrush(&ctx);
+	printf("%-20s %-8s %9s %9s %9s %6s %10s %10s %10s %12s %8s %8s %-7s %6s\n",
+			"kernel", "variant", "cold(ms)", "mean(ms)", "min(ms)", "IPC", "L1D/px", "LLC/px", "brmiss/px",
+			"bytes/px", "GB/s", "instr/B", "bound", "roof");
+
+	for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+		// the FP16 setup would time the FP32 fallback under the fp16 label
+		if (kernels[k].setup == setupBeautifyFp16 && !SmoothGain::isSupported(SmoothGain::PRECISION_FP16)) {
+			printf("%-20s %-8s not supported on this CPU, skipped\n", kernels[k].name, kernels[k].variant);
+			continue;
+		}
+		// the first call pays for page faults and thread pool start-up
+		kernels[k].setup(&ctx);
+		double coldStart = PerfCounters::nowSeconds();
+		kernels[k].run(&ctx);
+		double coldMs = (PerfCounters::nowSeconds() - coldStart) * 1000;
+		double minMs = 1e9;
+		PerfSample total;
+		memset(&total, 0, sizeof(total));
+		for (int i = 0; i < PERF_EVENT_COUNT; i++)
+			total.valid[i] = true;
+		for (int it = 0; it < iterations; it++) {
+			PerfSample sample;
+			kernels[k].setup(&ctx);
+			counters.start();
+			kernels[k].run(&ctx);
+			counters.stop(&sample);
+			minMs = std::min(minMs, sample.seconds * 1000);
+			total.seconds += sample.seconds;
+			for (int i = 0; i < PERF_EVENT_COUNT; i++) {
+				total.value[i] += sample.value[i];
+				total.valid[i] = total.valid[i] && sample.valid[i];
+			}
+		}
+		report(kernels[k], total, coldMs, minMs, iterations, pixels, peaks);
+	}
+
+	MagicBeautify::getInstance()->unInitMagicBeautify();
+	delete[] ctx.bitmap;
+	delete[] ctx.plane;
+	delete[] ctx.tiledPlane;
+	delete[] ctx.yuv;
+	delete[] ctx.rgba;
+	return 0;
+}
@@ -0,0 +1,39 @@
+/**
+ * Frame dump inspector.
+ *
+ * usage: MagicFrameDump frame.mfd [out.pam]
+ *
+ * Decodes a dump written by EglSurfaceBase.saveFrame, prints its size and
+ * optionally converts it to a PAM (RGB_ALPHA) image for viewers and
+ * image tools. Builds on a Linux host without the NDK.
+ */
+#include <stdio.h>
+#include "../dump/FrameDump.h"
+
+int main(int argc, char** argv)
+{
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s frame.mfd [out.pam]\n", argv[0]);
+		return 1;
+	}
+	int width, height;
+	uint8_t* pixels = FrameDump::load(argv[1], &width, &height);
+	if (pixels == NULL)
+		return 1;
+	printf("%s: %dx%d RGBA\n", argv[1], width, height);
+	int ret = 0;
+	if (argc > 2) {
+		FILE* out = fopen(argv[2], "wb");
+		if (out == NULL) {
+			perror(argv[2]);
+			ret = 1;
+		} else {
+			fprintf(out, "P7\nWIDTH %d\nHEIGHT %d\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n", width, height);
+			if (fwrite(pixels, 4, (size_t) width * height, out) != (size_t) width * height)
+				ret = 1;
+			fclose(out);
+		}
+	}
+	delete[] pixels;
+	return ret;
+}
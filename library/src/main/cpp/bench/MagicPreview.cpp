@@ -0,0 +1,285 @@
+/**
+ * CPU preview renderer driver.
+ *
+ * usage: MagicPreview [width] [height] [frames] [fps] [out.mfd]
+ *
+ * Feeds synthetic NV21 camera frames (a moving skin-toned face over a
+ * gradient, with sensor noise) through PreviewRenderer into a memory
+ * backed double buffered "window", first synchronously to measure frame
+ * time and then through the render thread at the camera rate to count
+ * dropped frames. The scopes and the focus assist overlays are timed on
+ * the same frames against their 0.5 ms and 2 ms budgets. Heap allocations are counted while frames run and must
+ * stay at zero. The last displayed frame can be written as a .mfd dump.
+ * Builds on a Linux host without the NDK.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <thread>
+#include <vector>
+#include "../preview/FocusAssist.h"
+#include "../preview/PreviewRenderer.h"
+#include "../preview/ScopeEngine.h"
+#include "../dump/FrameDump.h"
+
+static std::atomic<int64_t> sAllocations(0);
+
+void* operator new(size_t size)
+{
+	sAllocations++;
+	void* p = malloc(size ? size : 1);
+	if (p == NULL)
+		throw std::bad_alloc();
+	return p;
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+	sAllocations++;
+	return malloc(size ? size : 1);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+	return operator new(size, std::nothrow);
+}
+
+void operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+	free(p);
+}
+
+/** Two padded buffers flipped on post(), like a window's queue. */
+class MemorySurface : public PreviewSurface
+{
+public:
+	MemorySurface(int width, int height)
+	{
+		mWidth = width;
+		mHeight = height;
+		// window buffers are usually wider than the visible area
+		mStride = (width + 64) * 4;
+		mBuffers[0] = new uint8_t[(size_t) mStride * height];
+		mBuffers[1] = new uint8_t[(size_t) mStride * height];
+		mBack = 0;
+		mPosted = 0;
+	}
+
+	~MemorySurface()
+	{
+		delete[] mBuffers[0];
+		delete[] mBuffers[1];
+	}
+
+	bool lock(ImageView* buffer)
+	{
+		*buffer = ImageView(mBuffers[mBack], mWidth, mHeight, mStride, ImageView::FORMAT_RGBA_8888);
+		return true;
+	}
+
+	void post()
+	{
+		mBack ^= 1;
+		mPosted++;
+	}
+
+	const uint8_t* front() { return mBuffers[mBack ^ 1]; }
+	int stride() { return mStride; }
+	int64_t posted() { return mPosted; }
+
+private:
+	int mWidth;
+	int mHeight;
+	int mStride;
+	uint8_t* mBuffers[2];
+	int mBack;
+	std::atomic<int64_t> mPosted;
+};
+
+static void makeFrame(uint8_t* nv21, int width, int height, int index)
+{
+	uint8_t* chroma = nv21 + (size_t) width * height;
+	int cx = width / 2 + (int) (width / 6 * ((index % 16) / 8.0 - 1));
+	int cy = height / 2;
+	int radius = height / 3;
+	unsigned seed = 1234 + index;
+	for (int i = 0; i < height; i++) {
+		for (int j = 0; j < width; j++) {
+			int dx = j - cx, dy = i - cy;
+			bool face = dx * dx + dy * dy < radius * radius;
+			int y = face ? 150 + (dx * dy) % 11 : 40 + 140 * j / width;
+			seed = seed * 1103515245 + 12345;
+			y += (int) ((seed >> 16) % 17) - 8;
+			nv21[(size_t) i * width + j] = (uint8_t) std::min(235, std::max(16, y));
+			if ((i & 1) == 0 && (j & 1) == 0) {
+				// NV21 stores V before U
+				chroma[(size_t) (i >> 1) * width + j] = face ? 150 : 128 + (i * 20 / height);
+				chroma[(size_t) (i >> 1) * width + j + 1] = face ? 110 : 128 - (j * 20 / width);
+			}
+		}
+	}
+}
+
+// a warm look in the MagicLookupFilter layout
+static void makeLookup(uint8_t* rgba)
+{
+	for (int b = 0; b < 64; b++) {
+		for (int g = 0; g < 64; g++) {
+			for (int r = 0; r < 64; r++) {
+				uint8_t* texel = rgba + (size_t) ((b / 8) * 64 + g) * 512 * 4 + ((b % 8) * 64 + r) * 4;
+				texel[0] = (uint8_t) std::min(255, r * 255 / 63 + 12);
+				texel[1] = (uint8_t) (g * 255 / 63);
+				texel[2] = (uint8_t) (b * 255 / 63 * 7 / 8);
+				texel[3] = 255;
+			}
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	int width = argc > 1 ? atoi(argv[1]) : 1280;
+	int height = argc > 2 ? atoi(argv[2]) : 720;
+	int frames = argc > 3 ? atoi(argv[3]) : 300;
+	int fps = argc > 4 ? atoi(argv[4]) : 30;
+	const char* out = argc > 5 ? argv[5] : NULL;
+	if (width <= 0 || height <= 0 || frames <= 0 || fps <= 0) {
+		fprintf(stderr, "usage: %s [width] [height] [frames] [fps] [out.mfd]\n", argv[0]);
+		return 1;
+	}
+
+	const int sources = 16;
+	size_t frameBytes = (size_t) width * height * 3 / 2;
+	std::vector<uint8_t> input(frameBytes * sources);
+	for (int f = 0; f < sources; f++)
+		makeFrame(&input[frameBytes * f], width, height, f);
+	std::vector<uint8_t> lookup(512 * 512 * 4);
+	makeLookup(&lookup[0]);
+
+	PreviewRenderer renderer;
+	if (!renderer.init(width, height))
+		return 1;
+	renderer.setBeautyLevel(10 + 5 * 5 * 5, 3.0f);
+	renderer.setLookup(&lookup[0], 512 * 4);
+	renderer.setSkinProtection(true);
+	MemorySurface surface(width, height);
+
+	// synchronous: pure frame time, worker start-up excluded by a warm-up frame
+	ImageView buffer;
+	surface.lock(&buffer);
+	renderer.render(&input[0], buffer);
+	std::vector<double> times;
+	times.reserve(frames);
+	int64_t allocations = sAllocations.load();
+	for (int f = 0; f < frames; f++) {
+		surface.lock(&buffer);
+		std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+		renderer.render(&input[frameBytes * (f % sources)], buffer);
+		times.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count());
+		surface.post();
+	}
+	int64_t syncAllocations = sAllocations.load() - allocations;
+	std::sort(times.begin(), times.end());
+	double mean = 0;
+	for (size_t i = 0; i < times.size(); i++)
+		mean += times[i] / times.size();
+	double budget = 1000.0 / fps;
+	double p95 = times[times.size() * 95 / 100];
+	printf("%dx%d, %d threads: mean %.2f ms, p95 %.2f ms, max %.2f ms per frame (budget %.2f ms), "
+			"%lld allocations in %d frames\n",
+			width, height, (int) std::thread::hardware_concurrency(), mean, p95, times.back(), budget,
+			(long long) syncAllocations, frames);
+
+	// scopes on the camera thread, ahead of each submit
+	ScopeEngine* scopes = new ScopeEngine();
+	ScopeData* scopeData = new ScopeData;
+	allocations = sAllocations.load();
+	double scopeMean = 0, scopeMax = 0;
+	for (int f = 0; f < frames; f++) {
+		std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+		scopes->submit(&input[frameBytes * (f % sources)], width, height);
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+		scopeMean += ms / frames;
+		scopeMax = std::max(scopeMax, ms);
+	}
+	scopes->read(scopeData);
+	syncAllocations += sAllocations.load() - allocations;
+	printf("scopes: mean %.3f ms, max %.3f ms per frame (budget 0.50 ms), %d samples at step %d\n",
+			scopeMean, scopeMax, scopeData->samples, scopeData->step);
+	delete scopeData;
+	delete scopes;
+
+	// focus peaking and zebra; the first frame sizes the scratch
+	FocusAssist assist;
+	std::vector<uint8_t> mask((size_t) FocusAssist::maskSize(width) * FocusAssist::maskSize(height));
+	assist.compute(ImageView(&input[0], width, height, width, ImageView::FORMAT_GRAY_8), &mask[0],
+			FocusAssist::maskSize(width));
+	allocations = sAllocations.load();
+	double assistMean = 0, assistMax = 0;
+	for (int f = 0; f < frames; f++) {
+		std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+		assist.compute(ImageView(&input[frameBytes * (f % sources)], width, height, width, ImageView::FORMAT_GRAY_8),
+				&mask[0], FocusAssist::maskSize(width));
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+		assistMean += ms / frames;
+		assistMax = std::max(assistMax, ms);
+	}
+	syncAllocations += sAllocations.load() - allocations;
+	printf("focus assist: mean %.3f ms, max %.3f ms per frame (budget 2.00 ms)\n", assistMean, assistMax);
+
+	// threaded: camera-paced submits, the renderer drops what it cannot keep up with
+	renderer.setSurface(&surface);
+	renderer.start();
+	PreviewStats before = renderer.getStats();
+	allocations = sAllocations.load();
+	std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+	for (int f = 0; f < frames; f++) {
+		renderer.submit(&input[frameBytes * (f % sources)]);
+		next += std::chrono::microseconds(1000000 / fps);
+		std::this_thread::sleep_until(next);
+	}
+	int64_t threadedAllocations = sAllocations.load() - allocations;
+	renderer.stop();
+	renderer.setSurface(NULL);
+	PreviewStats stats = renderer.getStats();
+	printf("threaded at %d fps: %lld submitted, %lld rendered, %lld dropped, %lld allocations\n", fps,
+			(long long) (stats.submitted - before.submitted), (long long) (stats.rendered - before.rendered),
+			(long long) (stats.dropped - before.dropped), (long long) threadedAllocations);
+	bool realtime = p95 <= budget && stats.dropped == before.dropped;
+	printf("%s\n", realtime ? "realtime" : "NOT realtime");
+
+	if (out != NULL) {
+		int fd = open(out, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0 || FrameDump::save(surface.front(), width, height, surface.stride(), 0, fd) < 0)
+			perror(out);
+		if (fd >= 0)
+			close(fd);
+	}
+	return syncAllocations == 0 && threadedAllocations == 0 ? 0 : 2;
+}
@@ -0,0 +1,124 @@
+/**
+ * Offline video beautify.
+ *
+ * usage: MagicVideo [options] in.y4m|in.nv12 out
+ *   -s level    smoothing, 0..5 as passed to jniStartSkinSmooth (default 3)
+ *   -w level    whitening, 1..5 as passed to jniStartWhiteSkin (default off)
+ *   -l file     look: a 512x512 RGBA lookup image as raw bytes
+ *   -p          protect skin from the look
+ *   -h          FP16 smoothing gain, where the CPU has it (default FP32)
+ *   -S percent  stabilize, cropping this much off each side for the
+ *               correction (default off; 8 is typical)
+ *   -F frames   stabilization smoothing, frames the path takes to follow
+ *               the camera (default 30)
+ *   -N strength motion-compensated temporal denoise, 0..1 (default off)
+ *   -W width    NV12 input size; Y4M carries its own
+ *   -H height
+ *   -t threads  frame workers (default the ThreadPool size)
+ *   -r frames   reorder window (default twice the workers)
+ *   -L ms       frame latency target; frames are pipelined as deep as it
+ *               allows (default none: as many frames at once as fit)
+ *
+ * Reads raw 4:2:0 frames (Y4M, or NV12 when the name does not end in
+ * .y4m), memory-mapped, and writes the result in the same format, so a
+ * clip can be re-processed with other settings and compared without a
+ * codec. Prints throughput in frames per second, frame latency and the
+ * mean number of frames processed at once. Builds on a Linux host
+ * without the NDK.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <vector>
+#include "../beautify/SmoothGain.h"
+#include "../video/VideoProcessor.h"
+
+static bool endsWith(const char* s, const char* suffix)
+{
+	size_t n = strlen(s), m = strlen(suffix);
+	return n >= m && strcmp(s + n - m, suffix) == 0;
+}
+
+int main(int argc, char** argv)
+{
+	float smooth = 3, whiten = 0;
+	double latency = 0;
+	const char* look = NULL;
+	bool protect = false, half = false;
+	int stabilize = 0, smoothing = 0;
+	float denoise = 0;
+	int width = 0, height = 0, threads = 0, window = 0;
+	int opt;
+	while ((opt = getopt(argc, argv, "s:w:l:phS:F:N:W:H:t:r:L:")) != -1) {
+		switch (opt) {
+		case 's': smooth = atof(optarg); break;
+		case 'w': whiten = atof(optarg); break;
+		case 'l': look = optarg; break;
+		case 'p': protect = true; break;
+		case 'h': half = true; break;
+		case 'S': stabilize = atoi(optarg); break;
+		case 'F': smoothing = atoi(optarg); break;
+		case 'N': denoise = atof(optarg); break;
+		case 'W': width = atoi(optarg); break;
+		case 'H': height = atoi(optarg); break;
+		case 't': threads = atoi(optarg); break;
+		case 'r': window = atoi(optarg); break;
+		case 'L': latency = atof(optarg); break;
+		default: optind = argc + 1; break;
+		}
+	}
+	if (argc - optind != 2) {
+		fprintf(stderr, "usage: %s [-s smooth] [-w whiten] [-l lookup.rgba] [-p] [-h] [-S margin] [-F frames] "
+				"[-N strength] [-W width -H height] "
+				"[-t threads] [-r window] [-L latency] in.y4m|in.nv12 out\n", argv[0]);
+		return 1;
+	}
+	const char* inPath = argv[optind];
+	const char* outPath = argv[optind + 1];
+
+	VideoFile input;
+	int format = endsWith(inPath, ".y4m") ? VideoFile::FORMAT_Y4M : VideoFile::FORMAT_NV12;
+	if (!input.open(inPath, format, width, height))
+		return 1;
+
+	VideoProcessor processor;
+	// the same mapping from slider level to filter strength as jniStartSkinSmooth
+	processor.setBeautyLevel(smooth > 0 ? 10 + smooth * smooth * 5 : 0, whiten);
+	processor.setSkinProtection(protect);
+	if (half && !processor.setSmoothPrecision(SmoothGain::PRECISION_FP16))
+		fprintf(stderr, "no FP16 arithmetic on this CPU, smoothing in FP32\n");
+	processor.setStabilization(stabilize, smoothing);
+	processor.setDenoise(denoise);
+	processor.setThreads(threads, window);
+	processor.setLatencyTarget(latency);
+	if (look != NULL) {
+		std::vector<uint8_t> lookup(512 * 512 * 4);
+		FILE* f = fopen(look, "rb");
+		if (f == NULL || fread(&lookup[0], 1, lookup.size(), f) != lookup.size()) {
+			fprintf(stderr, "%s: not a 512x512 RGBA lookup image\n", look);
+			if (f != NULL)
+				fclose(f);
+			return 1;
+		}
+		fclose(f);
+		processor.setLookup(&lookup[0], 512 * 4);
+	}
+
+	int fd = open(outPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		perror(outPath);
+		return 1;
+	}
+	VideoStats stats;
+	memset(&stats, 0, sizeof(stats));
+	bool ok = processor.process(input, fd, &stats);
+	if (close(fd) < 0)
+		ok = false;
+	printf("%s: %d frames of %dx%d %s in %.2f s, %.1f fps, latency mean %.1f ms max %.1f ms, "
+			"%.1f frames at once\n", inPath, stats.frames, input.getWidth(), input.getHeight(),
+			format == VideoFile::FORMAT_Y4M ? "Y4M" : "NV12", stats.seconds, stats.framesPerSecond,
+			stats.meanLatencyMs, stats.maxLatencyMs, stats.meanDepth);
+	return ok ? 0 : 2;
+}
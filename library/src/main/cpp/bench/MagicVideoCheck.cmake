@@ -0,0 +1,29 @@
+# Runs MagicVideo over a synthetic clip whose width is 2 mod 4, the case
+# that misaligns per-thread scratch rows, with smoothing, stabilization
+# and denoising on and more scratch slices than one.
+#
+# cmake -DMAGIC_VIDEO=path/to/MagicVideo -DWORK_DIR=dir -P MagicVideoCheck.cmake
+
+set(width 322)
+set(height 182)
+math(EXPR frameBytes "${width} * ${height} * 3 / 2")
+
+# printable bytes only, so the frames can be written as CMake strings
+set(pattern "0123456789:<=>?@ABCDEFGHIJKLMNOPQRSTUVWXYZ^_abcdefghijklmnopqrstuvwxyz")
+foreach (i RANGE 11)
+    set(pattern "${pattern}${pattern}")
+endforeach ()
+
+set(clip "${WORK_DIR}/odd_width.y4m")
+file(WRITE "${clip}" "YUV4MPEG2 W${width} H${height} F30:1 Ip A1:1 C420jpeg\n")
+foreach (k RANGE 5)
+    math(EXPR offset "${k} * 7")
+    string(SUBSTRING "${pattern}" ${offset} ${frameBytes} frame)
+    file(APPEND "${clip}" "FRAME\n${frame}")
+endforeach ()
+
+execute_process(COMMAND "${MAGIC_VIDEO}" -t 4 -s 3 -w 2 -S 5 -N 3 "${clip}" "${WORK_DIR}/odd_width_out.y4m"
+        RESULT_VARIABLE result)
+if (NOT result EQUAL 0)
+    message(FATAL_ERROR "MagicVideo failed on a ${width}x${height} clip: ${result}")
+endif ()
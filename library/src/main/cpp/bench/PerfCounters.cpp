@@ -0,0 +1,147 @@
+#include "PerfCounters.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+static long perfEventOpen(struct perf_event_attr* attr, pid_t pid, int cpu, int groupFd, unsigned long flags)
+{
+	return syscall(__NR_perf_event_open, attr, pid, cpu, groupFd, flags);
+}
+
+static void describeEvent(int event, struct perf_event_attr* attr)
+{
+	switch (event) {
+	case PERF_EVENT_CYCLES:
+		attr->type = PERF_TYPE_HARDWARE;
+		attr->config = PERF_COUNT_HW_CPU_CYCLES;
+		break;
+	case PERF_EVENT_INSTRUCTIONS:
+		attr->type = PERF_TYPE_HARDWARE;
+		attr->config = PERF_COUNT_HW_INSTRUCTIONS;
+		break;
+	case PERF_EVENT_L1D_MISSES:
+		attr->type = PERF_TYPE_HW_CACHE;
+		attr->config = PERF_COUNT_HW_CACHE_L1D
+				| (PERF_COUNT_HW_CACHE_OP_READ << 8)
+				| (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+		break;
+	case PERF_EVENT_LLC_MISSES:
+		attr->type = PERF_TYPE_HARDWARE;
+		attr->config = PERF_COUNT_HW_CACHE_MISSES;
+		break;
+	default:
+		attr->type = PERF_TYPE_HARDWARE;
+		attr->config = PERF_COUNT_HW_BRANCH_MISSES;
+		break;
+	}
+}
+
+PerfCounters::PerfCounters()
+{
+	for (int i = 0; i < PERF_EVENT_COUNT; i++)
+		mFds[i] = -1;
+	mStartTime = 0.0;
+}
+
+PerfCounters::~PerfCounters()
+{
+	close();
+}
+
+bool PerfCounters::open()
+{
+	close();
+	for (int i = 0; i < PERF_EVENT_COUNT; i++) {
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		describeEvent(i, &attr);
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.inherit = 1;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		mFds[i] = (int) perfEventOpen(&attr, 0, -1, -1, 0);
+		if (mFds[i] < 0)
+			fprintf(stderr, "perf: %s unavailable (%s)\n", eventName(i), strerror(errno));
+	}
+	return anyAvailable();
+}
+
+void PerfCounters::close()
+{
+	for (int i = 0; i < PERF_EVENT_COUNT; i++) {
+		if (mFds[i] >= 0)
+			::close(mFds[i]);
+		mFds[i] = -1;
+	}
+}
+
+void PerfCounters::start()
+{
+	for (int i = 0; i < PERF_EVENT_COUNT; i++) {
+		if (mFds[i] < 0)
+			continue;
+		ioctl(mFds[i], PERF_EVENT_IOC_RESET, 0);
+		ioctl(mFds[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+	mStartTime = nowSeconds();
+}
+
+void PerfCounters::stop(PerfSample* sample)
+{
+	double endTime = nowSeconds();
+	for (int i = 0; i < PERF_EVENT_COUNT; i++) {
+		sample->value[i] = 0;
+		sample->valid[i] = false;
+		if (mFds[i] < 0)
+			continue;
+		ioctl(mFds[i], PERF_EVENT_IOC_DISABLE, 0);
+		uint64_t data[3];
+		if (read(mFds[i], data, sizeof(data)) != sizeof(data) || data[2] == 0)
+			continue;
+		// scale up when the PMU multiplexed this event with others
+		if (data[2] < data[1])
+			data[0] = (uint64_t) ((double) data[0] * data[1] / data[2]);
+		sample->value[i] = data[0];
+		sample->valid[i] = true;
+	}
+	sample->seconds = endTime - mStartTime;
+}
+
+bool PerfCounters::isAvailable(int event)
+{
+	return event >= 0 && event < PERF_EVENT_COUNT && mFds[event] >= 0;
+}
+
+bool PerfCounters::anyAvailable()
+{
+	for (int i = 0; i < PERF_EVENT_COUNT; i++)
+		if (mFds[i] >= 0)
+			return true;
+	return false;
+}
+
+const char* PerfCounters::eventName(int event)
+{
+	switch (event) {
+	case PERF_EVENT_CYCLES: return "cycles";
+	case PERF_EVENT_INSTRUCTIONS: return "instructions";
+	case PERF_EVENT_L1D_MISSES: return "L1D-misses";
+	case PERF_EVENT_LLC_MISSES: return "LLC-misses";
+	case PERF_EVENT_BRANCH_MISSES: return "branch-misses";
+	default: return "unknown";
+	}
+}
+
+double PerfCounters::nowSeconds()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
@@ -0,0 +1,51 @@
+#ifndef _PERF_COUNTERS_H_
+#define _PERF_COUNTERS_H_
+
+#include <stdint.h>
+
+enum PerfEvent
+{
+	PERF_EVENT_CYCLES = 0,
+	PERF_EVENT_INSTRUCTIONS,
+	PERF_EVENT_L1D_MISSES,
+	PERF_EVENT_LLC_MISSES,
+	PERF_EVENT_BRANCH_MISSES,
+	PERF_EVENT_COUNT
+};
+
+typedef struct
+{
+	uint64_t value[PERF_EVENT_COUNT];
+	bool valid[PERF_EVENT_COUNT];
+	double seconds;
+} PerfSample;
+
+/**
+ * Thin wrapper over perf_event_open for the calling thread.
+ * Every event is opened on its own so that a missing counter
+ * (kernel, PMU or perf_event_paranoid) only disables that event;
+ * wall-clock time is always reported.
+ */
+class PerfCounters
+{
+public:
+	PerfCounters();
+	~PerfCounters();
+
+	bool open();
+	void close();
+
+	void start();
+	void stop(PerfSample* sample);
+
+	bool isAvailable(int event);
+	bool anyAvailable();
+
+	static const char* eventName(int event);
+	static double nowSeconds();
+
+private:
+	int mFds[PERF_EVENT_COUNT];
+	double mStartTime;
+};
+#endif
@@ -1,21 +1,9 @@
 #include "BitmapOperation.h"
+#include "BitmapStore.h"
+#include "PixelCopy.h"
+#include "../utils/MagicLog.h"
 
 #define  LOG_TAG    "BitmapOperation"
-#define  LOGD(...)  __android_log_print(ANDROID_LOG_DEBUG,LOG_TAG,__VA_ARGS__)
-#define  LOGE(...)  __android_log_print(ANDROID_LOG_ERROR,LOG_TAG,__VA_ARGS__)
-
-int32_t BitmapOperation::convertArgbToInt(ARGB argb)
-{
-	return (argb.alpha << 24) | (argb.red << 16) | (argb.green << 8) | argb.blue;
-}
-
-void BitmapOperation::convertIntToArgb(uint32_t pixel, ARGB* argb)
-{
-	argb->red = ((pixel >> 16) & 0xff);
-	argb->green = ((pixel >> 8) & 0xff);
-	argb->blue = (pixel & 0xff);
-	argb->alpha = (pixel >> 24);
-}
 
 /**store java bitmap as JNI data*/ //
 jobject BitmapOperation::jniStoreBitmapData(
@@ -23,7 +11,6 @@ jobject BitmapOperation::jniStoreBitmapData(
 {
 	//LOGE("reading bitmap info...");
     AndroidBitmapInfo bitmapInfo;
-    uint32_t* storedBitmapPixels = NULL;
     int ret;
     if ((ret = AndroidBitmap_getInfo(env, bitmap, &bitmapInfo)) < 0)
 	{
@@ -45,14 +32,16 @@ jobject BitmapOperation::jniStoreBitmapData(
 		LOGE("AndroidBitmap_lockPixels() failed ! error=%d", ret);
 		return NULL;
 	}
-	uint32_t* src = (uint32_t*) bitmapPixels;
-    storedBitmapPixels = new uint32_t[bitmapInfo.height * bitmapInfo.width];
-    int pixelsCount = bitmapInfo.height * bitmapInfo.width;
-    memcpy(storedBitmapPixels, src, sizeof(uint32_t) * pixelsCount);
+    // hashed while copied; pixels stored before are shared, not copied again
+    JniBitmap *jniBitmap = BitmapStore::getInstance()->store(ImageView(bitmapPixels, bitmapInfo.width,
+            bitmapInfo.height, bitmapInfo.stride, ImageView::FORMAT_RGBA_8888), bitmapInfo);
     AndroidBitmap_unlockPixels(env, bitmap);
-    JniBitmap *jniBitmap = new JniBitmap();
-    jniBitmap->_bitmapInfo = bitmapInfo;
-    jniBitmap->_storedBitmapPixels = storedBitmapPixels;
+    if (jniBitmap == NULL)
+    {
+        env->ThrowNew(env->FindClass("java/lang/OutOfMemoryError"),
+                "native memory budget exceeded while storing bitmap");
+        return NULL;
+    }
     //LOGE("return NewDirectByteBuffer");
     return env->NewDirectByteBuffer(jniBitmap, 0);
 }
@@ -64,9 +53,7 @@ void BitmapOperation::jniFreeBitmapData(
     JniBitmap* jniBitmap = (JniBitmap*) env->GetDirectBufferAddress(handle);
     if (jniBitmap->_storedBitmapPixels == NULL)
     	return;
-    delete[] jniBitmap->_storedBitmapPixels;
-    jniBitmap->_storedBitmapPixels = NULL;
-    delete jniBitmap;
+    BitmapStore::getInstance()->free(jniBitmap);
 }
 
 /**restore java bitmap (from JNI data)*/ //
@@ -101,17 +88,55 @@ jobject BitmapOperation::jniGetBitmapFromStoredBitmapData(
     //
     int ret;
     void* bitmapPixels;
+    AndroidBitmapInfo newBitmapInfo;
+    if ((ret = AndroidBitmap_getInfo(env, newBitmap, &newBitmapInfo)) < 0)
+	{
+    	LOGE("AndroidBitmap_getInfo() failed ! error=%d", ret);
+    	return NULL;
+	}
     if ((ret = AndroidBitmap_lockPixels(env, newBitmap, &bitmapPixels)) < 0)
 	{
     	LOGE("AndroidBitmap_lockPixels() failed ! error=%d", ret);
     	return NULL;
 	}
-    uint32_t* newBitmapPixels = (uint32_t*) bitmapPixels;
-    int pixelsCount = jniBitmap->_bitmapInfo.height
-	    * jniBitmap->_bitmapInfo.width;
-    memcpy(newBitmapPixels, jniBitmap->_storedBitmapPixels,
-	    sizeof(uint32_t) * pixelsCount);
+    PixelCopy::copy(jniBitmap->getView(), ImageView(bitmapPixels, newBitmapInfo.width, newBitmapInfo.height,
+	    newBitmapInfo.stride, ImageView::FORMAT_RGBA_8888), PixelCopy::STREAM);
     AndroidBitmap_unlockPixels(env, newBitmap);
     //LOGD("returning the new bitmap");
     return newBitmap;
 }
+
+/**copy tightly packed RGBA pixels from a direct buffer (e.g. glReadPixels) into a bitmap, unchanged like copyPixelsFromBuffer*/ //
+jboolean BitmapOperation::jniCopyBufferToBitmap(
+	JNIEnv * env, jobject obj, jobject buffer, jobject bitmap)
+{
+    AndroidBitmapInfo bitmapInfo;
+    int ret;
+    if ((ret = AndroidBitmap_getInfo(env, bitmap, &bitmapInfo)) < 0)
+	{
+    	LOGE("AndroidBitmap_getInfo() failed ! error=%d", ret);
+    	return JNI_FALSE;
+	}
+    if (bitmapInfo.format != ANDROID_BITMAP_FORMAT_RGBA_8888)
+	{
+    	LOGE("Bitmap format is not RGBA_8888!");
+    	return JNI_FALSE;
+	}
+    void* src = env->GetDirectBufferAddress(buffer);
+    if (src == NULL || env->GetDirectBufferCapacity(buffer) < (jlong) bitmapInfo.width * bitmapInfo.height * 4)
+	{
+    	LOGE("buffer is not direct or smaller than the bitmap");
+    	return JNI_FALSE;
+	}
+    void* bitmapPixels;
+    if ((ret = AndroidBitmap_lockPixels(env, bitmap, &bitmapPixels)) < 0)
+	{
+    	LOGE("AndroidBitmap_lockPixels() failed ! error=%d", ret);
+    	return JNI_FALSE;
+	}
+    PixelCopy::copy(ImageView::packed(src, bitmapInfo.width, bitmapInfo.height, ImageView::FORMAT_RGBA_8888),
+	    ImageView(bitmapPixels, bitmapInfo.width, bitmapInfo.height, bitmapInfo.stride, ImageView::FORMAT_RGBA_8888),
+	    0);
+    AndroidBitmap_unlockPixels(env, bitmap);
+    return JNI_TRUE;
+}
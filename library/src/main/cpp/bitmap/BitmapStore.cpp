@@ -0,0 +1,156 @@
+#include "BitmapStore.h"
+#include <stdio.h>
+#include <new>
+#include "ContentHash.h"
+#include "PixelCopy.h"
+#include "../utils/MemoryGovernor.h"
+#include "../utils/MagicLog.h"
+
+#define  LOG_TAG    "BitmapStore"
+
+BitmapStore* BitmapStore::instance;
+
+BitmapStore* BitmapStore::getInstance()
+{
+	static std::once_flag once;
+	std::call_once(once, []() { instance = new BitmapStore(); });
+	return instance;
+}
+
+BitmapStore::BitmapStore()
+{
+}
+
+static inline ImageView viewOf(const StoredPixels* stored)
+{
+	return ImageView::packed(stored->pixels, stored->width, stored->height, ImageView::FORMAT_RGBA_8888);
+}
+
+StoredPixels* BitmapStore::allocate(int width, int height, uint64_t hash)
+{
+	int64_t bytes = (int64_t) width * height * 4;
+	if (!MemoryGovernor::getInstance()->reserve(MEMORY_OWNER_STORED_BITMAP, bytes))
+		return NULL;
+	StoredPixels* stored = new (std::nothrow) StoredPixels();
+	uint32_t* pixels = new (std::nothrow) uint32_t[(size_t) width * height];
+	if (stored == NULL || pixels == NULL) {
+		delete stored;
+		delete[] pixels;
+		MemoryGovernor::getInstance()->release(MEMORY_OWNER_STORED_BITMAP, bytes);
+		return NULL;
+	}
+	stored->pixels = pixels;
+	stored->width = width;
+	stored->height = height;
+	stored->hash = hash;
+	stored->refs = 1;
+	stored->indexed = false;
+	return stored;
+}
+
+void BitmapStore::destroy(StoredPixels* stored)
+{
+	delete[] stored->pixels;
+	MemoryGovernor::getInstance()->release(MEMORY_OWNER_STORED_BITMAP, (int64_t) stored->width * stored->height * 4);
+	delete stored;
+}
+
+void BitmapStore::unindex(StoredPixels* stored)
+{
+	if (!stored->indexed)
+		return;
+	auto range = mIndex.equal_range(stored->hash);
+	for (auto it = range.first; it != range.second; ++it) {
+		if (it->second == stored) {
+			mIndex.erase(it);
+			break;
+		}
+	}
+	stored->indexed = false;
+}
+
+JniBitmap* BitmapStore::store(const ImageView& image, const AndroidBitmapInfo& info)
+{
+	// copy and hash in one pass, streaming the stores past the caches as
+	// the plain copy did; without room for the copy, hash in place in case
+	// the pixels are stored already
+	StoredPixels* fresh = allocate(image.width, image.height, ContentHash::NONE);
+	uint64_t hash = fresh != NULL ? ContentHash::copy(image, viewOf(fresh), PixelCopy::STREAM)
+			: ContentHash::hash(image);
+
+	JniBitmap* bitmap = new JniBitmap();
+	bitmap->_bitmapInfo = info;
+	// the bitmap's rows may be padded, the stored copy is packed
+	bitmap->_bitmapInfo.stride = image.width * 4;
+	bitmap->_contentHash = hash;
+
+	std::unique_lock<std::mutex> lock(mLock);
+	StoredPixels* stored = NULL;
+	auto range = mIndex.equal_range(hash);
+	for (auto it = range.first; it != range.second && stored == NULL; ++it) {
+		if (ContentHash::equal(image, viewOf(it->second)))
+			stored = it->second;
+	}
+	if (stored != NULL) {
+		stored->refs++;
+	} else if (fresh != NULL) {
+		stored = fresh;
+		stored->hash = hash;
+		stored->indexed = true;
+		mIndex.insert(std::make_pair(hash, stored));
+		fresh = NULL;
+	} else {
+		lock.unlock();
+		LOGE("no memory to store a %dx%d bitmap", image.width, image.height);
+		delete bitmap;
+		return NULL;
+	}
+	lock.unlock();
+
+	if (fresh != NULL)
+		destroy(fresh);
+	bitmap->_stored = stored;
+	bitmap->_storedBitmapPixels = stored->pixels;
+	return bitmap;
+}
+
+void BitmapStore::free(JniBitmap* bitmap)
+{
+	StoredPixels* stored = bitmap->_stored;
+	if (stored != NULL) {
+		std::lock_guard<std::mutex> lock(mLock);
+		if (--stored->refs == 0)
+			unindex(stored);
+		else
+			stored = NULL;
+	}
+	if (stored != NULL)
+		destroy(stored);
+	bitmap->_stored = NULL;
+	bitmap->_storedBitmapPixels = NULL;
+	delete bitmap;
+}
+
+bool BitmapStore::detach(JniBitmap* bitmap)
+{
+	StoredPixels* stored = bitmap->_stored;
+	bitmap->_contentHash = ContentHash::NONE;
+	if (stored == NULL)
+		return true;
+	std::lock_guard<std::mutex> lock(mLock);
+	if (stored->refs == 1) {
+		unindex(stored);
+		return true;
+	}
+	// the other handles keep the indexed buffer, this one moves to a copy
+	StoredPixels* copy = allocate(stored->width, stored->height, stored->hash);
+	if (copy == NULL) {
+		LOGE("no memory to detach a shared %dx%d bitmap", stored->width, stored->height);
+		return false;
+	}
+	PixelCopy::copy(viewOf(stored), viewOf(copy), 0);
+	stored->refs--;
+	bitmap->_stored = copy;
+	bitmap->_storedBitmapPixels = copy->pixels;
+	return true;
+}
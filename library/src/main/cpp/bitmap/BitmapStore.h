@@ -0,0 +1,46 @@
+#ifndef _BITMAP_STORE_H_
+#define _BITMAP_STORE_H_
+
+#include <stdint.h>
+#include <mutex>
+#include <unordered_map>
+#include "JniBitmap.h"
+
+/**
+ * The native copies behind jniStoreBitmapData handles. Every copy is
+ * hashed as it is made (see ContentHash), and a bitmap whose pixels match
+ * one already stored gets a handle on the same buffer instead of a
+ * second one: re-opening a photo costs no memory, and its hash lets
+ * MagicBeautify recognise the image and keep its precomputed state.
+ *
+ * Shared buffers are copy-on-write. Code that writes into a stored bitmap
+ * calls detach() first, which gives the handle a buffer of its own and
+ * takes it out of the index, so neither the other handles nor a later
+ * store see the change.
+ */
+class BitmapStore
+{
+public:
+	static BitmapStore* getInstance();
+
+	// a handle on a packed copy of image, NULL when the memory budget
+	// cannot hold one and no stored bitmap has the same pixels
+	JniBitmap* store(const ImageView& image, const AndroidBitmapInfo& info);
+	void free(JniBitmap* bitmap);
+	// call before writing into the pixels: clears the handle's content
+	// hash; false when a shared buffer had to be copied and the copy does
+	// not fit the budget. Bitmaps not made by store() are left alone.
+	bool detach(JniBitmap* bitmap);
+
+private:
+	static BitmapStore* instance;
+	BitmapStore();
+
+	static StoredPixels* allocate(int width, int height, uint64_t hash);
+	static void destroy(StoredPixels* pixels);
+	void unindex(StoredPixels* pixels);
+
+	std::mutex mLock;
+	std::unordered_multimap<uint64_t, StoredPixels*> mIndex;
+};
+#endif
@@ -0,0 +1,244 @@
+#include "Compositor.h"
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include <vector>
+#include "../utils/ThreadPool.h"
+#include "../utils/MagicLog.h"
+
+#if defined(__aarch64__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define COMPOSITOR_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define COMPOSITOR_SSE 1
+#endif
+
+#define  LOG_TAG    "Compositor"
+
+// source coordinates are 16.16 fixed point
+static const int kMaxSpriteSize = 32767;
+
+typedef struct
+{
+	const Sprite* sprite;
+	// destination pixel centre to source texel centre:
+	// u = inverse[0] * x + inverse[1] * y + inverse[2], v likewise with 3..5
+	float inverse[6];
+	// destination bounds, right and bottom exclusive
+	int left;
+	int top;
+	int right;
+	int bottom;
+	// opacity as 0..256
+	int alpha;
+} Placement;
+
+/**
+ * One destination pixel: bilinear sample of the 2x2 texels at row0[0..1]
+ * and row1[0..1] with 8-bit weights fx, fy, scaled by alpha and blended
+ * source-over (premultiplied) into *dst. Every intermediate fits 16 bits,
+ * so the SIMD paths and the scalar one round identically.
+ */
+static inline void blendPixel(const uint32_t* row0, const uint32_t* row1, int fx, int fy, int alpha,
+		uint32_t* dst)
+{
+#if COMPOSITOR_NEON
+	uint16x8_t top = vmovl_u8(vld1_u8((const uint8_t*) row0));
+	uint16x8_t bottom = vmovl_u8(vld1_u8((const uint8_t*) row1));
+	uint16x8_t v = vmlaq_n_u16(vmulq_n_u16(top, (uint16_t) (256 - fy)), bottom, (uint16_t) fy);
+	v = vshrq_n_u16(vaddq_u16(v, vdupq_n_u16(128)), 8);
+	uint16x4_t s = vmla_n_u16(vmul_n_u16(vget_low_u16(v), (uint16_t) (256 - fx)), vget_high_u16(v), (uint16_t) fx);
+	s = vshr_n_u16(vadd_u16(s, vdup_n_u16(128)), 8);
+	s = vshr_n_u16(vadd_u16(vmul_n_u16(s, (uint16_t) alpha), vdup_n_u16(128)), 8);
+	uint16x4_t inverse = vsub_u16(vdup_n_u16(255), vdup_lane_u16(s, 3));
+	uint16x4_t d = vget_low_u16(vmovl_u8(vreinterpret_u8_u32(vdup_n_u32(*dst))));
+	uint16x4_t t = vadd_u16(vmul_u16(d, inverse), vdup_n_u16(128));
+	t = vshr_n_u16(vadd_u16(t, vshr_n_u16(t, 8)), 8);
+	uint8x8_t out = vqmovn_u16(vcombine_u16(vadd_u16(s, t), vdup_n_u16(0)));
+	*dst = vget_lane_u32(vreinterpret_u32_u8(out), 0);
+#elif COMPOSITOR_SSE
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i half = _mm_set1_epi16(128);
+	__m128i top = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) row0), zero);
+	__m128i bottom = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) row1), zero);
+	__m128i v = _mm_add_epi16(_mm_mullo_epi16(top, _mm_set1_epi16((short) (256 - fy))),
+			_mm_mullo_epi16(bottom, _mm_set1_epi16((short) fy)));
+	v = _mm_srli_epi16(_mm_add_epi16(v, half), 8);
+	// left texel in the low four lanes, right in the high four
+	__m128i h = _mm_mullo_epi16(v, _mm_set_epi16(fx, fx, fx, fx, 256 - fx, 256 - fx, 256 - fx, 256 - fx));
+	__m128i s = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(h, _mm_srli_si128(h, 8)), half), 8);
+	s = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(s, _mm_set1_epi16((short) alpha)), half), 8);
+	__m128i inverse = _mm_sub_epi16(_mm_set1_epi16(255), _mm_shufflelo_epi16(s, _MM_SHUFFLE(3, 3, 3, 3)));
+	__m128i d = _mm_unpacklo_epi8(_mm_cvtsi32_si128((int) *dst), zero);
+	__m128i t = _mm_add_epi16(_mm_mullo_epi16(d, inverse), half);
+	t = _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+	*dst = (uint32_t) _mm_cvtsi128_si32(_mm_packus_epi16(_mm_add_epi16(s, t), zero));
+#else
+	const uint8_t* p00 = (const uint8_t*) row0;
+	const uint8_t* p10 = (const uint8_t*) row1;
+	int s[4];
+	for (int c = 0; c < 4; c++) {
+		int left = (p00[c] * (256 - fy) + p10[c] * fy + 128) >> 8;
+		int right = (p00[c + 4] * (256 - fy) + p10[c + 4] * fy + 128) >> 8;
+		s[c] = (((left * (256 - fx) + right * fx + 128) >> 8) * alpha + 128) >> 8;
+	}
+	uint8_t* d = (uint8_t*) dst;
+	for (int c = 0; c < 4; c++) {
+		int t = d[c] * (255 - s[3]) + 128;
+		int out = s[c] + ((t + (t >> 8)) >> 8);
+		d[c] = out > 255 ? 255 : out;
+	}
+#endif
+}
+
+// narrows [*from, *to] to the x where lo <= start + step * x <= hi
+static void clipSpan(float start, float step, float lo, float hi, float* from, float* to)
+{
+	if (step == 0) {
+		if (start < lo || start > hi)
+			*to = *from - 1;
+		return;
+	}
+	float a = (lo - start) / step, b = (hi - start) / step;
+	if (a > b) {
+		float t = a;
+		a = b;
+		b = t;
+	}
+	if (a > *from)
+		*from = a;
+	if (b < *to)
+		*to = b;
+}
+
+static void drawSpan(const Placement& p, const ImageView& dst, int y, int left, int right)
+{
+	const ImageView& image = p.sprite->image;
+	const int w = image.width, h = image.height;
+	float cx = left + 0.5f, cy = y + 0.5f;
+	float u = p.inverse[0] * cx + p.inverse[1] * cy + p.inverse[2];
+	float v = p.inverse[3] * cx + p.inverse[4] * cy + p.inverse[5];
+	// only pixels whose 2x2 footprint touches the sprite, one extra either
+	// side for rounding; the fixed point test below is exact
+	float from = -1, to = right - left;
+	clipSpan(u, p.inverse[0], -1, w, &from, &to);
+	clipSpan(v, p.inverse[3], -1, h, &from, &to);
+	if (from > to)
+		return;
+	int first = left + (from > 0 ? (int) from : 0);
+	int last = left + (to < right - left - 1 ? (int) to + 1 : right - left - 1);
+	u += p.inverse[0] * (first - left);
+	v += p.inverse[3] * (first - left);
+	int32_t ufix = (int32_t) lrintf(u * 65536), vfix = (int32_t) lrintf(v * 65536);
+	const int32_t ustep = (int32_t) lrintf(p.inverse[0] * 65536), vstep = (int32_t) lrintf(p.inverse[3] * 65536);
+	uint32_t* out = dst.row32(y);
+	uint32_t edge[4];
+	for (int x = first; x <= last; x++, ufix += ustep, vfix += vstep) {
+		int x0 = ufix >> 16, y0 = vfix >> 16;
+		if (x0 < -1 || x0 >= w || y0 < -1 || y0 >= h)
+			continue;
+		int fx = (ufix >> 8) & 255, fy = (vfix >> 8) & 255;
+		if (x0 >= 0 && x0 < w - 1 && y0 >= 0 && y0 < h - 1) {
+			const uint32_t* row0 = image.row32(y0) + x0;
+			blendPixel(row0, image.row32(y0 + 1) + x0, fx, fy, p.alpha, out + x);
+		} else {
+			// texels outside the sprite are transparent, which fades its edges
+			for (int k = 0; k < 4; k++) {
+				int tx = x0 + (k & 1), ty = y0 + (k >> 1);
+				edge[k] = tx >= 0 && tx < w && ty >= 0 && ty < h ? image.row32(ty)[tx] : 0;
+			}
+			blendPixel(edge, edge + 2, fx, fy, p.alpha, out + x);
+		}
+	}
+}
+
+void Compositor::draw(const ImageView& dst, const Sprite* sprites, int count)
+{
+	if (dst.isEmpty() || dst.format != ImageView::FORMAT_RGBA_8888 || sprites == NULL || count <= 0)
+		return;
+	std::vector<Placement> placements;
+	placements.reserve(count);
+	for (int i = 0; i < count; i++) {
+		const Sprite& s = sprites[i];
+		const float* m = s.matrix;
+		if (s.image.isEmpty() || s.image.format != ImageView::FORMAT_RGBA_8888 || !(s.opacity > 0))
+			continue;
+		if (s.image.width > kMaxSpriteSize || s.image.height > kMaxSpriteSize) {
+			LOGE("sprite %d is %dx%d, larger than %d pixels", i, s.image.width, s.image.height, kMaxSpriteSize);
+			continue;
+		}
+		float det = m[0] * m[4] - m[1] * m[3];
+		if (fabsf(det) < 1e-8f)
+			continue;
+		Placement p;
+		p.sprite = &s;
+		p.alpha = s.opacity >= 1 ? 256 : (int) (s.opacity * 256 + 0.5f);
+		// inverse matrix, then shifted to texel centres
+		p.inverse[0] = m[4] / det;
+		p.inverse[1] = -m[1] / det;
+		p.inverse[2] = (m[1] * m[5] - m[4] * m[2]) / det - 0.5f;
+		p.inverse[3] = -m[3] / det;
+		p.inverse[4] = m[0] / det;
+		p.inverse[5] = (m[3] * m[2] - m[0] * m[5]) / det - 0.5f;
+		// bounds of the sprite grown by the half texel its edges fade over
+		float minX = 1e30f, minY = 1e30f, maxX = -1e30f, maxY = -1e30f;
+		for (int k = 0; k < 4; k++) {
+			float x = k & 1 ? s.image.width + 0.5f : -0.5f;
+			float y = k & 2 ? s.image.height + 0.5f : -0.5f;
+			float dx = m[0] * x + m[1] * y + m[2], dy = m[3] * x + m[4] * y + m[5];
+			minX = dx < minX ? dx : minX;
+			maxX = dx > maxX ? dx : maxX;
+			minY = dy < minY ? dy : minY;
+			maxY = dy > maxY ? dy : maxY;
+		}
+		p.left = minX > 0 ? (int) floorf(minX) : 0;
+		p.top = minY > 0 ? (int) floorf(minY) : 0;
+		p.right = maxX < dst.width ? (int) ceilf(maxX) : dst.width;
+		p.bottom = maxY < dst.height ? (int) ceilf(maxY) : dst.height;
+		if (p.left < p.right && p.top < p.bottom)
+			placements.push_back(p);
+	}
+	if (placements.empty())
+		return;
+
+	// bin the sprites into the tiles they cover, keeping list order per tile
+	const int tilesX = (dst.width + TILE_SIZE - 1) / TILE_SIZE;
+	const int tilesY = (dst.height + TILE_SIZE - 1) / TILE_SIZE;
+	std::vector<int> start(tilesX * tilesY + 1, 0);
+	for (size_t i = 0; i < placements.size(); i++) {
+		const Placement& p = placements[i];
+		for (int ty = p.top / TILE_SIZE; ty <= (p.bottom - 1) / TILE_SIZE; ty++)
+			for (int tx = p.left / TILE_SIZE; tx <= (p.right - 1) / TILE_SIZE; tx++)
+				start[ty * tilesX + tx + 1]++;
+	}
+	std::vector<int> covered;
+	for (int t = 0; t < tilesX * tilesY; t++) {
+		if (start[t + 1] != 0)
+			covered.push_back(t);
+		start[t + 1] += start[t];
+	}
+	std::vector<int> bins(start[tilesX * tilesY]);
+	std::vector<int> fill(start.begin(), start.end() - 1);
+	for (size_t i = 0; i < placements.size(); i++) {
+		const Placement& p = placements[i];
+		for (int ty = p.top / TILE_SIZE; ty <= (p.bottom - 1) / TILE_SIZE; ty++)
+			for (int tx = p.left / TILE_SIZE; tx <= (p.right - 1) / TILE_SIZE; tx++)
+				bins[fill[ty * tilesX + tx]++] = i;
+	}
+
+	ThreadPool::getInstance()->parallelFor(covered.size(), [&](int job) {
+		int tile = covered[job];
+		int tileLeft = tile % tilesX * TILE_SIZE, tileTop = tile / tilesX * TILE_SIZE;
+		int tileRight = tileLeft + TILE_SIZE < dst.width ? tileLeft + TILE_SIZE : dst.width;
+		int tileBottom = tileTop + TILE_SIZE < dst.height ? tileTop + TILE_SIZE : dst.height;
+		for (int b = start[tile]; b < start[tile + 1]; b++) {
+			const Placement& p = placements[bins[b]];
+			int left = p.left > tileLeft ? p.left : tileLeft;
+			int right = p.right < tileRight ? p.right : tileRight;
+			int bottom = p.bottom < tileBottom ? p.bottom : tileBottom;
+			for (int y = p.top > tileTop ? p.top : tileTop; y < bottom; y++)
+				drawSpan(p, dst, y, left, right);
+		}
+	});
+}
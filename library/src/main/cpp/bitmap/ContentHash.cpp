@@ -0,0 +1,190 @@
+#include "ContentHash.h"
+#include <string.h>
+#include <vector>
+#include "PixelCopy.h"
+#include "../utils/ThreadPool.h"
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#define CONTENT_HASH_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define CONTENT_HASH_SSE 1
+#endif
+
+// below this hashing is cheaper than waking the pool
+static const int64_t kParallelBytes = 1 << 20;
+static const int kRowsPerBand = 32;
+
+static const uint64_t kPrime1 = 0x9e3779b185ebca87ULL;
+static const uint64_t kPrime2 = 0xc2b2ae3d27d4eb4fULL;
+static const uint64_t kPrime3 = 0x165667b19e3779f9ULL;
+// starting keys of the two lanes
+static const uint64_t kKey0 = 0xbe4ba423396cfeb8ULL;
+static const uint64_t kKey1 = 0x1cad21f72c81017cULL;
+
+static inline uint64_t avalanche(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= kPrime2;
+	h ^= h >> 29;
+	h *= kPrime3;
+	h ^= h >> 32;
+	return h;
+}
+
+static inline uint64_t load64(const uint8_t* p)
+{
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+typedef struct
+{
+	uint64_t acc[2];
+	uint64_t key[2];
+} Lanes;
+
+// one 16 byte block; the reference the vector loops below must match
+static inline void mixBlock(Lanes* lanes, uint64_t lo, uint64_t hi)
+{
+	uint64_t d0 = lo ^ lanes->key[0];
+	uint64_t d1 = hi ^ lanes->key[1];
+	lanes->acc[0] += (d0 & 0xffffffffu) * (d0 >> 32) + hi;
+	lanes->acc[1] += (d1 & 0xffffffffu) * (d1 >> 32) + lo;
+	lanes->key[0] += kPrime1;
+	lanes->key[1] += kPrime2;
+}
+
+// hash of one row of bytes, copied to dst on the way unless dst is NULL;
+// stream needs dst 16 byte aligned for SSE2
+static uint64_t hashRow(const uint8_t* src, uint8_t* dst, size_t bytes, bool stream)
+{
+	Lanes lanes;
+	lanes.acc[0] = kPrime3;
+	lanes.acc[1] = kPrime2;
+	lanes.key[0] = kKey0;
+	lanes.key[1] = kKey1;
+	size_t j = 0;
+#if defined(CONTENT_HASH_NEON)
+	uint64x2_t acc = vld1q_u64(lanes.acc);
+	uint64x2_t key = vld1q_u64(lanes.key);
+	const uint64_t steps[2] = { kPrime1, kPrime2 };
+	const uint64x2_t step = vld1q_u64(steps);
+	for (; j + 16 <= bytes; j += 16) {
+		uint8x16_t raw = vld1q_u8(src + j);
+		if (stream)
+			__asm__ volatile("stnp %d0, %d1, [%2]" : : "w"(vget_low_u8(raw)), "w"(vget_high_u8(raw)),
+					"r"(dst + j) : "memory");
+		else if (dst != NULL)
+			vst1q_u8(dst + j, raw);
+		uint64x2_t v = vreinterpretq_u64_u8(raw);
+		uint64x2_t d = veorq_u64(v, key);
+		uint64x2_t product = vmull_u32(vmovn_u64(d), vshrn_n_u64(d, 32));
+		acc = vaddq_u64(acc, vaddq_u64(product, vextq_u64(v, v, 1)));
+		key = vaddq_u64(key, step);
+	}
+	vst1q_u64(lanes.acc, acc);
+	vst1q_u64(lanes.key, key);
+#elif defined(CONTENT_HASH_SSE)
+	__m128i acc = _mm_loadu_si128((const __m128i*) lanes.acc);
+	__m128i key = _mm_loadu_si128((const __m128i*) lanes.key);
+	const __m128i step = _mm_set_epi64x((long long) kPrime2, (long long) kPrime1);
+	for (; j + 16 <= bytes; j += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*) (src + j));
+		if (stream)
+			_mm_stream_si128((__m128i*) (dst + j), v);
+		else if (dst != NULL)
+			_mm_storeu_si128((__m128i*) (dst + j), v);
+		__m128i d = _mm_xor_si128(v, key);
+		// low half times high half of each 64-bit lane
+		__m128i product = _mm_mul_epu32(d, _mm_shuffle_epi32(d, _MM_SHUFFLE(3, 3, 1, 1)));
+		acc = _mm_add_epi64(acc, _mm_add_epi64(product, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2))));
+		key = _mm_add_epi64(key, step);
+	}
+	_mm_storeu_si128((__m128i*) lanes.acc, acc);
+	_mm_storeu_si128((__m128i*) lanes.key, key);
+#else
+	(void) stream;
+#endif
+	for (; j + 16 <= bytes; j += 16) {
+		if (dst != NULL)
+			memcpy(dst + j, src + j, 16);
+		mixBlock(&lanes, load64(src + j), load64(src + j + 8));
+	}
+	if (j < bytes) {
+		// zero padded; every row of an image has the same length
+		uint8_t tail[16] = { 0 };
+		memcpy(tail, src + j, bytes - j);
+		if (dst != NULL)
+			memcpy(dst + j, src + j, bytes - j);
+		mixBlock(&lanes, load64(tail), load64(tail + 8));
+	}
+	return avalanche(lanes.acc[0] ^ ((lanes.acc[1] << 31) | (lanes.acc[1] >> 33)) ^ bytes);
+}
+
+static uint64_t hashRows(const ImageView& src, const ImageView* dst, int flags)
+{
+	const int width = dst != NULL && dst->width < src.width ? dst->width : src.width;
+	const int height = dst != NULL && dst->height < src.height ? dst->height : src.height;
+	if (src.pixels == NULL || width <= 0 || height <= 0 || (dst != NULL && dst->pixels == NULL))
+		return ContentHash::NONE;
+	const size_t rowBytes = (size_t) width * ImageView::bytesPerPixel(src.format);
+	int64_t bytes = (int64_t) rowBytes * height;
+	bool stream = (flags & PixelCopy::STREAM) && bytes >= PixelCopy::STREAM_MIN_BYTES;
+	int bands = bytes < kParallelBytes ? 1 : (height + kRowsPerBand - 1) / kRowsPerBand;
+	int rowsPerBand = (height + bands - 1) / bands;
+	std::vector<uint64_t> sums(bands, 0);
+	ThreadPool::getInstance()->parallelFor(bands, [&](int band) {
+		int start = band * rowsPerBand;
+		int end = start + rowsPerBand < height ? start + rowsPerBand : height;
+		uint64_t sum = 0;
+		for (int i = start; i < end; i++) {
+			uint8_t* to = dst != NULL ? dst->row(i) : NULL;
+#if defined(CONTENT_HASH_SSE)
+			// MOVNTDQ needs an aligned row, which packed stored bitmaps have
+			bool streamRow = stream && ((uintptr_t) to & 15) == 0;
+#else
+			bool streamRow = stream;
+#endif
+			uint64_t row = hashRow(src.row(i), to, rowBytes, streamRow);
+			// the row number keeps rows from trading places unnoticed
+			sum += avalanche(row + (uint64_t) (i + 1) * kPrime1);
+		}
+#if defined(CONTENT_HASH_SSE)
+		if (stream)
+			_mm_sfence();
+#endif
+		sums[band] = sum;
+	});
+	uint64_t h = avalanche(((uint64_t) rowBytes << 32 | (uint32_t) height) ^ kPrime3);
+	for (int band = 0; band < bands; band++)
+		h += sums[band];
+	h = avalanche(h);
+	return h != ContentHash::NONE ? h : 1;
+}
+
+uint64_t ContentHash::copy(const ImageView& src, const ImageView& dst, int flags)
+{
+	return hashRows(src, &dst, flags);
+}
+
+uint64_t ContentHash::hash(const ImageView& image)
+{
+	return hashRows(image, NULL, 0);
+}
+
+bool ContentHash::equal(const ImageView& a, const ImageView& b)
+{
+	if (a.width != b.width || a.height != b.height || a.format != b.format)
+		return false;
+	if (a.pixels == b.pixels && a.stride == b.stride)
+		return true;
+	const size_t rowBytes = (size_t) a.width * ImageView::bytesPerPixel(a.format);
+	for (int i = 0; i < a.height; i++) {
+		if (memcmp(a.row(i), b.row(i), rowBytes) != 0)
+			return false;
+	}
+	return true;
+}
@@ -0,0 +1,34 @@
+#ifndef _CONTENT_HASH_H_
+#define _CONTENT_HASH_H_
+
+#include <stdint.h>
+#include "ImageView.h"
+
+/**
+ * 64-bit hash of the pixels of an image, for finding repeated inputs.
+ * copy() computes it on the way through a copy, so storing a bitmap reads
+ * its pixels once either way.
+ *
+ * Every row is hashed on its own, 16 bytes at a time: the block is mixed
+ * with a key that advances along the row and its two 32-bit halves are
+ * multiplied and accumulated with the data, two 64-bit lanes wide, as
+ * XXH3 does. Row hashes are mixed with their row number and summed, so
+ * bands run in parallel and the hash does not depend on the band split,
+ * the strides or the instruction set. It is not cryptographic: callers
+ * compare the pixels before they treat two images as the same.
+ */
+class ContentHash
+{
+public:
+	// never returned, so callers can keep it for "not known"
+	static const uint64_t NONE = 0;
+
+	// copies src into dst, clipped to the smaller view, and hashes what was
+	// copied; both views have the same format. PixelCopy::STREAM in flags
+	// streams the stores past the caches on the same terms as PixelCopy.
+	static uint64_t copy(const ImageView& src, const ImageView& dst, int flags = 0);
+	static uint64_t hash(const ImageView& image);
+	// same size, format and pixels; row padding is ignored
+	static bool equal(const ImageView& a, const ImageView& b);
+};
+#endif
@@ -1,30 +1,125 @@
 #include "Conversion.h"
 
-void Conversion::YCbCrToRGB(uint8_t* From, uint8_t* To, int length)
+static inline int clampChroma(float v)
+{
+	int c = (int) (v + 128.5f);
+	return c < 0 ? 0 : c > 255 ? 255 : c;
+}
+
+int Conversion::planeChroma(int chroma)
+{
+	float Cb = (float) ((chroma >> 8) & 0xff) - 128, Cr = (float) (chroma & 0xff) - 128;
+	// the colour at zero luma, then read back with red and blue in each other's place
+	float Red = RGBRCbF * Cb + RGBRCrF * Cr;
+	float Green = RGBGCbF * Cb + RGBGCrF * Cr;
+	float Blue = RGBBCbF * Cb + RGBBCrF * Cr;
+	int planeCb = clampChroma(YCbCrCbRF * Blue + YCbCrCbGF * Green + YCbCrCbBF * Red);
+	int planeCr = clampChroma(YCbCrCrRF * Blue + YCbCrCrGF * Green + YCbCrCrBF * Red);
+	return planeCb << 8 | planeCr;
+}
+
+int32_t Conversion::convertArgbToInt(ARGB argb)
+{
+	return (argb.alpha << 24) | (argb.red << 16) | (argb.green << 8) | argb.blue;
+}
+
+void Conversion::convertIntToArgb(uint32_t pixel, ARGB* argb)
+{
+	argb->red = ((pixel >> 16) & 0xff);
+	argb->green = ((pixel >> 8) & 0xff);
+	argb->blue = (pixel & 0xff);
+	argb->alpha = (pixel >> 24);
+}
+
+void Conversion::YCbCrToRGB(const ImageView& from, const ImageView& to)
+{
+	int width = from.width < to.width ? from.width : to.width;
+	int height = from.height < to.height ? from.height : to.height;
+	// whole packed images are one long row
+	if (from.isPacked() && to.isPacked() && from.width == to.width) {
+		YCbCrToRGBRow(from.pixels, to.pixels, width * height);
+		return;
+	}
+	for (int i = 0; i < height; i++)
+		YCbCrToRGBRow(from.row(i), to.row(i), width);
+}
+
+void Conversion::YCbCrToRGB(const ImageView& from, const ImageView& to, const ImageView& mask,
+		const uint16_t* chroma)
+{
+	int width = from.width < to.width ? from.width : to.width;
+	int height = from.height < to.height ? from.height : to.height;
+	width = width < mask.width ? width : mask.width;
+	height = height < mask.height ? height : mask.height;
+	if (from.isPacked() && to.isPacked() && mask.isPacked() && from.width == to.width && from.width == mask.width) {
+		YCbCrToRGBRow(from.pixels, to.pixels, mask.pixels, chroma, width * height);
+		return;
+	}
+	for (int i = 0; i < height; i++)
+		YCbCrToRGBRow(from.row(i), to.row(i), mask.row(i), chroma, width);
+}
+
+void Conversion::RGBToYCbCr(const ImageView& from, const ImageView& to)
+{
+	int width = from.width < to.width ? from.width : to.width;
+	int height = from.height < to.height ? from.height : to.height;
+	if (from.isPacked() && to.isPacked() && from.width == to.width) {
+		RGBToYCbCrRow(from.pixels, to.pixels, width * height);
+		return;
+	}
+	for (int i = 0; i < height; i++)
+		RGBToYCbCrRow(from.row(i), to.row(i), width);
+}
+
+static inline void storeRGB(int Y, int Cb, int Cr, uint8_t* To)
 {
-	if (length < 1) return;
 	int Red, Green, Blue;
-	int Y, Cb, Cr;
+	Cb -= 128; Cr -= 128;
+	Red = Y + ((RGBRCrI * Cr + HalfShiftValue) >> Shift);
+	Green = Y + ((RGBGCbI * Cb + RGBGCrI * Cr + HalfShiftValue) >> Shift);
+	Blue = Y + ((RGBBCbI * Cb + HalfShiftValue) >> Shift);
+	if (Red > 255) Red = 255; else if (Red < 0) Red = 0;
+	if (Green > 255) Green = 255; else if (Green < 0) Green = 0;
+	if (Blue > 255) Blue = 255; else if (Blue < 0) Blue = 0;
+	To[0] = (uint8_t)Blue;
+	To[1] = (uint8_t)Green;
+	To[2] = (uint8_t)Red;
+	To[3] = 0xff;
+}
+
+void Conversion::YCbCrToRGBRow(const uint8_t* From, uint8_t* To, int length)
+{
+	if (length < 1) return;
 	int i,offset;
 	for(i = 0; i < length; i++)
 	{
 		offset = (i << 1) + i;
-		Y = From[offset]; Cb = From[offset+1] - 128; Cr = From[offset+2] - 128;
-		Red = Y + ((RGBRCrI * Cr + HalfShiftValue) >> Shift);
-		Green = Y + ((RGBGCbI * Cb + RGBGCrI * Cr + HalfShiftValue) >> Shift);
-		Blue = Y + ((RGBBCbI * Cb + HalfShiftValue) >> Shift);
-		if (Red > 255) Red = 255; else if (Red < 0) Red = 0;
-		if (Green > 255) Green = 255; else if (Green < 0) Green = 0;
-		if (Blue > 255) Blue = 255; else if (Blue < 0) Blue = 0;
-		offset = i << 2;
-		To[offset] = (uint8_t)Blue;
-		To[offset+1] = (uint8_t)Green;
-		To[offset+2] = (uint8_t)Red;
-		To[offset+3] = 0xff;
+		storeRGB(From[offset], From[offset+1], From[offset+2], To + (i << 2));
+	}
+}
+
+void Conversion::YCbCrToRGBRow(const uint8_t* From, uint8_t* To, const uint8_t* Mask, const uint16_t* Chroma,
+		int length)
+{
+	if (length < 1) return;
+	int Cb, Cr, Weight;
+	int i,offset;
+	for(i = 0; i < length; i++)
+	{
+		offset = (i << 1) + i;
+		Cb = From[offset+1]; Cr = From[offset+2];
+		Weight = Mask[i];
+		if (Weight != 0)
+		{
+			int Mapped = Chroma[(Cb << 8) | Cr];
+			Cb += ((Mapped & 0xff) - Cb) * Weight / 255;
+			Cr += ((Mapped >> 8) - Cr) * Weight / 255;
+		}
+		storeRGB(From[offset], Cb, Cr, To + (i << 2));
 	}
 }
 
-void Conversion::RGBToYCbCr(uint8_t* From, uint8_t* To, int length)
+void Conversion::RGBToYCbCrRow(const uint8_t* From, uint8_t* To, int length)
 {
 	if (length < 1) return;
 	int Red, Green, Blue;
@@ -2,57 +2,88 @@
 #define _CONVERSION_H_
 
 #include <stdio.h>
-#include <android/log.h>
-
-const float YCbCrYRF = 0.299F;
-const float YCbCrYGF = 0.587F;
-const float YCbCrYBF = 0.114F;
-const float YCbCrCbRF = -0.168736F;
-const float YCbCrCbGF = -0.331264F;
-const float YCbCrCbBF = 0.500000F;
-const float YCbCrCrRF = 0.500000F;
-const float YCbCrCrGF = -0.418688F;
-const float YCbCrCrBF = -0.081312F;
-
-const float RGBRYF = 1.00000F;
-const float RGBRCbF = 0.0000F;
-const float RGBRCrF = 1.40200F;
-const float RGBGYF = 1.00000F;
-const float RGBGCbF = -0.34414F;
-const float RGBGCrF = -0.71414F;
-const float RGBBYF = 1.00000F;
-const float RGBBCbF = 1.77200F;
-const float RGBBCrF = 0.00000F;
-
-const int Shift = 20;
-const int HalfShiftValue = 1 << (Shift - 1);
-
-const int YCbCrYRI = (int)(YCbCrYRF * (1 << Shift) + 0.5);
-const int YCbCrYGI = (int)(YCbCrYGF * (1 << Shift) + 0.5);
-const int YCbCrYBI = (int)(YCbCrYBF * (1 << Shift) + 0.5);
-const int YCbCrCbRI = (int)(YCbCrCbRF * (1 << Shift) + 0.5);
-const int YCbCrCbGI = (int)(YCbCrCbGF * (1 << Shift) + 0.5);
-const int YCbCrCbBI = (int)(YCbCrCbBF * (1 << Shift) + 0.5);
-const int YCbCrCrRI = (int)(YCbCrCrRF * (1 << Shift) + 0.5);
-const int YCbCrCrGI = (int)(YCbCrCrGF * (1 << Shift) + 0.5);
-const int YCbCrCrBI = (int)(YCbCrCrBF * (1 << Shift) + 0.5);
-
-const int RGBRYI = (int)(RGBRYF * (1 << Shift) + 0.5);
-const int RGBRCbI = (int)(RGBRCbF * (1 << Shift) + 0.5);
-const int RGBRCrI = (int)(RGBRCrF * (1 << Shift) + 0.5);
-const int RGBGYI = (int)(RGBGYF * (1 << Shift) + 0.5);
-const int RGBGCbI = (int)(RGBGCbF * (1 << Shift) + 0.5);
-const int RGBGCrI = (int)(RGBGCrF * (1 << Shift) + 0.5);
-const int RGBBYI = (int)(RGBBYF * (1 << Shift) + 0.5);
-const int RGBBCbI = (int)(RGBBCbF * (1 << Shift) + 0.5);
-const int RGBBCrI = (int)(RGBBCrF * (1 << Shift) + 0.5);
+#include <stdint.h>
+#include "ImageView.h"
 
+constexpr float YCbCrYRF = 0.299F;
+constexpr float YCbCrYGF = 0.587F;
+constexpr float YCbCrYBF = 0.114F;
+constexpr float YCbCrCbRF = -0.168736F;
+constexpr float YCbCrCbGF = -0.331264F;
+constexpr float YCbCrCbBF = 0.500000F;
+constexpr float YCbCrCrRF = 0.500000F;
+constexpr float YCbCrCrGF = -0.418688F;
+constexpr float YCbCrCrBF = -0.081312F;
+
+constexpr float RGBRYF = 1.00000F;
+constexpr float RGBRCbF = 0.0000F;
+constexpr float RGBRCrF = 1.40200F;
+constexpr float RGBGYF = 1.00000F;
+constexpr float RGBGCbF = -0.34414F;
+constexpr float RGBGCrF = -0.71414F;
+constexpr float RGBBYF = 1.00000F;
+constexpr float RGBBCbF = 1.77200F;
+constexpr float RGBBCrF = 0.00000F;
+
+constexpr int Shift = 20;
+constexpr int HalfShiftValue = 1 << (Shift - 1);
+
+constexpr int YCbCrYRI = (int)(YCbCrYRF * (1 << Shift) + 0.5);
+constexpr int YCbCrYGI = (int)(YCbCrYGF * (1 << Shift) + 0.5);
+constexpr int YCbCrYBI = (int)(YCbCrYBF * (1 << Shift) + 0.5);
+constexpr int YCbCrCbRI = (int)(YCbCrCbRF * (1 << Shift) + 0.5);
+constexpr int YCbCrCbGI = (int)(YCbCrCbGF * (1 << Shift) + 0.5);
+constexpr int YCbCrCbBI = (int)(YCbCrCbBF * (1 << Shift) + 0.5);
+constexpr int YCbCrCrRI = (int)(YCbCrCrRF * (1 << Shift) + 0.5);
+constexpr int YCbCrCrGI = (int)(YCbCrCrGF * (1 << Shift) + 0.5);
+constexpr int YCbCrCrBI = (int)(YCbCrCrBF * (1 << Shift) + 0.5);
+
+constexpr int RGBRYI = (int)(RGBRYF * (1 << Shift) + 0.5);
+constexpr int RGBRCbI = (int)(RGBRCbF * (1 << Shift) + 0.5);
+constexpr int RGBRCrI = (int)(RGBRCrF * (1 << Shift) + 0.5);
+constexpr int RGBGYI = (int)(RGBGYF * (1 << Shift) + 0.5);
+constexpr int RGBGCbI = (int)(RGBGCbF * (1 << Shift) + 0.5);
+constexpr int RGBGCrI = (int)(RGBGCrF * (1 << Shift) + 0.5);
+constexpr int RGBBYI = (int)(RGBBYF * (1 << Shift) + 0.5);
+constexpr int RGBBCbI = (int)(RGBBCbF * (1 << Shift) + 0.5);
+constexpr int RGBBCrI = (int)(RGBBCrF * (1 << Shift) + 0.5);
+
+typedef struct
+{
+	uint8_t alpha, red, green, blue;
+} ARGB;
+
+/**
+ * JFIF YCbCr <-> 32-bit pixels, B, G, R, A in memory. Views are clipped
+ * to the smaller of the two; from is FORMAT_YCBCR_888 and to
+ * FORMAT_RGBA_8888 or the other way round.
+ *
+ * Android RGBA_8888 pixels are R, G, B, A in memory, so the planes built
+ * from them hold the YCbCr of each colour with red and blue swapped: the
+ * plane's Cb is close to the true Cr and the reverse. Everything that
+ * only reads and writes the planes is consistent; a chroma given from
+ * outside, in true JFIF terms, goes through planeChroma() first.
+ */
 class Conversion
 {
 public:
-	static void YCbCrToRGB(uint8_t* From, uint8_t* To, int Length);
-	static void RGBToYCbCr(uint8_t* From, uint8_t* To, int Length);
-private:
+	// true Cb << 8 | Cr to the Cb << 8 | Cr the planes hold for that colour;
+	// the map is linear and does not depend on luma
+	static int planeChroma(int chroma);
 
+	static int32_t convertArgbToInt(ARGB argb);
+	static void convertIntToArgb(uint32_t pixel, ARGB* argb);
+
+	static void YCbCrToRGB(const ImageView& from, const ImageView& to);
+	// chroma remapped on the way: where the GRAY_8 mask is non-zero, Cb/Cr
+	// move toward chroma[Cb << 8 | Cr] (Cb low byte, Cr high) by its weight
+	static void YCbCrToRGB(const ImageView& from, const ImageView& to, const ImageView& mask,
+			const uint16_t* chroma);
+	static void RGBToYCbCr(const ImageView& from, const ImageView& to);
+private:
+	static void YCbCrToRGBRow(const uint8_t* From, uint8_t* To, int Length);
+	static void YCbCrToRGBRow(const uint8_t* From, uint8_t* To, const uint8_t* Mask, const uint16_t* Chroma,
+			int Length);
+	static void RGBToYCbCrRow(const uint8_t* From, uint8_t* To, int Length);
 };
 #endif
@@ -0,0 +1,34 @@
+#include "Downsample.h"
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#define DOWNSAMPLE_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define DOWNSAMPLE_SSE 1
+#endif
+
+void Downsample::halveRow(const uint8_t* a, const uint8_t* b, uint8_t* out, int width)
+{
+	int j = 0;
+#if defined(DOWNSAMPLE_NEON)
+	for (; j + 8 <= width; j += 8) {
+		uint16x8_t sum = vpaddlq_u8(vld1q_u8(a + 2 * j));
+		sum = vpadalq_u8(sum, vld1q_u8(b + 2 * j));
+		vst1_u8(out + j, vrshrn_n_u16(sum, 2));
+	}
+#elif defined(DOWNSAMPLE_SSE)
+	const __m128i low = _mm_set1_epi16(0xff);
+	const __m128i two = _mm_set1_epi16(2);
+	for (; j + 8 <= width; j += 8) {
+		__m128i va = _mm_loadu_si128((const __m128i*) (a + 2 * j));
+		__m128i vb = _mm_loadu_si128((const __m128i*) (b + 2 * j));
+		__m128i sum = _mm_add_epi16(_mm_and_si128(va, low), _mm_srli_epi16(va, 8));
+		sum = _mm_add_epi16(sum, _mm_add_epi16(_mm_and_si128(vb, low), _mm_srli_epi16(vb, 8)));
+		sum = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+		_mm_storel_epi64((__m128i*) (out + j), _mm_packus_epi16(sum, sum));
+	}
+#endif
+	for (; j < width; j++)
+		out[j] = (uint8_t) ((a[2 * j] + a[2 * j + 1] + b[2 * j] + b[2 * j + 1] + 2) >> 2);
+}
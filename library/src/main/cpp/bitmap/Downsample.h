@@ -0,0 +1,18 @@
+#ifndef _DOWNSAMPLE_H_
+#define _DOWNSAMPLE_H_
+
+#include <stdint.h>
+
+/**
+ * 2:1 box downsampling of 8-bit planes, a row at a time so callers can
+ * keep a few reduced rows in a rolling window instead of a whole plane.
+ * NEON and SSE2 give the same rounding as the scalar fallback.
+ */
+class Downsample
+{
+public:
+	// out[j] is the rounded mean of the 2x2 block at column 2j of rows a
+	// and b; both rows hold 2 * width bytes
+	static void halveRow(const uint8_t* a, const uint8_t* b, uint8_t* out, int width);
+};
+#endif
@@ -0,0 +1,484 @@
+#include "HealingBrush.h"
+#include <stdio.h>
+#include <string.h>
+#include <functional>
+#include <new>
+#include <vector>
+#include "../utils/MemoryGovernor.h"
+#include "../utils/ThreadPool.h"
+#include "../utils/MagicLog.h"
+
+#if defined(__aarch64__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define HEALING_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define HEALING_SSE 1
+#endif
+
+#define  LOG_TAG    "HealingBrush"
+
+static const int kChannels = 3;
+// Jacobi damping that damps the high half of the spectrum fastest
+static const float kOmega = 0.8f;
+static const int kPreSweeps = 2;
+static const int kPostSweeps = 2;
+// the coarsest grid is a few cells across, so this many sweeps solve it
+static const int kCoarsestSweeps = 32;
+static const int kCoarsestSize = 4;
+static const int kMaxLevels = 12;
+static const int kMinBandRows = 16;
+// fall in the residual's norm that ends the iterations early
+static const double kTolerance = 1e-3;
+
+// one grid of the pyramid: cells with a zero border one cell wide, so
+// every cell has four neighbours to read
+typedef struct
+{
+	int width;
+	int height;
+	int stride;
+	// 1 where the value is solved, 0 where it is held
+	float* mask;
+	float* value[kChannels];
+	// the next Jacobi iterate, or the residual on its way down
+	float* spare[kChannels];
+	float* rhs[kChannels];
+} Level;
+
+static inline size_t levelCells(const Level& level)
+{
+	return (size_t) level.stride * (level.height + 2);
+}
+
+// row points at the row's first cell; out = row moved toward the 5-point solution
+static void smoothRow(const float* row, const float* rhs, const float* mask, float* out, int width, int stride)
+{
+	int j = 0;
+#if defined(HEALING_NEON)
+	const float32x4_t quarter = vdupq_n_f32(0.25f * kOmega);
+	const float32x4_t omega = vdupq_n_f32(kOmega);
+	for (; j + 4 <= width; j += 4) {
+		float32x4_t c = vld1q_f32(row + j);
+		float32x4_t sum = vaddq_f32(vaddq_f32(vld1q_f32(row + j - 1), vld1q_f32(row + j + 1)),
+				vaddq_f32(vld1q_f32(row + j - stride), vld1q_f32(row + j + stride)));
+		float32x4_t step = vmlsq_f32(vmulq_f32(vaddq_f32(sum, vld1q_f32(rhs + j)), quarter), c, omega);
+		vst1q_f32(out + j, vmlaq_f32(c, step, vld1q_f32(mask + j)));
+	}
+#elif defined(HEALING_SSE)
+	const __m128 quarter = _mm_set1_ps(0.25f * kOmega);
+	const __m128 omega = _mm_set1_ps(kOmega);
+	for (; j + 4 <= width; j += 4) {
+		__m128 c = _mm_loadu_ps(row + j);
+		__m128 sum = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(row + j - 1), _mm_loadu_ps(row + j + 1)),
+				_mm_add_ps(_mm_loadu_ps(row + j - stride), _mm_loadu_ps(row + j + stride)));
+		__m128 step = _mm_sub_ps(_mm_mul_ps(_mm_add_ps(sum, _mm_loadu_ps(rhs + j)), quarter), _mm_mul_ps(c, omega));
+		_mm_storeu_ps(out + j, _mm_add_ps(c, _mm_mul_ps(step, _mm_loadu_ps(mask + j))));
+	}
+#endif
+	for (; j < width; j++) {
+		float sum = row[j - 1] + row[j + 1] + row[j - stride] + row[j + stride];
+		out[j] = row[j] + mask[j] * ((sum + rhs[j]) * (0.25f * kOmega) - row[j] * kOmega);
+	}
+}
+
+// out = rhs - (4 * row - neighbours) where solved, 0 elsewhere
+static void residualRow(const float* row, const float* rhs, const float* mask, float* out, int width, int stride)
+{
+	int j = 0;
+#if defined(HEALING_NEON)
+	const float32x4_t four = vdupq_n_f32(4.0f);
+	for (; j + 4 <= width; j += 4) {
+		float32x4_t sum = vaddq_f32(vaddq_f32(vld1q_f32(row + j - 1), vld1q_f32(row + j + 1)),
+				vaddq_f32(vld1q_f32(row + j - stride), vld1q_f32(row + j + stride)));
+		float32x4_t r = vmlsq_f32(vaddq_f32(vld1q_f32(rhs + j), sum), vld1q_f32(row + j), four);
+		vst1q_f32(out + j, vmulq_f32(r, vld1q_f32(mask + j)));
+	}
+#elif defined(HEALING_SSE)
+	const __m128 four = _mm_set1_ps(4.0f);
+	for (; j + 4 <= width; j += 4) {
+		__m128 sum = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(row + j - 1), _mm_loadu_ps(row + j + 1)),
+				_mm_add_ps(_mm_loadu_ps(row + j - stride), _mm_loadu_ps(row + j + stride)));
+		__m128 r = _mm_sub_ps(_mm_add_ps(_mm_loadu_ps(rhs + j), sum), _mm_mul_ps(_mm_loadu_ps(row + j), four));
+		_mm_storeu_ps(out + j, _mm_mul_ps(r, _mm_loadu_ps(mask + j)));
+	}
+#endif
+	for (; j < width; j++) {
+		float sum = row[j - 1] + row[j + 1] + row[j - stride] + row[j + stride];
+		out[j] = mask[j] * (rhs[j] + sum - 4.0f * row[j]);
+	}
+}
+
+// out = 4 * row - neighbours where solved, 0 elsewhere
+static void laplacianRow(const float* row, const float* mask, float* out, int width, int stride)
+{
+	int j = 0;
+#if defined(HEALING_NEON)
+	const float32x4_t four = vdupq_n_f32(4.0f);
+	for (; j + 4 <= width; j += 4) {
+		float32x4_t sum = vaddq_f32(vaddq_f32(vld1q_f32(row + j - 1), vld1q_f32(row + j + 1)),
+				vaddq_f32(vld1q_f32(row + j - stride), vld1q_f32(row + j + stride)));
+		float32x4_t l = vmlaq_f32(vnegq_f32(sum), vld1q_f32(row + j), four);
+		vst1q_f32(out + j, vmulq_f32(l, vld1q_f32(mask + j)));
+	}
+#elif defined(HEALING_SSE)
+	const __m128 four = _mm_set1_ps(4.0f);
+	for (; j + 4 <= width; j += 4) {
+		__m128 sum = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(row + j - 1), _mm_loadu_ps(row + j + 1)),
+				_mm_add_ps(_mm_loadu_ps(row + j - stride), _mm_loadu_ps(row + j + stride)));
+		__m128 l = _mm_sub_ps(_mm_mul_ps(_mm_loadu_ps(row + j), four), sum);
+		_mm_storeu_ps(out + j, _mm_mul_ps(l, _mm_loadu_ps(mask + j)));
+	}
+#endif
+	for (; j < width; j++) {
+		float sum = row[j - 1] + row[j + 1] + row[j - stride] + row[j + stride];
+		out[j] = mask[j] * (4.0f * row[j] - sum);
+	}
+}
+
+static int bandCount(int rows)
+{
+	int bands = rows / kMinBandRows;
+	int threads = ThreadPool::getInstance()->getThreadCount();
+	if (bands > threads)
+		bands = threads;
+	return bands > 1 ? bands : 1;
+}
+
+// job(channel, band, top, bottom) over bandCount(rows) bands of every channel at once
+static void forBands(int rows, const std::function<void(int, int, int, int)>& job)
+{
+	int bands = bandCount(rows);
+	ThreadPool::getInstance()->parallelFor(kChannels * bands, [&](int k) {
+		int band = k / kChannels;
+		job(k % kChannels, band, rows * band / bands, rows * (band + 1) / bands);
+	});
+}
+
+static void sweep(Level& level, int count)
+{
+	for (int n = 0; n < count; n++) {
+		forBands(level.height, [&](int c, int, int top, int bottom) {
+			for (int i = top; i < bottom; i++) {
+				size_t row = (size_t) (i + 1) * level.stride + 1;
+				smoothRow(level.value[c] + row, level.rhs[c] + row, level.mask + row, level.spare[c] + row,
+						level.width, level.stride);
+			}
+		});
+		for (int c = 0; c < kChannels; c++) {
+			float* swap = level.value[c];
+			level.value[c] = level.spare[c];
+			level.spare[c] = swap;
+		}
+	}
+}
+
+/**
+ * Correction scheme on nested points: coarse point (i, j) is fine point
+ * (2i, 2j). The residual comes down by full weighting, times four because
+ * the coarse spacing is twice the fine one; the coarse error starts at
+ * zero and goes back up by bilinear interpolation. Coarse points outside
+ * the coarse mask, and the border, hold zero error.
+ */
+static void vCycle(Level* levels, int count, int l)
+{
+	Level& fine = levels[l];
+	if (l == count - 1) {
+		sweep(fine, kCoarsestSweeps);
+		return;
+	}
+	Level& coarse = levels[l + 1];
+	sweep(fine, kPreSweeps);
+	forBands(fine.height, [&](int c, int, int top, int bottom) {
+		for (int i = top; i < bottom; i++) {
+			size_t row = (size_t) (i + 1) * fine.stride + 1;
+			residualRow(fine.value[c] + row, fine.rhs[c] + row, fine.mask + row, fine.spare[c] + row,
+					fine.width, fine.stride);
+		}
+	});
+	forBands(coarse.height, [&](int c, int, int top, int bottom) {
+		for (int i = top; i < bottom; i++) {
+			// fine rows 2i - 1, 2i and 2i + 1, the outer two possibly the border
+			const float* b = fine.spare[c] + (size_t) (2 * i + 1) * fine.stride + 1;
+			const float* a = b - fine.stride;
+			const float* d = b + fine.stride;
+			float* rhs = coarse.rhs[c] + (size_t) (i + 1) * coarse.stride + 1;
+			for (int j = 0; j < coarse.width; j++) {
+				int k = 2 * j;
+				rhs[j] = b[k] + 0.5f * (b[k - 1] + b[k + 1] + a[k] + d[k])
+						+ 0.25f * (a[k - 1] + a[k + 1] + d[k - 1] + d[k + 1]);
+			}
+			memset(coarse.value[c] + (size_t) (i + 1) * coarse.stride + 1, 0, sizeof(float) * coarse.width);
+		}
+	});
+	vCycle(levels, count, l + 1);
+	forBands(fine.height, [&](int c, int, int top, int bottom) {
+		for (int i = top; i < bottom; i++) {
+			// the coarse rows above and below; the same one on even rows
+			const float* above = coarse.value[c] + (size_t) ((i >> 1) + 1) * coarse.stride + 1;
+			const float* below = above + (i & 1 ? coarse.stride : 0);
+			float* value = fine.value[c] + (size_t) (i + 1) * fine.stride + 1;
+			const float* mask = fine.mask + (size_t) (i + 1) * fine.stride + 1;
+			for (int j = 0; j < fine.width; j++) {
+				if (mask[j] == 0)
+					continue;
+				int x = j >> 1, next = x + (j & 1);
+				value[j] += 0.25f * (above[x] + above[next] + below[x] + below[next]);
+			}
+		}
+	});
+	sweep(fine, kPostSweeps);
+}
+
+/**
+ * Conjugate gradients on the fine grid, with a V-cycle as the
+ * preconditioner. On the masked grids a coarse point next to the outline
+ * sees the boundary a whole coarse step away when it is closer, so coarse
+ * corrections overshoot there, enough to stall or even diverge plain
+ * V-cycles on large dabs. A V-cycle with as many Jacobi sweeps after as
+ * before and restriction the transpose of interpolation is still
+ * symmetric positive definite. CG then converges in a number of iterations that
+ * barely depends on the dab's size. The fine level's right-hand side
+ * holds the residual; the solution, search direction and its laplacian
+ * are the three arrays per channel passed in. Stops once every channel's
+ * residual has fallen by kTolerance or after MAX_ITERATIONS.
+ */
+static void solve(Level* levels, int count, float** solution, float** direction, float** product)
+{
+	Level& fine = levels[0];
+	const size_t cells = levelCells(fine);
+	const int bands = bandCount(fine.height);
+	std::vector<double> partial(kChannels * bands);
+	double start[kChannels], rz[kChannels], previous[kChannels];
+	bool active[kChannels];
+	// a sum over the fine grid per channel, from per-band sums
+	auto total = [&](int c) {
+		double sum = 0;
+		for (int b = 0; b < bands; b++)
+			sum += partial[b * kChannels + c];
+		return sum;
+	};
+
+	forBands(fine.height, [&](int c, int band, int top, int bottom) {
+		double sum = 0;
+		for (int i = top; i < bottom; i++) {
+			size_t row = (size_t) (i + 1) * fine.stride + 1;
+			float* r = fine.rhs[c] + row;
+			residualRow(solution[c] + row, r, fine.mask + row, r, fine.width, fine.stride);
+			for (int j = 0; j < fine.width; j++)
+				sum += (double) r[j] * r[j];
+		}
+		partial[band * kChannels + c] = sum;
+	});
+	for (int c = 0; c < kChannels; c++) {
+		start[c] = total(c);
+		active[c] = start[c] > 0;
+	}
+
+	for (int n = 0; n < HealingBrush::MAX_ITERATIONS; n++) {
+		for (int c = 0; c < kChannels; c++)
+			memset(fine.value[c], 0, sizeof(float) * cells);
+		vCycle(levels, count, 0);
+		forBands(fine.height, [&](int c, int band, int top, int bottom) {
+			double sum = 0;
+			for (int i = top; i < bottom; i++) {
+				size_t row = (size_t) (i + 1) * fine.stride + 1;
+				const float* r = fine.rhs[c] + row;
+				const float* z = fine.value[c] + row;
+				for (int j = 0; j < fine.width; j++)
+					sum += (double) r[j] * z[j];
+			}
+			partial[band * kChannels + c] = sum;
+		});
+		float beta[kChannels];
+		for (int c = 0; c < kChannels; c++) {
+			rz[c] = total(c);
+			beta[c] = n > 0 && previous[c] != 0 ? (float) (rz[c] / previous[c]) : 0;
+			previous[c] = rz[c];
+		}
+		// the direction has to be whole before its laplacian reads across bands
+		forBands(fine.height, [&](int c, int, int top, int bottom) {
+			size_t from = (size_t) (top + 1) * fine.stride, to = (size_t) (bottom + 1) * fine.stride;
+			const float* z = fine.value[c];
+			float* d = direction[c];
+			for (size_t k = from; k < to; k++)
+				d[k] = z[k] + beta[c] * d[k];
+		});
+		forBands(fine.height, [&](int c, int band, int top, int bottom) {
+			double sum = 0;
+			for (int i = top; i < bottom; i++) {
+				size_t row = (size_t) (i + 1) * fine.stride + 1;
+				const float* d = direction[c] + row;
+				float* q = product[c] + row;
+				laplacianRow(d, fine.mask + row, q, fine.width, fine.stride);
+				for (int j = 0; j < fine.width; j++)
+					sum += (double) d[j] * q[j];
+			}
+			partial[band * kChannels + c] = sum;
+		});
+		float alpha[kChannels];
+		for (int c = 0; c < kChannels; c++) {
+			double dq = total(c);
+			alpha[c] = active[c] && dq > 0 ? (float) (rz[c] / dq) : 0;
+		}
+		forBands(fine.height, [&](int c, int band, int top, int bottom) {
+			double sum = 0;
+			size_t from = (size_t) (top + 1) * fine.stride, to = (size_t) (bottom + 1) * fine.stride;
+			float* x = solution[c];
+			float* r = fine.rhs[c];
+			const float* d = direction[c];
+			const float* q = product[c];
+			for (size_t k = from; k < to; k++) {
+				x[k] += alpha[c] * d[k];
+				r[k] -= alpha[c] * q[k];
+				sum += (double) r[k] * r[k];
+			}
+			partial[band * kChannels + c] = sum;
+		});
+		bool done = true;
+		for (int c = 0; c < kChannels; c++) {
+			active[c] = active[c] && total(c) > start[c] * (kTolerance * kTolerance);
+			done = done && !active[c];
+		}
+		if (done)
+			break;
+	}
+}
+
+bool HealingBrush::heal(const ImageView& image, int x, int y, int sourceX, int sourceY, int radius)
+{
+	if (image.isEmpty() || image.format != ImageView::FORMAT_RGBA_8888 || radius < 1) {
+		LOGE("healing needs an RGBA_8888 image and a positive radius");
+		return false;
+	}
+	if (radius > MAX_RADIUS)
+		radius = MAX_RADIUS;
+	const int dx = sourceX - x, dy = sourceY - y;
+	// the box around the disc and its outline, where both it and its source are on the image
+	int left = x - radius - 1, top = y - radius - 1, right = x + radius + 1, bottom = y + radius + 1;
+	left = left > 0 ? left : 0;
+	left = left > -dx ? left : -dx;
+	top = top > 0 ? top : 0;
+	top = top > -dy ? top : -dy;
+	right = right < image.width - 1 ? right : image.width - 1;
+	right = right < image.width - 1 - dx ? right : image.width - 1 - dx;
+	bottom = bottom < image.height - 1 ? bottom : image.height - 1;
+	bottom = bottom < image.height - 1 - dy ? bottom : image.height - 1 - dy;
+	if (right - left < 2 || bottom - top < 2)
+		return true;
+
+	Level levels[kMaxLevels];
+	int count = 0;
+	size_t cells = 0;
+	for (int w = right - left + 1, h = bottom - top + 1; count < kMaxLevels; w = (w + 1) / 2, h = (h + 1) / 2) {
+		Level& level = levels[count++];
+		level.width = w;
+		level.height = h;
+		level.stride = w + 2;
+		cells += levelCells(level);
+		if (w <= kCoarsestSize || h <= kCoarsestSize)
+			break;
+	}
+	const int boxWidth = levels[0].width, boxHeight = levels[0].height;
+	// and the solution, search direction and its laplacian on the fine grid
+	size_t floats = cells * (1 + 3 * kChannels) + levelCells(levels[0]) * 3 * kChannels;
+	int64_t bytes = (int64_t) (floats * sizeof(float) + (size_t) boxWidth * boxHeight * sizeof(uint32_t));
+	if (!MemoryGovernor::getInstance()->reserve(MEMORY_OWNER_POOL, bytes)) {
+		LOGE("memory budget cannot hold a healing dab of radius %d", radius);
+		return false;
+	}
+	float* memory = new (std::nothrow) float[floats];
+	uint32_t* source = new (std::nothrow) uint32_t[(size_t) boxWidth * boxHeight];
+	if (memory == NULL || source == NULL) {
+		delete[] memory;
+		delete[] source;
+		MemoryGovernor::getInstance()->release(MEMORY_OWNER_POOL, bytes);
+		return false;
+	}
+	memset(memory, 0, floats * sizeof(float));
+	float* p = memory;
+	for (int l = 0; l < count; l++) {
+		size_t n = levelCells(levels[l]);
+		levels[l].mask = p;
+		p += n;
+		for (int c = 0; c < kChannels; c++) {
+			levels[l].value[c] = p;
+			levels[l].spare[c] = p + n;
+			levels[l].rhs[c] = p + 2 * n;
+			p += 3 * n;
+		}
+	}
+	float* solution[kChannels];
+	float* direction[kChannels];
+	float* product[kChannels];
+	for (int c = 0; c < kChannels; c++) {
+		size_t n = levelCells(levels[0]);
+		solution[c] = p;
+		direction[c] = p + n;
+		product[c] = p + 2 * n;
+		p += 3 * n;
+	}
+
+	// the disc, inside the box so its outline is too; the source is copied
+	// first because the dab may overlap it
+	Level& fine = levels[0];
+	int solved = 0;
+	for (int i = 0; i < boxHeight; i++) {
+		const uint32_t* dst = image.row32(top + i) + left;
+		const uint32_t* src = image.row32(top + i + dy) + left + dx;
+		float* mask = fine.mask + (size_t) (i + 1) * fine.stride + 1;
+		int ry = top + i - y;
+		for (int j = 0; j < boxWidth; j++) {
+			int rx = left + j - x;
+			source[(size_t) i * boxWidth + j] = src[j];
+			if (i > 0 && i < boxHeight - 1 && j > 0 && j < boxWidth - 1 && rx * rx + ry * ry <= radius * radius) {
+				mask[j] = 1;
+				solved++;
+				continue;
+			}
+			for (int c = 0; c < kChannels; c++)
+				solution[c][(size_t) (i + 1) * fine.stride + 1 + j] =
+						(float) ((dst[j] >> (8 * c)) & 0xff) - (float) ((src[j] >> (8 * c)) & 0xff);
+		}
+	}
+	// a coarse point is solved when the fine point under it is
+	for (int l = 1; l < count; l++) {
+		Level& level = levels[l];
+		const Level& finer = levels[l - 1];
+		for (int i = 0; i < level.height; i++) {
+			const float* under = finer.mask + (size_t) (2 * i + 1) * finer.stride + 1;
+			float* mask = level.mask + (size_t) (i + 1) * level.stride + 1;
+			for (int j = 0; j < level.width; j++)
+				mask[j] = under[2 * j];
+		}
+	}
+
+	if (solved > 0) {
+		solve(levels, count, solution, direction, product);
+		int bands = boxHeight / kMinBandRows > 0 ? boxHeight / kMinBandRows : 1;
+		ThreadPool::getInstance()->parallelFor(bands, [&](int band) {
+			for (int i = boxHeight * band / bands; i < boxHeight * (band + 1) / bands; i++) {
+				uint32_t* dst = image.row32(top + i) + left;
+				const uint32_t* src = source + (size_t) i * boxWidth;
+				size_t row = (size_t) (i + 1) * fine.stride + 1;
+				for (int j = 0; j < boxWidth; j++) {
+					if (fine.mask[row + j] == 0)
+						continue;
+					int alpha = dst[j] >> 24;
+					uint32_t pixel = (uint32_t) alpha << 24;
+					for (int c = 0; c < kChannels; c++) {
+						int v = (int) (((src[j] >> (8 * c)) & 0xff) + solution[c][row + j] + 0.5f + 256) - 256;
+						v = v < 0 ? 0 : v > alpha ? alpha : v;
+						pixel |= (uint32_t) v << (8 * c);
+					}
+					dst[j] = pixel;
+				}
+			}
+		});
+	}
+
+	delete[] memory;
+	delete[] source;
+	MemoryGovernor::getInstance()->release(MEMORY_OWNER_POOL, bytes);
+	return true;
+}
@@ -0,0 +1,41 @@
+#ifndef _HEALING_BRUSH_H_
+#define _HEALING_BRUSH_H_
+
+#include <stdint.h>
+#include "ImageView.h"
+
+/**
+ * Healing brush for RGBA_8888 images, in place: a round dab takes its
+ * texture from the source position and its colour from what surrounds
+ * the destination, so a blemish is covered without a visible patch.
+ *
+ * The dab is a Poisson blend solved as a correction: the source pixels
+ * plus the membrane h with laplacian(h) = 0 inside the dab and h equal to
+ * destination minus source on the pixels just outside it. Only the dab's
+ * bounding box is solved. It uses multigrid V-cycles on a pyramid of that
+ * box: damped Jacobi smoothing, residuals brought down by full weighting
+ * and corrections interpolated bilinearly back up. The V-cycles
+ * precondition conjugate gradients, which keep the convergence steady
+ * where the round outline makes the coarse grids inexact. A V-cycle costs
+ * a fixed number of passes over the box whatever its size, and the
+ * iterations needed barely grow, so a dab costs time proportional to its
+ * area. Gauss-Seidel alone needs a number of sweeps that grows with it.
+ *
+ * Sweeps run on four floats at a time with NEON and SSE2, over jobs of one
+ * colour channel and one band of rows each. Alpha is left alone and the
+ * colour is clamped to it, so premultiplied pixels stay valid.
+ */
+class HealingBrush
+{
+public:
+	static const int MAX_RADIUS = 512;
+	// conjugate gradient iterations, each preconditioned by one V-cycle
+	static const int MAX_ITERATIONS = 12;
+
+	// heals the disc of radius pixels around (x, y) from the one around
+	// (sourceX, sourceY); the parts whose source or surroundings fall off
+	// the image are left out. False when the image is not RGBA_8888 or
+	// the memory budget cannot hold the solver.
+	static bool heal(const ImageView& image, int x, int y, int sourceX, int sourceY, int radius);
+};
+#endif
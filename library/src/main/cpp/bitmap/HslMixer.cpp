@@ -0,0 +1,107 @@
+#include "HslMixer.h"
+#include <math.h>
+
+static const float kCentres[HslMixer::BANDS] = { 0, 30, 60, 120, 180, 240, 270, 300 };
+
+static inline float clampUnit(float v)
+{
+	return v < -1 ? -1 : v > 1 ? 1 : v;
+}
+
+static inline float clamp01(float v)
+{
+	return v < 0 ? 0 : v > 1 ? 1 : v;
+}
+
+HslMixer::HslMixer()
+{
+	reset();
+}
+
+void HslMixer::reset()
+{
+	for (int i = 0; i < BANDS; i++) {
+		mHue[i] = 0;
+		mSaturation[i] = 0;
+		mLuminance[i] = 0;
+	}
+}
+
+void HslMixer::setBand(int band, float hue, float saturation, float luminance)
+{
+	if (band < 0 || band >= BANDS)
+		return;
+	mHue[band] = clampUnit(hue);
+	mSaturation[band] = clampUnit(saturation);
+	mLuminance[band] = clampUnit(luminance);
+}
+
+bool HslMixer::isIdentity() const
+{
+	for (int i = 0; i < BANDS; i++) {
+		if (mHue[i] != 0 || mSaturation[i] != 0 || mLuminance[i] != 0)
+			return false;
+	}
+	return true;
+}
+
+static inline float hueToChannel(float p, float q, float t)
+{
+	if (t < 0)
+		t += 1;
+	if (t > 1)
+		t -= 1;
+	if (t < 1.0f / 6)
+		return p + (q - p) * 6 * t;
+	if (t < 0.5f)
+		return q;
+	if (t < 2.0f / 3)
+		return p + (q - p) * (2.0f / 3 - t) * 6;
+	return p;
+}
+
+uint32_t HslMixer::apply(uint32_t pixel) const
+{
+	float r = (pixel & 0xff) / 255.0f, g = ((pixel >> 8) & 0xff) / 255.0f, b = ((pixel >> 16) & 0xff) / 255.0f;
+	float high = r > g ? (r > b ? r : b) : (g > b ? g : b);
+	float low = r < g ? (r < b ? r : b) : (g < b ? g : b);
+	float l = (high + low) / 2;
+	float chroma = high - low;
+	if (chroma <= 0)
+		return pixel;
+	float s = chroma / (l < 0.5f ? high + low : 2 - high - low);
+	float h;
+	if (high == r)
+		h = 60 * fmodf((g - b) / chroma + 6, 6);
+	else if (high == g)
+		h = 60 * ((b - r) / chroma + 2);
+	else
+		h = 60 * ((r - g) / chroma + 4);
+
+	// the bands either side of h, blended by a raised cosine
+	int lower = BANDS - 1;
+	for (int i = 0; i < BANDS && kCentres[i] <= h; i++)
+		lower = i;
+	int upper = (lower + 1) % BANDS;
+	float from = kCentres[lower];
+	float to = upper == 0 ? 360 : kCentres[upper];
+	float t = (h < from ? h + 360 - from : h - from) / (to - from);
+	float wUpper = 0.5f - 0.5f * cosf((float) M_PI * t);
+	float wLower = 1 - wUpper;
+	float dh = wLower * mHue[lower] + wUpper * mHue[upper];
+	float ds = wLower * mSaturation[lower] + wUpper * mSaturation[upper];
+	float dl = wLower * mLuminance[lower] + wUpper * mLuminance[upper];
+
+	h = fmodf(h + dh * MAX_HUE_SHIFT * s + 360, 360) / 360;
+	// towards the extremes without ever clipping; saturation scales, so
+	// near greys do not pick up a colour from their noise
+	l = clamp01(l + dl * s * (l < 0.5f ? l : 1 - l));
+	s = clamp01(s * (1 + ds));
+
+	float q = l < 0.5f ? l * (1 + s) : l + s - l * s;
+	float p = 2 * l - q;
+	int outR = (int) (hueToChannel(p, q, h + 1.0f / 3) * 255 + 0.5f);
+	int outG = (int) (hueToChannel(p, q, h) * 255 + 0.5f);
+	int outB = (int) (hueToChannel(p, q, h - 1.0f / 3) * 255 + 0.5f);
+	return (pixel & 0xff000000u) | (outB << 16) | (outG << 8) | outR;
+}
@@ -0,0 +1,50 @@
+#ifndef _HSL_MIXER_H_
+#define _HSL_MIXER_H_
+
+#include <stdint.h>
+
+/**
+ * Hue, saturation and luminance per colour band, as in a photo editor's
+ * HSL panel. Band centres sit at the usual hues (reds at 0 degrees,
+ * oranges 30, yellows 60, greens 120, aquas 180, blues 240, purples 270,
+ * magentas 300) and a pixel's adjustment blends the two bands either side
+ * of its hue by a raised cosine, so the weights sum to one and no hue sees
+ * a step. Hue and luminance moves scale with saturation, which leaves greys
+ * alone.
+ *
+ * apply() is the exact per-pixel evaluation. It costs two colour space
+ * conversions and a band search per pixel, so frames go through a
+ * LookTable the mixer is compiled into instead (LookTable::setMixer).
+ */
+class HslMixer
+{
+public:
+	static const int RED = 0;
+	static const int ORANGE = 1;
+	static const int YELLOW = 2;
+	static const int GREEN = 3;
+	static const int AQUA = 4;
+	static const int BLUE = 5;
+	static const int PURPLE = 6;
+	static const int MAGENTA = 7;
+	static const int BANDS = 8;
+
+	// a hue of 1 turns the band by MAX_HUE_SHIFT degrees
+	static const int MAX_HUE_SHIFT = 30;
+
+	HslMixer();
+
+	// every value -1..1, 0 leaves the band alone; clamped
+	void setBand(int band, float hue, float saturation, float luminance);
+	void reset();
+	bool isIdentity() const;
+
+	// 0x00BBGGRR as in LookTable, the top byte is kept
+	uint32_t apply(uint32_t pixel) const;
+
+private:
+	float mHue[BANDS];
+	float mSaturation[BANDS];
+	float mLuminance[BANDS];
+};
+#endif
@@ -0,0 +1,86 @@
+#ifndef _IMAGE_VIEW_H_
+#define _IMAGE_VIEW_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Non-owning view of an image: first pixel, size, bytes per row and pixel
+ * format. Rows may be padded (window buffers, camera frames, bitmaps with
+ * a larger stride) and a view may be a crop of a larger one, so kernels
+ * taking views work on sub-regions in place instead of on packed copies.
+ * Copying a view copies the pointer, never the pixels.
+ */
+class ImageView
+{
+public:
+	// 4 bytes; Android bitmaps and windows store red first
+	static const int FORMAT_RGBA_8888 = 0;
+	// 3 bytes Y, Cb, Cr, the interleaved planes of MagicBeautify
+	static const int FORMAT_YCBCR_888 = 1;
+	// 1 byte, luma planes and masks
+	static const int FORMAT_GRAY_8 = 2;
+
+	uint8_t* pixels;
+	int width;
+	int height;
+	// bytes from one row to the next
+	int stride;
+	int format;
+
+	ImageView()
+	{
+		pixels = NULL;
+		width = 0;
+		height = 0;
+		stride = 0;
+		format = FORMAT_RGBA_8888;
+	}
+
+	ImageView(void* pixels, int width, int height, int stride, int format)
+	{
+		this->pixels = (uint8_t*) pixels;
+		this->width = width;
+		this->height = height;
+		this->stride = stride;
+		this->format = format;
+	}
+
+	// rows back to back, no padding
+	static ImageView packed(void* pixels, int width, int height, int format)
+	{
+		return ImageView(pixels, width, height, width * bytesPerPixel(format), format);
+	}
+
+	static int bytesPerPixel(int format)
+	{
+		return format == FORMAT_RGBA_8888 ? 4 : format == FORMAT_YCBCR_888 ? 3 : 1;
+	}
+
+	bool isEmpty() const { return pixels == NULL || width <= 0 || height <= 0; }
+	bool isPacked() const { return stride == width * bytesPerPixel(format); }
+
+	uint8_t* row(int y) const { return pixels + (ptrdiff_t) y * stride; }
+	uint32_t* row32(int y) const { return (uint32_t*) row(y); }
+
+	// the part of this view inside the rectangle, clipped to it
+	ImageView crop(int x, int y, int cropWidth, int cropHeight) const
+	{
+		if (x < 0) {
+			cropWidth += x;
+			x = 0;
+		}
+		if (y < 0) {
+			cropHeight += y;
+			y = 0;
+		}
+		if (cropWidth > width - x)
+			cropWidth = width - x;
+		if (cropHeight > height - y)
+			cropHeight = height - y;
+		if (cropWidth <= 0 || cropHeight <= 0)
+			return ImageView(NULL, 0, 0, stride, format);
+		return ImageView(row(y) + x * bytesPerPixel(format), cropWidth, cropHeight, stride, format);
+	}
+};
+#endif
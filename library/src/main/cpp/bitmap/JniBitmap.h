@@ -1,20 +1,39 @@
 #ifndef _JNI_BITMAP_H_
 #define _JNI_BITMAP_H_
 #include <android/bitmap.h>
+#include "ImageView.h"
 
+// a buffer of BitmapStore, shared by the handles on equal pixels
 typedef struct
 {
-	uint8_t alpha, red, green, blue;
-} ARGB;
+	uint32_t* pixels;
+	int width;
+	int height;
+	uint64_t hash;
+	int refs;
+	// in the index, where store() finds it; never again once written
+	bool indexed;
+} StoredPixels;
 
 class JniBitmap
 {
 public:
     uint32_t* _storedBitmapPixels;
     AndroidBitmapInfo _bitmapInfo;
+    // ContentHash of the pixels, ContentHash::NONE when unknown or written since
+    uint64_t _contentHash;
+    // NULL when the pixels do not come from BitmapStore
+    StoredPixels* _stored;
     JniBitmap()
 	{
     	_storedBitmapPixels = NULL;
+    	_contentHash = 0;
+    	_stored = NULL;
+	}
+    ImageView getView()
+	{
+    	return ImageView(_storedBitmapPixels, _bitmapInfo.width, _bitmapInfo.height,
+    		_bitmapInfo.stride, ImageView::FORMAT_RGBA_8888);
 	}
 };
 #endif
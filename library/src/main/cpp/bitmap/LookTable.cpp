@@ -0,0 +1,165 @@
+#include "LookTable.h"
+#include <string.h>
+#include "ContentHash.h"
+#include "../utils/ThreadPool.h"
+
+static inline int clampByte(float v)
+{
+	return v <= 0 ? 0 : v >= 255 ? 255 : (int) (v + 0.5f);
+}
+
+LookTable::LookTable()
+{
+	mTable = new uint64_t[SIZE * SIZE * SIZE];
+	mBase = new uint64_t[SIZE * SIZE * SIZE];
+	mHasLookup = false;
+	mLoaded = false;
+	mHash = ContentHash::NONE;
+}
+
+LookTable::~LookTable()
+{
+	delete[] mTable;
+	delete[] mBase;
+}
+
+/**
+ * Trilinear sample of the 64 level lookup image at grid point (r, g, b).
+ * Level c of blue picks tile (c % 8, c / 8); red and green address the tile.
+ */
+uint32_t LookTable::sampleLookup(const uint8_t* rgba, int stride, int r, int g, int b)
+{
+	float position[3] = { r * 63.0f / (SIZE - 1), g * 63.0f / (SIZE - 1), b * 63.0f / (SIZE - 1) };
+	int base[3];
+	float fraction[3];
+	for (int c = 0; c < 3; c++) {
+		base[c] = position[c] >= 63 ? 62 : (int) position[c];
+		fraction[c] = position[c] - base[c];
+	}
+	float sum[3] = { 0, 0, 0 };
+	for (int corner = 0; corner < 8; corner++) {
+		int cr = base[0] + (corner & 1);
+		int cg = base[1] + ((corner >> 1) & 1);
+		int cb = base[2] + ((corner >> 2) & 1);
+		float weight = (corner & 1 ? fraction[0] : 1 - fraction[0])
+				* (corner & 2 ? fraction[1] : 1 - fraction[1])
+				* (corner & 4 ? fraction[2] : 1 - fraction[2]);
+		const uint8_t* texel = rgba + (size_t) ((cb / 8) * 64 + cg) * stride + ((cb % 8) * 64 + cr) * 4;
+		for (int c = 0; c < 3; c++)
+			sum[c] += weight * texel[c];
+	}
+	return (uint32_t) clampByte(sum[0]) | ((uint32_t) clampByte(sum[1]) << 8) | ((uint32_t) clampByte(sum[2]) << 16);
+}
+
+void LookTable::setLookup(const uint8_t* rgba, int stride)
+{
+	mHasLookup = rgba != NULL;
+	if (rgba == NULL) {
+		compose();
+		return;
+	}
+	for (int b = 0; b < SIZE; b++)
+		for (int g = 0; g < SIZE; g++)
+			for (int r = 0; r < SIZE; r++)
+				mBase[(b * SIZE + g) * SIZE + r] = sampleLookup(rgba, stride, r, g, b);
+	setSkinLookup(NULL, 0);
+}
+
+void LookTable::setSkinLookup(const uint8_t* rgba, int stride)
+{
+	if (!mHasLookup)
+		return;
+	for (int b = 0; b < SIZE; b++) {
+		for (int g = 0; g < SIZE; g++) {
+			for (int r = 0; r < SIZE; r++) {
+				uint64_t& entry = mBase[(b * SIZE + g) * SIZE + r];
+				uint32_t safe;
+				if (rgba != NULL) {
+					safe = sampleLookup(rgba, stride, r, g, b);
+				} else {
+					// the look's brightness and contrast, the original hue and saturation
+					uint32_t look = (uint32_t) entry;
+					float y = 0.299f * (look & 0xff) + 0.587f * ((look >> 8) & 0xff) + 0.114f * ((look >> 16) & 0xff);
+					float red = r * 255.0f / (SIZE - 1), green = g * 255.0f / (SIZE - 1), blue = b * 255.0f / (SIZE - 1);
+					float cb = -0.168736f * red - 0.331264f * green + 0.5f * blue;
+					float cr = 0.5f * red - 0.418688f * green - 0.081312f * blue;
+					safe = (uint32_t) clampByte(y + 1.402f * cr)
+							| ((uint32_t) clampByte(y - 0.344136f * cb - 0.714136f * cr) << 8)
+							| ((uint32_t) clampByte(y + 1.772f * cb) << 16);
+				}
+				entry = (entry & 0xffffffffu) | ((uint64_t) safe << 32);
+			}
+		}
+	}
+	compose();
+}
+
+void LookTable::setMixer(const HslMixer* mixer)
+{
+	mMixer = mixer != NULL ? *mixer : HslMixer();
+	compose();
+}
+
+/**
+ * The cube the pixels go through: the mixer evaluated exactly at every
+ * grid colour the look produces, both the look and its skin-safe variant,
+ * so the two stages cost one lookup.
+ */
+void LookTable::compose()
+{
+	bool mix = !mMixer.isIdentity();
+	mLoaded = mHasLookup || mix;
+	if (!mLoaded) {
+		mHash = ContentHash::NONE;
+		return;
+	}
+	const int entries = SIZE * SIZE * SIZE;
+	if (!mHasLookup) {
+		for (int b = 0; b < SIZE; b++) {
+			for (int g = 0; g < SIZE; g++) {
+				for (int r = 0; r < SIZE; r++) {
+					uint64_t grid = (uint32_t) clampByte(r * 255.0f / (SIZE - 1))
+							| ((uint32_t) clampByte(g * 255.0f / (SIZE - 1)) << 8)
+							| ((uint32_t) clampByte(b * 255.0f / (SIZE - 1)) << 16);
+					mBase[(b * SIZE + g) * SIZE + r] = grid | (grid << 32);
+				}
+			}
+		}
+	}
+	if (!mix) {
+		memcpy(mTable, mBase, sizeof(uint64_t) * entries);
+	} else {
+		// one blue slice per job
+		ThreadPool::getInstance()->parallelFor(SIZE, [this](int b) {
+			for (int i = b * SIZE * SIZE; i < (b + 1) * SIZE * SIZE; i++) {
+				uint64_t entry = mBase[i];
+				mTable[i] = mMixer.apply((uint32_t) entry) | ((uint64_t) mMixer.apply((uint32_t) (entry >> 32)) << 32);
+			}
+		});
+	}
+	mHash = ContentHash::hash(ImageView::packed(mTable, SIZE * sizeof(uint64_t), SIZE * SIZE, ImageView::FORMAT_GRAY_8));
+}
+
+void LookTable::applyImage(const ImageView& src, const ImageView& dst, const ImageView& skin) const
+{
+	int width = src.width < dst.width ? src.width : dst.width;
+	int height = src.height < dst.height ? src.height : dst.height;
+	for (int i = 0; i < height; i++)
+		applyRow(src.row32(i), dst.row32(i), width, skin.isEmpty() ? NULL : skin.row(i));
+}
+
+void LookTable::applyRow(const uint32_t* src, uint32_t* dst, int width, const uint8_t* skin) const
+{
+	if (!mLoaded) {
+		if (src != dst)
+			memcpy(dst, src, (size_t) width * 4);
+		return;
+	}
+	if (skin == NULL) {
+		for (int j = 0; j < width; j++)
+			dst[j] = apply(src[j], 0);
+	} else {
+		for (int j = 0; j < width; j++)
+			dst[j] = apply(src[j], skin[j]);
+	}
+}
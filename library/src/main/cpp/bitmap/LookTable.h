@@ -0,0 +1,125 @@
+#ifndef _LOOK_TABLE_H_
+#define _LOOK_TABLE_H_
+
+#include <stdint.h>
+#include "HslMixer.h"
+#include "ImageView.h"
+#include "../utils/MagicTables.h"
+
+/**
+ * Colour look as a 33 point RGB cube, applied by tetrahedral interpolation.
+ *
+ * Every grid entry holds two colours: the look itself and a skin-safe
+ * variant, so protecting skin is a per-pixel blend between the two inside
+ * the same lookup, driven by a skin mask (0 = look, 255 = skin-safe; soft
+ * masks blend). Both colours share a cache line, so protection adds no
+ * memory traffic.
+ *
+ * An HslMixer set on the table is compiled into the cube after the look,
+ * in a few milliseconds per change, so the mixer costs nothing per pixel
+ * on top of the look; with a mixer and no lookup image the cube holds the
+ * mixer alone.
+ *
+ * Pixels are RGBA in memory order (red in the low byte), as Android
+ * bitmaps and windows store them.
+ */
+class LookTable
+{
+public:
+	static const int SIZE = 33;
+
+	LookTable();
+	~LookTable();
+
+	// 512x512 lookup image in the MagicLookupFilter layout, NULL for none;
+	// also resets the skin-safe look
+	void setLookup(const uint8_t* rgba, int stride);
+	// skin-safe look from another lookup image; NULL derives one that keeps
+	// the look's luma but the original chroma
+	void setSkinLookup(const uint8_t* rgba, int stride);
+	// copied; NULL or an identity mixer removes it
+	void setMixer(const HslMixer* mixer);
+	// neither a lookup nor a mixer
+	bool isEmpty() const { return !mLoaded; }
+	// ContentHash of the cube, ContentHash::NONE while empty; equal
+	// tables render equal images
+	uint64_t getHash() const { return mHash; }
+
+	// skin may be NULL; src and dst may be the same row
+	void applyRow(const uint32_t* src, uint32_t* dst, int width, const uint8_t* skin) const;
+	// RGBA views clipped to the smaller one, a GRAY_8 skin view or an empty one
+	void applyImage(const ImageView& src, const ImageView& dst, const ImageView& skin) const;
+	inline uint32_t apply(uint32_t pixel, int skin) const;
+
+	// the cube and the look before the mixer
+	static int64_t tableBytes() { return (int64_t) 2 * SIZE * SIZE * SIZE * sizeof(uint64_t); }
+
+private:
+	LookTable(const LookTable&);
+	LookTable& operator=(const LookTable&);
+
+	static inline uint32_t blend(int w0, int w1, int w2, int w3, uint32_t p0, uint32_t p1, uint32_t p2, uint32_t p3);
+	static uint32_t sampleLookup(const uint8_t* rgba, int stride, int r, int g, int b);
+	// rebuilds mTable from mBase and the mixer
+	void compose();
+
+	// low word the look, high word the skin-safe look, both 0x00BBGGRR
+	uint64_t* mTable;
+	// the same before the mixer
+	uint64_t* mBase;
+	HslMixer mMixer;
+	bool mHasLookup;
+	bool mLoaded;
+	uint64_t mHash;
+};
+
+inline uint32_t LookTable::apply(uint32_t pixel, int skin) const
+{
+	int cr = kLut33Cell[pixel & 0xff], cg = kLut33Cell[(pixel >> 8) & 0xff], cb = kLut33Cell[(pixel >> 16) & 0xff];
+	int fr = cr & 511, fg = cg & 511, fb = cb & 511;
+	const uint64_t* c000 = mTable + ((cb >> 9) * SIZE + (cg >> 9)) * SIZE + (cr >> 9);
+	const int dr = 1, dg = SIZE, db = SIZE * SIZE;
+	// the cube is split into six tetrahedra along the order of the fractions
+	int w0, w1, w2, w3, o1, o2;
+	if (fr > fg) {
+		if (fg > fb) {
+			w0 = 256 - fr; w1 = fr - fg; w2 = fg - fb; w3 = fb; o1 = dr; o2 = dr + dg;
+		} else if (fr > fb) {
+			w0 = 256 - fr; w1 = fr - fb; w2 = fb - fg; w3 = fg; o1 = dr; o2 = dr + db;
+		} else {
+			w0 = 256 - fb; w1 = fb - fr; w2 = fr - fg; w3 = fg; o1 = db; o2 = dr + db;
+		}
+	} else {
+		if (fb > fg) {
+			w0 = 256 - fb; w1 = fb - fg; w2 = fg - fr; w3 = fr; o1 = db; o2 = dg + db;
+		} else if (fb > fr) {
+			w0 = 256 - fg; w1 = fg - fb; w2 = fb - fr; w3 = fr; o1 = dg; o2 = dg + db;
+		} else {
+			w0 = 256 - fg; w1 = fg - fr; w2 = fr - fb; w3 = fb; o1 = dg; o2 = dr + dg;
+		}
+	}
+	uint64_t p0 = c000[0], p1 = c000[o1], p2 = c000[o2], p3 = c000[dr + dg + db];
+	uint32_t out = blend(w0, w1, w2, w3, (uint32_t) p0, (uint32_t) p1, (uint32_t) p2, (uint32_t) p3);
+	if (skin == 0)
+		return out | (pixel & 0xff000000u);
+	uint32_t skinSafe = blend(w0, w1, w2, w3, (uint32_t) (p0 >> 32), (uint32_t) (p1 >> 32),
+			(uint32_t) (p2 >> 32), (uint32_t) (p3 >> 32));
+	// skin 255 must reach the skin-safe look exactly
+	int safe = skin + (skin >> 7);
+	int red = out & 0xff, green = (out >> 8) & 0xff, blue = out >> 16;
+	red += (((int) (skinSafe & 0xff) - red) * safe + 128) >> 8;
+	green += (((int) ((skinSafe >> 8) & 0xff) - green) * safe + 128) >> 8;
+	blue += (((int) (skinSafe >> 16) - blue) * safe + 128) >> 8;
+	return (pixel & 0xff000000u) | (blue << 16) | (green << 8) | red;
+}
+
+inline uint32_t LookTable::blend(int w0, int w1, int w2, int w3, uint32_t p0, uint32_t p1, uint32_t p2, uint32_t p3)
+{
+	uint32_t red = (w0 * (p0 & 0xff) + w1 * (p1 & 0xff) + w2 * (p2 & 0xff) + w3 * (p3 & 0xff) + 128) >> 8;
+	uint32_t green = (w0 * ((p0 >> 8) & 0xff) + w1 * ((p1 >> 8) & 0xff) + w2 * ((p2 >> 8) & 0xff)
+			+ w3 * ((p3 >> 8) & 0xff) + 128) >> 8;
+	uint32_t blue = (w0 * ((p0 >> 16) & 0xff) + w1 * ((p1 >> 16) & 0xff) + w2 * ((p2 >> 16) & 0xff)
+			+ w3 * ((p3 >> 16) & 0xff) + 128) >> 8;
+	return (blue << 16) | (green << 8) | red;
+}
+#endif
@@ -0,0 +1,152 @@
+#include "PixelCopy.h"
+#include <string.h>
+#include "../utils/ThreadPool.h"
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#define PIXEL_COPY_NEON 1
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#define PIXEL_COPY_SSE 1
+#endif
+
+// below this the copy is cheaper than waking the pool
+static const int64_t kParallelBytes = 1 << 20;
+static const int kRowsPerBand = 32;
+
+static inline uint32_t convertPixel(uint32_t p, int flags)
+{
+	if (flags & PixelCopy::SWAP_RB)
+		p = (p & 0xff00ff00u) | ((p >> 16) & 0xffu) | ((p & 0xffu) << 16);
+	if (flags & PixelCopy::FILL_ALPHA)
+		p |= 0xff000000u;
+	return p;
+}
+
+static void copyRow(const uint32_t* src, uint32_t* dst, int width, int flags, bool stream)
+{
+	int j = 0;
+	if (flags == 0 && !stream) {
+		memcpy(dst, src, (size_t) width * 4);
+		return;
+	}
+#if PIXEL_COPY_NEON
+	static const uint8_t kSwap[16] = { 2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15 };
+	const uint8x16_t swap = vld1q_u8(kSwap);
+	const uint8x16_t alpha = vreinterpretq_u8_u32(vdupq_n_u32(flags & PixelCopy::FILL_ALPHA ? 0xff000000u : 0));
+	for (; j + 8 <= width; j += 8) {
+		uint8x16_t a = vld1q_u8((const uint8_t*) (src + j));
+		uint8x16_t b = vld1q_u8((const uint8_t*) (src + j + 4));
+		if (flags & PixelCopy::SWAP_RB) {
+			a = vqtbl1q_u8(a, swap);
+			b = vqtbl1q_u8(b, swap);
+		}
+		a = vorrq_u8(a, alpha);
+		b = vorrq_u8(b, alpha);
+		if (stream) {
+			__asm__ volatile("stnp %q0, %q1, [%2]" : : "w"(a), "w"(b), "r"(dst + j) : "memory");
+		} else {
+			vst1q_u8((uint8_t*) (dst + j), a);
+			vst1q_u8((uint8_t*) (dst + j + 4), b);
+		}
+	}
+#elif PIXEL_COPY_SSE
+	const __m128i swap = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+	const __m128i alpha = _mm_set1_epi32(flags & PixelCopy::FILL_ALPHA ? (int) 0xff000000u : 0);
+	if (stream) {
+		// MOVNTDQ needs a 16 byte aligned destination
+		for (; j < width && ((uintptr_t) (dst + j) & 15) != 0; j++)
+			dst[j] = convertPixel(src[j], flags);
+	}
+	for (; j + 4 <= width; j += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i*) (src + j));
+		if (flags & PixelCopy::SWAP_RB)
+			v = _mm_shuffle_epi8(v, swap);
+		v = _mm_or_si128(v, alpha);
+		if (stream)
+			_mm_stream_si128((__m128i*) (dst + j), v);
+		else
+			_mm_storeu_si128((__m128i*) (dst + j), v);
+	}
+#endif
+	for (; j < width; j++)
+		dst[j] = convertPixel(src[j], flags);
+}
+
+static void fillRow(uint32_t* dst, int width, uint32_t value, bool stream)
+{
+	int j = 0;
+#if PIXEL_COPY_NEON
+	if (stream) {
+		const uint32x4_t v = vdupq_n_u32(value);
+		for (; j + 8 <= width; j += 8)
+			__asm__ volatile("stnp %q0, %q0, [%1]" : : "w"(v), "r"(dst + j) : "memory");
+	}
+#elif PIXEL_COPY_SSE
+	if (stream) {
+		const __m128i v = _mm_set1_epi32((int) value);
+		for (; j < width && ((uintptr_t) (dst + j) & 15) != 0; j++)
+			dst[j] = value;
+		for (; j + 4 <= width; j += 4)
+			_mm_stream_si128((__m128i*) (dst + j), v);
+	}
+#else
+	(void) stream;
+#endif
+	for (; j < width; j++)
+		dst[j] = value;
+}
+
+static inline void streamFence(bool stream)
+{
+#if PIXEL_COPY_SSE
+	if (stream)
+		_mm_sfence();
+#else
+	(void) stream;
+#endif
+}
+
+void PixelCopy::copy(const void* src, int srcStride, void* dst, int dstStride,
+		int width, int height, int flags)
+{
+	if (src == NULL || dst == NULL || width <= 0 || height <= 0)
+		return;
+	int64_t bytes = (int64_t) width * height * 4;
+	bool stream = (flags & STREAM) && bytes >= STREAM_MIN_BYTES;
+	int convert = flags & (SWAP_RB | FILL_ALPHA);
+	const uint8_t* from = (const uint8_t*) src;
+	uint8_t* to = (uint8_t*) dst;
+	if (!convert && !stream && srcStride == width * 4 && dstStride == width * 4 && bytes < kParallelBytes) {
+		memcpy(to, from, bytes);
+		return;
+	}
+	int bands = bytes < kParallelBytes ? 1 : (height + kRowsPerBand - 1) / kRowsPerBand;
+	int rowsPerBand = (height + bands - 1) / bands;
+	ThreadPool::getInstance()->parallelFor(bands, [&](int band) {
+		int start = band * rowsPerBand;
+		int end = start + rowsPerBand < height ? start + rowsPerBand : height;
+		for (int i = start; i < end; i++)
+			copyRow((const uint32_t*) (from + (int64_t) i * srcStride),
+					(uint32_t*) (to + (int64_t) i * dstStride), width, convert, stream);
+		streamFence(stream);
+	});
+}
+
+void PixelCopy::fill(void* dst, int dstStride, int width, int height, uint32_t value, int flags)
+{
+	if (dst == NULL || width <= 0 || height <= 0)
+		return;
+	int64_t bytes = (int64_t) width * height * 4;
+	bool stream = (flags & STREAM) && bytes >= STREAM_MIN_BYTES;
+	uint8_t* to = (uint8_t*) dst;
+	int bands = bytes < kParallelBytes ? 1 : (height + kRowsPerBand - 1) / kRowsPerBand;
+	int rowsPerBand = (height + bands - 1) / bands;
+	ThreadPool::getInstance()->parallelFor(bands, [&](int band) {
+		int start = band * rowsPerBand;
+		int end = start + rowsPerBand < height ? start + rowsPerBand : height;
+		for (int i = start; i < end; i++)
+			fillRow((uint32_t*) (to + (int64_t) i * dstStride), width, value, stream);
+		streamFence(stream);
+	});
+}
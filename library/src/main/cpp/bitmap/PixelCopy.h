@@ -0,0 +1,43 @@
+#ifndef _PIXEL_COPY_H_
+#define _PIXEL_COPY_H_
+
+#include <stdint.h>
+#include "ImageView.h"
+
+/**
+ * Full-frame 32-bit pixel copy and fill.
+ * Large frames are split into row bands over the ThreadPool, format
+ * conversion is done on the fly, and with STREAM the stores bypass the
+ * caches (MOVNTDQ / STNP) so a copy nobody reads back soon does not evict
+ * the working set or pay for the read-for-ownership of the destination.
+ * Strides are in bytes.
+ */
+class PixelCopy
+{
+public:
+	// RGBA <-> BGRA
+	static const int SWAP_RB = 1;
+	// force alpha to 0xff
+	static const int FILL_ALPHA = 2;
+	// destination is not re-read soon; only honoured from STREAM_MIN_BYTES
+	static const int STREAM = 4;
+	// beyond a typical mobile L2/L3 the destination would be evicted anyway
+	static const int64_t STREAM_MIN_BYTES = 8 << 20;
+
+	static void copy(const void* src, int srcStride, void* dst, int dstStride,
+			int width, int height, int flags);
+	static void fill(void* dst, int dstStride, int width, int height, uint32_t value, int flags);
+
+	// clipped to the smaller view
+	static void copy(const ImageView& src, const ImageView& dst, int flags)
+	{
+		copy(src.pixels, src.stride, dst.pixels, dst.stride, src.width < dst.width ? src.width : dst.width,
+				src.height < dst.height ? src.height : dst.height, flags);
+	}
+
+	static void fill(const ImageView& dst, uint32_t value, int flags)
+	{
+		fill(dst.pixels, dst.stride, dst.width, dst.height, value, flags);
+	}
+};
+#endif
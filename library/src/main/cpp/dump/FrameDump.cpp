@@ -0,0 +1,288 @@
+#include "FrameDump.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <vector>
+#include "../utils/ThreadPool.h"
+#include "../utils/MemoryGovernor.h"
+#include "../utils/MagicLog.h"
+
+#define  LOG_TAG    "FrameDump"
+
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF  0x40
+#define QOI_OP_LUMA  0x80
+#define QOI_OP_RUN   0xc0
+#define QOI_OP_RGB   0xfe
+#define QOI_OP_RGBA  0xff
+#define QOI_MASK_2   0xc0
+#define QOI_HASH(p)  ((p[0] * 3 + p[1] * 5 + p[2] * 7 + p[3] * 11) & 63)
+
+static const uint8_t kMagic[4] = { 'M', 'F', 'D', '1' };
+static const uint8_t kEndMarker[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+static const int kHeaderWords = 4;
+static const int kMinStripeRows = 16;
+static const int kMaxStripes = 32;
+
+static void putU32(uint8_t* p, uint32_t v)
+{
+	p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static uint32_t getU32(const uint8_t* p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static bool writeFully(int fd, const uint8_t* data, size_t size)
+{
+	while (size > 0) {
+		ssize_t n = write(fd, data, size);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		data += n;
+		size -= n;
+	}
+	return true;
+}
+
+size_t FrameDump::maxStripeSize(int width, int rows)
+{
+	return (size_t) width * rows * 5 + sizeof(kEndMarker);
+}
+
+size_t FrameDump::encodeStripe(const uint8_t* rgba, int width, int rows, int stride, uint8_t* out)
+{
+	uint8_t index[64 * 4];
+	uint8_t prev[4] = { 0, 0, 0, 255 };
+	memset(index, 0, sizeof(index));
+	size_t p = 0;
+	int run = 0;
+	for (int i = 0; i < rows; i++) {
+		const uint8_t* px = rgba + (ptrdiff_t) i * stride;
+		for (int j = 0; j < width; j++, px += 4) {
+			if (*(const uint32_t*) px == *(const uint32_t*) prev) {
+				if (++run == 62) {
+					out[p++] = QOI_OP_RUN | (run - 1);
+					run = 0;
+				}
+				continue;
+			}
+			if (run > 0) {
+				out[p++] = QOI_OP_RUN | (run - 1);
+				run = 0;
+			}
+			int hash = QOI_HASH(px);
+			uint8_t* slot = index + hash * 4;
+			if (*(uint32_t*) slot == *(const uint32_t*) px) {
+				out[p++] = QOI_OP_INDEX | hash;
+			} else {
+				memcpy(slot, px, 4);
+				if (px[3] == prev[3]) {
+					int8_t vr = px[0] - prev[0];
+					int8_t vg = px[1] - prev[1];
+					int8_t vb = px[2] - prev[2];
+					int8_t vgr = vr - vg;
+					int8_t vgb = vb - vg;
+					if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+						out[p++] = QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2);
+					} else if (vgr > -9 && vgr < 8 && vg > -33 && vg < 32 && vgb > -9 && vgb < 8) {
+						out[p++] = QOI_OP_LUMA | (vg + 32);
+						out[p++] = (vgr + 8) << 4 | (vgb + 8);
+					} else {
+						out[p++] = QOI_OP_RGB;
+						out[p++] = px[0];
+						out[p++] = px[1];
+						out[p++] = px[2];
+					}
+				} else {
+					out[p++] = QOI_OP_RGBA;
+					memcpy(out + p, px, 4);
+					p += 4;
+				}
+			}
+			memcpy(prev, px, 4);
+		}
+	}
+	if (run > 0)
+		out[p++] = QOI_OP_RUN | (run - 1);
+	memcpy(out + p, kEndMarker, sizeof(kEndMarker));
+	return p + sizeof(kEndMarker);
+}
+
+bool FrameDump::decodeStripe(const uint8_t* data, size_t size, int width, int rows, uint8_t* out)
+{
+	uint8_t index[64 * 4];
+	uint8_t px[4] = { 0, 0, 0, 255 };
+	memset(index, 0, sizeof(index));
+	size_t total = (size_t) width * rows;
+	size_t limit = size - sizeof(kEndMarker);
+	size_t p = 0;
+	int run = 0;
+	for (size_t n = 0; n < total; n++, out += 4) {
+		if (run > 0) {
+			run--;
+		} else {
+			if (p >= limit)
+				return false;
+			int b1 = data[p++];
+			if (b1 == QOI_OP_RGB) {
+				px[0] = data[p++]; px[1] = data[p++]; px[2] = data[p++];
+			} else if (b1 == QOI_OP_RGBA) {
+				memcpy(px, data + p, 4);
+				p += 4;
+			} else if ((b1 & QOI_MASK_2) == QOI_OP_INDEX) {
+				memcpy(px, index + b1 * 4, 4);
+			} else if ((b1 & QOI_MASK_2) == QOI_OP_DIFF) {
+				px[0] += ((b1 >> 4) & 0x03) - 2;
+				px[1] += ((b1 >> 2) & 0x03) - 2;
+				px[2] += (b1 & 0x03) - 2;
+			} else if ((b1 & QOI_MASK_2) == QOI_OP_LUMA) {
+				int b2 = data[p++];
+				int vg = (b1 & 0x3f) - 32;
+				px[0] += vg - 8 + ((b2 >> 4) & 0x0f);
+				px[1] += vg;
+				px[2] += vg - 8 + (b2 & 0x0f);
+			} else {
+				run = b1 & 0x3f;
+			}
+			memcpy(index + QOI_HASH(px) * 4, px, 4);
+		}
+		memcpy(out, px, 4);
+	}
+	return p <= limit;
+}
+
+int64_t FrameDump::save(const uint8_t* rgba, int width, int height, int stride, int flags, int fd)
+{
+	if (rgba == NULL || width <= 0 || height <= 0 || stride < width * 4 || fd < 0)
+		return -1;
+	int stripes = ThreadPool::getInstance()->getThreadCount();
+	if (stripes > kMaxStripes)
+		stripes = kMaxStripes;
+	if (stripes > height / kMinStripeRows)
+		stripes = height / kMinStripeRows > 0 ? height / kMinStripeRows : 1;
+	int stripeRows = (height + stripes - 1) / stripes;
+	stripes = (height + stripeRows - 1) / stripeRows;
+
+	// flipping is free here: walk the source rows with a negative stride
+	const uint8_t* top = rgba;
+	ptrdiff_t step = stride;
+	if (flags & FLAG_FLIP_VERTICAL) {
+		top = rgba + (ptrdiff_t) (height - 1) * stride;
+		step = -step;
+	}
+
+	int64_t scratch = 0;
+	for (int s = 0; s < stripes; s++)
+		scratch += maxStripeSize(width, s == stripes - 1 ? height - s * stripeRows : stripeRows);
+	if (!MemoryGovernor::getInstance()->reserve(MEMORY_OWNER_POOL, scratch)) {
+		LOGE("no memory budget for %.1f MB of encode buffers", scratch / 1048576.0);
+		return -1;
+	}
+
+	std::vector<uint8_t*> buffers(stripes);
+	std::vector<size_t> sizes(stripes);
+	ThreadPool::getInstance()->parallelFor(stripes, [&](int s) {
+		int rows = s == stripes - 1 ? height - s * stripeRows : stripeRows;
+		buffers[s] = new uint8_t[maxStripeSize(width, rows)];
+		const uint8_t* src = top + (ptrdiff_t) s * stripeRows * step;
+		sizes[s] = encodeStripe(src, width, rows, (int) step, buffers[s]);
+	});
+
+	std::vector<uint8_t> header((kHeaderWords + 1 + stripes) * 4);
+	memcpy(&header[0], kMagic, 4);
+	putU32(&header[4], width);
+	putU32(&header[8], height);
+	putU32(&header[12], stripes);
+	putU32(&header[16], stripeRows);
+	int64_t total = header.size();
+	for (int s = 0; s < stripes; s++) {
+		putU32(&header[20 + s * 4], (uint32_t) sizes[s]);
+		total += sizes[s];
+	}
+	bool ok = writeFully(fd, &header[0], header.size());
+	for (int s = 0; s < stripes; s++) {
+		if (ok)
+			ok = writeFully(fd, buffers[s], sizes[s]);
+		delete[] buffers[s];
+	}
+	MemoryGovernor::getInstance()->release(MEMORY_OWNER_POOL, scratch);
+	if (!ok) {
+		LOGE("write failed: %s", strerror(errno));
+		return -1;
+	}
+	return total;
+}
+
+uint8_t* FrameDump::load(const char* path, int* width, int* height)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		LOGE("cannot open %s: %s", path, strerror(errno));
+		return NULL;
+	}
+	struct stat st;
+	uint8_t* file = NULL;
+	if (fstat(fd, &st) == 0 && st.st_size > (kHeaderWords + 1) * 4) {
+		file = new uint8_t[st.st_size];
+		size_t got = 0;
+		while (got < (size_t) st.st_size) {
+			ssize_t n = read(fd, file + got, st.st_size - got);
+			if (n <= 0)
+				break;
+			got += n;
+		}
+		if (got != (size_t) st.st_size) {
+			delete[] file;
+			file = NULL;
+		}
+	}
+	close(fd);
+	if (file == NULL || memcmp(file, kMagic, 4) != 0) {
+		LOGE("%s is not a frame dump", path);
+		delete[] file;
+		return NULL;
+	}
+	int w = getU32(file + 4);
+	int h = getU32(file + 8);
+	int stripes = getU32(file + 12);
+	size_t offset = (kHeaderWords + 1 + (size_t) stripes) * 4;
+	int stripeRows = getU32(file + 16);
+	if (w <= 0 || h <= 0 || stripes <= 0 || stripes > h || offset > (size_t) st.st_size
+			|| stripeRows <= 0 || (int64_t) stripeRows * (stripes - 1) >= h) {
+		LOGE("%s has a corrupt header", path);
+		delete[] file;
+		return NULL;
+	}
+	uint8_t* pixels = new uint8_t[(size_t) w * h * 4];
+	std::vector<size_t> offsets(stripes + 1, 0);
+	offsets[0] = offset;
+	for (int s = 0; s < stripes; s++)
+		offsets[s + 1] = offsets[s] + getU32(file + 20 + s * 4);
+	std::vector<char> ok(stripes, 0);
+	ThreadPool::getInstance()->parallelFor(stripes, [&](int s) {
+		size_t size = offsets[s + 1] - offsets[s];
+		int rows = s == stripes - 1 ? h - s * stripeRows : stripeRows;
+		if (rows <= 0 || size < sizeof(kEndMarker) || offsets[s + 1] > (size_t) st.st_size)
+			return;
+		ok[s] = decodeStripe(file + offsets[s], size, w, rows, pixels + (size_t) s * stripeRows * w * 4);
+	});
+	delete[] file;
+	for (int s = 0; s < stripes; s++) {
+		if (!ok[s]) {
+			LOGE("%s: stripe %d is corrupt", path, s);
+			delete[] pixels;
+			return NULL;
+		}
+	}
+	*width = w;
+	*height = h;
+	return pixels;
+}
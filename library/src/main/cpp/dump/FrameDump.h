@@ -0,0 +1,35 @@
+#ifndef _FRAME_DUMP_H_
+#define _FRAME_DUMP_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Lossless RGBA frame dump (.mfd).
+ *
+ * The image is cut into horizontal stripes that are encoded independently
+ * with the QOI op set (index / diff / luma / run / literal), so stripes can
+ * be encoded and decoded in parallel. Layout, all integers little-endian:
+ *
+ *   "MFD1" | width u32 | height u32 | stripes u32 | stripe rows u32
+ *   | stripe byte size u32 * stripes | stripe data ...
+ *
+ * Each stripe covers stripe rows of the top-down image (the last one the
+ * remainder) and ends with the 8 byte QOI end marker.
+ */
+class FrameDump
+{
+public:
+	// rows of the source are read bottom-up, e.g. straight from glReadPixels
+	static const int FLAG_FLIP_VERTICAL = 1;
+
+	// returns bytes written or -1
+	static int64_t save(const uint8_t* rgba, int width, int height, int stride, int flags, int fd);
+	// returns a new[] allocated RGBA buffer (width * 4 stride) or NULL
+	static uint8_t* load(const char* path, int* width, int* height);
+
+	static size_t encodeStripe(const uint8_t* rgba, int width, int rows, int stride, uint8_t* out);
+	static bool decodeStripe(const uint8_t* data, size_t size, int width, int rows, uint8_t* out);
+	static size_t maxStripeSize(int width, int rows);
+};
+#endif
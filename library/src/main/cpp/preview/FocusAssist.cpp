@@ -0,0 +1,185 @@
+#include "FocusAssist.h"
+#include <stdio.h>
+#include <string.h>
+#include <new>
+#include "../bitmap/Downsample.h"
+#include "../utils/MemoryGovernor.h"
+#include "../utils/MagicLog.h"
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#define FOCUS_ASSIST_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define FOCUS_ASSIST_SSE 1
+#endif
+
+#define  LOG_TAG    "FocusAssist"
+
+// one stripe period, so every row's pattern is a window into one buffer
+#define STRIPE_PERIOD (2 * FocusAssist::STRIPE_WIDTH)
+
+FocusAssist::FocusAssist()
+{
+	// in-focus texture, and white at the top of the video range
+	mPeakThreshold = 160;
+	mZebraLevel = 235;
+	mMaskWidth = 0;
+	mScratch = NULL;
+	mReservedBytes = 0;
+}
+
+FocusAssist::~FocusAssist()
+{
+	release();
+}
+
+void FocusAssist::setPeaking(int threshold)
+{
+	mPeakThreshold = threshold > 0 ? threshold : 0;
+}
+
+void FocusAssist::setZebra(int level)
+{
+	mZebraLevel = level > 0 ? level : 0;
+}
+
+void FocusAssist::release()
+{
+	delete[] mScratch;
+	mScratch = NULL;
+	mMaskWidth = 0;
+	MemoryGovernor::getInstance()->release(MEMORY_OWNER_POOL, mReservedBytes);
+	mReservedBytes = 0;
+}
+
+bool FocusAssist::reserve(int maskWidth)
+{
+	if (maskWidth == mMaskWidth)
+		return true;
+	release();
+	int64_t bytes = (int64_t) 4 * maskWidth + STRIPE_PERIOD;
+	if (!MemoryGovernor::getInstance()->reserve(MEMORY_OWNER_POOL, bytes))
+		return false;
+	mReservedBytes = bytes;
+	mScratch = new (std::nothrow) uint8_t[bytes];
+	if (mScratch == NULL) {
+		LOGE("allocation failed for a %d wide mask", maskWidth);
+		release();
+		return false;
+	}
+	uint8_t* stripes = mScratch + 3 * maskWidth;
+	for (int j = 0; j < maskWidth + STRIPE_PERIOD; j++)
+		stripes[j] = (j / STRIPE_WIDTH) & 1 ? 0xff : 0;
+	mMaskWidth = maskWidth;
+	return true;
+}
+
+static inline uint8_t maskCell(const uint8_t* up, const uint8_t* mid, const uint8_t* down, int j,
+		int peakThreshold, int zebraLevel, uint8_t stripe)
+{
+	uint8_t flags = mid[j] >= zebraLevel ? (stripe & FocusAssist::ZEBRA) : 0;
+	if (up != NULL && peakThreshold > 0) {
+		int gx = (up[j + 1] + 2 * mid[j + 1] + down[j + 1]) - (up[j - 1] + 2 * mid[j - 1] + down[j - 1]);
+		int gy = (down[j - 1] + 2 * down[j] + down[j + 1]) - (up[j - 1] + 2 * up[j] + up[j + 1]);
+		if ((gx < 0 ? -gx : gx) + (gy < 0 ? -gy : gy) >= peakThreshold)
+			flags |= FocusAssist::PEAK;
+	}
+	return flags;
+}
+
+// one mask row; up and down are NULL on the first and last row, where
+// the Sobel kernel does not fit
+static void maskRow(const uint8_t* up, const uint8_t* mid, const uint8_t* down, const uint8_t* stripes,
+		uint8_t* out, int width, int peakThreshold, int zebraLevel)
+{
+	if (up == NULL || width < 3) {
+		for (int j = 0; j < width; j++)
+			out[j] = maskCell(NULL, mid, NULL, j, peakThreshold, zebraLevel, stripes[j]);
+		return;
+	}
+	out[0] = maskCell(NULL, mid, NULL, 0, peakThreshold, zebraLevel, stripes[0]);
+	int j = 1;
+	// levels above 255 never match, threshold 0 never marks
+	const bool zebra = zebraLevel <= 255;
+	const bool peak = peakThreshold > 0;
+#if defined(FOCUS_ASSIST_NEON)
+	const uint8x8_t level = vdup_n_u8(zebra ? zebraLevel : 255);
+	const uint8x8_t zebraBit = vdup_n_u8(zebra ? FocusAssist::ZEBRA : 0);
+	const int16x8_t threshold = vdupq_n_s16(peak ? peakThreshold : 0x7fff);
+	const uint8x8_t peakBit = vdup_n_u8(peak ? FocusAssist::PEAK : 0);
+	for (; j + 9 <= width; j += 8) {
+		int16x8_t ul = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(up + j - 1)));
+		int16x8_t uc = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(up + j)));
+		int16x8_t ur = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(up + j + 1)));
+		int16x8_t ml = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(mid + j - 1)));
+		uint8x8_t mc8 = vld1_u8(mid + j);
+		int16x8_t mr = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(mid + j + 1)));
+		int16x8_t dl = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(down + j - 1)));
+		int16x8_t dc = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(down + j)));
+		int16x8_t dr = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(down + j + 1)));
+		int16x8_t gx = vsubq_s16(vaddq_s16(vaddq_s16(ur, dr), vshlq_n_s16(mr, 1)),
+				vaddq_s16(vaddq_s16(ul, dl), vshlq_n_s16(ml, 1)));
+		int16x8_t gy = vsubq_s16(vaddq_s16(vaddq_s16(dl, dr), vshlq_n_s16(dc, 1)),
+				vaddq_s16(vaddq_s16(ul, ur), vshlq_n_s16(uc, 1)));
+		int16x8_t magnitude = vaddq_s16(vabsq_s16(gx), vabsq_s16(gy));
+		uint8x8_t flags = vand_u8(vmovn_u16(vcgeq_s16(magnitude, threshold)), peakBit);
+		uint8x8_t bright = vand_u8(vcge_u8(mc8, level), vand_u8(vld1_u8(stripes + j), zebraBit));
+		vst1_u8(out + j, vorr_u8(flags, bright));
+	}
+#elif defined(FOCUS_ASSIST_SSE)
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i level = _mm_set1_epi8((char) (zebra ? zebraLevel : 255));
+	const __m128i zebraBit = _mm_set1_epi8(zebra ? FocusAssist::ZEBRA : 0);
+	// magnitude > threshold - 1, i.e. >= threshold
+	const __m128i threshold = _mm_set1_epi16(peak ? peakThreshold - 1 : 0x7fff);
+	const __m128i peakBit = _mm_set1_epi8(peak ? FocusAssist::PEAK : 0);
+	for (; j + 9 <= width; j += 8) {
+		__m128i ul = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) (up + j - 1)), zero);
+		__m128i uc = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) (up + j)), zero);
+		__m128i ur = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) (up + j + 1)), zero);
+		__m128i ml = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) (mid + j - 1)), zero);
+		__m128i mc8 = _mm_loadl_epi64((const __m128i*) (mid + j));
+		__m128i mr = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) (mid + j + 1)), zero);
+		__m128i dl = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) (down + j - 1)), zero);
+		__m128i dc = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) (down + j)), zero);
+		__m128i dr = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) (down + j + 1)), zero);
+		__m128i gx = _mm_sub_epi16(_mm_add_epi16(_mm_add_epi16(ur, dr), _mm_slli_epi16(mr, 1)),
+				_mm_add_epi16(_mm_add_epi16(ul, dl), _mm_slli_epi16(ml, 1)));
+		__m128i gy = _mm_sub_epi16(_mm_add_epi16(_mm_add_epi16(dl, dr), _mm_slli_epi16(dc, 1)),
+				_mm_add_epi16(_mm_add_epi16(ul, ur), _mm_slli_epi16(uc, 1)));
+		__m128i magnitude = _mm_add_epi16(_mm_max_epi16(gx, _mm_sub_epi16(zero, gx)),
+				_mm_max_epi16(gy, _mm_sub_epi16(zero, gy)));
+		__m128i edge = _mm_cmpgt_epi16(magnitude, threshold);
+		__m128i flags = _mm_and_si128(_mm_packs_epi16(edge, edge), peakBit);
+		__m128i bright = _mm_cmpeq_epi8(_mm_max_epu8(mc8, level), mc8);
+		bright = _mm_and_si128(bright, _mm_and_si128(_mm_loadl_epi64((const __m128i*) (stripes + j)), zebraBit));
+		_mm_storel_epi64((__m128i*) (out + j), _mm_or_si128(flags, bright));
+	}
+#endif
+	for (; j < width - 1; j++)
+		out[j] = maskCell(up, mid, down, j, peakThreshold, zebraLevel, stripes[j]);
+	out[width - 1] = maskCell(NULL, mid, NULL, width - 1, peakThreshold, zebraLevel, stripes[width - 1]);
+}
+
+bool FocusAssist::compute(const ImageView& luma, uint8_t* out, int stride)
+{
+	const int width = maskSize(luma.width);
+	const int height = maskSize(luma.height);
+	if (luma.isEmpty() || width <= 0 || height <= 0 || out == NULL)
+		return false;
+	if (!reserve(width))
+		return false;
+	uint8_t* rows[3] = { mScratch, mScratch + width, mScratch + 2 * width };
+	const uint8_t* stripes = mScratch + 3 * width;
+	Downsample::halveRow(luma.row(0), luma.row(1), rows[0], width);
+	for (int i = 0; i < height; i++) {
+		if (i + 1 < height)
+			Downsample::halveRow(luma.row(2 * i + 2), luma.row(2 * i + 3), rows[(i + 1) % 3], width);
+		bool inside = i > 0 && i + 1 < height;
+		// stripes run down and to the left
+		maskRow(inside ? rows[(i + 2) % 3] : NULL, rows[i % 3], inside ? rows[(i + 1) % 3] : NULL,
+				stripes + i % STRIPE_PERIOD, out + (size_t) i * stride, width, mPeakThreshold, mZebraLevel);
+	}
+	return true;
+}
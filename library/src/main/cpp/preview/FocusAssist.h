@@ -0,0 +1,53 @@
+#ifndef _FOCUS_ASSIST_H_
+#define _FOCUS_ASSIST_H_
+
+#include <stdint.h>
+#include "../bitmap/ImageView.h"
+
+/**
+ * Focus peaking and zebra overlays for a manual shooting mode, computed
+ * from the preview luma at half resolution: a Sobel edge magnitude at or
+ * above the peaking threshold sets PEAK, luma at or above the zebra level
+ * sets ZEBRA on diagonal stripes STRIPE_WIDTH cells wide. The result is
+ * one byte of flags per 2x2 block, small enough to upload as a texture
+ * and draw over the preview.
+ *
+ * The luma is reduced a row at a time into a three row window, so the
+ * scratch is a few rows whatever the frame size. Sobel, thresholds and
+ * stripes run 8 cells at a time on NEON and SSE2, on the calling thread,
+ * so it runs next to the beautify jobs without competing for the pool.
+ */
+class FocusAssist
+{
+public:
+	static const uint8_t PEAK = 1;
+	static const uint8_t ZEBRA = 2;
+	static const int STRIPE_WIDTH = 4;
+
+	FocusAssist();
+	~FocusAssist();
+
+	static int maskSize(int size) { return size / 2; }
+
+	// |Gx| + |Gy| of the half resolution luma, 0..2040; 0 turns peaking off
+	void setPeaking(int threshold);
+	// 0..255, anything above turns zebra off
+	void setZebra(int level);
+
+	// luma is GRAY_8, the NV21 Y plane; out holds maskSize(width) x
+	// maskSize(height) bytes, stride apart. False when the scratch does
+	// not fit the memory budget.
+	bool compute(const ImageView& luma, uint8_t* out, int stride);
+	void release();
+
+private:
+	bool reserve(int maskWidth);
+
+	int mPeakThreshold;
+	int mZebraLevel;
+	int mMaskWidth;
+	// three reduced rows, then the stripe pattern
+	uint8_t* mScratch;
+	int64_t mReservedBytes;
+};
+#endif
@@ -0,0 +1,248 @@
+#include "FrameRing.h"
+#include <stdio.h>
+#include <string.h>
+#include <new>
+#include "../bitmap/Downsample.h"
+#include "../utils/MemoryGovernor.h"
+#include "../utils/MagicLog.h"
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#define FRAME_RING_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define FRAME_RING_SSE 1
+#endif
+
+#define  LOG_TAG    "FrameRing"
+
+FrameRing::FrameRing()
+{
+	mSlots = NULL;
+	mCapacity = 0;
+	mWidth = 0;
+	mHeight = 0;
+	mScratch = NULL;
+	mReservedBytes = 0;
+}
+
+FrameRing::~FrameRing()
+{
+	release();
+}
+
+bool FrameRing::isIdle()
+{
+	for (int i = 0; i < mCapacity; i++) {
+		if (mSlots[i].writing || mSlots[i].readers > 0)
+			return false;
+	}
+	return true;
+}
+
+void FrameRing::freeBuffers(std::unique_lock<std::mutex>& lock)
+{
+	mIdle.wait(lock, [this] { return isIdle(); });
+	for (int i = 0; i < mCapacity; i++)
+		delete[] mSlots[i].pixels;
+	delete[] mSlots;
+	delete[] mScratch;
+	mSlots = NULL;
+	mScratch = NULL;
+	mCapacity = 0;
+	mWidth = 0;
+	mHeight = 0;
+	MemoryGovernor::getInstance()->release(MEMORY_OWNER_POOL, mReservedBytes);
+	mReservedBytes = 0;
+}
+
+void FrameRing::release()
+{
+	std::unique_lock<std::mutex> lock(mLock);
+	freeBuffers(lock);
+}
+
+bool FrameRing::init(int width, int height, int capacity)
+{
+	std::unique_lock<std::mutex> lock(mLock);
+	freeBuffers(lock);
+	if (width <= 0 || height <= 0 || (width & 1) || (height & 1) || capacity <= 0) {
+		LOGE("cannot ring %d frames of %dx%d NV21", capacity, width, height);
+		return false;
+	}
+	int64_t frameBytes = (int64_t) width * height * 3 / 2;
+	int64_t total = frameBytes * capacity + 3 * (width / 2);
+	if (!MemoryGovernor::getInstance()->reserve(MEMORY_OWNER_POOL, total))
+		return false;
+	mReservedBytes = total;
+	mSlots = new (std::nothrow) Slot[capacity];
+	mScratch = new (std::nothrow) uint8_t[3 * (width / 2)];
+	bool allocated = mSlots != NULL && mScratch != NULL;
+	if (mSlots != NULL) {
+		mCapacity = capacity;
+		for (int i = 0; i < capacity; i++) {
+			mSlots[i].pixels = new (std::nothrow) uint8_t[frameBytes];
+			mSlots[i].timestamp = 0;
+			mSlots[i].score = 0;
+			mSlots[i].valid = false;
+			mSlots[i].writing = false;
+			mSlots[i].readers = 0;
+			allocated = allocated && mSlots[i].pixels != NULL;
+		}
+	}
+	if (!allocated) {
+		LOGE("allocation failed for %d frames of %dx%d", capacity, width, height);
+		freeBuffers(lock);
+		return false;
+	}
+	mWidth = width;
+	mHeight = height;
+	return true;
+}
+
+float FrameRing::push(const uint8_t* nv21, size_t bytes, int64_t timestampNanos)
+{
+	std::unique_lock<std::mutex> lock(mLock);
+	const int width = mWidth, height = mHeight;
+	if (bytes < (size_t) width * height * 3 / 2)
+		return -1;
+	Slot* slot = NULL;
+	for (int i = 0; i < mCapacity; i++) {
+		Slot* candidate = &mSlots[i];
+		if (candidate->readers > 0)
+			continue;
+		if (slot == NULL || !candidate->valid || (slot->valid && candidate->timestamp < slot->timestamp))
+			slot = candidate;
+		if (!slot->valid)
+			break;
+	}
+	if (slot == NULL)
+		return -1;
+	slot->valid = false;
+	slot->writing = true;
+	lock.unlock();
+
+	memcpy(slot->pixels, nv21, (size_t) width * height * 3 / 2);
+	float score = sharpness(ImageView(slot->pixels, width, height, width, ImageView::FORMAT_GRAY_8), mScratch);
+
+	lock.lock();
+	slot->timestamp = timestampNanos;
+	slot->score = score;
+	slot->valid = true;
+	slot->writing = false;
+	mIdle.notify_all();
+	return score;
+}
+
+int64_t FrameRing::takeSharpest(int64_t maxAgeNanos, uint8_t* out, size_t bytes, float* score)
+{
+	std::unique_lock<std::mutex> lock(mLock);
+	const size_t frameBytes = (size_t) mWidth * mHeight * 3 / 2;
+	if (bytes < frameBytes)
+		return -1;
+	int64_t newest = INT64_MIN;
+	for (int i = 0; i < mCapacity; i++) {
+		if (mSlots[i].valid && mSlots[i].timestamp > newest)
+			newest = mSlots[i].timestamp;
+	}
+	Slot* best = NULL;
+	for (int i = 0; i < mCapacity; i++) {
+		Slot* candidate = &mSlots[i];
+		if (!candidate->valid || newest - candidate->timestamp > maxAgeNanos)
+			continue;
+		// ties go to the newer frame
+		if (best == NULL || candidate->score > best->score
+				|| (candidate->score == best->score && candidate->timestamp > best->timestamp))
+			best = candidate;
+	}
+	if (best == NULL)
+		return -1;
+	best->readers++;
+	lock.unlock();
+
+	memcpy(out, best->pixels, frameBytes);
+
+	lock.lock();
+	best->readers--;
+	mIdle.notify_all();
+	if (score != NULL)
+		*score = best->score;
+	return best->timestamp;
+}
+
+// Laplacian of the middle row at columns 1..width-2, summed and squared;
+// the squares stay within 32 bits per lane for rows up to 16k wide
+static void laplacianRow(const uint8_t* up, const uint8_t* mid, const uint8_t* down, int width,
+		int64_t* sum, uint64_t* sumSqr)
+{
+	int j = 1;
+	int64_t s = 0;
+	uint64_t q = 0;
+#if defined(FRAME_RING_NEON)
+	int32x4_t vs = vdupq_n_s32(0);
+	int32x4_t vq = vdupq_n_s32(0);
+	for (; j + 9 <= width; j += 8) {
+		int16x8_t c = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(mid + j)));
+		int16x8_t l = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(mid + j - 1)));
+		int16x8_t r = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(mid + j + 1)));
+		int16x8_t u = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(up + j)));
+		int16x8_t d = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(down + j)));
+		int16x8_t lap = vsubq_s16(vsubq_s16(vshlq_n_s16(c, 2), vaddq_s16(l, r)), vaddq_s16(u, d));
+		vs = vpadalq_s16(vs, lap);
+		vq = vmlal_s16(vq, vget_low_s16(lap), vget_low_s16(lap));
+		vq = vmlal_high_s16(vq, lap, lap);
+	}
+	s = vaddlvq_s32(vs);
+	q = vaddlvq_u32(vreinterpretq_u32_s32(vq));
+#elif defined(FRAME_RING_SSE)
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i ones = _mm_set1_epi16(1);
+	__m128i vs = zero;
+	__m128i vq = zero;
+	for (; j + 9 <= width; j += 8) {
+		__m128i c = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) (mid + j)), zero);
+		__m128i l = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) (mid + j - 1)), zero);
+		__m128i r = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) (mid + j + 1)), zero);
+		__m128i u = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) (up + j)), zero);
+		__m128i d = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) (down + j)), zero);
+		__m128i lap = _mm_sub_epi16(_mm_sub_epi16(_mm_slli_epi16(c, 2), _mm_add_epi16(l, r)), _mm_add_epi16(u, d));
+		vs = _mm_add_epi32(vs, _mm_madd_epi16(lap, ones));
+		vq = _mm_add_epi32(vq, _mm_madd_epi16(lap, lap));
+	}
+	int32_t lanes[4];
+	uint32_t squares[4];
+	_mm_storeu_si128((__m128i*) lanes, vs);
+	_mm_storeu_si128((__m128i*) squares, vq);
+	for (int i = 0; i < 4; i++) {
+		s += lanes[i];
+		q += squares[i];
+	}
+#endif
+	for (; j < width - 1; j++) {
+		int lap = 4 * mid[j] - mid[j - 1] - mid[j + 1] - up[j] - down[j];
+		s += lap;
+		q += lap * lap;
+	}
+	*sum += s;
+	*sumSqr += q;
+}
+
+float FrameRing::sharpness(const ImageView& luma, uint8_t* scratch)
+{
+	const int width = luma.width / 2;
+	const int height = luma.height / 2;
+	if (width < 3 || height < 3)
+		return 0;
+	uint8_t* rows[3] = { scratch, scratch + width, scratch + 2 * width };
+	Downsample::halveRow(luma.row(0), luma.row(1), rows[0], width);
+	Downsample::halveRow(luma.row(2), luma.row(3), rows[1], width);
+	int64_t sum = 0;
+	uint64_t sumSqr = 0;
+	for (int i = 1; i < height - 1; i++) {
+		Downsample::halveRow(luma.row(2 * i + 2), luma.row(2 * i + 3), rows[(i + 1) % 3], width);
+		laplacianRow(rows[(i - 1) % 3], rows[i % 3], rows[(i + 1) % 3], width, &sum, &sumSqr);
+	}
+	double count = (double) (width - 2) * (height - 2);
+	double mean = sum / count;
+	return (float) (sumSqr / count - mean * mean);
+}
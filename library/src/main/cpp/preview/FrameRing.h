@@ -0,0 +1,74 @@
+#ifndef _FRAME_RING_H_
+#define _FRAME_RING_H_
+
+#include <stdint.h>
+#include <condition_variable>
+#include <mutex>
+#include "../bitmap/ImageView.h"
+
+/**
+ * The last few full resolution NV21 preview frames with their timestamps
+ * and a sharpness score, so a capture can use the sharpest recent frame
+ * instead of whatever the sensor sees once takePicture gets through.
+ *
+ * The score is the variance of the 4-neighbour Laplacian of the luma
+ * downsampled 2:1 both ways, which rises with in-focus detail and drops
+ * with motion blur; the halving keeps sensor noise from dominating it.
+ *
+ * Every buffer is allocated by init(). push() copies into the oldest slot
+ * that is not being read and scores it without holding the lock, and
+ * takeSharpest() copies out the same way, so the camera thread and the
+ * shutter only ever wait on each other for the bookkeeping. release()
+ * waits for copies in flight.
+ */
+class FrameRing
+{
+public:
+	FrameRing();
+	~FrameRing();
+
+	// false when the memory budget cannot hold capacity frames
+	bool init(int width, int height, int capacity);
+	void release();
+
+	// one camera thread; the frame's sharpness score, negative when the
+	// ring is not initialised, bytes is short of a frame or every slot is
+	// being read
+	float push(const uint8_t* nv21, size_t bytes, int64_t timestampNanos);
+	// copies the sharpest frame no older than maxAgeNanos before the newest
+	// one into out; its timestamp, or -1 when the ring is empty or bytes is
+	// short of a frame
+	int64_t takeSharpest(int64_t maxAgeNanos, uint8_t* out, size_t bytes, float* score);
+
+	// luma is GRAY_8; scratch holds 3 * (luma.width / 2) bytes
+	static float sharpness(const ImageView& luma, uint8_t* scratch);
+
+	int getWidth() { return mWidth; }
+	int getHeight() { return mHeight; }
+
+private:
+	typedef struct
+	{
+		uint8_t* pixels;
+		int64_t timestamp;
+		float score;
+		bool valid;
+		bool writing;
+		// takeSharpest() copies in flight, push() must not reuse the slot
+		int readers;
+	} Slot;
+
+	bool isIdle();
+	// waits for the copies in flight, then frees every buffer
+	void freeBuffers(std::unique_lock<std::mutex>& lock);
+
+	std::mutex mLock;
+	std::condition_variable mIdle;
+	Slot* mSlots;
+	int mCapacity;
+	int mWidth;
+	int mHeight;
+	uint8_t* mScratch;
+	int64_t mReservedBytes;
+};
+#endif
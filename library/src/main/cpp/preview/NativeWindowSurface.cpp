@@ -0,0 +1,34 @@
+#include "PreviewSurface.h"
+#include "../utils/MagicLog.h"
+
+#define  LOG_TAG    "NativeWindowSurface"
+
+NativeWindowSurface::NativeWindowSurface(ANativeWindow* window, int width, int height)
+{
+	mWindow = window;
+	ANativeWindow_acquire(mWindow);
+	// the compositor scales the buffer to the view, so frames never need resizing here
+	ANativeWindow_setBuffersGeometry(mWindow, width, height, WINDOW_FORMAT_RGBA_8888);
+}
+
+NativeWindowSurface::~NativeWindowSurface()
+{
+	ANativeWindow_release(mWindow);
+}
+
+bool NativeWindowSurface::lock(ImageView* buffer)
+{
+	ANativeWindow_Buffer locked;
+	int ret = ANativeWindow_lock(mWindow, &locked, NULL);
+	if (ret < 0) {
+		LOGE("ANativeWindow_lock() failed ! error=%d", ret);
+		return false;
+	}
+	*buffer = ImageView(locked.bits, locked.width, locked.height, locked.stride * 4, ImageView::FORMAT_RGBA_8888);
+	return true;
+}
+
+void NativeWindowSurface::post()
+{
+	ANativeWindow_unlockAndPost(mWindow);
+}
@@ -0,0 +1,425 @@
+#include "PreviewRenderer.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <new>
+#include "../beautify/SmoothGain.h"
+#include "../utils/MagicTables.h"
+#include "../utils/MemoryGovernor.h"
+#include "../utils/ThreadPool.h"
+#include "../utils/MagicLog.h"
+
+#define  LOG_TAG    "PreviewRenderer"
+
+static inline int clampByte(int v)
+{
+	return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+// Cb/Cr box of Chai & Ngan, the usual skin test on camera chroma. This is
+// not the still path's rule: MagicBeautify::initSkinMatrix tests each
+// pixel's RGB (Kovac's daylight and flash bounds), which needs the luma
+// too, while the preview decides once per NV21 chroma sample from chroma
+// alone. The two masks agree on most skin but differ along its edges, on
+// very dark or bright skin that the RGB bounds reject, and on skin-coloured
+// surfaces the box accepts, so a preview frame and the photo taken from it
+// can smooth slightly different areas.
+static inline bool isSkin(int u, int v)
+{
+	return u >= 77 && u <= 127 && v >= 133 && v <= 173;
+}
+
+PreviewRenderer::PreviewRenderer() : mGainMap(MEMORY_OWNER_POOL)
+{
+	mWidth = 0;
+	mHeight = 0;
+	mRadius = 0;
+	mBands = 0;
+	mReservedBytes = 0;
+	mSlots[0] = NULL;
+	mSlots[1] = NULL;
+	mScratch = NULL;
+	mBandScratch = NULL;
+	mLook = NULL;
+	mSkinPlane = NULL;
+	mSmoothLevel = 0;
+	mPrecision = SmoothGain::PRECISION_FP32;
+	mProtectSkin = false;
+	for (int i = 0; i < 256; i++)
+		mWhiten[i] = i;
+	mRunning = false;
+	mPending = -1;
+	mRendering = -1;
+	mSurface = NULL;
+	mFrameInput = NULL;
+	mFrameOutput = NULL;
+	memset(&mStats, 0, sizeof(mStats));
+}
+
+PreviewRenderer::~PreviewRenderer()
+{
+	stop();
+	release();
+}
+
+bool PreviewRenderer::init(int width, int height)
+{
+	release();
+	if (width <= 0 || height <= 0 || (width & 1) || (height & 1)) {
+		LOGE("NV21 frames need an even size, got %dx%d", width, height);
+		return false;
+	}
+	int64_t frameBytes = (int64_t) width * height * 3 / 2;
+	int bands = ThreadPool::getInstance()->getThreadCount();
+	int64_t bandBytes = (int64_t) width * (2 * sizeof(uint32_t) + 2 * sizeof(float) + 2);
+	int64_t skinBytes = (int64_t) (width / 2) * (height / 2);
+	int64_t total = frameBytes * 2 + bandBytes * bands + LookTable::tableBytes() + skinBytes;
+	if (!MemoryGovernor::getInstance()->reserve(MEMORY_OWNER_POOL, total))
+		return false;
+	mReservedBytes = total;
+	mSlots[0] = new (std::nothrow) uint8_t[frameBytes];
+	mSlots[1] = new (std::nothrow) uint8_t[frameBytes];
+	mScratch = new (std::nothrow) uint8_t[bandBytes * bands];
+	mBandScratch = new (std::nothrow) BandScratch[bands];
+	mSkinPlane = new (std::nothrow) uint8_t[skinBytes];
+	try {
+		mLook = new LookTable();
+	} catch (const std::bad_alloc&) {
+		mLook = NULL;
+	}
+	if (mSlots[0] == NULL || mSlots[1] == NULL || mScratch == NULL || mBandScratch == NULL || mLook == NULL
+			|| mSkinPlane == NULL) {
+		LOGE("allocation failed for a %dx%d preview", width, height);
+		release();
+		return false;
+	}
+	uint8_t* p = mScratch;
+	for (int b = 0; b < bands; b++) {
+		mBandScratch[b].columnSum = (uint32_t*) p;
+		p += width * sizeof(uint32_t);
+		mBandScratch[b].columnSumSqr = (uint32_t*) p;
+		p += width * sizeof(uint32_t);
+		mBandScratch[b].mean = (float*) p;
+		p += width * sizeof(float);
+		mBandScratch[b].var = (float*) p;
+		p += width * sizeof(float);
+		mBandScratch[b].skin = p;
+		p += width;
+		mBandScratch[b].luma = p;
+		p += width;
+	}
+	mWidth = width;
+	mHeight = height;
+	mBands = bands;
+	// same window as MagicBeautify uses for the still image
+	mRadius = (width > height ? width : height) * 0.02;
+	if (mRadius < 1)
+		mRadius = 1;
+	return true;
+}
+
+void PreviewRenderer::release()
+{
+	delete[] mSlots[0];
+	delete[] mSlots[1];
+	delete[] mScratch;
+	delete[] mBandScratch;
+	delete mLook;
+	delete[] mSkinPlane;
+	mGainMap.release();
+	mSlots[0] = NULL;
+	mSlots[1] = NULL;
+	mScratch = NULL;
+	mBandScratch = NULL;
+	mLook = NULL;
+	mSkinPlane = NULL;
+	mWidth = 0;
+	mHeight = 0;
+	MemoryGovernor::getInstance()->release(MEMORY_OWNER_POOL, mReservedBytes);
+	mReservedBytes = 0;
+}
+
+void PreviewRenderer::setSurface(PreviewSurface* surface)
+{
+	std::lock_guard<std::mutex> lock(mSurfaceLock);
+	mSurface = surface;
+}
+
+void PreviewRenderer::setBeautyLevel(float smoothLevel, float whitenLevel)
+{
+	std::lock_guard<std::mutex> lock(mSettingsLock);
+	mSmoothLevel = smoothLevel >= 10.0 && smoothLevel <= 510.0 ? smoothLevel : 0;
+	float a = whitenLevel >= 1.0 && whitenLevel <= 5.0 ? log(whitenLevel) : 0;
+	for (int i = 0; i < 256; i++) {
+		if (a != 0)
+			mWhiten[i] = 255 * (log(kDiv255[i] * (whitenLevel - 1) + 1) / a);
+		else
+			mWhiten[i] = i;
+	}
+}
+
+bool PreviewRenderer::setSmoothPrecision(int precision)
+{
+	if (!SmoothGain::isSupported(precision))
+		return false;
+	std::lock_guard<std::mutex> lock(mSettingsLock);
+	mPrecision = precision;
+	return true;
+}
+
+void PreviewRenderer::setLookup(const uint8_t* rgba, int stride)
+{
+	std::lock_guard<std::mutex> lock(mSettingsLock);
+	if (mLook != NULL)
+		mLook->setLookup(rgba, stride);
+}
+
+void PreviewRenderer::setMixer(const HslMixer& mixer)
+{
+	std::lock_guard<std::mutex> lock(mSettingsLock);
+	if (mLook != NULL)
+		mLook->setMixer(&mixer);
+}
+
+void PreviewRenderer::setSkinProtection(bool protect)
+{
+	std::lock_guard<std::mutex> lock(mSettingsLock);
+	mProtectSkin = protect;
+}
+
+void PreviewRenderer::start()
+{
+	std::lock_guard<std::mutex> lock(mLock);
+	if (mRunning || mWidth == 0)
+		return;
+	mRunning = true;
+	mPending = -1;
+	mThread = std::thread(&PreviewRenderer::renderLoop, this);
+}
+
+void PreviewRenderer::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(mLock);
+		if (!mRunning)
+			return;
+		mRunning = false;
+	}
+	mWake.notify_all();
+	mThread.join();
+}
+
+bool PreviewRenderer::submit(const uint8_t* nv21)
+{
+	std::lock_guard<std::mutex> lock(mLock);
+	if (!mRunning)
+		return false;
+	int slot = mRendering == 0 ? 1 : 0;
+	memcpy(mSlots[slot], nv21, (size_t) mWidth * mHeight * 3 / 2);
+	std::lock_guard<std::mutex> stats(mStatsLock);
+	mStats.submitted++;
+	if (mPending >= 0)
+		mStats.dropped++;
+	mPending = slot;
+	mWake.notify_one();
+	return true;
+}
+
+void PreviewRenderer::renderLoop()
+{
+	for (;;) {
+		int slot;
+		{
+			std::unique_lock<std::mutex> lock(mLock);
+			mWake.wait(lock, [&]() { return mPending >= 0 || !mRunning; });
+			if (!mRunning)
+				return;
+			slot = mPending;
+			mPending = -1;
+			mRendering = slot;
+		}
+		{
+			std::lock_guard<std::mutex> lock(mSurfaceLock);
+			ImageView buffer;
+			if (mSurface != NULL && mSurface->lock(&buffer)) {
+				render(mSlots[slot], buffer);
+				mSurface->post();
+			}
+		}
+		std::lock_guard<std::mutex> lock(mLock);
+		mRendering = -1;
+	}
+}
+
+void PreviewRenderer::render(const uint8_t* nv21, const ImageView& output)
+{
+	if (mWidth == 0 || nv21 == NULL || output.isEmpty())
+		return;
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+	{
+		std::lock_guard<std::mutex> lock(mSettingsLock);
+		// a job capturing only this fits std::function's inline storage, so no allocation
+		mFrameInput = nv21;
+		mFrameOutput = &output;
+		ThreadPool::getInstance()->parallelFor(mBands, [this](int band) {
+			renderBand(mFrameInput, *mFrameOutput, band);
+		}, ThreadPool::PRIORITY_REALTIME);
+	}
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+	std::lock_guard<std::mutex> lock(mStatsLock);
+	mStats.rendered++;
+	mStats.lastMs = ms;
+	mStats.meanMs += (ms - mStats.meanMs) / mStats.rendered;
+	if (ms > mStats.maxMs)
+		mStats.maxMs = ms;
+}
+
+bool PreviewRenderer::exportGainMap(const uint8_t* nv21, int scale, int depth, uint8_t* out, int stride)
+{
+	if (mWidth == 0 || nv21 == NULL)
+		return false;
+	float level;
+	{
+		std::lock_guard<std::mutex> lock(mSettingsLock);
+		level = mSmoothLevel;
+	}
+	std::lock_guard<std::mutex> lock(mGainMapLock);
+	int chromaWidth = mWidth / 2;
+	int chromaHeight = mHeight / 2;
+	const uint8_t* chroma = nv21 + (size_t) mWidth * mHeight;
+	if (level > 0) {
+		ThreadPool::getInstance()->parallelFor(mBands, [&](int band) {
+			int rowsPerBand = (chromaHeight + mBands - 1) / mBands;
+			int end = (band + 1) * rowsPerBand < chromaHeight ? (band + 1) * rowsPerBand : chromaHeight;
+			for (int i = band * rowsPerBand; i < end; i++) {
+				const uint8_t* vu = chroma + (size_t) i * mWidth;
+				uint8_t* skin = mSkinPlane + (size_t) i * chromaWidth;
+				for (int j = 0; j < chromaWidth; j++)
+					skin[j] = isSkin(vu[2 * j + 1], vu[2 * j]) ? 255 : 0;
+			}
+		});
+	}
+	return mGainMap.compute(ImageView((void*) nv21, mWidth, mHeight, mWidth, ImageView::FORMAT_GRAY_8),
+			level > 0 ? ImageView(mSkinPlane, chromaWidth, chromaHeight, chromaWidth, ImageView::FORMAT_GRAY_8)
+					: ImageView(),
+			scale, mRadius, level, depth, out, stride);
+}
+
+PreviewStats PreviewRenderer::getStats()
+{
+	std::lock_guard<std::mutex> lock(mStatsLock);
+	return mStats;
+}
+
+/**
+ * Local mean and variance of luma come from box sums: per-column sums over
+ * the rows of the window slide down the band, and each output row slides
+ * a horizontal window over them. Each band primes its column sums from
+ * the rows above it, so bands are independent.
+ */
+void PreviewRenderer::renderBand(const uint8_t* nv21, const ImageView& output, int band)
+{
+	BandScratch& scratch = mBandScratch[band];
+	const int width = mWidth;
+	const int height = mHeight;
+	const int r = mRadius;
+	int rowsPerBand = (height + mBands - 1) / mBands;
+	int start = band * rowsPerBand;
+	int end = start + rowsPerBand < height ? start + rowsPerBand : height;
+	int outWidth = width < output.width ? width : output.width;
+	int outEnd = end < output.height ? end : output.height;
+	const uint8_t* luma = nv21;
+	const uint8_t* chroma = nv21 + (size_t) width * height;
+	bool smooth = mSmoothLevel > 0;
+	bool protect = mProtectSkin && !mLook->isEmpty();
+
+	int top = start - r > 0 ? start - r : 0;
+	int bottom = top - 1;
+	if (smooth) {
+		memset(scratch.columnSum, 0, sizeof(uint32_t) * width);
+		memset(scratch.columnSumSqr, 0, sizeof(uint32_t) * width);
+	}
+	for (int i = start; i < outEnd; i++) {
+		const uint8_t* vu = chroma + (size_t) (i >> 1) * width;
+		const uint8_t* line = luma + (size_t) i * width;
+		if (!smooth) {
+			if (protect) {
+				for (int j = 0; j < outWidth; j++)
+					scratch.skin[j] = isSkin(vu[(j & ~1) + 1], vu[j & ~1]) ? 255 : 0;
+			}
+			convertRow(line, vu, protect ? scratch.skin : NULL,
+					output.row32(i), outWidth);
+			continue;
+		}
+		int windowBottom = i + r < height - 1 ? i + r : height - 1;
+		int windowTop = i - r > 0 ? i - r : 0;
+		while (bottom < windowBottom) {
+			const uint8_t* add = luma + (size_t) ++bottom * width;
+			for (int j = 0; j < width; j++) {
+				scratch.columnSum[j] += add[j];
+				scratch.columnSumSqr[j] += add[j] * add[j];
+			}
+		}
+		for (; top < windowTop; top++) {
+			const uint8_t* remove = luma + (size_t) top * width;
+			for (int j = 0; j < width; j++) {
+				scratch.columnSum[j] -= remove[j];
+				scratch.columnSumSqr[j] -= remove[j] * remove[j];
+			}
+		}
+		int rows = bottom - top + 1;
+
+		// a window's sum of squares passes 32 bits from radius 64 (3200 px
+		// frames); a column's stays inside them
+		uint32_t sum = 0;
+		uint64_t sumSqr = 0;
+		for (int j = 0; j <= r && j < width; j++) {
+			sum += scratch.columnSum[j];
+			sumSqr += scratch.columnSumSqr[j];
+		}
+		for (int j = 0; j < width; j++) {
+			int left = j - r > 0 ? j - r : 0;
+			int right = j + r < width - 1 ? j + r : width - 1;
+			scratch.skin[j] = isSkin(vu[(j & ~1) + 1], vu[j & ~1]) ? 255 : 0;
+			if (scratch.skin[j]) {
+				float count = (float) (rows * (right - left + 1));
+				float m = sum / count;
+				scratch.mean[j] = m;
+				scratch.var[j] = sumSqr / count - m * m;
+			}
+			if (j + r + 1 < width) {
+				sum += scratch.columnSum[j + r + 1];
+				sumSqr += scratch.columnSumSqr[j + r + 1];
+			}
+			if (j - r >= 0) {
+				sum -= scratch.columnSum[j - r];
+				sumSqr -= scratch.columnSumSqr[j - r];
+			}
+		}
+		memcpy(scratch.luma, line, width);
+		SmoothGain::apply(mPrecision, scratch.mean, scratch.var, scratch.skin, scratch.luma, 1, width, mSmoothLevel);
+		convertRow(scratch.luma, vu, protect ? scratch.skin : NULL,
+				output.row32(i), outWidth);
+	}
+}
+
+/**
+ * BT.601 video range YCbCr to RGBA, whitening applied to luma first, then
+ * the look, blended toward its skin-safe variant where skin is set.
+ */
+void PreviewRenderer::convertRow(const uint8_t* luma, const uint8_t* vu, const uint8_t* skin, uint32_t* out, int width)
+{
+	bool look = !mLook->isEmpty();
+	for (int j = 0; j < width; j++) {
+		int c = 298 * (mWhiten[luma[j]] - 16);
+		int d = vu[(j & ~1) + 1] - 128;
+		int e = vu[j & ~1] - 128;
+		int red = clampByte((c + 409 * e + 128) >> 8);
+		int green = clampByte((c - 100 * d - 208 * e + 128) >> 8);
+		int blue = clampByte((c + 516 * d + 128) >> 8);
+		// RGBA_8888 in memory order
+		uint32_t rgba = 0xff000000u | (blue << 16) | (green << 8) | red;
+		out[j] = look ? mLook->apply(rgba, skin != NULL ? skin[j] : 0) : rgba;
+	}
+}
@@ -0,0 +1,127 @@
+#ifndef _PREVIEW_RENDERER_H_
+#define _PREVIEW_RENDERER_H_
+
+#include <stdint.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "PreviewSurface.h"
+#include "../beautify/GainMap.h"
+#include "../bitmap/LookTable.h"
+
+typedef struct
+{
+	int64_t submitted;
+	int64_t rendered;
+	// frames replaced by a newer one before the renderer got to them
+	int64_t dropped;
+	double lastMs;
+	double meanMs;
+	double maxMs;
+} PreviewStats;
+
+/**
+ * CPU camera preview for devices whose GPU cannot keep up with the filter
+ * chain: NV21 frame -> skin smoothing and whitening on luma -> look LUT ->
+ * RGBA into a display buffer with stride, in one pass over row bands on
+ * the ThreadPool. Skin is found with a chroma-only test, not the RGB rule
+ * of the still path (see isSkin in PreviewRenderer.cpp).
+ *
+ * Every buffer is allocated by init(), so steady-state frames allocate
+ * nothing. Input is double buffered: submit() copies into the slot the
+ * render thread is not reading and replaces a frame still waiting there,
+ * so the camera thread never blocks on rendering.
+ */
+class PreviewRenderer
+{
+public:
+	PreviewRenderer();
+	~PreviewRenderer();
+
+	// false when the memory budget cannot hold the buffers
+	bool init(int width, int height);
+	void release();
+
+	// not owned; NULL detaches, waiting for a frame in flight
+	void setSurface(PreviewSurface* surface);
+	// same ranges as MagicBeautify: smoothing 10..510, whitening 1..5, anything else turns it off
+	void setBeautyLevel(float smoothLevel, float whitenLevel);
+	// SmoothGain::PRECISION_*, FP32 by default; false and unchanged when the CPU lacks it
+	bool setSmoothPrecision(int precision);
+	// 512x512 lookup image in the MagicLookupFilter layout, NULL to drop the look
+	void setLookup(const uint8_t* rgba, int stride);
+	// compiled into the look table, identity to drop it
+	void setMixer(const HslMixer& mixer);
+	// keeps the look's colour shift off skin, blended by the same mask the smoothing uses
+	void setSkinProtection(bool protect);
+
+	void start();
+	void stop();
+	// false when the renderer is not running
+	bool submit(const uint8_t* nv21);
+
+	// renders synchronously, clipped to the smaller of frame and buffer
+	void render(const uint8_t* nv21, const ImageView& output);
+
+	// GainMap of an NV21 frame at the current smoothing level, for a GPU
+	// to blend from; the map scratch is allocated by the first call
+	bool exportGainMap(const uint8_t* nv21, int scale, int depth, uint8_t* out, int stride);
+
+	PreviewStats getStats();
+	int getWidth() { return mWidth; }
+	int getHeight() { return mHeight; }
+
+private:
+	typedef struct
+	{
+		uint32_t* columnSum;
+		uint32_t* columnSumSqr;
+		float* mean;
+		float* var;
+		uint8_t* skin;
+		uint8_t* luma;
+	} BandScratch;
+
+	void renderLoop();
+	void renderBand(const uint8_t* nv21, const ImageView& output, int band);
+	void convertRow(const uint8_t* luma, const uint8_t* vu, const uint8_t* skin, uint32_t* out, int width);
+
+	int mWidth;
+	int mHeight;
+	int mRadius;
+	int mBands;
+	int64_t mReservedBytes;
+
+	uint8_t* mSlots[2];
+	uint8_t* mScratch;
+	BandScratch* mBandScratch;
+	LookTable* mLook;
+
+	// held for a whole frame, so settings change between frames
+	std::mutex mSettingsLock;
+	const uint8_t* mFrameInput;
+	const ImageView* mFrameOutput;
+	float mSmoothLevel;
+	int mPrecision;
+	bool mProtectSkin;
+	uint8_t mWhiten[256];
+
+	std::mutex mLock;
+	std::condition_variable mWake;
+	std::thread mThread;
+	bool mRunning;
+	int mPending;
+	int mRendering;
+
+	std::mutex mSurfaceLock;
+	PreviewSurface* mSurface;
+
+	// skin of the exported frame at chroma resolution
+	std::mutex mGainMapLock;
+	uint8_t* mSkinPlane;
+	GainMap mGainMap;
+
+	std::mutex mStatsLock;
+	PreviewStats mStats;
+};
+#endif
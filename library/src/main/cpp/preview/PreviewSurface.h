@@ -0,0 +1,37 @@
+#ifndef _PREVIEW_SURFACE_H_
+#define _PREVIEW_SURFACE_H_
+
+#include <stdint.h>
+#include "../bitmap/ImageView.h"
+
+/**
+ * Where the CPU preview renderer puts finished frames. On a device this is
+ * an ANativeWindow; host tools use a plain memory buffer.
+ */
+class PreviewSurface
+{
+public:
+	virtual ~PreviewSurface() {}
+	// an RGBA_8888 view of the back buffer; false when there is nothing to draw into right now
+	virtual bool lock(ImageView* buffer) = 0;
+	virtual void post() = 0;
+};
+
+#ifdef __ANDROID__
+#include <android/native_window.h>
+
+class NativeWindowSurface : public PreviewSurface
+{
+public:
+	// takes its own reference on window
+	NativeWindowSurface(ANativeWindow* window, int width, int height);
+	~NativeWindowSurface();
+
+	bool lock(ImageView* buffer);
+	void post();
+
+private:
+	ANativeWindow* mWindow;
+};
+#endif
+#endif
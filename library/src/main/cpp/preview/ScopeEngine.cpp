@@ -0,0 +1,124 @@
+#include "ScopeEngine.h"
+#include <math.h>
+#include <string.h>
+
+// reads give up after this many writer laps, keeping their previous data
+#define READ_ATTEMPTS 4
+
+static inline int clampByte(int v)
+{
+	return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+static inline uint32_t jitter(uint32_t row, uint32_t frame)
+{
+	uint32_t h = row * 0x9e3779b1u ^ frame * 0x85ebca6bu;
+	h ^= h >> 15;
+	h *= 0x2c1b3c6du;
+	h ^= h >> 12;
+	return h;
+}
+
+ScopeEngine::ScopeEngine() : mPublished(-1), mStep(0)
+{
+	for (int i = 0; i < 2; i++) {
+		mSlots[i].sequence.store(0);
+		memset(&mSlots[i].data, 0, sizeof(ScopeData));
+	}
+	mFrame = 0;
+}
+
+void ScopeEngine::setSampleStep(int step)
+{
+	mStep.store(step > 0 ? step : 0);
+}
+
+int ScopeEngine::pickStep(int width, int height)
+{
+	int step = mStep.load(std::memory_order_relaxed);
+	if (step == 0)
+		step = (int) (sqrt((double) width * height / SAMPLE_TARGET) + 0.5);
+	if (step < 1)
+		step = 1;
+	// keep a waveform cell within 16 bits even if a whole slice is one level
+	int sliceWidth = (width + SCOPE_COLUMNS - 1) / SCOPE_COLUMNS;
+	while ((int64_t) (sliceWidth / step + 1) * ((height + step - 1) / step) > 65535)
+		step++;
+	return step;
+}
+
+bool ScopeEngine::submit(const uint8_t* nv21, int width, int height)
+{
+	if (nv21 == NULL || width < 2 || height < 2)
+		return false;
+	const int step = pickStep(width, height);
+	const int index = mPublished.load(std::memory_order_relaxed) == 0 ? 1 : 0;
+	Slot& slot = mSlots[index];
+	ScopeData& data = slot.data;
+
+	// odd while written; the fence keeps the data stores after it
+	uint32_t sequence = slot.sequence.load(std::memory_order_relaxed);
+	slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	memset(mPartial, 0, sizeof(mPartial));
+	memset(data.waveform, 0, sizeof(data.waveform));
+	const uint8_t* chroma = nv21 + (size_t) width * height;
+	const uint32_t columnScale = ((uint32_t) SCOPE_COLUMNS << 16) / width;
+	const uint32_t frame = (uint32_t) ++mFrame;
+	int samples = 0;
+	for (int y = jitter(0xffffffffu, frame) % step; y < height; y += step) {
+		const uint8_t* line = nv21 + (size_t) y * width;
+		const uint8_t* vu = chroma + (size_t) (y >> 1) * width;
+		int k = 0;
+		for (int x = jitter(y, frame) % step; x < width; x += step, k++) {
+			uint32_t* histogram = mPartial[k & 3];
+			int l = line[x];
+			int c = 298 * (l - 16);
+			int d = vu[(x & ~1) + 1] - 128;
+			int e = vu[x & ~1] - 128;
+			histogram[l]++;
+			histogram[256 + clampByte((c + 409 * e + 128) >> 8)]++;
+			histogram[512 + clampByte((c - 100 * d - 208 * e + 128) >> 8)]++;
+			histogram[768 + clampByte((c + 516 * d + 128) >> 8)]++;
+			data.waveform[((x * columnScale) >> 16) * 256 + l]++;
+		}
+		samples += k;
+	}
+	uint32_t* histograms[4] = { data.luma, data.red, data.green, data.blue };
+	for (int h = 0; h < 4; h++) {
+		const uint32_t* p0 = mPartial[0] + h * 256;
+		const uint32_t* p1 = mPartial[1] + h * 256;
+		const uint32_t* p2 = mPartial[2] + h * 256;
+		const uint32_t* p3 = mPartial[3] + h * 256;
+		for (int i = 0; i < 256; i++)
+			histograms[h][i] = p0[i] + p1[i] + p2[i] + p3[i];
+	}
+	data.frame = mFrame;
+	data.samples = samples;
+	data.step = step;
+
+	slot.sequence.store(sequence + 2, std::memory_order_release);
+	mPublished.store(index, std::memory_order_release);
+	return true;
+}
+
+bool ScopeEngine::read(ScopeData* out)
+{
+	for (int attempt = 0; attempt < READ_ATTEMPTS; attempt++) {
+		int index = mPublished.load(std::memory_order_acquire);
+		if (index < 0)
+			return false;
+		const Slot& slot = mSlots[index];
+		uint32_t sequence = slot.sequence.load(std::memory_order_acquire);
+		if (sequence & 1)
+			continue;
+		// may overlap a write that started after the load above; the
+		// sequence check below throws such a copy away
+		memcpy(out, &slot.data, sizeof(ScopeData));
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (slot.sequence.load(std::memory_order_relaxed) == sequence)
+			return true;
+	}
+	return false;
+}
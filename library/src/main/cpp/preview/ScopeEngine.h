@@ -0,0 +1,73 @@
+#ifndef _SCOPE_ENGINE_H_
+#define _SCOPE_ENGINE_H_
+
+#include <stdint.h>
+#include <atomic>
+
+// slices of the frame in the waveform
+static const int SCOPE_COLUMNS = 256;
+
+typedef struct
+{
+	// sample counts per level, RGB by the BT.601 video range conversion
+	// of PreviewRenderer
+	uint32_t luma[256];
+	uint32_t red[256];
+	uint32_t green[256];
+	uint32_t blue[256];
+	// luma waveform: SCOPE_COLUMNS vertical slices of the frame, left to right,
+	// each a histogram of the luma levels sampled in that slice
+	uint16_t waveform[SCOPE_COLUMNS * 256];
+	// 1 for the first frame submitted, 0 while nothing has been
+	int64_t frame;
+	int32_t samples;
+	int32_t step;
+} ScopeData;
+
+/**
+ * Live histograms and waveform for the camera preview. Only every step-th
+ * pixel of every step-th row of an NV21 frame is sampled, the step picked
+ * so a frame costs about SAMPLE_TARGET samples whatever the preview size,
+ * and each row's samples start at an offset hashed from row and frame, so
+ * the grid does not alias with regular patterns and successive frames see
+ * different pixels.
+ *
+ * One thread submits, any number read. The engine keeps two ScopeData: a
+ * submit fills the one not last published and publishes it by index. Each
+ * has a sequence that is odd while it is written, so a reader copies the
+ * published one and retries if the sequence moved; neither side ever
+ * takes a lock or waits on the other.
+ */
+class ScopeEngine
+{
+public:
+	static const int SAMPLE_TARGET = 32768;
+
+	ScopeEngine();
+
+	// 0 picks the step from SAMPLE_TARGET, the default
+	void setSampleStep(int step);
+
+	// one writer at a time; false for a frame too small to sample
+	bool submit(const uint8_t* nv21, int width, int height);
+	// false when nothing was published yet, or the writer lapped every retry
+	bool read(ScopeData* out);
+
+private:
+	typedef struct
+	{
+		std::atomic<uint32_t> sequence;
+		ScopeData data;
+	} Slot;
+
+	int pickStep(int width, int height);
+
+	Slot mSlots[2];
+	std::atomic<int> mPublished;
+	std::atomic<int> mStep;
+	int64_t mFrame;
+	// four interleaved copies of the four histograms, so consecutive
+	// samples falling in the same bin do not serialize on one counter
+	uint32_t mPartial[4][4 * 256];
+};
+#endif
@@ -0,0 +1,18 @@
+#include "CpuFeatures.h"
+
+#if defined(__aarch64__) && defined(__linux__)
+#include <sys/auxv.h>
+#ifndef HWCAP_ASIMDHP
+#define HWCAP_ASIMDHP (1 << 10)
+#endif
+#endif
+
+bool CpuFeatures::hasFp16Arithmetic()
+{
+#if defined(__aarch64__) && defined(__linux__)
+	static const bool supported = (getauxval(AT_HWCAP) & HWCAP_ASIMDHP) != 0;
+	return supported;
+#else
+	return false;
+#endif
+}
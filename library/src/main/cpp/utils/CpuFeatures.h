@@ -0,0 +1,14 @@
+#ifndef _CPU_FEATURES_H_
+#define _CPU_FEATURES_H_
+
+/**
+ * Runtime CPU feature checks for kernels that are built for a newer
+ * instruction set than the ABI baseline. Probed once, then cached.
+ */
+class CpuFeatures
+{
+public:
+	// ARMv8.2 half precision vector arithmetic (asimdhp)
+	static bool hasFp16Arithmetic();
+};
+#endif
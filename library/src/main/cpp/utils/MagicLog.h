@@ -0,0 +1,18 @@
+#ifndef _MAGIC_LOG_H_
+#define _MAGIC_LOG_H_
+
+/**
+ * Logging for the native sources: each file defines LOG_TAG and includes
+ * this. Android builds write to logcat; host builds of the tools print
+ * errors to stderr and drop debug messages.
+ */
+#ifdef __ANDROID__
+#include <android/log.h>
+#define  LOGD(...)  __android_log_print(ANDROID_LOG_DEBUG,LOG_TAG,__VA_ARGS__)
+#define  LOGE(...)  __android_log_print(ANDROID_LOG_ERROR,LOG_TAG,__VA_ARGS__)
+#else
+#include <stdio.h>
+#define  LOGD(...)  ((void) 0)
+#define  LOGE(...)  (fprintf(stderr, LOG_TAG ": " __VA_ARGS__), fputc('\n', stderr))
+#endif
+#endif
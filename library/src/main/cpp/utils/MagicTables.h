@@ -0,0 +1,126 @@
+#ifndef _MAGIC_TABLES_H_
+#define _MAGIC_TABLES_H_
+
+#include <stdint.h>
+
+/**
+ * Fixed lookup tables, built by the compiler so that loading the library
+ * and the first call into a kernel do no table setup at all.
+ * The ct* helpers are only meant for constant evaluation.
+ */
+
+constexpr double CT_LN2 = 0.69314718055994530942;
+
+constexpr double ctExp(double x)
+{
+	int k = (int) (x / CT_LN2);
+	double r = x - k * CT_LN2;
+	double term = 1.0, sum = 1.0;
+	for (int n = 1; n < 24; n++) {
+		term *= r / n;
+		sum += term;
+	}
+	for (; k > 0; k--)
+		sum *= 2.0;
+	for (; k < 0; k++)
+		sum *= 0.5;
+	return sum;
+}
+
+constexpr double ctLog(double x)
+{
+	int e = 0;
+	while (x > 2.0) { x *= 0.5; e++; }
+	while (x < 1.0) { x *= 2.0; e--; }
+	double y = (x - 1.0) / (x + 1.0);
+	double y2 = y * y, term = y, sum = 0.0;
+	for (int n = 1; n < 60; n += 2) {
+		sum += term / n;
+		term *= y2;
+	}
+	return 2.0 * sum + e * CT_LN2;
+}
+
+constexpr double ctPow(double base, double exponent)
+{
+	return base <= 0.0 ? 0.0 : ctExp(exponent * ctLog(base));
+}
+
+constexpr double ctSrgbToLinear(double c)
+{
+	return c <= 0.04045 ? c / 12.92 : ctPow((c + 0.055) / 1.055, 2.4);
+}
+
+template <typename T, int N>
+struct MagicTable
+{
+	T value[N];
+	constexpr const T& operator[](int i) const { return value[i]; }
+	constexpr int size() const { return N; }
+};
+
+/** x / 255 as float */
+constexpr MagicTable<float, 256> makeDiv255Table()
+{
+	MagicTable<float, 256> table = {};
+	for (int i = 0; i < 256; i++)
+		table.value[i] = (float) (i / 255.0);
+	return table;
+}
+
+/** 8-bit sRGB code to 12-bit linear light */
+constexpr MagicTable<uint16_t, 256> makeSrgbToLinear12Table()
+{
+	MagicTable<uint16_t, 256> table = {};
+	for (int i = 0; i < 256; i++)
+		table.value[i] = (uint16_t) (ctSrgbToLinear(i / 255.0) * 4095.0 + 0.5);
+	return table;
+}
+
+/**
+ * 12-bit linear light back to the nearest 8-bit sRGB code. The decision
+ * points between code c and c + 1 are the linear values of (c + 0.5) / 255,
+ * so the table is filled with one walk over 4096 entries.
+ */
+constexpr MagicTable<uint8_t, 4096> makeLinear12ToSrgbTable()
+{
+	MagicTable<uint8_t, 4096> table = {};
+	int code = 0;
+	double next = ctSrgbToLinear(0.5 / 255.0) * 4095.0;
+	for (int i = 0; i < 4096; i++) {
+		while (code < 255 && i >= next) {
+			code++;
+			next = code < 255 ? ctSrgbToLinear((code + 0.5) / 255.0) * 4095.0 : 4096.0;
+		}
+		table.value[i] = (uint8_t) code;
+	}
+	return table;
+}
+
+/**
+ * 8-bit channel to a cell of a 33 point LUT grid: the cell index (0..31)
+ * from bit 9 up (entry >> 9), the position inside the cell (0..256) in
+ * the low 9 bits (entry & 0x1ff).
+ */
+constexpr MagicTable<uint16_t, 256> makeLut33CellTable()
+{
+	MagicTable<uint16_t, 256> table = {};
+	for (int i = 0; i < 256; i++) {
+		int position = i * 32;
+		int cell = position / 255 < 31 ? position / 255 : 31;
+		int fraction = ((position - cell * 255) * 256 + 127) / 255;
+		table.value[i] = (uint16_t) ((cell << 9) | fraction);
+	}
+	return table;
+}
+
+constexpr MagicTable<float, 256> kDiv255 = makeDiv255Table();
+constexpr MagicTable<uint16_t, 256> kSrgbToLinear12 = makeSrgbToLinear12Table();
+constexpr MagicTable<uint8_t, 4096> kLinear12ToSrgb = makeLinear12ToSrgbTable();
+constexpr MagicTable<uint16_t, 256> kLut33Cell = makeLut33CellTable();
+
+static_assert(kSrgbToLinear12[0] == 0 && kSrgbToLinear12[255] == 4095, "sRGB decode table endpoints");
+static_assert(kLinear12ToSrgb[0] == 0 && kLinear12ToSrgb[4095] == 255, "sRGB encode table endpoints");
+static_assert(kLinear12ToSrgb[kSrgbToLinear12[128]] == 128, "sRGB tables round trip");
+static_assert(kLut33Cell[0] == 0 && kLut33Cell[255] == ((31 << 9) | 256), "LUT cell table endpoints");
+#endif
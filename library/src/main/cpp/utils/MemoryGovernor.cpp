@@ -0,0 +1,129 @@
+#include "MemoryGovernor.h"
+#include <stdio.h>
+#include <unistd.h>
+#include "MagicLog.h"
+
+#define  LOG_TAG    "MemoryGovernor"
+
+#define MB(x) ((double) (x) / (1 << 20))
+
+MemoryGovernor* MemoryGovernor::instance;
+
+MemoryGovernor* MemoryGovernor::getInstance()
+{
+	static std::once_flag once;
+	std::call_once(once, []() { instance = new MemoryGovernor(); });
+	return instance;
+}
+
+MemoryGovernor::MemoryGovernor()
+{
+	// a quarter of physical memory unless the app configures something else
+	long pages = sysconf(_SC_PHYS_PAGES);
+	long pageSize = sysconf(_SC_PAGESIZE);
+	mBudget = pages > 0 && pageSize > 0 ? (int64_t) pages * pageSize / 4 : (int64_t) 512 << 20;
+	for (int i = 0; i < MEMORY_OWNER_COUNT; i++)
+		mUsage[i] = 0;
+	mNextEvictorId = 1;
+}
+
+void MemoryGovernor::setBudget(int64_t bytes)
+{
+	std::lock_guard<std::mutex> lock(mLock);
+	mBudget = bytes;
+}
+
+int64_t MemoryGovernor::getBudget()
+{
+	std::lock_guard<std::mutex> lock(mLock);
+	return mBudget;
+}
+
+int64_t MemoryGovernor::getUsage(int owner)
+{
+	std::lock_guard<std::mutex> lock(mLock);
+	return owner >= 0 && owner < MEMORY_OWNER_COUNT ? mUsage[owner] : 0;
+}
+
+int64_t MemoryGovernor::getTotalUsage()
+{
+	std::lock_guard<std::mutex> lock(mLock);
+	int64_t total = 0;
+	for (int i = 0; i < MEMORY_OWNER_COUNT; i++)
+		total += mUsage[i];
+	return total;
+}
+
+bool MemoryGovernor::reserve(int owner, int64_t bytes)
+{
+	if (owner < 0 || owner >= MEMORY_OWNER_COUNT || bytes < 0)
+		return false;
+	for (int attempt = 0; ; attempt++) {
+		int64_t need;
+		{
+			std::lock_guard<std::mutex> lock(mLock);
+			int64_t total = 0;
+			for (int i = 0; i < MEMORY_OWNER_COUNT; i++)
+				total += mUsage[i];
+			if (total + bytes <= mBudget) {
+				mUsage[owner] += bytes;
+				return true;
+			}
+			need = total + bytes - mBudget;
+		}
+		if (attempt > 0)
+			break;
+		// caches release through release(), so they run without mLock held
+		std::lock_guard<std::mutex> evict(mEvictLock);
+		int64_t freed = 0;
+		for (size_t i = 0; i < mEvictors.size() && freed < need; i++)
+			freed += mEvictors[i].second(need - freed);
+		if (freed > 0)
+			LOGD("evicted %.1f MB of caches for %s", MB(freed), ownerName(owner));
+	}
+	LOGE("refusing %.1f MB for %s: %.1f MB of %.1f MB budget in use (bitmaps %.1f, beautify %.1f, caches %.1f, pools %.1f)",
+			MB(bytes), ownerName(owner), MB(getTotalUsage()), MB(getBudget()),
+			MB(getUsage(MEMORY_OWNER_STORED_BITMAP)), MB(getUsage(MEMORY_OWNER_BEAUTIFY)),
+			MB(getUsage(MEMORY_OWNER_CACHE)), MB(getUsage(MEMORY_OWNER_POOL)));
+	return false;
+}
+
+void MemoryGovernor::release(int owner, int64_t bytes)
+{
+	if (owner < 0 || owner >= MEMORY_OWNER_COUNT)
+		return;
+	std::lock_guard<std::mutex> lock(mLock);
+	mUsage[owner] -= bytes;
+	if (mUsage[owner] < 0)
+		mUsage[owner] = 0;
+}
+
+int MemoryGovernor::registerEvictor(const Evictor& evictor)
+{
+	std::lock_guard<std::mutex> lock(mEvictLock);
+	int id = mNextEvictorId++;
+	mEvictors.push_back(std::make_pair(id, evictor));
+	return id;
+}
+
+void MemoryGovernor::unregisterEvictor(int id)
+{
+	std::lock_guard<std::mutex> lock(mEvictLock);
+	for (size_t i = 0; i < mEvictors.size(); i++) {
+		if (mEvictors[i].first == id) {
+			mEvictors.erase(mEvictors.begin() + i);
+			return;
+		}
+	}
+}
+
+const char* MemoryGovernor::ownerName(int owner)
+{
+	switch (owner) {
+	case MEMORY_OWNER_STORED_BITMAP: return "stored bitmaps";
+	case MEMORY_OWNER_BEAUTIFY: return "beautify";
+	case MEMORY_OWNER_CACHE: return "caches";
+	case MEMORY_OWNER_POOL: return "pools";
+	default: return "unknown";
+	}
+}
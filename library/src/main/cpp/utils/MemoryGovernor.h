@@ -0,0 +1,58 @@
+#ifndef _MEMORY_GOVERNOR_H_
+#define _MEMORY_GOVERNOR_H_
+
+#include <stdint.h>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+enum MemoryOwner
+{
+	MEMORY_OWNER_STORED_BITMAP = 0,
+	MEMORY_OWNER_BEAUTIFY,
+	MEMORY_OWNER_CACHE,
+	MEMORY_OWNER_POOL,
+	MEMORY_OWNER_COUNT
+};
+
+/**
+ * Accounting and admission control for the large native buffers.
+ * Every full-frame allocation is charged to an owner before it is made;
+ * when a charge would exceed the budget, registered caches are asked to
+ * give memory back first, and if that is not enough the charge is refused
+ * so the caller can pick a smaller engine or report the failure instead
+ * of letting new[] take the process down.
+ */
+class MemoryGovernor
+{
+public:
+	// returns the bytes actually freed
+	typedef std::function<int64_t(int64_t bytesNeeded)> Evictor;
+
+	static MemoryGovernor* getInstance();
+
+	void setBudget(int64_t bytes);
+	int64_t getBudget();
+	int64_t getUsage(int owner);
+	int64_t getTotalUsage();
+
+	bool reserve(int owner, int64_t bytes);
+	void release(int owner, int64_t bytes);
+
+	int registerEvictor(const Evictor& evictor);
+	void unregisterEvictor(int id);
+
+	static const char* ownerName(int owner);
+
+private:
+	static MemoryGovernor* instance;
+	MemoryGovernor();
+
+	std::mutex mLock;
+	std::mutex mEvictLock;
+	int64_t mBudget;
+	int64_t mUsage[MEMORY_OWNER_COUNT];
+	std::vector<std::pair<int, Evictor> > mEvictors;
+	int mNextEvictorId;
+};
+#endif
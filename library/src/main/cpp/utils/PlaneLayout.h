@@ -0,0 +1,154 @@
+#ifndef _PLANE_LAYOUT_H_
+#define _PLANE_LAYOUT_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "ThreadPool.h"
+
+/**
+ * Element order of an internal working plane.
+ *
+ * Neighbourhood kernels read rows that are far apart (the four corners of
+ * an integral image window sit 2 * radius rows away from each other), so
+ * on wide images every lookup lands on a different page. The tiled orders
+ * keep a small square of the plane in a contiguous block:
+ *
+ *   LAYOUT_TILED   8x8 tiles, row-major inside the tile, tiles row-major
+ *   LAYOUT_MORTON  32x32 blocks in Z-order inside the block, blocks row-major
+ *
+ * Planes are padded to whole tiles. Kernels take one of the index functors
+ * below as a template parameter so the inner loops compile to plain
+ * arithmetic for each layout.
+ */
+class PlaneLayout
+{
+public:
+	static const int LAYOUT_LINEAR = 0;
+	static const int LAYOUT_TILED = 1;
+	static const int LAYOUT_MORTON = 2;
+
+	static const int TILE_SHIFT = 3;
+	static const int MORTON_SHIFT = 5;
+
+	struct Linear
+	{
+		int width;
+		inline size_t operator()(int x, int y) const
+		{
+			return (size_t) y * width + x;
+		}
+	};
+
+	struct Tiled
+	{
+		int tilesX;
+		inline size_t operator()(int x, int y) const
+		{
+			size_t tile = (size_t) (y >> TILE_SHIFT) * tilesX + (x >> TILE_SHIFT);
+			return (tile << (2 * TILE_SHIFT)) | ((y & 7) << TILE_SHIFT) | (x & 7);
+		}
+	};
+
+	struct Morton
+	{
+		int tilesX;
+		// spreads the 5 low bits of v to the even bit positions
+		static inline uint32_t spread(uint32_t v)
+		{
+			v = (v | (v << 4)) & 0x10f;
+			v = (v | (v << 2)) & 0x133;
+			return (v | (v << 1)) & 0x155;
+		}
+		inline size_t operator()(int x, int y) const
+		{
+			size_t tile = (size_t) (y >> MORTON_SHIFT) * tilesX + (x >> MORTON_SHIFT);
+			return (tile << (2 * MORTON_SHIFT)) | (spread(y & 31) << 1) | spread(x & 31);
+		}
+	};
+
+	PlaneLayout() : mode(LAYOUT_LINEAR), width(0), height(0), tilesX(0), tilesY(0) {}
+
+	PlaneLayout(int mode, int width, int height) : mode(mode), width(width), height(height)
+	{
+		int shift = tileShift();
+		tilesX = shift ? (width + (1 << shift) - 1) >> shift : 0;
+		tilesY = shift ? (height + (1 << shift) - 1) >> shift : 0;
+	}
+
+	int tileShift() const
+	{
+		return mode == LAYOUT_TILED ? TILE_SHIFT : mode == LAYOUT_MORTON ? MORTON_SHIFT : 0;
+	}
+
+	// elements to allocate, padding included
+	size_t size() const
+	{
+		if (mode == LAYOUT_LINEAR)
+			return (size_t) width * height;
+		return ((size_t) tilesX * tilesY) << (2 * tileShift());
+	}
+
+	Linear linear() const { Linear index = { width }; return index; }
+	Tiled tiled() const { Tiled index = { tilesX }; return index; }
+	Morton morton() const { Morton index = { tilesX }; return index; }
+
+	/** Scatters a row-major plane (stride in elements) into this layout. */
+	template <typename T>
+	void fromLinear(const T* src, int stride, T* dst) const
+	{
+		switch (mode) {
+		case LAYOUT_TILED: scatter(tiled(), src, stride, dst); break;
+		case LAYOUT_MORTON: scatter(morton(), src, stride, dst); break;
+		default: scatter(linear(), src, stride, dst); break;
+		}
+	}
+
+	/** Gathers this layout back into a row-major plane (stride in elements). */
+	template <typename T>
+	void toLinear(const T* src, T* dst, int stride) const
+	{
+		switch (mode) {
+		case LAYOUT_TILED: gather(tiled(), src, dst, stride); break;
+		case LAYOUT_MORTON: gather(morton(), src, dst, stride); break;
+		default: gather(linear(), src, dst, stride); break;
+		}
+	}
+
+	int mode;
+	int width;
+	int height;
+	int tilesX;
+	int tilesY;
+
+private:
+	// one band of tile rows per job, so no two jobs write the same tile
+	int bandRows() const
+	{
+		return 1 << (mode == LAYOUT_LINEAR ? TILE_SHIFT : tileShift());
+	}
+
+	template <typename Index, typename T>
+	void scatter(const Index& index, const T* src, int stride, T* dst) const
+	{
+		int rows = bandRows();
+		ThreadPool::getInstance()->parallelFor((height + rows - 1) / rows, [&](int band) {
+			int end = (band + 1) * rows < height ? (band + 1) * rows : height;
+			for (int y = band * rows; y < end; y++)
+				for (int x = 0; x < width; x++)
+					dst[index(x, y)] = src[(size_t) y * stride + x];
+		});
+	}
+
+	template <typename Index, typename T>
+	void gather(const Index& index, const T* src, T* dst, int stride) const
+	{
+		int rows = bandRows();
+		ThreadPool::getInstance()->parallelFor((height + rows - 1) / rows, [&](int band) {
+			int end = (band + 1) * rows < height ? (band + 1) * rows : height;
+			for (int y = band * rows; y < end; y++)
+				for (int x = 0; x < width; x++)
+					dst[(size_t) y * stride + x] = src[index(x, y)];
+		});
+	}
+};
+#endif
@@ -0,0 +1,96 @@
+#include "ThreadPool.h"
+
+static thread_local bool tInsideJob = false;
+
+ThreadPool* ThreadPool::instance;
+
+ThreadPool* ThreadPool::getInstance()
+{
+	static std::once_flag once;
+	std::call_once(once, []() { instance = new ThreadPool(); });
+	return instance;
+}
+
+ThreadPool::ThreadPool()
+{
+	mRealtimeBatches = 0;
+	mThreadCount = (int) std::thread::hardware_concurrency();
+	if (mThreadCount < 1)
+		mThreadCount = 1;
+}
+
+int ThreadPool::getThreadCount()
+{
+	return mThreadCount;
+}
+
+void ThreadPool::startWorkers()
+{
+	for (int i = 1; i < mThreadCount; i++)
+		mWorkers.push_back(std::thread(&ThreadPool::workerLoop, this));
+}
+
+ThreadPool::Batch* ThreadPool::nextBatch()
+{
+	for (Batch* batch : mBatches) {
+		if (batch->next < batch->count)
+			return batch;
+	}
+	return NULL;
+}
+
+// called with mLock held, which it drops while the job runs
+void ThreadPool::runJob(Batch* batch, int i)
+{
+	mLock.unlock();
+	tInsideJob = true;
+	(*batch->job)(i);
+	tInsideJob = false;
+	mLock.lock();
+	if (++batch->finished == batch->count)
+		mDone.notify_all();
+}
+
+void ThreadPool::workerLoop()
+{
+	std::unique_lock<std::mutex> lock(mLock);
+	for (;;) {
+		Batch* batch;
+		mWake.wait(lock, [&]() { return (batch = nextBatch()) != NULL; });
+		runJob(batch, batch->next++);
+	}
+}
+
+void ThreadPool::parallelFor(int count, const std::function<void(int)>& job, int priority)
+{
+	if (count <= 0)
+		return;
+	if (count == 1 || mThreadCount == 1 || tInsideJob) {
+		for (int i = 0; i < count; i++)
+			job(i);
+		return;
+	}
+	Batch batch = { &job, count, 0, 0 };
+	std::unique_lock<std::mutex> lock(mLock);
+	if (mWorkers.empty())
+		startWorkers();
+	if (priority == PRIORITY_REALTIME) {
+		mBatches.insert(mBatches.begin() + mRealtimeBatches, &batch);
+		mRealtimeBatches++;
+	} else {
+		mBatches.push_back(&batch);
+	}
+	mWake.notify_all();
+	// the caller only takes its own jobs, so it returns as soon as they are done
+	while (batch.next < count)
+		runJob(&batch, batch.next++);
+	mDone.wait(lock, [&]() { return batch.finished == count; });
+	for (std::deque<Batch*>::iterator it = mBatches.begin(); it != mBatches.end(); ++it) {
+		if (*it == &batch) {
+			mBatches.erase(it);
+			break;
+		}
+	}
+	if (priority == PRIORITY_REALTIME)
+		mRealtimeBatches--;
+}
@@ -0,0 +1,63 @@
+#ifndef _THREAD_POOL_H_
+#define _THREAD_POOL_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Process wide worker pool shared by the native kernels.
+ * No thread is created until the first parallelFor() with more than one
+ * job, so loading the library stays cheap. The calling thread takes jobs
+ * too, and a parallelFor() issued from inside a job runs inline.
+ *
+ * parallelFor() calls from different threads run at the same time: workers
+ * take one job at a time from whichever call is first in line, and
+ * PRIORITY_REALTIME calls go ahead of the others. A preview frame so only
+ * waits for the jobs workers are already in, not for a whole still render.
+ */
+class ThreadPool
+{
+public:
+	static const int PRIORITY_NORMAL = 0;
+	// frame-budgeted work such as the CPU preview
+	static const int PRIORITY_REALTIME = 1;
+
+	static ThreadPool* getInstance();
+
+	// runs job(i) for every i in [0, count) and returns when all are done
+	void parallelFor(int count, const std::function<void(int)>& job, int priority = PRIORITY_NORMAL);
+	int getThreadCount();
+
+private:
+	typedef struct
+	{
+		const std::function<void(int)>* job;
+		int count;
+		int next;
+		int finished;
+	} Batch;
+
+	static ThreadPool* instance;
+	ThreadPool();
+
+	void startWorkers();
+	void workerLoop();
+	// the first batch in line with a job left, NULL when there is none
+	Batch* nextBatch();
+	void runJob(Batch* batch, int i);
+
+	std::mutex mLock;
+	std::condition_variable mWake;
+	std::condition_variable mDone;
+	std::vector<std::thread> mWorkers;
+
+	// realtime batches first, each priority in arrival order
+	std::deque<Batch*> mBatches;
+	int mRealtimeBatches;
+	int mThreadCount;
+};
+#endif
@@ -0,0 +1,291 @@
+#include "Stabilizer.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#define STABILIZER_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define STABILIZER_SSE 1
+#endif
+
+// 255 * 257 still fits the 16-bit column accumulators
+static const int kColumnBlockRows = 257;
+
+Stabilizer::Stabilizer()
+{
+	mMargin = DEFAULT_MARGIN;
+	mAlpha = 2.0f / (DEFAULT_SMOOTHING + 1);
+	mWidth = 0;
+	mHeight = 0;
+	mCurrent = 0;
+	reset(0, 0);
+}
+
+void Stabilizer::setMargin(int percent)
+{
+	mMargin = percent < 1 ? 1 : percent > 25 ? 25 : percent;
+}
+
+void Stabilizer::setSmoothing(int frames)
+{
+	mAlpha = 2.0f / ((frames > 1 ? frames : 1) + 1);
+}
+
+void Stabilizer::reset(int width, int height)
+{
+	mWidth = width;
+	mHeight = height;
+	mHasPrevious = false;
+	mMotionX = 0;
+	mMotionY = 0;
+	mPathX = 0;
+	mPathY = 0;
+	mFilterX.first = mFilterX.second = 0;
+	mFilterY.first = mFilterY.second = 0;
+	for (int i = 0; i < 2; i++) {
+		mRows[i].assign(height > 1 ? height - 1 : 0, 0);
+		mColumns[i].assign(width > 1 ? width - 1 : 0, 0);
+	}
+	mColumnSum.assign(width, 0);
+	mColumnBlock.assign(width, 0);
+}
+
+// adds a row into 16-bit column accumulators and returns its sum
+static uint32_t accumulateRow(const uint8_t* row, uint16_t* columns, int width)
+{
+	int j = 0;
+	uint32_t sum = 0;
+#if defined(STABILIZER_NEON)
+	uint32x4_t rowSum = vdupq_n_u32(0);
+	for (; j + 16 <= width; j += 16) {
+		uint8x16_t v = vld1q_u8(row + j);
+		rowSum = vpadalq_u16(rowSum, vpaddlq_u8(v));
+		vst1q_u16(columns + j, vaddw_u8(vld1q_u16(columns + j), vget_low_u8(v)));
+		vst1q_u16(columns + j + 8, vaddw_u8(vld1q_u16(columns + j + 8), vget_high_u8(v)));
+	}
+	sum = vaddvq_u32(rowSum);
+#elif defined(STABILIZER_SSE)
+	const __m128i zero = _mm_setzero_si128();
+	__m128i rowSum = zero;
+	for (; j + 16 <= width; j += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*) (row + j));
+		rowSum = _mm_add_epi64(rowSum, _mm_sad_epu8(v, zero));
+		__m128i* low = (__m128i*) (columns + j);
+		__m128i* high = (__m128i*) (columns + j + 8);
+		_mm_storeu_si128(low, _mm_add_epi16(_mm_loadu_si128(low), _mm_unpacklo_epi8(v, zero)));
+		_mm_storeu_si128(high, _mm_add_epi16(_mm_loadu_si128(high), _mm_unpackhi_epi8(v, zero)));
+	}
+	sum = (uint32_t) (_mm_cvtsi128_si32(rowSum) + _mm_cvtsi128_si32(_mm_srli_si128(rowSum, 8)));
+#endif
+	for (; j < width; j++) {
+		sum += row[j];
+		columns[j] += row[j];
+	}
+	return sum;
+}
+
+/**
+ * The shift d at which current[i + d] best matches previous[i], by total
+ * absolute difference over the samples both cover at every shift, and to
+ * a fraction of a sample by a parabola through the best cost and its
+ * neighbours. Every shift in range is tried at full resolution: the
+ * profiles are one-dimensional, so that costs less than the sums, and a
+ * decimated first pass would lose fine texture whose period is below the
+ * decimation step.
+ */
+float Stabilizer::matchProfiles(const int32_t* previous, const int32_t* current, int length, int range)
+{
+	if (range > length / 4)
+		range = length / 4;
+	if (range < 1)
+		return 0;
+	int64_t costs[2 * MAX_MOTION + 1];
+	int best = -range;
+	for (int d = -range; d <= range; d++) {
+		const int32_t* shifted = current + d;
+		int64_t cost = 0;
+		for (int i = range; i < length - range; i++) {
+			int32_t diff = previous[i] - shifted[i];
+			cost += diff < 0 ? -diff : diff;
+		}
+		costs[d + range] = cost;
+		if (cost < costs[best + range] || (cost == costs[best + range] && abs(d) < abs(best)))
+			best = d;
+	}
+	if (best == -range || best == range)
+		return (float) best;
+	double left = (double) costs[best + range - 1], centre = (double) costs[best + range],
+			right = (double) costs[best + range + 1];
+	double curvature = left - 2 * centre + right;
+	if (curvature <= 0)
+		return (float) best;
+	return (float) (best + 0.5 * (left - right) / curvature);
+}
+
+/**
+ * One step of Brown's double exponential smoothing toward path, and the
+ * offset from the smoothed path back to it. An offset beyond the margin
+ * is held at the margin and the filter is moved to match, so the smoothed
+ * path never drifts further from the camera than the crop can follow.
+ */
+float Stabilizer::followPath(PathFilter& filter, float path, float margin)
+{
+	filter.first += mAlpha * (path - filter.first);
+	filter.second += mAlpha * (filter.first - filter.second);
+	float smooth = 2 * filter.first - filter.second;
+	float offset = path - smooth;
+	if (offset > margin || offset < -margin) {
+		offset = offset > 0 ? margin : -margin;
+		float shift = path - offset - smooth;
+		filter.first += shift;
+		filter.second += shift;
+	}
+	return offset;
+}
+
+void Stabilizer::track(const uint8_t* luma, int stride, float* offsetX, float* offsetY)
+{
+	int32_t* rows = mRows[mCurrent].data();
+	int32_t* columns = mColumns[mCurrent].data();
+	uint16_t* block = mColumnBlock.data();
+	memset(mColumnSum.data(), 0, sizeof(uint32_t) * mWidth);
+	uint32_t previousRow = 0;
+	for (int top = 0; top < mHeight; top += kColumnBlockRows) {
+		int bottom = top + kColumnBlockRows < mHeight ? top + kColumnBlockRows : mHeight;
+		memset(block, 0, sizeof(uint16_t) * mWidth);
+		for (int i = top; i < bottom; i++) {
+			uint32_t sum = accumulateRow(luma + (size_t) i * stride, block, mWidth);
+			if (i > 0)
+				rows[i - 1] = (int32_t) (sum - previousRow);
+			previousRow = sum;
+		}
+		for (int j = 0; j < mWidth; j++)
+			mColumnSum[j] += block[j];
+	}
+	for (int j = 0; j + 1 < mWidth; j++)
+		columns[j] = (int32_t) (mColumnSum[j + 1] - mColumnSum[j]);
+
+	if (mHasPrevious) {
+		int previous = 1 - mCurrent;
+		mMotionX = matchProfiles(mColumns[previous].data(), columns, mWidth - 1, MAX_MOTION);
+		mMotionY = matchProfiles(mRows[previous].data(), rows, mHeight - 1, MAX_MOTION);
+	}
+	mPathX += mMotionX;
+	mPathY += mMotionY;
+	*offsetX = followPath(mFilterX, mPathX, mMargin * mWidth / 100.0f);
+	*offsetY = followPath(mFilterY, mPathY, mMargin * mHeight / 100.0f);
+	mCurrent = 1 - mCurrent;
+	mHasPrevious = true;
+}
+
+size_t Stabilizer::scratchBytes(int width)
+{
+	// column table and weights, and one blended row of up to two channels
+	return (size_t) width * (sizeof(int32_t) + sizeof(uint16_t)) + (size_t) (width + 1) * 2;
+}
+
+// out = a + (b - a) * weight / 256, rounded; weight 1..255
+static void blendRows(const uint8_t* a, const uint8_t* b, uint8_t* out, int length, int weight)
+{
+	int k = 0;
+#if defined(STABILIZER_NEON)
+	uint8x8_t wa = vdup_n_u8((uint8_t) (256 - weight)), wb = vdup_n_u8((uint8_t) weight);
+	for (; k + 16 <= length; k += 16) {
+		uint8x16_t va = vld1q_u8(a + k), vb = vld1q_u8(b + k);
+		uint16x8_t low = vmlal_u8(vmull_u8(vget_low_u8(va), wa), vget_low_u8(vb), wb);
+		uint16x8_t high = vmlal_u8(vmull_u8(vget_high_u8(va), wa), vget_high_u8(vb), wb);
+		vst1q_u8(out + k, vcombine_u8(vrshrn_n_u16(low, 8), vrshrn_n_u16(high, 8)));
+	}
+#elif defined(STABILIZER_SSE)
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i wa = _mm_set1_epi16((short) (256 - weight)), wb = _mm_set1_epi16((short) weight);
+	const __m128i half = _mm_set1_epi16(128);
+	for (; k + 16 <= length; k += 16) {
+		__m128i va = _mm_loadu_si128((const __m128i*) (a + k));
+		__m128i vb = _mm_loadu_si128((const __m128i*) (b + k));
+		// at most 255 * 256 + 128, inside unsigned 16 bits
+		__m128i low = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(va, zero), wa),
+				_mm_mullo_epi16(_mm_unpacklo_epi8(vb, zero), wb)), half);
+		__m128i high = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(va, zero), wa),
+				_mm_mullo_epi16(_mm_unpackhi_epi8(vb, zero), wb)), half);
+		_mm_storeu_si128((__m128i*) (out + k), _mm_packus_epi16(_mm_srli_epi16(low, 8), _mm_srli_epi16(high, 8)));
+	}
+#endif
+	for (; k < length; k++)
+		out[k] = (uint8_t) ((a[k] * (256 - weight) + b[k] * weight + 128) >> 8);
+}
+
+// a source coordinate as a sample and a 1/256 weight toward the next one
+static inline void splitCoordinate(float position, int size, int* index, int* weight)
+{
+	int i = (int) floorf(position);
+	int w = (int) ((position - i) * 256 + 0.5f);
+	if (w == 256) {
+		i++;
+		w = 0;
+	}
+	if (i < 0) {
+		i = 0;
+		w = 0;
+	} else if (i >= size - 1) {
+		i = size - 1;
+		w = 0;
+	}
+	*index = i;
+	*weight = w;
+}
+
+void Stabilizer::warpRows(const uint8_t* src, uint8_t* dst, int width, int height, int stride, int channels,
+		float offsetX, float offsetY, int top, int bottom, uint8_t* scratch) const
+{
+	float marginX = mMargin * width / 100.0f, marginY = mMargin * height / 100.0f;
+	offsetX = offsetX < -marginX ? -marginX : offsetX > marginX ? marginX : offsetX;
+	offsetY = offsetY < -marginY ? -marginY : offsetY > marginY ? marginY : offsetY;
+	float scaleX = (width - 2 * marginX) / width, scaleY = (height - 2 * marginY) / height;
+
+	int32_t* column = (int32_t*) scratch;
+	uint16_t* columnWeight = (uint16_t*) (column + width);
+	uint8_t* blended = (uint8_t*) (columnWeight + width);
+	for (int j = 0; j < width; j++) {
+		int index, weight;
+		splitCoordinate(marginX + offsetX + (j + 0.5f) * scaleX - 0.5f, width, &index, &weight);
+		column[j] = index * channels;
+		columnWeight[j] = (uint16_t) weight;
+	}
+	// only the source columns the crop reaches are blended, and the
+	// sample past the last repeats it for the weight 0 taps at the edge
+	int first = column[0];
+	int end = column[width - 1] + 2 * channels;
+	if (end > width * channels)
+		end = width * channels;
+
+	for (int i = top; i < bottom; i++) {
+		int row, weight;
+		splitCoordinate(marginY + offsetY + (i + 0.5f) * scaleY - 0.5f, height, &row, &weight);
+		const uint8_t* a = src + (size_t) row * stride;
+		if (weight == 0)
+			memcpy(blended + first, a + first, end - first);
+		else
+			blendRows(a + first, a + stride + first, blended + first, end - first, weight);
+		for (int c = 0; c < channels; c++)
+			blended[width * channels + c] = blended[(width - 1) * channels + c];
+
+		uint8_t* out = dst + (size_t) i * stride;
+		if (channels == 1) {
+			for (int j = 0; j < width; j++) {
+				int k = column[j], w = columnWeight[j];
+				out[j] = (uint8_t) ((blended[k] * (256 - w) + blended[k + 1] * w + 128) >> 8);
+			}
+		} else {
+			for (int j = 0; j < width; j++) {
+				int k = column[j], w = columnWeight[j];
+				for (int c = 0; c < channels; c++)
+					out[j * channels + c] = (uint8_t) ((blended[k + c] * (256 - w) + blended[k + channels + c] * w
+							+ 128) >> 8);
+			}
+		}
+	}
+}
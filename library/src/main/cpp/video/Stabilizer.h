@@ -0,0 +1,86 @@
+#ifndef _STABILIZER_H_
+#define _STABILIZER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+/**
+ * Global-motion video stabilization for 4:2:0 frames.
+ *
+ * track() takes each frame's luma in order. It sums every row and every
+ * column into two profiles with SIMD and finds the shift between this
+ * frame's profiles and the last frame's, to a fraction of a pixel. The profiles are matched on their differences, so exposure
+ * drift does not read as motion. Summing the accumulated motion gives the
+ * camera path. A causal double exponential low-pass (Brown's method) then
+ * follows that path without lagging behind a steady pan. Each frame is
+ * shifted by the gap between the two paths, held inside the crop margin.
+ *
+ * warpRows() crops margin percent off each side, moved by that offset,
+ * and scales the rest back up to the frame size. It is a separable
+ * bilinear remap: rows are blended vertically with SIMD, then resampled
+ * through a per-call column table, one plane and one band at a time.
+ */
+class Stabilizer
+{
+public:
+	static const int DEFAULT_MARGIN = 8;
+	static const int DEFAULT_SMOOTHING = 30;
+	// largest motion between two frames that is still measured, in luma pixels
+	static const int MAX_MOTION = 64;
+
+	Stabilizer();
+
+	// percent of the width and height held in reserve on each side, 1..25
+	void setMargin(int percent);
+	int getMargin() { return mMargin; }
+	// frames the smoothed path takes to follow the camera; more is steadier
+	void setSmoothing(int frames);
+
+	// starts a new path for frames of this size
+	void reset(int width, int height);
+	// the next frame: its motion against the previous one, then the offset
+	// in luma pixels the warp moves its crop by
+	void track(const uint8_t* luma, int stride, float* offsetX, float* offsetY);
+	// motion of the last tracked frame against the one before, in luma pixels
+	float getMotionX() { return mMotionX; }
+	float getMotionY() { return mMotionY; }
+
+	// bytes of the scratch warpRows() takes, which must be 4 byte aligned
+	static size_t scratchBytes(int width);
+	// output rows [top, bottom) of one plane with interleaved samples of
+	// channels bytes; width, height and offset in that plane's samples
+	void warpRows(const uint8_t* src, uint8_t* dst, int width, int height, int stride, int channels,
+			float offsetX, float offsetY, int top, int bottom, uint8_t* scratch) const;
+
+private:
+	typedef struct
+	{
+		// S1 and S2 of Brown's method
+		float first;
+		float second;
+	} PathFilter;
+
+	static float matchProfiles(const int32_t* previous, const int32_t* current, int length, int range);
+	float followPath(PathFilter& filter, float path, float margin);
+
+	int mMargin;
+	float mAlpha;
+	int mWidth;
+	int mHeight;
+	bool mHasPrevious;
+	float mMotionX;
+	float mMotionY;
+	float mPathX;
+	float mPathY;
+	PathFilter mFilterX;
+	PathFilter mFilterY;
+	// differenced row and column sums, this frame and the last
+	std::vector<int32_t> mRows[2];
+	std::vector<int32_t> mColumns[2];
+	std::vector<uint32_t> mColumnSum;
+	// column sums of up to 257 rows, before they are widened
+	std::vector<uint16_t> mColumnBlock;
+	int mCurrent;
+};
+#endif
@@ -0,0 +1,318 @@
+#include "TemporalDenoiser.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include <vector>
+#include "../utils/MemoryGovernor.h"
+#include "../utils/MagicLog.h"
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#define DENOISER_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define DENOISER_SSE 1
+#endif
+
+#define  LOG_TAG    "TemporalDenoiser"
+
+// blend weight out of 256 at full strength; the rest always comes from the new frame
+static const int kMaxWeight = 224;
+// luma levels of difference at which the weight reaches 0, at no and full strength
+static const int kMinThreshold = 12;
+static const int kThresholdRange = 36;
+
+TemporalDenoiser::TemporalDenoiser()
+{
+	mStrength = 0;
+	mMaxWeight = 0;
+	mWeightSlope = 1;
+	mWidth = 0;
+	mHeight = 0;
+	mCb = 0;
+	mCr = 0;
+	mChromaStep = 1;
+	mChromaStride = 0;
+	mFrameBytes = 0;
+	mBlocksX = 0;
+	mBlocksY = 0;
+	mMemory = NULL;
+	mFrames[0] = mFrames[1] = NULL;
+	mVectors[0] = mVectors[1] = NULL;
+	mReservedBytes = 0;
+}
+
+TemporalDenoiser::~TemporalDenoiser()
+{
+	release();
+}
+
+void TemporalDenoiser::setStrength(float strength)
+{
+	mStrength = strength < 0 ? 0 : strength > 1 ? 1 : strength;
+	mMaxWeight = (int) (mStrength * kMaxWeight + 0.5f);
+	int threshold = kMinThreshold + (int) (mStrength * kThresholdRange + 0.5f);
+	mWeightSlope = mMaxWeight / threshold > 1 ? mMaxWeight / threshold : 1;
+}
+
+bool TemporalDenoiser::reset(int width, int height, size_t cb, size_t cr, int chromaStep, int chromaStride)
+{
+	release();
+	mWidth = width;
+	mHeight = height;
+	mCb = cb;
+	mCr = cr;
+	mChromaStep = chromaStep;
+	mChromaStride = chromaStride;
+	mFrameBytes = (size_t) width * height + 2 * (size_t) (width / 2) * (height / 2);
+	mBlocksX = (width + BLOCK - 1) / BLOCK;
+	mBlocksY = (height + BLOCK - 1) / BLOCK;
+	size_t vectorBytes = sizeof(Vector) * mBlocksX * mBlocksY;
+	int64_t bytes = (int64_t) (mFrameBytes + vectorBytes) * 2;
+	if (!MemoryGovernor::getInstance()->reserve(MEMORY_OWNER_POOL, bytes)) {
+		LOGE("memory budget cannot hold two %dx%d frames", width, height);
+		return false;
+	}
+	mMemory = new (std::nothrow) uint8_t[bytes];
+	if (mMemory == NULL) {
+		MemoryGovernor::getInstance()->release(MEMORY_OWNER_POOL, bytes);
+		return false;
+	}
+	mReservedBytes = bytes;
+	mFrames[0] = mMemory;
+	mFrames[1] = mMemory + mFrameBytes;
+	mVectors[0] = (Vector*) (mMemory + 2 * mFrameBytes);
+	mVectors[1] = mVectors[0] + mBlocksX * mBlocksY;
+	memset(mVectors[0], 0, 2 * vectorBytes);
+	return true;
+}
+
+void TemporalDenoiser::release()
+{
+	if (mMemory == NULL)
+		return;
+	delete[] mMemory;
+	mMemory = NULL;
+	mFrames[0] = mFrames[1] = NULL;
+	mVectors[0] = mVectors[1] = NULL;
+	MemoryGovernor::getInstance()->release(MEMORY_OWNER_POOL, mReservedBytes);
+	mReservedBytes = 0;
+}
+
+// sum of absolute differences of a 16-pixel wide block
+static int blockSad16(const uint8_t* a, const uint8_t* b, int stride, int rows)
+{
+#if defined(DENOISER_NEON)
+	uint16x8_t sum = vdupq_n_u16(0);
+	for (int i = 0; i < rows; i++, a += stride, b += stride)
+		sum = vpadalq_u8(sum, vabdq_u8(vld1q_u8(a), vld1q_u8(b)));
+	return (int) vaddlvq_u16(sum);
+#elif defined(DENOISER_SSE)
+	__m128i sum = _mm_setzero_si128();
+	for (int i = 0; i < rows; i++, a += stride, b += stride)
+		sum = _mm_add_epi64(sum, _mm_sad_epu8(_mm_loadu_si128((const __m128i*) a),
+				_mm_loadu_si128((const __m128i*) b)));
+	return _mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_srli_si128(sum, 8));
+#else
+	int sum = 0;
+	for (int i = 0; i < rows; i++, a += stride, b += stride) {
+		for (int j = 0; j < 16; j++)
+			sum += abs(a[j] - b[j]);
+	}
+	return sum;
+#endif
+}
+
+int TemporalDenoiser::blockCost(const uint8_t* in, const uint8_t* reference, int x, int y, int width, int height,
+		Vector v) const
+{
+	const uint8_t* a = in + (size_t) y * mWidth + x;
+	const uint8_t* b = reference + (size_t) (y + v.y) * mWidth + x + v.x;
+	if (width == 16)
+		return blockSad16(a, b, mWidth, height);
+	int sum = 0;
+	for (int i = 0; i < height; i++, a += mWidth, b += mWidth) {
+		for (int j = 0; j < width; j++)
+			sum += abs(a[j] - b[j]);
+	}
+	return sum;
+}
+
+/**
+ * Predictive search: the best of the candidates, then steps to the best
+ * of the eight neighbouring vectors until none is cheaper. Vectors stay
+ * within SEARCH_RANGE and keep the block inside the frame. A vector has
+ * to beat staying put by a quarter level per pixel, so noise alone does
+ * not pull flat areas around.
+ */
+TemporalDenoiser::Vector TemporalDenoiser::search(const uint8_t* in, const uint8_t* reference, int blockX,
+		int blockY, const Vector* candidates, int count) const
+{
+	const int x = blockX * BLOCK, y = blockY * BLOCK;
+	const int width = mWidth - x < BLOCK ? mWidth - x : BLOCK;
+	const int height = mHeight - y < BLOCK ? mHeight - y : BLOCK;
+	const int minX = -x > -SEARCH_RANGE ? -x : -SEARCH_RANGE;
+	const int maxX = mWidth - width - x < SEARCH_RANGE ? mWidth - width - x : SEARCH_RANGE;
+	const int minY = -y > -SEARCH_RANGE ? -y : -SEARCH_RANGE;
+	const int maxY = mHeight - height - y < SEARCH_RANGE ? mHeight - height - y : SEARCH_RANGE;
+
+	Vector zero = { 0, 0 };
+	Vector best = zero;
+	int zeroCost = blockCost(in, reference, x, y, width, height, zero);
+	int bestCost = zeroCost;
+	for (int i = 0; i < count; i++) {
+		Vector v = candidates[i];
+		if (v.x < minX || v.x > maxX || v.y < minY || v.y > maxY || (v.x == best.x && v.y == best.y))
+			continue;
+		int cost = blockCost(in, reference, x, y, width, height, v);
+		if (cost < bestCost) {
+			bestCost = cost;
+			best = v;
+		}
+	}
+	for (int step = 0; step < 2 * SEARCH_RANGE; step++) {
+		Vector centre = best;
+		for (int dy = -1; dy <= 1; dy++) {
+			for (int dx = -1; dx <= 1; dx++) {
+				Vector v = { (int8_t) (centre.x + dx), (int8_t) (centre.y + dy) };
+				if ((dx == 0 && dy == 0) || v.x < minX || v.x > maxX || v.y < minY || v.y > maxY)
+					continue;
+				int cost = blockCost(in, reference, x, y, width, height, v);
+				if (cost < bestCost) {
+					bestCost = cost;
+					best = v;
+				}
+			}
+		}
+		if (best.x == centre.x && best.y == centre.y)
+			break;
+	}
+	if (zeroCost <= bestCost + width * height / 4)
+		return zero;
+	return best;
+}
+
+/**
+ * out = in + (reference - in) * w / 256 with w = max(0, maxWeight - |reference - in| * slope).
+ * Only differences below maxWeight / slope blend, which keeps the product
+ * inside 16 bits.
+ */
+void TemporalDenoiser::blendRow(const uint8_t* in, const uint8_t* reference, uint8_t* out, int length) const
+{
+	int j = 0;
+#if defined(DENOISER_NEON)
+	const uint16x8_t maxWeight = vdupq_n_u16((uint16_t) mMaxWeight);
+	const uint16x8_t slope = vdupq_n_u16((uint16_t) mWeightSlope);
+	for (; j + 16 <= length; j += 16) {
+		uint8x16_t c = vld1q_u8(in + j);
+		uint8x16_t r = vld1q_u8(reference + j);
+		uint8x16_t d = vabdq_u8(c, r);
+		int16x8_t wLow = vreinterpretq_s16_u16(vqsubq_u16(maxWeight, vmulq_u16(vmovl_u8(vget_low_u8(d)), slope)));
+		int16x8_t wHigh = vreinterpretq_s16_u16(vqsubq_u16(maxWeight, vmulq_u16(vmovl_u8(vget_high_u8(d)), slope)));
+		int16x8_t low = vreinterpretq_s16_u16(vsubl_u8(vget_low_u8(r), vget_low_u8(c)));
+		int16x8_t high = vreinterpretq_s16_u16(vsubl_u8(vget_high_u8(r), vget_high_u8(c)));
+		low = vaddq_s16(vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(c))), vrshrq_n_s16(vmulq_s16(low, wLow), 8));
+		high = vaddq_s16(vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(c))), vrshrq_n_s16(vmulq_s16(high, wHigh), 8));
+		vst1q_u8(out + j, vcombine_u8(vqmovun_s16(low), vqmovun_s16(high)));
+	}
+#elif defined(DENOISER_SSE)
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i maxWeight = _mm_set1_epi16((short) mMaxWeight);
+	const __m128i slope = _mm_set1_epi16((short) mWeightSlope);
+	const __m128i half = _mm_set1_epi16(128);
+	for (; j + 16 <= length; j += 16) {
+		__m128i c = _mm_loadu_si128((const __m128i*) (in + j));
+		__m128i r = _mm_loadu_si128((const __m128i*) (reference + j));
+		__m128i d = _mm_or_si128(_mm_subs_epu8(c, r), _mm_subs_epu8(r, c));
+		__m128i cLow = _mm_unpacklo_epi8(c, zero), cHigh = _mm_unpackhi_epi8(c, zero);
+		__m128i wLow = _mm_subs_epu16(maxWeight, _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), slope));
+		__m128i wHigh = _mm_subs_epu16(maxWeight, _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), slope));
+		__m128i low = _mm_mullo_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(r, zero), cLow), wLow);
+		__m128i high = _mm_mullo_epi16(_mm_sub_epi16(_mm_unpackhi_epi8(r, zero), cHigh), wHigh);
+		low = _mm_add_epi16(cLow, _mm_srai_epi16(_mm_add_epi16(low, half), 8));
+		high = _mm_add_epi16(cHigh, _mm_srai_epi16(_mm_add_epi16(high, half), 8));
+		_mm_storeu_si128((__m128i*) (out + j), _mm_packus_epi16(low, high));
+	}
+#endif
+	for (; j < length; j++) {
+		int c = in[j], diff = reference[j] - c;
+		int w = mMaxWeight - abs(diff) * mWeightSlope;
+		out[j] = w > 0 ? (uint8_t) (c + ((diff * w + 128) >> 8)) : (uint8_t) c;
+	}
+}
+
+/**
+ * Block row by block row: the row's vectors are searched first, then the
+ * luma and chroma rows of the band that fall inside it are blended. Only
+ * the band holding a block row's first line stores its vectors for the
+ * next frame's search.
+ */
+void TemporalDenoiser::denoiseRows(const uint8_t* in, int frame, int top, int bottom)
+{
+	uint8_t* out = mFrames[frame & 1];
+	const uint8_t* reference = mFrames[(frame + 1) & 1];
+	Vector* vectors = mVectors[frame & 1];
+	const Vector* previous = mVectors[(frame + 1) & 1];
+	// interleaved chroma is one plane starting at whichever of Cb and Cr comes first
+	const int planes = mChromaStep == 1 ? 2 : 1;
+	const size_t plane[2] = { mChromaStep == 1 ? mCb : (mCb < mCr ? mCb : mCr), mCr };
+	const int chromaWidth = mWidth / 2;
+
+	if (frame == 0) {
+		memcpy(out + (size_t) top * mWidth, in + (size_t) top * mWidth, (size_t) (bottom - top) * mWidth);
+		for (int p = 0; p < planes; p++) {
+			for (int i = top / 2; i < bottom / 2; i++) {
+				size_t offset = plane[p] + (size_t) i * mChromaStride;
+				memcpy(out + offset, in + offset, (size_t) chromaWidth * mChromaStep);
+			}
+		}
+		return;
+	}
+
+	std::vector<Vector> row(mBlocksX);
+	for (int blockY = top / BLOCK; blockY <= (bottom - 1) / BLOCK; blockY++) {
+		const int y = blockY * BLOCK;
+		const int height = mHeight - y < BLOCK ? mHeight - y : BLOCK;
+		for (int blockX = 0; blockX < mBlocksX; blockX++) {
+			const Vector* last = previous + blockY * mBlocksX + blockX;
+			Vector candidates[4];
+			int count = 0;
+			if (blockX > 0)
+				candidates[count++] = row[blockX - 1];
+			candidates[count++] = last[0];
+			if (blockX + 1 < mBlocksX)
+				candidates[count++] = last[1];
+			if (blockY + 1 < mBlocksY)
+				candidates[count++] = last[mBlocksX];
+			row[blockX] = search(in, reference, blockX, blockY, candidates, count);
+		}
+		if (y >= top)
+			memcpy(vectors + blockY * mBlocksX, &row[0], sizeof(Vector) * mBlocksX);
+
+		int from = y > top ? y : top, to = y + height < bottom ? y + height : bottom;
+		for (int i = from; i < to; i++) {
+			size_t offset = (size_t) i * mWidth;
+			for (int blockX = 0; blockX < mBlocksX; blockX++) {
+				int x = blockX * BLOCK;
+				Vector v = row[blockX];
+				blendRow(in + offset + x, reference + offset + (ptrdiff_t) v.y * mWidth + x + v.x, out + offset + x,
+						mWidth - x < BLOCK ? mWidth - x : BLOCK);
+			}
+		}
+		// chroma blocks are half the size and move by half the vector
+		for (int i = from / 2; i < to / 2; i++) {
+			for (int p = 0; p < planes; p++) {
+				size_t offset = plane[p] + (size_t) i * mChromaStride;
+				for (int blockX = 0; blockX < mBlocksX; blockX++) {
+					int x = blockX * BLOCK / 2;
+					Vector v = row[blockX];
+					ptrdiff_t shift = (ptrdiff_t) (v.y / 2) * mChromaStride + (v.x / 2) * mChromaStep;
+					int width = chromaWidth - x < BLOCK / 2 ? chromaWidth - x : BLOCK / 2;
+					blendRow(in + offset + x * mChromaStep, reference + offset + x * mChromaStep + shift,
+							out + offset + x * mChromaStep, width * mChromaStep);
+				}
+			}
+		}
+	}
+}
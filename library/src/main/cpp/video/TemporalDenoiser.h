@@ -0,0 +1,87 @@
+#ifndef _TEMPORAL_DENOISER_H_
+#define _TEMPORAL_DENOISER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Motion-compensated recursive denoise of 4:2:0 frames, I420 or NV12/NV21.
+ *
+ * Each frame is blended into the denoised frame before it, which is the
+ * only reference kept: memory is two frames (the reference and the frame
+ * being written) whatever the clip length, and the cost is linear in
+ * pixels. Motion is searched per BLOCK x BLOCK luma block with SIMD sums
+ * of absolute differences. It starts from the zero vector, the block to
+ * the left and the same block in the last frame, then steps one pixel at
+ * a time while that lowers the cost, up to SEARCH_RANGE. Chroma follows
+ * the luma vector at half resolution.
+ *
+ * Every pixel then moves toward its motion-compensated reference by a
+ * weight that falls off linearly with the difference between the two.
+ * Noise-sized differences blend and real changes (occlusions, vectors
+ * that missed, a scene cut) keep the new frame, so moving detail is not
+ * smeared.
+ *
+ * Frames must be denoised in order, each one after the last has finished,
+ * but a frame's rows may be split over threads: the motion search only
+ * reads, and a block row shared by two bands is searched by both with the
+ * same result.
+ */
+class TemporalDenoiser
+{
+public:
+	static const int BLOCK = 16;
+	static const int SEARCH_RANGE = 16;
+
+	TemporalDenoiser();
+	~TemporalDenoiser();
+
+	// 0..1, 0 turns the denoise off
+	void setStrength(float strength);
+	float getStrength() { return mStrength; }
+
+	// frames of this layout, the same offsets as VideoProcessor: chroma
+	// planes at cb and cr with chromaStep bytes between samples (2 for
+	// interleaved chroma) and chromaStride between rows. Charges the two
+	// frames to MEMORY_OWNER_POOL; false when the budget cannot hold them.
+	bool reset(int width, int height, size_t cb, size_t cr, int chromaStep, int chromaStride);
+	void release();
+
+	// where frame number frame is denoised to; valid until frame + 2 starts
+	const uint8_t* getOutput(int frame) const { return mFrames[frame & 1]; }
+	// luma rows [top, bottom), both even, and the chroma rows under them
+	void denoiseRows(const uint8_t* in, int frame, int top, int bottom);
+
+private:
+	typedef struct
+	{
+		int8_t x;
+		int8_t y;
+	} Vector;
+
+	Vector search(const uint8_t* in, const uint8_t* reference, int blockX, int blockY, const Vector* candidates,
+			int count) const;
+	int blockCost(const uint8_t* in, const uint8_t* reference, int x, int y, int width, int height,
+			Vector v) const;
+	void blendRow(const uint8_t* in, const uint8_t* reference, uint8_t* out, int length) const;
+
+	float mStrength;
+	// blend weight out of 256 for identical pixels, and its fall per level of difference
+	int mMaxWeight;
+	int mWeightSlope;
+	int mWidth;
+	int mHeight;
+	size_t mCb;
+	size_t mCr;
+	int mChromaStep;
+	int mChromaStride;
+	size_t mFrameBytes;
+	int mBlocksX;
+	int mBlocksY;
+	uint8_t* mMemory;
+	uint8_t* mFrames[2];
+	// per block, written with the frame of the same parity
+	Vector* mVectors[2];
+	int64_t mReservedBytes;
+};
+#endif
@@ -0,0 +1,136 @@
+#include "VideoFile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../utils/MagicLog.h"
+
+#define  LOG_TAG    "VideoFile"
+
+static const char kY4mMagic[] = "YUV4MPEG2 ";
+static const char kFrameMagic[] = "FRAME";
+
+VideoFile::VideoFile()
+{
+	mFormat = FORMAT_NV12;
+	mWidth = 0;
+	mHeight = 0;
+	mMap = NULL;
+	mMapBytes = 0;
+}
+
+VideoFile::~VideoFile()
+{
+	close();
+}
+
+bool VideoFile::open(const char* path, int format, int width, int height)
+{
+	close();
+	int fd = ::open(path, O_RDONLY);
+	if (fd < 0) {
+		LOGE("cannot open %s", path);
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_size == 0) {
+		LOGE("%s is empty", path);
+		::close(fd);
+		return false;
+	}
+	void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (map == MAP_FAILED) {
+		LOGE("cannot map %s", path);
+		return false;
+	}
+	// frames are read front to back, several at a time
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+	mMap = (const uint8_t*) map;
+	mMapBytes = st.st_size;
+	mFormat = format;
+
+	bool ok;
+	if (format == FORMAT_Y4M) {
+		ok = parseY4m();
+	} else {
+		mWidth = width;
+		mHeight = height;
+		ok = width > 0 && height > 0 && !(width & 1) && !(height & 1);
+		if (ok) {
+			for (size_t offset = 0; offset + getFrameBytes() <= mMapBytes; offset += getFrameBytes())
+				mFrames.push_back(offset);
+			if (mMapBytes % getFrameBytes() != 0)
+				LOGE("%s ends with a partial frame, ignored", path);
+		}
+	}
+	if (!ok || mFrames.empty()) {
+		LOGE("%s holds no %dx%d 4:2:0 frames", path, mWidth, mHeight);
+		close();
+		return false;
+	}
+	return true;
+}
+
+void VideoFile::close()
+{
+	if (mMap != NULL)
+		munmap((void*) mMap, mMapBytes);
+	mMap = NULL;
+	mMapBytes = 0;
+	mWidth = 0;
+	mHeight = 0;
+	mHeader.clear();
+	mFrames.clear();
+}
+
+bool VideoFile::parseY4m()
+{
+	const char* text = (const char*) mMap;
+	const char* end = (const char*) memchr(text, '\n', mMapBytes);
+	if (end == NULL || strncmp(text, kY4mMagic, sizeof(kY4mMagic) - 1) != 0) {
+		LOGE("not a YUV4MPEG2 stream");
+		return false;
+	}
+	mHeader.assign(text, end + 1 - text);
+	// space separated tags; W, H and C matter here, the rest is copied through
+	for (const char* tag = text + sizeof(kY4mMagic) - 1; tag < end; ) {
+		const char* next = (const char*) memchr(tag, ' ', end - tag);
+		if (next == NULL)
+			next = end;
+		if (*tag == 'W') {
+			mWidth = atoi(tag + 1);
+		} else if (*tag == 'H') {
+			mHeight = atoi(tag + 1);
+		} else if (*tag == 'C' && strncmp(tag + 1, "420", 3) != 0) {
+			LOGE("Y4M colour space %.*s is not supported, only 4:2:0", (int) (next - tag - 1), tag + 1);
+			return false;
+		}
+		tag = next + 1;
+	}
+	if (mWidth <= 0 || mHeight <= 0 || (mWidth & 1) || (mHeight & 1)) {
+		LOGE("Y4M frames need an even size, got %dx%d", mWidth, mHeight);
+		return false;
+	}
+	size_t offset = mHeader.size();
+	while (offset + sizeof(kFrameMagic) - 1 < mMapBytes) {
+		if (memcmp(mMap + offset, kFrameMagic, sizeof(kFrameMagic) - 1) != 0) {
+			LOGE("Y4M frame header missing at byte %zu", offset);
+			break;
+		}
+		const uint8_t* line = (const uint8_t*) memchr(mMap + offset, '\n', mMapBytes - offset);
+		if (line == NULL)
+			break;
+		offset = line + 1 - mMap;
+		if (offset + getFrameBytes() > mMapBytes) {
+			LOGE("Y4M stream ends with a partial frame, ignored");
+			break;
+		}
+		mFrames.push_back(offset);
+		offset += getFrameBytes();
+	}
+	return true;
+}
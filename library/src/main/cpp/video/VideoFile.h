@@ -0,0 +1,55 @@
+#ifndef _VIDEO_FILE_H_
+#define _VIDEO_FILE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+/**
+ * Raw 4:2:0 video file, memory-mapped read-only.
+ *
+ * Y4M (YUV4MPEG2) carries its size in the stream header and stores I420
+ * frames (Y, then Cb, then Cr planes), each behind a "FRAME" line. NV12 is
+ * headerless: frames of a Y plane and an interleaved CbCr plane back to
+ * back, so the size must be given. Frames are located once at open(), so
+ * getFrame() is random access and safe to call from any thread.
+ */
+class VideoFile
+{
+public:
+	static const int FORMAT_Y4M = 0;
+	static const int FORMAT_NV12 = 1;
+
+	VideoFile();
+	~VideoFile();
+
+	// width and height are only used for NV12; both must be even
+	bool open(const char* path, int format, int width, int height);
+	void close();
+
+	int getFormat() { return mFormat; }
+	int getWidth() { return mWidth; }
+	int getHeight() { return mHeight; }
+	int getFrameCount() { return (int) mFrames.size(); }
+	size_t getFrameBytes() { return (size_t) mWidth * mHeight * 3 / 2; }
+	const uint8_t* getFrame(int index) { return mMap + mFrames[index]; }
+	// the Y4M stream header line including its newline, empty for NV12
+	const std::string& getHeader() { return mHeader; }
+
+private:
+	VideoFile(const VideoFile&);
+	VideoFile& operator=(const VideoFile&);
+
+	bool parseY4m();
+
+	int mFormat;
+	int mWidth;
+	int mHeight;
+	const uint8_t* mMap;
+	size_t mMapBytes;
+	std::string mHeader;
+	// byte offset of every frame's pixels in the map
+	std::vector<size_t> mFrames;
+};
+#endif
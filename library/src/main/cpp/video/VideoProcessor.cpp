@@ -0,0 +1,638 @@
+#include "VideoProcessor.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <unistd.h>
+#include <chrono>
+#include <new>
+#include <thread>
+#include <vector>
+#include "../beautify/SmoothGain.h"
+#include "../utils/MagicTables.h"
+#include "../utils/MemoryGovernor.h"
+#include "../utils/ThreadPool.h"
+#include "../utils/MagicLog.h"
+
+#define  LOG_TAG    "VideoProcessor"
+
+// chroma rows, so bands stay well above the smoothing window overlap
+static const int kMinBandRows = 16;
+static const char kFrameHeader[] = "FRAME\n";
+
+static inline int clampByte(int v)
+{
+	return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+// Cb/Cr box of Chai & Ngan, the same skin test the preview uses
+static inline bool isSkin(int u, int v)
+{
+	return u >= 77 && u <= 127 && v >= 133 && v <= 173;
+}
+
+// bytes rounded up so that the next buffer carved after them stays aligned
+static inline size_t alignedBytes(size_t bytes)
+{
+	return (bytes + 15) & ~(size_t) 15;
+}
+
+static bool writeFully(int fd, const void* data, size_t size)
+{
+	const uint8_t* p = (const uint8_t*) data;
+	while (size > 0) {
+		ssize_t written = write(fd, p, size);
+		if (written < 0 && errno == EINTR)
+			continue;
+		if (written <= 0)
+			return false;
+		p += written;
+		size -= written;
+	}
+	return true;
+}
+
+VideoProcessor::VideoProcessor()
+{
+	mWidth = 0;
+	mHeight = 0;
+	mRadius = 0;
+	mCb = 0;
+	mCr = 0;
+	mChromaStep = 0;
+	mChromaStride = 0;
+	mSmoothLevel = 0;
+	mPrecision = SmoothGain::PRECISION_FP32;
+	for (int i = 0; i < 256; i++)
+		mWhiten[i] = i;
+	mWhitening = false;
+	mProtectSkin = false;
+	mStabilizeMargin = 0;
+	mDenoising = false;
+	mThreads = 0;
+	mWindow = 0;
+	mLatencyTargetMs = 0;
+	mSlotCount = 0;
+	mThreadCount = 0;
+	mNextFrame = 0;
+	mCompleted = 0;
+	mWritten = 0;
+	mDenoised = 0;
+	mDepth = 0;
+	mAbort = false;
+	mSlots = NULL;
+	mSkinPlanes = NULL;
+	mStablePlanes = NULL;
+	mReady = NULL;
+	mTasks = NULL;
+	mScratch = NULL;
+	mLatencyEma = 0;
+	mSinceAdjust = 0;
+	mLatencySum = 0;
+	mLatencyMax = 0;
+	mDepthSum = 0;
+}
+
+void VideoProcessor::setBeautyLevel(float smoothLevel, float whitenLevel)
+{
+	mSmoothLevel = smoothLevel >= 10.0 && smoothLevel <= 510.0 ? smoothLevel : 0;
+	float a = whitenLevel >= 1.0 && whitenLevel <= 5.0 ? log(whitenLevel) : 0;
+	for (int i = 0; i < 256; i++) {
+		if (a != 0)
+			mWhiten[i] = 255 * (log(kDiv255[i] * (whitenLevel - 1) + 1) / a);
+		else
+			mWhiten[i] = i;
+	}
+	mWhitening = a != 0;
+}
+
+bool VideoProcessor::setSmoothPrecision(int precision)
+{
+	if (!SmoothGain::isSupported(precision))
+		return false;
+	mPrecision = precision;
+	return true;
+}
+
+void VideoProcessor::setLookup(const uint8_t* rgba, int stride)
+{
+	mLook.setLookup(rgba, stride);
+}
+
+void VideoProcessor::setSkinProtection(bool protect)
+{
+	mProtectSkin = protect;
+}
+
+void VideoProcessor::setStabilization(int marginPercent, int smoothingFrames)
+{
+	mStabilizeMargin = marginPercent > 0 ? marginPercent : 0;
+	if (mStabilizeMargin > 0)
+		mStabilizer.setMargin(mStabilizeMargin);
+	mStabilizer.setSmoothing(smoothingFrames > 0 ? smoothingFrames : Stabilizer::DEFAULT_SMOOTHING);
+}
+
+void VideoProcessor::setDenoise(float strength)
+{
+	mDenoiser.setStrength(strength);
+	mDenoising = mDenoiser.getStrength() > 0;
+}
+
+void VideoProcessor::setThreads(int threads, int window)
+{
+	mThreads = threads;
+	mWindow = window;
+}
+
+void VideoProcessor::setLatencyTarget(double ms)
+{
+	mLatencyTargetMs = ms > 0 ? ms : 0;
+}
+
+bool VideoProcessor::process(VideoFile& input, int outFd, VideoStats* stats)
+{
+	mWidth = input.getWidth();
+	mHeight = input.getHeight();
+	mRadius = (mWidth > mHeight ? mWidth : mHeight) * 0.02;
+	if (mRadius < 1)
+		mRadius = 1;
+	size_t lumaBytes = (size_t) mWidth * mHeight;
+	if (input.getFormat() == VideoFile::FORMAT_Y4M) {
+		mCb = lumaBytes;
+		mCr = lumaBytes + lumaBytes / 4;
+		mChromaStep = 1;
+		mChromaStride = mWidth / 2;
+	} else {
+		mCb = lumaBytes;
+		mCr = lumaBytes + 1;
+		mChromaStep = 2;
+		mChromaStride = mWidth;
+	}
+
+	int threads = mThreads > 0 ? mThreads : ThreadPool::getInstance()->getThreadCount();
+	int window = mWindow > 0 ? mWindow : 2 * threads;
+	if (window < threads)
+		window = threads;
+	int frames = input.getFrameCount();
+	size_t frameBytes = input.getFrameBytes();
+	// the mask is only read by the smoothing
+	size_t skinBytes = mSmoothLevel > 0 ? (size_t) (mWidth / 2) * (mHeight / 2) : 0;
+	// the warped frame the later stages read instead of the input
+	size_t stableBytes = mStabilizeMargin > 0 ? frameBytes : 0;
+	size_t warpBytes = mStabilizeMargin > 0 ? alignedBytes(Stabilizer::scratchBytes(mWidth)) : 0;
+	// the sums and the mask row keep every slice and every row in it aligned
+	size_t wordRow = alignedBytes((size_t) mWidth * sizeof(uint32_t));
+	size_t skinRow = alignedBytes(mWidth);
+	int64_t scratchBytes = (int64_t) 4 * wordRow + skinRow + warpBytes;
+	int64_t total = (int64_t) (frameBytes + skinBytes + stableBytes) * window + scratchBytes * threads;
+	// the denoiser holds its own two frames, which the later stages read instead
+	if (mDenoising && !mDenoiser.reset(mWidth, mHeight, mCb, mCr, mChromaStep, mChromaStride))
+		return false;
+	if (!MemoryGovernor::getInstance()->reserve(MEMORY_OWNER_POOL, total)) {
+		LOGE("memory budget cannot hold a %d frame window of %dx%d", window, mWidth, mHeight);
+		mDenoiser.release();
+		return false;
+	}
+	uint8_t* slotMemory = new (std::nothrow) uint8_t[(frameBytes + skinBytes + stableBytes) * window];
+	uint8_t* scratchMemory = new (std::nothrow) uint8_t[scratchBytes * threads];
+	mSlots = new (std::nothrow) uint8_t*[window];
+	mSkinPlanes = new (std::nothrow) uint8_t*[window];
+	mStablePlanes = new (std::nothrow) uint8_t*[window];
+	mReady = new (std::nothrow) bool[window];
+	mTasks = new (std::nothrow) FrameTask[window];
+	mScratch = new (std::nothrow) FrameScratch[threads];
+	bool ok = slotMemory != NULL && scratchMemory != NULL && mSlots != NULL && mSkinPlanes != NULL
+			&& mStablePlanes != NULL && mReady != NULL && mTasks != NULL && mScratch != NULL;
+	if (ok) {
+		for (int i = 0; i < window; i++) {
+			mSlots[i] = slotMemory + frameBytes * i;
+			mSkinPlanes[i] = slotMemory + frameBytes * window + skinBytes * i;
+			mStablePlanes[i] = slotMemory + (frameBytes + skinBytes) * window + stableBytes * i;
+			mReady[i] = false;
+		}
+		uint8_t* p = scratchMemory;
+		for (int t = 0; t < threads; t++) {
+			mScratch[t].columnSum = (uint32_t*) p;
+			p += wordRow;
+			mScratch[t].columnSumSqr = (uint32_t*) p;
+			p += wordRow;
+			mScratch[t].mean = (float*) p;
+			p += wordRow;
+			mScratch[t].var = (float*) p;
+			p += wordRow;
+			mScratch[t].skin = p;
+			p += skinRow;
+			mScratch[t].warp = p;
+			p += warpBytes;
+		}
+	} else {
+		LOGE("allocation failed for a %d frame window of %dx%d", window, mWidth, mHeight);
+	}
+
+	mWritten = 0;
+	mLatencySum = 0;
+	mLatencyMax = 0;
+	mDepthSum = 0;
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+	if (ok && input.getFormat() == VideoFile::FORMAT_Y4M)
+		ok = writeFully(outFd, input.getHeader().data(), input.getHeader().size());
+	int written = 0;
+	if (ok) {
+		mSlotCount = window;
+		mThreadCount = threads;
+		mNextFrame = 0;
+		mCompleted = 0;
+		mDenoised = 0;
+		// a latency target starts from the shallowest pipeline and deepens it
+		mDepth = mLatencyTargetMs > 0 ? 1 : window;
+		mAbort = false;
+		mLatencyEma = 0;
+		mSinceAdjust = 0;
+		mStabilizer.reset(mWidth, mHeight);
+		std::vector<std::thread> workers;
+		for (int t = 0; t < threads; t++)
+			workers.push_back(std::thread(&VideoProcessor::workerLoop, this, &input, t));
+		// this thread is the writer: frames leave in order, whichever worker finishes first
+		for (; written < frames; written++) {
+			int slot = written % window;
+			{
+				std::unique_lock<std::mutex> lock(mLock);
+				mChanged.wait(lock, [&]() { return mReady[slot]; });
+			}
+			if ((input.getFormat() == VideoFile::FORMAT_Y4M
+					&& !writeFully(outFd, kFrameHeader, sizeof(kFrameHeader) - 1))
+					|| !writeFully(outFd, mSlots[slot], frameBytes)) {
+				LOGE("write failed after %d frames", written);
+				ok = false;
+			}
+			{
+				std::lock_guard<std::mutex> lock(mLock);
+				double ms = std::chrono::duration<double, std::milli>(
+						std::chrono::steady_clock::now() - mTasks[slot].started).count();
+				mLatencySum += ms;
+				if (ms > mLatencyMax)
+					mLatencyMax = ms;
+				mDepthSum += mDepth;
+				adjustDepth(ms);
+				mReady[slot] = false;
+				mWritten = written + 1;
+				mAbort = !ok;
+			}
+			mChanged.notify_all();
+			if (!ok)
+				break;
+		}
+		for (size_t t = 0; t < workers.size(); t++)
+			workers[t].join();
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+	delete[] slotMemory;
+	delete[] scratchMemory;
+	delete[] mSlots;
+	delete[] mSkinPlanes;
+	delete[] mStablePlanes;
+	delete[] mReady;
+	delete[] mTasks;
+	delete[] mScratch;
+	mSlots = NULL;
+	mSkinPlanes = NULL;
+	mStablePlanes = NULL;
+	mReady = NULL;
+	mTasks = NULL;
+	mScratch = NULL;
+	MemoryGovernor::getInstance()->release(MEMORY_OWNER_POOL, total);
+	mDenoiser.release();
+
+	if (stats != NULL) {
+		// a frame that failed to write still counts toward the latency
+		int counted = mWritten;
+		stats->frames = written;
+		stats->seconds = seconds;
+		stats->framesPerSecond = seconds > 0 ? written / seconds : 0;
+		stats->meanLatencyMs = counted > 0 ? mLatencySum / counted : 0;
+		stats->maxLatencyMs = mLatencyMax;
+		stats->meanDepth = counted > 0 ? mDepthSum / counted : 0;
+	}
+	return ok;
+}
+
+/**
+ * One step at a time toward the latency target: deeper while the smoothed
+ * latency is well under it, shallower while it is over. Each step waits
+ * for as many frames as are in flight, so it is judged on frames that
+ * were started under the new depth.
+ */
+void VideoProcessor::adjustDepth(double latencyMs)
+{
+	if (mLatencyTargetMs <= 0)
+		return;
+	mLatencyEma = mWritten == 0 ? latencyMs : 0.8 * mLatencyEma + 0.2 * latencyMs;
+	if (++mSinceAdjust <= mDepth)
+		return;
+	if (mLatencyEma > mLatencyTargetMs && mDepth > 1) {
+		mDepth--;
+		mSinceAdjust = 0;
+	} else if (mLatencyEma < 0.75 * mLatencyTargetMs && mDepth < mSlotCount) {
+		mDepth++;
+		mSinceAdjust = 0;
+	}
+}
+
+bool VideoProcessor::claimBand(VideoFile* input, int* slot, int* stage, int* band)
+{
+	const int frames = input->getFrameCount();
+	for (int f = mWritten; f < mNextFrame; f++) {
+		FrameTask& task = mTasks[f % mSlotCount];
+		if (task.stage != STAGE_DONE && task.nextBand < task.bands
+				&& (task.stage != STAGE_DENOISE || canDenoise(f))) {
+			*slot = f % mSlotCount;
+			*stage = task.stage;
+			*band = task.nextBand++;
+			return true;
+		}
+	}
+	if (mNextFrame >= frames || mNextFrame >= mWritten + mSlotCount || mNextFrame - mCompleted >= mDepth)
+		return false;
+	// the workers are shared among the frames in flight; a band keeps a
+	// few rows so the smoothing window overlap stays small next to it
+	int bands = (mThreadCount + mDepth - 1) / mDepth;
+	int maxBands = mHeight / 2 / kMinBandRows;
+	if (bands > maxBands)
+		bands = maxBands > 1 ? maxBands : 1;
+	*slot = mNextFrame % mSlotCount;
+	FrameTask& task = mTasks[*slot];
+	task.frame = mNextFrame++;
+	task.stage = mStabilizeMargin > 0 ? STAGE_STABILIZE : mDenoising ? STAGE_DENOISE : STAGE_PREPARE;
+	task.offsetX = 0;
+	task.offsetY = 0;
+	// frames are admitted in order, which is the order the path needs
+	if (mStabilizeMargin > 0)
+		mStabilizer.track(input->getFrame(task.frame), mWidth, &task.offsetX, &task.offsetY);
+	task.bands = bands;
+	task.nextBand = 1;
+	task.doneBands = 0;
+	task.started = std::chrono::steady_clock::now();
+	if (task.stage == STAGE_DENOISE && !canDenoise(task.frame)) {
+		// admitted, but waits for the frame before it
+		task.nextBand = 0;
+		return false;
+	}
+	*stage = task.stage;
+	*band = 0;
+	return true;
+}
+
+/**
+ * The previous frame's denoised output is this frame's reference, and the
+ * frame two back is reading the buffer this one writes to until it is done.
+ */
+bool VideoProcessor::canDenoise(int frame)
+{
+	if (frame != mDenoised)
+		return false;
+	return frame < 2 || frame - 2 < mWritten || mTasks[(frame - 2) % mSlotCount].stage == STAGE_DONE;
+}
+
+void VideoProcessor::finishBand(int slot)
+{
+	FrameTask& task = mTasks[slot];
+	if (++task.doneBands < task.bands)
+		return;
+	if (task.stage == STAGE_DENOISE)
+		mDenoised++;
+	task.stage = nextStage(task.stage);
+	task.nextBand = 0;
+	task.doneBands = 0;
+	if (task.stage == STAGE_DONE) {
+		mReady[slot] = true;
+		mCompleted++;
+	}
+}
+
+int VideoProcessor::nextStage(int stage)
+{
+	switch (stage) {
+	case STAGE_STABILIZE:
+		return mDenoising ? STAGE_DENOISE : STAGE_PREPARE;
+	case STAGE_SMOOTH:
+		return mLook.isEmpty() ? STAGE_DONE : STAGE_LOOK;
+	default:
+		return stage + 1;
+	}
+}
+
+void VideoProcessor::workerLoop(VideoFile* input, int worker)
+{
+	const int frames = input->getFrameCount();
+	for (;;) {
+		int slot = 0, stage = 0, band = 0;
+		bool claimed = false;
+		{
+			std::unique_lock<std::mutex> lock(mLock);
+			mChanged.wait(lock, [&]() {
+				if (mAbort || mCompleted >= frames)
+					return true;
+				claimed = claimBand(input, &slot, &stage, &band);
+				return claimed;
+			});
+			if (!claimed)
+				return;
+		}
+		// the band's rows are this worker's alone until it reports them done
+		runBand(input->getFrame(mTasks[slot].frame), slot, stage, band, mScratch[worker]);
+		{
+			std::lock_guard<std::mutex> lock(mLock);
+			finishBand(slot);
+		}
+		mChanged.notify_all();
+	}
+}
+
+// bands are cut on chroma rows so every band holds whole 2x2 blocks
+void VideoProcessor::runBand(const uint8_t* in, int slot, int stage, int band, FrameScratch& scratch)
+{
+	const int bands = mTasks[slot].bands;
+	const int chromaRows = mHeight / 2;
+	int top = chromaRows * band / bands;
+	int bottom = chromaRows * (band + 1) / bands;
+	uint8_t* out = mSlots[slot];
+	// once warped, the stabilized frame stands in for the input, and once
+	// denoised, the denoiser's output does
+	if (mDenoising && stage > STAGE_DENOISE)
+		in = mDenoiser.getOutput(mTasks[slot].frame);
+	else if (mStabilizeMargin > 0 && stage != STAGE_STABILIZE)
+		in = mStablePlanes[slot];
+	switch (stage) {
+	case STAGE_STABILIZE:
+		stabilizeRows(in, mStablePlanes[slot], slot, top, bottom, scratch.warp);
+		break;
+	case STAGE_DENOISE:
+		mDenoiser.denoiseRows(in, mTasks[slot].frame, 2 * top, 2 * bottom);
+		break;
+	case STAGE_PREPARE:
+		prepareRows(in, out, mSkinPlanes[slot], top, bottom);
+		break;
+	case STAGE_SMOOTH:
+		smoothRows(in, out, mSkinPlanes[slot], 2 * top, 2 * bottom, scratch);
+		break;
+	case STAGE_LOOK:
+		lookRows(out, 2 * top, 2 * bottom);
+		break;
+	}
+}
+
+// chroma rows [top, bottom) and the luma rows over them, through the crop-warp
+void VideoProcessor::stabilizeRows(const uint8_t* in, uint8_t* out, int slot, int top, int bottom, uint8_t* scratch)
+{
+	float offsetX = mTasks[slot].offsetX, offsetY = mTasks[slot].offsetY;
+	const int chromaWidth = mWidth / 2, chromaHeight = mHeight / 2;
+	mStabilizer.warpRows(in, out, mWidth, mHeight, mWidth, 1, offsetX, offsetY, 2 * top, 2 * bottom, scratch);
+	// NV12 chroma is one plane of CbCr pairs, Y4M two planes
+	mStabilizer.warpRows(in + mCb, out + mCb, chromaWidth, chromaHeight, mChromaStride, mChromaStep,
+			offsetX / 2, offsetY / 2, top, bottom, scratch);
+	if (mChromaStep == 1)
+		mStabilizer.warpRows(in + mCr, out + mCr, chromaWidth, chromaHeight, mChromaStride, 1,
+				offsetX / 2, offsetY / 2, top, bottom, scratch);
+}
+
+// chroma rows [top, bottom): copied as they are, and the skin mask
+void VideoProcessor::prepareRows(const uint8_t* in, uint8_t* out, uint8_t* skin, int top, int bottom)
+{
+	size_t offset = (size_t) top * mChromaStride;
+	size_t bytes = (size_t) (bottom - top) * mChromaStride;
+	// smoothing and whitening only touch luma
+	memcpy(out + mCb + offset, in + mCb + offset, bytes);
+	if (mChromaStep == 1)
+		memcpy(out + mCr + offset, in + mCr + offset, bytes);
+	if (mSmoothLevel <= 0)
+		return;
+	const int chromaWidth = mWidth / 2;
+	for (int i = top; i < bottom; i++) {
+		const uint8_t* cb = in + mCb + (size_t) i * mChromaStride;
+		const uint8_t* cr = in + mCr + (size_t) i * mChromaStride;
+		uint8_t* line = skin + (size_t) i * chromaWidth;
+		for (int j = 0; j < chromaWidth; j++)
+			line[j] = isSkin(cb[j * mChromaStep], cr[j * mChromaStep]) ? 255 : 0;
+	}
+}
+
+/**
+ * Same statistics as the preview: per-column sums over the rows of the
+ * window slide down the band, and each row slides a horizontal window
+ * over them. The sums are exact, so a band starting mid-frame gets the
+ * same result as a pass over the whole frame. Whitening is applied to
+ * each row as it is finished.
+ */
+void VideoProcessor::smoothRows(const uint8_t* in, uint8_t* out, const uint8_t* skin, int begin, int end,
+		FrameScratch& scratch)
+{
+	const int width = mWidth;
+	const int height = mHeight;
+	if (mSmoothLevel <= 0) {
+		size_t from = (size_t) begin * width, to = (size_t) end * width;
+		if (mWhitening) {
+			for (size_t k = from; k < to; k++)
+				out[k] = mWhiten[in[k]];
+		} else {
+			memcpy(out + from, in + from, to - from);
+		}
+		return;
+	}
+	const int r = mRadius;
+	const int chromaWidth = width / 2;
+	memset(scratch.columnSum, 0, sizeof(uint32_t) * width);
+	memset(scratch.columnSumSqr, 0, sizeof(uint32_t) * width);
+	int top = begin - r > 0 ? begin - r : 0, bottom = top - 1;
+	for (int i = begin; i < end; i++) {
+		int windowBottom = i + r < height - 1 ? i + r : height - 1;
+		int windowTop = i - r > 0 ? i - r : 0;
+		while (bottom < windowBottom) {
+			const uint8_t* add = in + (size_t) ++bottom * width;
+			for (int j = 0; j < width; j++) {
+				scratch.columnSum[j] += add[j];
+				scratch.columnSumSqr[j] += add[j] * add[j];
+			}
+		}
+		for (; top < windowTop; top++) {
+			const uint8_t* remove = in + (size_t) top * width;
+			for (int j = 0; j < width; j++) {
+				scratch.columnSum[j] -= remove[j];
+				scratch.columnSumSqr[j] -= remove[j] * remove[j];
+			}
+		}
+		int rows = bottom - top + 1;
+
+		const uint8_t* skinLine = skin + (size_t) (i >> 1) * chromaWidth;
+		// a window's sum of squares passes 32 bits from radius 64 (3200 px
+		// frames); a column's stays inside them
+		uint32_t sum = 0;
+		uint64_t sumSqr = 0;
+		for (int j = 0; j <= r && j < width; j++) {
+			sum += scratch.columnSum[j];
+			sumSqr += scratch.columnSumSqr[j];
+		}
+		for (int j = 0; j < width; j++) {
+			int left = j - r > 0 ? j - r : 0;
+			int right = j + r < width - 1 ? j + r : width - 1;
+			scratch.skin[j] = skinLine[j >> 1];
+			if (scratch.skin[j]) {
+				float count = (float) (rows * (right - left + 1));
+				float m = sum / count;
+				scratch.mean[j] = m;
+				scratch.var[j] = sumSqr / count - m * m;
+			}
+			if (j + r + 1 < width) {
+				sum += scratch.columnSum[j + r + 1];
+				sumSqr += scratch.columnSumSqr[j + r + 1];
+			}
+			if (j - r >= 0) {
+				sum -= scratch.columnSum[j - r];
+				sumSqr -= scratch.columnSumSqr[j - r];
+			}
+		}
+		uint8_t* line = out + (size_t) i * width;
+		memcpy(line, in + (size_t) i * width, width);
+		SmoothGain::apply(mPrecision, scratch.mean, scratch.var, scratch.skin, line, 1, width, mSmoothLevel);
+		if (mWhitening) {
+			for (int j = 0; j < width; j++)
+				line[j] = mWhiten[line[j]];
+		}
+	}
+}
+
+/**
+ * BT.601 video range, a 2x2 block at a time: the four pixels go through
+ * the look and the block's new chroma is the mean of theirs.
+ */
+void VideoProcessor::lookRows(uint8_t* frame, int begin, int end)
+{
+	for (int i = begin; i < end; i += 2) {
+		uint8_t* cbRow = frame + mCb + (size_t) (i >> 1) * mChromaStride;
+		uint8_t* crRow = frame + mCr + (size_t) (i >> 1) * mChromaStride;
+		for (int j = 0; j < mWidth; j += 2) {
+			int c = (j >> 1) * mChromaStep;
+			int u = cbRow[c], v = crRow[c];
+			int d = u - 128;
+			int e = v - 128;
+			int skin = mProtectSkin && isSkin(u, v) ? 255 : 0;
+			int sumCb = 0, sumCr = 0;
+			for (int k = 0; k < 4; k++) {
+				uint8_t* y = frame + (size_t) (i + (k >> 1)) * mWidth + j + (k & 1);
+				int luma = 298 * (*y - 16);
+				int red = clampByte((luma + 409 * e + 128) >> 8);
+				int green = clampByte((luma - 100 * d - 208 * e + 128) >> 8);
+				int blue = clampByte((luma + 516 * d + 128) >> 8);
+				uint32_t graded = mLook.apply(0xff000000u | (blue << 16) | (green << 8) | red, skin);
+				red = graded & 0xff;
+				green = (graded >> 8) & 0xff;
+				blue = (graded >> 16) & 0xff;
+				*y = ((66 * red + 129 * green + 25 * blue + 128) >> 8) + 16;
+				sumCb += (-38 * red - 74 * green + 112 * blue + 128) >> 8;
+				sumCr += (112 * red - 94 * green - 18 * blue + 128) >> 8;
+			}
+			cbRow[c] = clampByte(((sumCb + 2) >> 2) + 128);
+			crRow[c] = clampByte(((sumCr + 2) >> 2) + 128);
+		}
+	}
+}
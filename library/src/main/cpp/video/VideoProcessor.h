@@ -0,0 +1,182 @@
+#ifndef _VIDEO_PROCESSOR_H_
+#define _VIDEO_PROCESSOR_H_
+
+#include <stdint.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include "Stabilizer.h"
+#include "TemporalDenoiser.h"
+#include "VideoFile.h"
+#include "../bitmap/LookTable.h"
+
+typedef struct
+{
+	int frames;
+	double seconds;
+	double framesPerSecond;
+	// from a frame starting processing to it being written
+	double meanLatencyMs;
+	double maxLatencyMs;
+	// frames processed at once, averaged over the frames written
+	double meanDepth;
+} VideoStats;
+
+/**
+ * Offline beautify of a raw 4:2:0 clip: optional stabilization and
+ * temporal denoise, skin smoothing and whitening on luma, then the look,
+ * written as raw frames in the input's format.
+ *
+ * Each frame goes through stages, stabilize (the crop-warp of the
+ * Stabilizer, when on), denoise (the TemporalDenoiser, when on), prepare
+ * (chroma copy and skin mask), smooth (luma) and look, each cut into row
+ * bands, then the writer puts it out in order. Workers take bands from the oldest frame first, so a
+ * worker left idle by a frame waiting on its last band of one stage picks
+ * up the next frame's earlier stage: up to depth frames are pipelined,
+ * each split over threads / depth bands. Depth 1 is one frame over all
+ * cores, lowest latency; depth window is whole frames in parallel, most
+ * throughput. With a latency target the depth is adjusted as frames come
+ * out, to the deepest pipeline that still meets it.
+ *
+ * At most window frames are in flight or waiting to be written, so memory
+ * stays bounded however far a fast worker runs ahead of a slow one.
+ *
+ * Stabilization tracks each frame as it is admitted, in frame order under
+ * the scheduling lock; that is one pass of row and column sums over the
+ * luma, a fraction of the warp that follows in bands.
+ *
+ * The denoise blends each frame into the denoised frame before it, so a
+ * frame starts that stage only once the previous frame has finished it,
+ * and once the frame two back, whose buffer it reuses, is done. Its bands
+ * still run in parallel, and other frames' stages fill in around it.
+ */
+class VideoProcessor
+{
+public:
+	VideoProcessor();
+
+	// same ranges as PreviewRenderer: smoothing 10..510, whitening 1..5, anything else turns it off
+	void setBeautyLevel(float smoothLevel, float whitenLevel);
+	// SmoothGain::PRECISION_*, FP32 by default; false and unchanged when the CPU lacks it
+	bool setSmoothPrecision(int precision);
+	// 512x512 lookup image in the MagicLookupFilter layout, NULL to drop the look
+	void setLookup(const uint8_t* rgba, int stride);
+	void setSkinProtection(bool protect);
+	// percent of each side the Stabilizer crops for its correction, 0 (the
+	// default) turns stabilization off; smoothing in frames, 0 for the default
+	void setStabilization(int marginPercent, int smoothingFrames);
+	// TemporalDenoiser strength 0..1, 0 (the default) turns it off
+	void setDenoise(float strength);
+	// 0 picks the ThreadPool size and twice as many frames
+	void setThreads(int threads, int window);
+	// milliseconds from a frame starting to it being written; 0, the
+	// default, runs for throughput alone
+	void setLatencyTarget(double ms);
+
+	// false on a write error or when the memory budget cannot hold the window
+	bool process(VideoFile& input, int outFd, VideoStats* stats);
+
+private:
+	typedef struct
+	{
+		uint32_t* columnSum;
+		uint32_t* columnSumSqr;
+		float* mean;
+		float* var;
+		uint8_t* skin;
+		uint8_t* warp;
+	} FrameScratch;
+
+	enum Stage
+	{
+		STAGE_STABILIZE = 0,
+		STAGE_DENOISE,
+		STAGE_PREPARE,
+		STAGE_SMOOTH,
+		STAGE_LOOK,
+		STAGE_DONE
+	};
+
+	// a frame in flight, in the slot of its frame number
+	typedef struct
+	{
+		int frame;
+		int stage;
+		int bands;
+		int nextBand;
+		int doneBands;
+		// the Stabilizer's crop offset, in luma pixels
+		float offsetX;
+		float offsetY;
+		std::chrono::steady_clock::time_point started;
+	} FrameTask;
+
+	void workerLoop(VideoFile* input, int worker);
+	// under mLock: the next band to run, oldest frame first, admitting a
+	// new frame when none is left and the depth allows
+	bool claimBand(VideoFile* input, int* slot, int* stage, int* band);
+	void finishBand(int slot);
+	int nextStage(int stage);
+	// under mLock: whether a frame's denoise may start
+	bool canDenoise(int frame);
+	void adjustDepth(double latencyMs);
+	void runBand(const uint8_t* in, int slot, int stage, int band, FrameScratch& scratch);
+	void stabilizeRows(const uint8_t* in, uint8_t* out, int slot, int top, int bottom, uint8_t* scratch);
+	void prepareRows(const uint8_t* in, uint8_t* out, uint8_t* skin, int top, int bottom);
+	void smoothRows(const uint8_t* in, uint8_t* out, const uint8_t* skin, int top, int bottom,
+			FrameScratch& scratch);
+	void lookRows(uint8_t* frame, int top, int bottom);
+
+	int mWidth;
+	int mHeight;
+	int mRadius;
+	// chroma planes as offsets into a frame, same for input and output:
+	// bytes between horizontally adjacent samples and between rows
+	size_t mCb;
+	size_t mCr;
+	int mChromaStep;
+	int mChromaStride;
+
+	float mSmoothLevel;
+	int mPrecision;
+	uint8_t mWhiten[256];
+	bool mWhitening;
+	LookTable mLook;
+	bool mProtectSkin;
+	Stabilizer mStabilizer;
+	int mStabilizeMargin;
+	TemporalDenoiser mDenoiser;
+	bool mDenoising;
+	int mThreads;
+	int mWindow;
+	double mLatencyTargetMs;
+
+	// frame scheduling; counters, tasks and mReady are guarded by mLock,
+	// a band's rows belong to the worker that claimed it
+	std::mutex mLock;
+	std::condition_variable mChanged;
+	int mSlotCount;
+	int mThreadCount;
+	int mNextFrame;
+	int mCompleted;
+	int mWritten;
+	// frames through the denoise, which they pass in order
+	int mDenoised;
+	int mDepth;
+	bool mAbort;
+	uint8_t** mSlots;
+	// skin at chroma resolution, one plane per slot
+	uint8_t** mSkinPlanes;
+	// the stabilized input of each slot, which the later stages read
+	uint8_t** mStablePlanes;
+	bool* mReady;
+	FrameTask* mTasks;
+	FrameScratch* mScratch;
+	// latency controller and stats
+	double mLatencyEma;
+	int mSinceAdjust;
+	double mLatencySum;
+	double mLatencyMax;
+	double mDepthSum;
+};
+#endif
@@ -4,6 +4,7 @@
 package com.seu.magicfilter.beautify;
 
 import android.graphics.Bitmap;
+import android.view.Surface;
 
 import java.nio.ByteBuffer;
 
@@ -11,17 +12,253 @@ import java.nio.ByteBuffer;
  * Created by why8222 on 2016/2/29.
  */
 public class MagicJni {
+    /** Owners accepted by {@link #jniGetMemoryUsage(int)}; -1 sums all of them. */
+    public static final int MEMORY_OWNER_ALL = -1;
+    public static final int MEMORY_OWNER_STORED_BITMAP = 0;
+    public static final int MEMORY_OWNER_BEAUTIFY = 1;
+    public static final int MEMORY_OWNER_CACHE = 2;
+    public static final int MEMORY_OWNER_POOL = 3;
+
+    private static final long sLoadStartNanos;
+    private static final long sLoadEndNanos;
+
     static{
-        System.loadLibrary("MagicBeautify");
+        sLoadStartNanos = System.nanoTime();
+        System.loadLibrary("native-lib");
+        sLoadEndNanos = System.nanoTime();
+    }
+
+    /**
+     * Time spent inside System.loadLibrary, JNI_OnLoad included.
+     */
+    public static long getLibraryLoadNanos() {
+        return sLoadEndNanos - sLoadStartNanos;
     }
 
+    /**
+     * Cold start: time from System.loadLibrary to the end of the first native call that
+     * produced a result, or -1 when nothing has run yet.
+     */
+    public static long getColdStartNanos() {
+        long first = jniGetFirstResultNanos();
+        return first == 0 ? -1 : first - sLoadStartNanos;
+    }
+
+    /**
+     * @throws OutOfMemoryError when the native memory budget cannot hold the session
+     */
     public static native void jniInitMagicBeautify(ByteBuffer handler);
     public static native void jniUnInitMagicBeautify();
 
     public static native void jniStartSkinSmooth(float denoiseLevel);
     public static native void jniStartWhiteSkin(float whitenLevel);
+    /**
+     * Smooths and whitens in linear light instead of on sRGB values, which keeps strong
+     * settings from shifting colours. Takes effect at the next jniInitMagicBeautify.
+     */
+    public static native void jniSetLinearLight(boolean linear);
+
+    /** Smoothing gain in 32-bit float, the default. */
+    public static final int SMOOTH_FP32 = 0;
+    /**
+     * Smoothing gain in half floats on ARMv8.2 CPUs with FP16 arithmetic: twice the lanes per
+     * instruction, and up to one luma level away from SMOOTH_FP32.
+     */
+    public static final int SMOOTH_FP16 = 1;
+    /**
+     * One of the SMOOTH_* precisions for jniStartSkinSmooth and the CPU preview. Returns false
+     * and keeps the current one when this CPU cannot run it.
+     */
+    public static native boolean jniSetSmoothPrecision(int precision);
 
+    /** Whitens the whole frame, the default. */
+    public static final int WHITEN_FULL = 0;
+    /** Whitens detected skin only; the background keeps its exposure. */
+    public static final int WHITEN_SKIN = 1;
+    /** Like WHITEN_SKIN with feathered edges. */
+    public static final int WHITEN_SKIN_SOFT = 2;
+    /** One of the WHITEN_* modes, used from the next jniStartWhiteSkin. */
+    public static native void jniSetWhitenMask(int mask);
+
+    /** Target for jniSetSkinTone: the average tone of the skin found in the image. */
+    public static final int SKIN_TONE_AUTO = -1;
+    /**
+     * Evens out detected skin by pulling its chroma toward one tone, so redness and blotches
+     * fade while texture and brightness stay. strength is 0..1, 0 turns it off; target is
+     * the JFIF Cb << 8 | Cr of the tone (about 110 << 8 | 150 for typical skin), or
+     * SKIN_TONE_AUTO. Used from the next jniStartSkinSmooth or
+     * jniStartWhiteSkin; with smoothing on it costs no extra pass over the image.
+     */
+    public static native void jniSetSkinTone(float strength, int target);
+
+    /**
+     * Bytes of finished renders kept by image content and settings, so the same photo with the
+     * same settings, or a look tried before, comes back as a copy instead of a render. 64 MB by
+     * default; 0 turns the cache off. It gives memory back whenever the budget runs short.
+     */
+    public static native void jniSetResultCacheLimit(long bytes);
+
+    /**
+     * Exports the smoothing statistics of the current session at 1/scale of its size, for a
+     * shader to blend from: each cell is a (mean, gain) pair, two bytes, or with wide two
+     * native-order shorts, both full range. Sample it bilinearly and output
+     * mix(mean, luma, gain). The buffer must be direct and hold a packed map of
+     * ceil(width / scale) x ceil(height / scale) cells.
+     */
+    public static native boolean jniExportGainMap(int scale, boolean wide, ByteBuffer map);
+
+    /**
+     * Bitmaps with the same pixels share one native copy, and a beautify session initialised
+     * again on the same pixels keeps its precomputed state. Writing into a shared copy gives
+     * the handle its own first.
+     *
+     * @throws OutOfMemoryError when the native memory budget cannot hold the copy
+     */
     public static native ByteBuffer jniStoreBitmapData(Bitmap bitmap);
     public static native void jniFreeBitmapData(ByteBuffer handler);
     public static native Bitmap jniGetBitmapFromStoredBitmapData(ByteBuffer handler);
+
+    /**
+     * Copies tightly packed RGBA pixels from a direct buffer into an ARGB_8888 bitmap of
+     * the same size, as Bitmap.copyPixelsFromBuffer would.
+     * @return false if the buffer is not direct or too small, or the bitmap cannot be
+     * locked; the bitmap is left untouched
+     */
+    public static native boolean jniCopyBufferToBitmap(ByteBuffer pixels, Bitmap bitmap);
+
+    /**
+     * Draws stickers onto the stored bitmap in order, source-over with bilinear sampling.
+     * matrices holds the first six values of each sprite's android.graphics.Matrix
+     * (Matrix.getValues order), mapping sprite pixels to bitmap pixels; opacities are 0..1.
+     * Sprites are ARGB_8888 bitmaps with premultiplied alpha, as Android stores them.
+     */
+    public static native boolean jniDrawSprites(ByteBuffer handler, Bitmap[] sprites, float[] matrices,
+                                                float[] opacities);
+
+    /**
+     * Healing brush: covers the disc of radius pixels around (x, y) in the stored bitmap
+     * with the texture around (sourceX, sourceY), blended seamlessly into the colours
+     * around the disc (a Poisson blend). Cost grows with the disc's area; the parts of
+     * the disc whose source falls off the bitmap are left alone. Call once per dab
+     * along a stroke.
+     *
+     * @return false when the memory budget cannot hold the solver
+     * @throws OutOfMemoryError when the native memory budget cannot hold a private copy
+     *                          of pixels shared with another handle
+     */
+    public static native boolean jniHeal(ByteBuffer handler, int x, int y, int sourceX, int sourceY,
+                                         int radius);
+
+    /**
+     * Writes an RGBA frame held in a direct buffer to fd as a lossless .mfd dump.
+     *
+     * @param flip true when the rows are bottom-up, as returned by glReadPixels
+     * @return bytes written, or -1 on failure
+     */
+    public static native long jniSaveFrame(ByteBuffer pixels, int width, int height,
+                                           boolean flip, int fd);
+
+    /**
+     * Caps the native buffers (stored bitmaps, beautify session, caches, pools). Defaults to
+     * a quarter of physical memory; allocations that would exceed it are refused.
+     */
+    public static native void jniSetMemoryBudget(long bytes);
+    public static native long jniGetMemoryUsage(int owner);
+
+    /**
+     * Grades the beautified image with a 512x512 lookup image as used by MagicLookupFilter,
+     * or null for no look. With protectSkin, skin keeps its own hue and saturation and only
+     * takes the look's tone. Applies to the current session and re-renders it.
+     *
+     * @throws OutOfMemoryError when the native memory budget cannot hold the look
+     */
+    public static native void jniSetLook(Bitmap lookup, boolean protectSkin);
+
+    /** HSL mixer bands, in the order jniSetHslMixer takes them. */
+    public static final int HSL_RED = 0;
+    public static final int HSL_ORANGE = 1;
+    public static final int HSL_YELLOW = 2;
+    public static final int HSL_GREEN = 3;
+    public static final int HSL_AQUA = 4;
+    public static final int HSL_BLUE = 5;
+    public static final int HSL_PURPLE = 6;
+    public static final int HSL_MAGENTA = 7;
+    public static final int HSL_BANDS = 8;
+
+    /**
+     * Hue, saturation and luminance per colour band, applied after the look: values holds
+     * three floats per HSL_* band in order, each -1..1 with 0 leaving it alone (a hue of 1
+     * turns the band by 30 degrees), or null to reset. The mixer is compiled into the look's
+     * table, so it costs nothing per pixel on top of the look. Re-renders the current session.
+     *
+     * @throws OutOfMemoryError when the native memory budget cannot hold the table
+     */
+    public static native void jniSetHslMixer(float[] values);
+
+    /**
+     * CPU preview for devices whose GPU cannot run the filter chain at frame rate: NV21
+     * camera frames are smoothed, whitened and graded natively and drawn straight into a
+     * Surface. Frames submitted faster than they render replace each other.
+     *
+     * @return false when the native memory budget cannot hold the preview buffers
+     */
+    public static native boolean jniPreviewStart(int width, int height);
+    public static native void jniPreviewStop();
+    public static native void jniPreviewSetSurface(Surface surface);
+    /** Same ranges as jniStartSkinSmooth / jniStartWhiteSkin; out of range turns the step off. */
+    public static native void jniPreviewSetBeautyLevel(float smoothLevel, float whitenLevel);
+    /** 512x512 lookup image as used by MagicLookupFilter, or null for no look. */
+    public static native void jniPreviewSetLookup(Bitmap lookup);
+    /** The preview's HSL mixer, as jniSetHslMixer sets it for stills. */
+    public static native void jniPreviewSetHslMixer(float[] values);
+    /** Keeps the look's colour shift off skin, as jniSetLook does for stills. */
+    public static native void jniPreviewSetSkinProtection(boolean protect);
+    /** Call from Camera.PreviewCallback; the frame is copied before this returns. */
+    public static native boolean jniPreviewSubmit(byte[] nv21);
+    /**
+     * The map of jniExportGainMap for one NV21 frame at the preview size and smoothing level,
+     * so a GPU filter chain can apply the native smoothing statistics itself.
+     */
+    public static native boolean jniPreviewExportGainMap(byte[] nv21, int scale, boolean wide, ByteBuffer map);
+
+    /** Overlay flags of jniAssistCompute. */
+    public static final int ASSIST_PEAK = 1;
+    public static final int ASSIST_ZEBRA = 2;
+
+    /** Sobel magnitude (0..2040) at which an edge is highlighted, 0 turns focus peaking off. */
+    public static native void jniAssistSetPeaking(int threshold);
+    /** Luma (0..255) from which zebra stripes are drawn, above 255 turns them off. */
+    public static native void jniAssistSetZebra(int level);
+    /**
+     * Focus peaking and zebra for one NV21 frame: mask gets one byte of ASSIST_* flags per 2x2
+     * pixels, (width / 2) x (height / 2) bytes in rows, for a texture drawn over the preview.
+     */
+    public static native boolean jniAssistCompute(byte[] nv21, int width, int height, ByteBuffer mask);
+
+    /** Keeps the last capacity preview frames of this size for jniRingTakeSharpest. */
+    public static native boolean jniRingStart(int width, int height, int capacity);
+    public static native void jniRingStop();
+    /**
+     * Call from Camera.PreviewCallback with the frame's timestamp; copies the frame into the ring and
+     * returns its sharpness score, negative when the ring is not running or the frame has another size.
+     */
+    public static native float jniRingPush(byte[] nv21, long timestampNanos);
+    /**
+     * At shutter time: copies the sharpest ring frame taken at most maxAgeNanos before the newest one
+     * into out and returns its timestamp, or -1 when there is none.
+     */
+    public static native long jniRingTakeSharpest(long maxAgeNanos, byte[] out);
+
+    /** Pixels between scope samples along and across rows; 0 sizes it to the frame, the default. */
+    public static native void jniScopeSetSampleStep(int step);
+    /** Samples an NV21 frame into the scopes; cheap enough for every Camera.PreviewCallback frame. */
+    public static native boolean jniScopeSubmit(byte[] nv21, int width, int height);
+    /**
+     * Latest scopes without waiting on the camera thread: histograms gets 4 x 256 sample counts,
+     * luma, red, green then blue; waveform, when not null, 256 columns left to right of 256
+     * unsigned luma counts each. Returns the frame number read, or 0 when nothing was.
+     */
+    public static native long jniScopeRead(int[] histograms, short[] waveform);
+
+    private static native long jniGetFirstResultNanos();
 }
@@ -4,19 +4,19 @@
 
 package com.seu.magicfilter.encoder.gles;
 
-import android.graphics.Bitmap;
 import android.opengl.EGL14;
 import android.opengl.EGLSurface;
 import android.opengl.GLES20;
+import android.os.ParcelFileDescriptor;
 import android.util.Log;
 
+import com.seu.magicfilter.beautify.MagicJni;
 import com.seu.magicfilter.utils.OpenGlUtils;
 
-import java.io.BufferedOutputStream;
 import java.io.File;
-import java.io.FileOutputStream;
 import java.io.IOException;
-import java.nio.IntBuffer;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
 
 /**
  * Common base class for EGL surfaces.
@@ -33,6 +33,9 @@ public class EglSurfaceBase {
     protected int mWidth = -1;
     protected int mHeight = -1;
 
+    // Readback buffer for saveFrame(), reused while the surface size stays the same.
+    private ByteBuffer mFrameBuffer;
+
     protected EglSurfaceBase(EglCore eglCore) {
         mEglCore = eglCore;
     }
@@ -139,7 +142,7 @@ public class EglSurfaceBase {
     }
 
     /**
-     * Saves the EGL surface to a file.
+     * Saves the EGL surface to a file as a lossless .mfd frame dump.
      * <p>
      * Expects that this object's EGL surface is current.
      */
@@ -149,35 +152,37 @@ public class EglSurfaceBase {
         }
 
         // glReadPixels fills in a "direct" ByteBuffer with what is essentially big-endian RGBA
-        // data (i.e. a byte of red, followed by a byte of green...).  While the Bitmap
-        // constructor that takes an int[] wants little-endian ARGB (blue/red swapped), the
-        // Bitmap "copy pixels" method wants the same format GL provides.
-        //
-        // Ideally we'd have some way to re-use the ByteBuffer, especially if we're calling
-        // here often.
-        //
-        // Making this even more interesting is the upside-down nature of GL, which means
-        // our output will look upside down relative to what appears on screen if the
-        // typical GL conventions are used.
+        // data (i.e. a byte of red, followed by a byte of green...), bottom row first because
+        // of the upside-down nature of GL.  The native writer takes the buffer as-is, flips
+        // the rows while encoding and writes straight to the file descriptor, so no Bitmap
+        // or PNG compression is involved.
 
         String filename = file.toString();
 
         int width = getWidth();
         int height = getHeight();
-        IntBuffer ib = IntBuffer.allocate(width * height);
-        GLES20.glReadPixels(0, 0, width, height, GLES20.GL_RGBA, GLES20.GL_UNSIGNED_BYTE, ib);
+        if (mFrameBuffer == null || mFrameBuffer.capacity() != width * height * 4) {
+            mFrameBuffer = ByteBuffer.allocateDirect(width * height * 4)
+                    .order(ByteOrder.nativeOrder());
+        }
+        mFrameBuffer.rewind();
+        GLES20.glReadPixels(0, 0, width, height, GLES20.GL_RGBA, GLES20.GL_UNSIGNED_BYTE,
+                mFrameBuffer);
         OpenGlUtils.checkGlError("glReadPixels");
 
-        BufferedOutputStream bos = null;
+        ParcelFileDescriptor pfd = ParcelFileDescriptor.open(file,
+                ParcelFileDescriptor.MODE_WRITE_ONLY | ParcelFileDescriptor.MODE_CREATE
+                        | ParcelFileDescriptor.MODE_TRUNCATE);
+        long written;
         try {
-            bos = new BufferedOutputStream(new FileOutputStream(filename));
-            Bitmap bmp = Bitmap.createBitmap(width, height, Bitmap.Config.ARGB_8888);
-            bmp.copyPixelsFromBuffer(IntBuffer.wrap(ib.array()));
-            bmp.compress(Bitmap.CompressFormat.PNG, 90, bos);
-            bmp.recycle();
+            written = MagicJni.jniSaveFrame(mFrameBuffer, width, height, true, pfd.getFd());
         } finally {
-            if (bos != null) bos.close();
+            pfd.close();
+        }
+        if (written < 0) {
+            throw new IOException("Failed to write frame to '" + filename + "'");
         }
-        Log.d(TAG, "Saved " + width + "x" + height + " frame as '" + filename + "'");
+        Log.d(TAG, "Saved " + width + "x" + height + " frame as '" + filename + "' ("
+                + written + " bytes)");
     }
 }
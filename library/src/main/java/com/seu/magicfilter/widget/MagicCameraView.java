@@ -13,6 +13,7 @@ import android.opengl.GLES20;
 import android.util.AttributeSet;
 import android.view.SurfaceHolder;
 
+import com.seu.magicfilter.beautify.MagicJni;
 import com.seu.magicfilter.camera.CameraEngine;
 import com.seu.magicfilter.camera.utils.CameraInfo;
 import com.seu.magicfilter.encoder.video.TextureMovieEncoder;
@@ -30,7 +31,6 @@ import java.io.File;
 import java.nio.ByteBuffer;
 import java.nio.ByteOrder;
 import java.nio.FloatBuffer;
-import java.nio.IntBuffer;
 
 import javax.microedition.khronos.egl.EGLConfig;
 import javax.microedition.khronos.opengles.GL10;
@@ -58,6 +58,8 @@ public class MagicCameraView extends MagicBaseView {
     private static TextureMovieEncoder videoEncoder = new TextureMovieEncoder();
 
     private File outputFile;
+    // glReadPixels target for drawPhoto, kept between captures of the same size or smaller
+    private ByteBuffer captureBuffer;
 
     public MagicCameraView(Context context, AttributeSet attrs) {
         super(context, attrs);
@@ -273,10 +275,17 @@ public class MagicCameraView extends MagicBaseView {
             beautyFilter.onDrawFrame(textureId);
             filter.onDrawFrame(mFrameBufferTextures[0], gLCubeBuffer, gLTextureBuffer);
         }
-        IntBuffer ib = IntBuffer.allocate(width * height);
+        if(captureBuffer == null || captureBuffer.capacity() < width * height * 4)
+            captureBuffer = ByteBuffer.allocateDirect(width * height * 4)
+                    .order(ByteOrder.nativeOrder());
+        ByteBuffer ib = captureBuffer;
+        ib.clear();
         GLES20.glReadPixels(0, 0, width, height, GLES20.GL_RGBA, GLES20.GL_UNSIGNED_BYTE, ib);
         Bitmap result = Bitmap.createBitmap(width, height, Bitmap.Config.ARGB_8888);
-        result.copyPixelsFromBuffer(ib);
+        if(!MagicJni.jniCopyBufferToBitmap(ib, result)) {
+            ib.position(0).limit(width * height * 4);
+            result.copyPixelsFromBuffer(ib);
+        }
 
         GLES20.glBindFramebuffer(GLES20.GL_FRAMEBUFFER, 0);
         GLES20.glDeleteTextures(1, new int[]{textureId}, 0);